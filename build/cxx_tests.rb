@@ -51,10 +51,18 @@
 
   "#{TEST_OUTPUT_DIR}cxx/ServerKit/ChannelTest.o" =>
     "test/cxx/ServerKit/ChannelTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/ServerKit/FdSourceChannelTest.o" =>
+    "test/cxx/ServerKit/FdSourceChannelTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/ServerKit/FileBufferedChannelTest.o" =>
     "test/cxx/ServerKit/FileBufferedChannelTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/ServerKit/FileBufferedFdSinkChannelTest.o" =>
+    "test/cxx/ServerKit/FileBufferedFdSinkChannelTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/ServerKit/HeaderTableTest.o" =>
     "test/cxx/ServerKit/HeaderTableTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/ServerKit/HttpHeaderParserTest.o" =>
+    "test/cxx/ServerKit/HttpHeaderParserTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/ServerKit/IoUringTest.o" =>
+    "test/cxx/ServerKit/IoUringTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/ServerKit/ServerTest.o" =>
     "test/cxx/ServerKit/ServerTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/ServerKit/HttpServerTest.o" =>
@@ -90,6 +98,8 @@
     "test/cxx/FileDescriptorTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/SystemTimeTest.o" =>
     "test/cxx/SystemTimeTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/SafeLibevTest.o" =>
+    "test/cxx/SafeLibevTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/FilterSupportTest.o" =>
     "test/cxx/FilterSupportTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/CachedFileStatTest.o" =>
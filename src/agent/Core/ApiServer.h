@@ -44,6 +44,7 @@
 #include <Shared/ApiServerUtils.h>
 #include <Shared/ApiAccountUtils.h>
 #include <ServerKit/HttpServer.h>
+#include <ServerKit/AcceptLoadBalancer.h>
 #include <DataStructures/LString.h>
 #include <Exceptions.h>
 #include <StaticString.h>
@@ -71,6 +72,7 @@ using namespace std;
  *   client_freelist_limit          unsigned integer   -   default(0)
  *   instance_dir                   string             -   -
  *   min_spare_clients              unsigned integer   -   default(0)
+ *   pipelined_requests_limit       unsigned integer   -   default(0)
  *   request_freelist_limit         unsigned integer   -   default(1024)
  *   start_reading_after_accept     boolean            -   default(true)
  *   watchdog_fd_passing_password   string             -   secret
@@ -258,6 +260,9 @@ private:
 
 			Json::Value response;
 			response["threads"] = (Json::UInt) controllers.size();
+			if (acceptLoadBalancer != NULL) {
+				response["accept_load_balancer"] = acceptLoadBalancer->inspectStateAsJson();
+			}
 
 			for (unsigned int i = 0; i < controllers.size(); i++) {
 				string key = "thread" + toString(i + 1);
@@ -684,13 +689,16 @@ public:
 	vector<Controller *> controllers;
 	ApplicationPool2::PoolPtr appPool;
 	EventFd *exitEvent;
+	/** NULL if clients are not accepted through an AcceptLoadBalancer. */
+	const ServerKit::AcceptLoadBalancer<Controller> *acceptLoadBalancer;
 
 	ApiServer(ServerKit::Context *context, const Schema &schema,
 		const Json::Value &initialConfig,
 		const ConfigKit::Translator &translator = ConfigKit::DummyTranslator())
 		: ParentClass(context, schema, initialConfig, translator),
 		  serverConnectionPath("^/server/(.+)\\.json$"),
-		  exitEvent(NULL)
+		  exitEvent(NULL),
+		  acceptLoadBalancer(NULL)
 	{
 		apiAccountDatabase = ApiAccountUtils::ApiAccountDatabase(
 			config["authorizations"]);
@@ -48,6 +48,7 @@ public:
 	virtual void unref() const = 0;
 
 	virtual pid_t getPid() const = 0;
+	virtual StaticString getGroupName() const = 0;
 	virtual StaticString getGupid() const = 0;
 	virtual StaticString getProtocol() const = 0;
 	virtual unsigned int getStickySessionId() const = 0;
@@ -63,6 +64,31 @@ public:
 	 * This Session object becomes fully unsable after closing.
 	 */
 	virtual void close(bool success, bool wantKeepAlive = false) = 0;
+
+	/**
+	 * Ends the current request like close() does, but keeps the session open
+	 * (and thus keeps its slot in the process's concurrency), so that it
+	 * can be initiate()d again for another request to the same process.
+	 * Returns false without doing anything if the session cannot be reused,
+	 * in which case the caller must close() it instead.
+	 */
+	virtual bool recycle(bool success, bool wantKeepAlive = false) {
+		return false;
+	}
+
+	virtual unsigned int getRecycleCount() const {
+		return 0;
+	}
+
+	/**
+	 * Whether a recycle()d session may be initiate()d again. May be
+	 * called without holding the pool lock, so the answer is only a
+	 * hint: it becomes false once the process stops accepting new
+	 * requests (e.g. because it is being disabled, detached or restarted).
+	 */
+	virtual bool isReusable() const {
+		return false;
+	}
 };
 
 
@@ -140,6 +140,17 @@ public:
 	 *     if processesBeingSpawned > 0: m_spawning
 	 */
 	short processesBeingSpawned;
+	/**
+	 * The amount of capacity that this Group has registered in
+	 * `Pool::capacityBudgetUsed`. Brought in sync with `capacityUsed()`
+	 * by `updatePoolCapacityBudget()` whenever one of the counters that
+	 * contribute to it changes.
+	 *
+	 * Invariant:
+	 *    if lifeStatus == ALIVE: capacityAccountedInPool == capacityUsed()
+	 *    if lifeStatus != ALIVE: capacityAccountedInPool == 0
+	 */
+	unsigned int capacityAccountedInPool;
 	/**
 	 * A Group object progresses through a life.
 	 *
@@ -205,8 +216,10 @@ public:
 	SessionPtr newSession(Process *process, unsigned long long now = 0);
 	static void _onSessionInitiateFailure(Session *session);
 	static void _onSessionClose(Session *session);
+	static bool _onSessionRecycle(Session *session);
 	OXT_FORCE_INLINE void onSessionInitiateFailure(Process *process, Session *session);
 	OXT_FORCE_INLINE void onSessionClose(Process *process, Session *session);
+	bool onSessionRecycle(Process *process, Session *session);
 
 	/****** Spawning and restarting ******/
 
@@ -263,6 +276,8 @@ public:
 	unsigned int generateStickySessionId();
 	ProcessPtr createProcessObject(const Json::Value &json);
 	bool poolAtFullCapacity() const;
+	void updatePoolCapacityBudget();
+	void releasePoolCapacityBudget();
 	ProcessPtr poolForceFreeCapacity(const Group *exclude, boost::container::vector<Callback> &postLockActions);
 	void wakeUpGarbageCollector();
 	bool anotherGroupIsWaitingForCapacity() const;
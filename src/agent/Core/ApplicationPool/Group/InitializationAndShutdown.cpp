@@ -112,6 +112,7 @@ Group::Group(Pool *_pool, const Options &_options)
 	spawner        = getContext()->getSpawningKitFactory()->create(options);
 	restartsInitiated = 0;
 	processesBeingSpawned = 0;
+	capacityAccountedInPool = 0;
 	m_spawning     = false;
 	m_restarting   = false;
 	lifeStatus.store(ALIVE, boost::memory_order_relaxed);
@@ -177,6 +178,7 @@ Group::shutdown(const Callback &callback,
 	P_DEBUG("Begin shutting down group " << info.name);
 	shutdownCallback = callback;
 	detachAll(postLockActions);
+	releasePoolCapacityBudget();
 	startCheckingDetachedProcesses(true);
 	interruptableThreads.interrupt_all();
 	postLockActions.push_back(boost::bind(doCleanupSpawner, spawner));
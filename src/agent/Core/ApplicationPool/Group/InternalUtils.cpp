@@ -180,6 +180,40 @@ Group::poolAtFullCapacity() const {
 	return getPool()->atFullCapacityUnlocked();
 }
 
+/**
+ * Propagates changes in `capacityUsed()` to the Pool's capacity budget.
+ * Must be called, within the pool lock, after modifying any of the
+ * process counters or `processesBeingSpawned`.
+ */
+void
+Group::updatePoolCapacityBudget() {
+	if (OXT_UNLIKELY(!isAlive())) {
+		return;
+	}
+
+	unsigned int used = capacityUsed();
+	if (used > capacityAccountedInPool) {
+		getPool()->capacityBudgetUsed.fetch_add(used - capacityAccountedInPool,
+			boost::memory_order_release);
+	} else if (used < capacityAccountedInPool) {
+		getPool()->capacityBudgetUsed.fetch_sub(capacityAccountedInPool - used,
+			boost::memory_order_release);
+	}
+	capacityAccountedInPool = used;
+}
+
+/**
+ * Called upon shutdown. After this, any capacity still held by this Group
+ * (e.g. processes that are still being spawned) no longer counts towards the
+ * Pool's limits, just like it did when the Pool summed capacity over `groups`.
+ */
+void
+Group::releasePoolCapacityBudget() {
+	getPool()->capacityBudgetUsed.fetch_sub(capacityAccountedInPool,
+		boost::memory_order_release);
+	capacityAccountedInPool = 0;
+}
+
 ProcessPtr
 Group::poolForceFreeCapacity(const Group *exclude,
 	boost::container::vector<Callback> &postLockActions)
@@ -135,6 +135,8 @@ void
 Group::addProcessToList(const ProcessPtr &process, ProcessList &destination) {
 	destination.push_back(process);
 	process->setIndex(destination.size() - 1);
+	process->acceptsRecycledSessions.store(&destination == &enabledProcesses,
+		boost::memory_order_relaxed);
 	if (&destination == &enabledProcesses) {
 		process->enabled = Process::ENABLED;
 		enabledCount++;
@@ -163,6 +165,7 @@ Group::addProcessToList(const ProcessPtr &process, ProcessList &destination) {
 	} else {
 		P_BUG("Unknown destination list");
 	}
+	updatePoolCapacityBudget();
 }
 
 /**
@@ -198,6 +201,7 @@ Group::removeProcessFromList(const ProcessPtr &process, ProcessList &source) {
 	default:
 		P_BUG("Unknown 'enabled' state " << (int) process->enabled);
 	}
+	updatePoolCapacityBudget();
 
 	// Rebuild indices
 	ProcessList::iterator it, end = source.end();
@@ -529,6 +533,7 @@ Group::detachAll(boost::container::vector<Callback> &postLockActions) {
 	disablingCount = 0;
 	disabledCount = 0;
 	nEnabledProcessesTotallyBusy = 0;
+	updatePoolCapacityBudget();
 	clearDisableWaitlist(DR_NOOP, postLockActions);
 	startCheckingDetachedProcesses(false);
 }
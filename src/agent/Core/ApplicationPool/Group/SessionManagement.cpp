@@ -93,6 +93,7 @@ Group::newSession(Process *process, unsigned long long now) {
 	SessionPtr session = process->newSession(now);
 	session->onInitiateFailure = _onSessionInitiateFailure;
 	session->onClose   = _onSessionClose;
+	session->onRecycle = _onSessionRecycle;
 	if (process->enabled == Process::ENABLED) {
 		enabledProcessBusynessLevels[process->getIndex()] = process->busyness();
 		if (!wasTotallyBusy && process->isTotallyBusy()) {
@@ -116,6 +117,13 @@ Group::_onSessionClose(Session *session) {
 	process->getGroup()->onSessionClose(process, session);
 }
 
+bool
+Group::_onSessionRecycle(Session *session) {
+	Process *process = session->getProcess();
+	assert(process != NULL);
+	return process->getGroup()->onSessionRecycle(process, session);
+}
+
 OXT_FORCE_INLINE void
 Group::onSessionInitiateFailure(Process *process, Session *session) {
 	boost::container::vector<Callback> actions;
@@ -244,6 +252,56 @@ Group::onSessionClose(Process *process, Session *session) {
 	}
 }
 
+/**
+ * Called when a controller thread wants to keep a session around for another
+ * request after the current one finished. Allowing that is only fair if
+ * closing the session wouldn't have made a difference: nobody is waiting
+ * for this process's capacity, nothing is waiting for the session count
+ * to drop (disabling, detaching, out-of-band work, max requests), and
+ * the process would still be the one that route() picks. Otherwise we
+ * return false and the caller closes the session normally.
+ *
+ * The session keeps counting towards the process's busyness, so the
+ * busyness levels don't change; only the request statistics do.
+ */
+bool
+Group::onSessionRecycle(Process *process, Session *session) {
+	TRACE_POINT();
+	Pool *pool = getPool();
+	boost::unique_lock<boost::mutex> lock(pool->syncher);
+
+	if (OXT_UNLIKELY(!isAlive()
+		|| !process->isAlive()
+		|| process->enabled != Process::ENABLED
+		|| process->oobwStatus != Process::OOBW_NOT_ACTIVE
+		|| restarting()))
+	{
+		return false;
+	}
+	if (!getWaitlist.empty()
+		|| !pool->getWaitlist.empty()
+		|| anotherGroupIsWaitingForCapacity())
+	{
+		return false;
+	}
+	if (options.maxRequests > 0 && process->processed + 1 >= options.maxRequests) {
+		return false;
+	}
+
+	int busyness = process->busynessWithOneSessionLess();
+	unsigned int i, size = enabledProcessBusynessLevels.size();
+	unsigned int index = process->getIndex();
+	for (i = 0; i < size; i++) {
+		if (i != index && enabledProcessBusynessLevels[i] < busyness) {
+			return false;
+		}
+	}
+
+	P_TRACE(2, "Session recycled for process " << process->inspect());
+	process->sessionRecycled();
+	return true;
+}
+
 
 /****************************
  *
@@ -146,6 +146,7 @@ Group::spawnThreadRealMain(const SpawningKit::SpawnerPtr &spawner,
 
 		processesBeingSpawned--;
 		assert(processesBeingSpawned == 0);
+		updatePoolCapacityBudget();
 
 		UPDATE_TRACE_POINT();
 		boost::container::vector<Callback> actions;
@@ -187,6 +188,7 @@ Group::spawnThreadRealMain(const SpawningKit::SpawnerPtr &spawner,
 			P_DEBUG("Spawn loop done");
 		} else {
 			processesBeingSpawned++;
+			updatePoolCapacityBudget();
 			P_DEBUG("Continue spawning");
 		}
 
@@ -307,6 +309,7 @@ Group::restart(const Options &options, RestartMethod method) {
 	restartsInitiated++;
 
 	processesBeingSpawned = 0;
+	updatePoolCapacityBudget();
 	m_spawning   = false;
 	m_restarting = true;
 	uuid         = generateUuid(pool);
@@ -435,6 +438,7 @@ Group::spawn() {
 			POOL_HELPER_THREAD_STACK_SIZE);
 		m_spawning = true;
 		processesBeingSpawned++;
+		updatePoolCapacityBudget();
 		return SR_OK;
 	}
 }
@@ -87,6 +87,9 @@ Group::verifyInvariants() const {
 		assert(disablingCount == 0);
 		assert(disabledCount == 0);
 		assert(nEnabledProcessesTotallyBusy == 0);
+		assert(capacityAccountedInPool == 0);
+	} else {
+		assert(capacityAccountedInPool == capacityUsed());
 	}
 
 	// Verify list sizes.
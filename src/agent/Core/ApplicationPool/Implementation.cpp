@@ -328,11 +328,19 @@ recreateString(psg_pool_t *pool, StaticString &str) {
 
 void
 Session::requestOOBW() {
+	oobwRequested = true;
 	ProcessPtr process = getProcess()->shared_from_this();
 	assert(process->isAlive());
 	process->getGroup()->requestOOBW(process);
 }
 
+bool
+Session::isReusable() const {
+	return !closed
+		&& !oobwRequested
+		&& processInfo->process->acceptsRecycledSessions.load(boost::memory_order_relaxed);
+}
+
 
 } // namespace ApplicationPool2
 } // namespace Passenger
@@ -37,6 +37,7 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/function.hpp>
+#include <boost/atomic.hpp>
 #include <boost/foreach.hpp>
 #include <boost/pool/object_pool.hpp>
 // We use boost::container::vector instead of std::vector, because the
@@ -206,8 +207,29 @@ public:
 	friend class Process;
 	friend struct tut::ApplicationPool2_PoolTest;
 
+	/**
+	 * Protects the entire pool: the group map, the wait list and the state
+	 * of all Groups and Processes.
+	 *
+	 * TODO: this is still a single global lock, and with many groups it is
+	 * the most contended lock in the Core. Per-group locks need the wait
+	 * list hand-off, `forceFreeCapacity()` and spawn loop attachment to stop
+	 * spanning multiple groups first. `capacityBudgetUsed` already lets
+	 * capacity checks run without it.
+	 */
 	mutable boost::mutex syncher;
 	unsigned int max;
+	/**
+	 * The sum of `Group::capacityUsed()` over all Groups in `groups`. Groups
+	 * update this counter incrementally (see `Group::updatePoolCapacityBudget()`)
+	 * so that capacity checks are O(1) instead of a scan over all groups.
+	 *
+	 * Only modified while holding `syncher`, but may be read without it.
+	 *
+	 * Invariant:
+	 *    capacityBudgetUsed == sum of group->capacityUsed() over all groups
+	 */
+	boost::atomic<unsigned int> capacityBudgetUsed;
 	unsigned long long maxIdleTime;
 	bool selfchecking;
 
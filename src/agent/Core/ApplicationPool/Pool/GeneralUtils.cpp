@@ -122,6 +122,14 @@ Pool::verifyExpensiveInvariants() const {
 		const GroupPtr *group;
 		assert(!groups.lookup(waiter.options.getAppGroupName(), &group));
 	}
+
+	unsigned int capacityUsedByGroups = 0;
+	GroupMap::ConstIterator g_it(groups);
+	while (*g_it != NULL) {
+		capacityUsedByGroups += g_it.getValue()->capacityUsed();
+		g_it.next();
+	}
+	assert(capacityUsedByGroups == capacityUsedUnlocked());
 	#endif
 }
 
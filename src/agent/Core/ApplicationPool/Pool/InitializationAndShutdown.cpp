@@ -55,6 +55,7 @@ Pool::Pool(const SpawningKit::FactoryPtr &spawningKitFactory,
 
 	lifeStatus   = ALIVE;
 	max          = 6;
+	capacityBudgetUsed.store(0, boost::memory_order_relaxed);
 	maxIdleTime  = 60 * 1000000;
 	selfchecking = true;
 	palloc       = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
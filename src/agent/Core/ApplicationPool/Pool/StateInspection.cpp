@@ -47,20 +47,7 @@ using namespace boost;
 
 unsigned int
 Pool::capacityUsedUnlocked() const {
-	if (groups.size() == 1) {
-		GroupPtr *group;
-		groups.lookupRandom(NULL, &group);
-		return (*group)->capacityUsed();
-	} else {
-		GroupMap::ConstIterator g_it(groups);
-		int result = 0;
-		while (*g_it != NULL) {
-			const GroupPtr &group = g_it.getValue();
-			result += group->capacityUsed();
-			g_it.next();
-		}
-		return result;
-	}
+	return capacityBudgetUsed.load(boost::memory_order_relaxed);
 }
 
 bool
@@ -388,10 +375,13 @@ Pool::makeSingleNonEmptyStrValueJsonConfigFormat(const StaticString &val) {
 	}
 }
 
+/**
+ * Does not need to grab the lock because the capacity budget
+ * is maintained atomically.
+ */
 unsigned int
 Pool::capacityUsed() const {
-	LockGuard l(syncher);
-	return capacityUsedUnlocked();
+	return capacityBudgetUsed.load(boost::memory_order_acquire);
 }
 
 bool
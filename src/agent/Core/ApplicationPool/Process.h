@@ -416,6 +416,12 @@ public:
 		 * out-of-band work can be performed. */
 		OOBW_IN_PROGRESS,
 	} oobwStatus;
+	/**
+	 * Mirrors `enabled == ENABLED`, so that controller threads can check
+	 * without the pool lock whether a session that they kept around after a
+	 * request (see Session::recycle()) may still be used for another one.
+	 */
+	boost::atomic<bool> acceptsRecycledSessions;
 	/** Caches whether or not the OS process still exists. */
 	mutable bool m_osProcessExists: 1;
 	bool longRunningConnectionsAborted: 1;
@@ -441,6 +447,7 @@ public:
 		  lifeStatus(ALIVE),
 		  enabled(ENABLED),
 		  oobwStatus(OOBW_NOT_ACTIVE),
+		  acceptsRecycledSessions(true),
 		  m_osProcessExists(true),
 		  longRunningConnectionsAborted(false),
 		  shutdownStartTime(0)
@@ -719,6 +726,19 @@ public:
 		}
 	}
 
+	/**
+	 * The busyness that this process would have if one of its sessions
+	 * were closed.
+	 */
+	int busynessWithOneSessionLess() const {
+		assert(sessions > 0);
+		if (concurrency == 0) {
+			return sessions - 1;
+		} else {
+			return (int) (((long long) (sessions - 1) * INT_MAX) / (double) concurrency);
+		}
+	}
+
 	/**
 	 * Whether we've reached the maximum number of concurrent sessions for this
 	 * process.
@@ -806,6 +826,21 @@ public:
 		assert(!isTotallyBusy());
 	}
 
+	/**
+	 * Called when a session finished a request but stays open for another
+	 * one (see Session::recycle()). The session keeps counting towards
+	 * `sessions`.
+	 */
+	void sessionRecycled(unsigned long long now = 0) {
+		assert(sessions > 0);
+		processed++;
+		if (now != 0) {
+			lastUsed = now;
+		} else {
+			lastUsed = SystemTime::getUsec();
+		}
+	}
+
 	/**
 	 * Returns the uptime of this process so far, as a string.
 	 */
@@ -65,6 +65,7 @@ using namespace oxt;
 class Session: public AbstractSession {
 public:
 	typedef void (*Callback)(Session *session);
+	typedef bool (*RecycleCallback)(Session *session);
 
 private:
 	/**
@@ -86,7 +87,10 @@ private:
 
 	Connection connection;
 	mutable boost::atomic<int> refcount;
+	/** Number of times that this session has been recycle()d. */
+	unsigned int recycled;
 	bool closed;
+	bool oobwRequested;
 
 	void deinitiate(bool success, bool wantKeepAlive) {
 		connection.fail = !success;
@@ -117,15 +121,19 @@ private:
 public:
 	Callback onInitiateFailure;
 	Callback onClose;
+	RecycleCallback onRecycle;
 
 	Session(Context *_context, const BasicProcessInfo *_processInfo, Socket *_socket)
 		: context(_context),
 		  processInfo(_processInfo),
 		  socket(_socket),
 		  refcount(1),
+		  recycled(0),
 		  closed(false),
+		  oobwRequested(false),
 		  onInitiateFailure(NULL),
-		  onClose(NULL)
+		  onClose(NULL),
+		  onRecycle(NULL)
 		{ }
 
 	~Session() {
@@ -161,6 +169,11 @@ public:
 		return processInfo->pid;
 	}
 
+	virtual StaticString getGroupName() const {
+		assert(!closed);
+		return processInfo->groupInfo->name;
+	}
+
 	virtual StaticString getGupid() const {
 		assert(!closed);
 		return StaticString(processInfo->gupid, processInfo->gupidSize);
@@ -183,6 +196,10 @@ public:
 
 	virtual void initiate(bool blocking = true) {
 		assert(!closed);
+		if (initiated()) {
+			// Recycled with a kept-alive connection.
+			return;
+		}
 		ScopeGuard g(boost::bind(&Session::callOnInitiateFailure, this));
 		Connection connection = socket->checkoutConnection();
 		connection.fail = true;
@@ -219,6 +236,34 @@ public:
 		socket = NULL;
 	}
 
+	/**
+	 * A recycled session keeps its connection if the application allowed
+	 * keep-alive, so that the next initiate() doesn't have to check one out
+	 * from the Socket. Sessions that requested out-of-band work are not
+	 * recyclable, because the Group only starts the work once the session
+	 * is closed. The Group gets the final say through `onRecycle`, which
+	 * updates the process's statistics like `onClose` would.
+	 */
+	virtual bool recycle(bool success, bool wantKeepAlive = false) {
+		if (OXT_UNLIKELY(closed || oobwRequested)) {
+			return false;
+		}
+		if (onRecycle != NULL && !onRecycle(this)) {
+			return false;
+		}
+		if (initiated() && (!success || !wantKeepAlive)) {
+			deinitiate(success, wantKeepAlive);
+		}
+		recycled++;
+		return true;
+	}
+
+	virtual unsigned int getRecycleCount() const {
+		return recycled;
+	}
+
+	virtual bool isReusable() const;
+
 	virtual bool isClosed() const {
 		return closed;
 	}
@@ -49,12 +49,17 @@ private:
 	mutable unsigned int refcount;
 	pid_t pid;
 	string gupid;
+	string groupName;
 	string protocol;
 	ApiKey apiKey;
 	SocketPair connection;
 	BufferedIO peerBufferedIO;
 	unsigned int stickySessionId;
+	unsigned int initiateCount;
+	unsigned int recycleCount;
 	mutable bool closed;
+	bool recyclable;
+	bool reusable;
 	mutable bool success;
 	mutable bool wantKeepAlive;
 
@@ -65,7 +70,11 @@ public:
 		  gupid("gupid-123"),
 		  protocol("session"),
 		  stickySessionId(0),
+		  initiateCount(0),
+		  recycleCount(0),
 		  closed(false),
+		  recyclable(true),
+		  reusable(true),
 		  success(false),
 		  wantKeepAlive(false)
 		{ }
@@ -109,6 +118,16 @@ public:
 		gupid = v;
 	}
 
+	virtual StaticString getGroupName() const {
+		boost::lock_guard<boost::mutex> l(syncher);
+		return groupName;
+	}
+
+	void setGroupName(const string &v) {
+		boost::lock_guard<boost::mutex> l(syncher);
+		groupName = v;
+	}
+
 	virtual StaticString getProtocol() const {
 		boost::lock_guard<boost::mutex> l(syncher);
 		return protocol;
@@ -170,6 +189,41 @@ public:
 		if (!blocking) {
 			setNonBlocking(connection.first);
 		}
+		initiateCount++;
+	}
+
+	unsigned int getInitiateCount() const {
+		boost::lock_guard<boost::mutex> l(syncher);
+		return initiateCount;
+	}
+
+	virtual bool recycle(bool _success, bool _wantKeepAlive = false) {
+		boost::lock_guard<boost::mutex> l(syncher);
+		if (closed || !recyclable) {
+			return false;
+		}
+		recycleCount++;
+		return true;
+	}
+
+	virtual unsigned int getRecycleCount() const {
+		boost::lock_guard<boost::mutex> l(syncher);
+		return recycleCount;
+	}
+
+	void setRecyclable(bool v) {
+		boost::lock_guard<boost::mutex> l(syncher);
+		recyclable = v;
+	}
+
+	virtual bool isReusable() const {
+		boost::lock_guard<boost::mutex> l(syncher);
+		return !closed && reusable;
+	}
+
+	void setReusable(bool v) {
+		boost::lock_guard<boost::mutex> l(syncher);
+		reusable = v;
 	}
 
 	virtual void close(bool _success, bool _wantKeepAlive = false) {
@@ -41,6 +41,7 @@
 #include <ConfigKit/PrefixTranslator.h>
 #include <ServerKit/Context.h>
 #include <ServerKit/HttpServer.h>
+#include <ServerKit/AcceptLoadBalancer.h>
 #include <Core/Controller/Config.h>
 #include <Core/SecurityUpdateChecker.h>
 #include <Core/ApiServer.h>
@@ -79,31 +80,49 @@ using namespace std;
  *   api_server_addresses                                            array of strings   -          default([]),read_only
  *   api_server_authorizations                                       array              -          default("[FILTERED]"),secret
  *   api_server_client_freelist_limit                                unsigned integer   -          default(0)
+ *   api_server_fd_source_channel_readv_buffers                      unsigned integer   -          default(1)
  *   api_server_file_buffered_channel_auto_start_mover               boolean            -          default(true)
  *   api_server_file_buffered_channel_auto_truncate_file             boolean            -          default(true)
  *   api_server_file_buffered_channel_buffer_dir                     string             -          default
+ *   api_server_file_buffered_channel_buffer_file_pool_size          unsigned integer   -          default(0),read_only
  *   api_server_file_buffered_channel_delay_in_file_mode_switching   unsigned integer   -          default(0)
+ *   api_server_file_buffered_channel_io_uring                       boolean            -          default(false),read_only
  *   api_server_file_buffered_channel_max_disk_chunk_read_size       unsigned integer   -          default(0)
+ *   api_server_file_buffered_channel_memory_budget                  unsigned integer   -          default(0)
  *   api_server_file_buffered_channel_threshold                      unsigned integer   -          default(131072)
  *   api_server_mbuf_block_chunk_size                                unsigned integer   -          default(4096),read_only
+ *   api_server_mbuf_block_huge_pages                                boolean            -          default(false),read_only
+ *   api_server_mbuf_block_size_classes                              boolean            -          default(false),read_only
+ *   api_server_mbuf_block_slab_size                                 unsigned integer   -          default(0),read_only
  *   api_server_min_spare_clients                                    unsigned integer   -          default(0)
+ *   api_server_pipelined_requests_limit                             unsigned integer   -          default(0)
  *   api_server_request_freelist_limit                               unsigned integer   -          default(1024)
  *   api_server_start_reading_after_accept                           boolean            -          default(true)
  *   app_output_log_level                                            string             -          default("notice")
  *   benchmark_mode                                                  string             -          -
  *   controller_accept_burst_count                                   unsigned integer   -          default(32)
+ *   controller_accept_load_balancing_policy                         string             -          default("round_robin"),read_only
  *   controller_addresses                                            array of strings   -          default(["tcp://127.0.0.1:3000"]),read_only
  *   controller_client_freelist_limit                                unsigned integer   -          default(0)
  *   controller_cpu_affine                                           boolean            -          default(false),read_only
+ *   controller_fd_source_channel_readv_buffers                      unsigned integer   -          default(1)
  *   controller_file_buffered_channel_auto_start_mover               boolean            -          default(true)
  *   controller_file_buffered_channel_auto_truncate_file             boolean            -          default(true)
  *   controller_file_buffered_channel_buffer_dir                     string             -          default
+ *   controller_file_buffered_channel_buffer_file_pool_size          unsigned integer   -          default(0),read_only
  *   controller_file_buffered_channel_delay_in_file_mode_switching   unsigned integer   -          default(0)
+ *   controller_file_buffered_channel_io_uring                       boolean            -          default(false),read_only
  *   controller_file_buffered_channel_max_disk_chunk_read_size       unsigned integer   -          default(0)
+ *   controller_file_buffered_channel_memory_budget                  unsigned integer   -          default(0)
  *   controller_file_buffered_channel_threshold                      unsigned integer   -          default(131072)
  *   controller_mbuf_block_chunk_size                                unsigned integer   -          default(4096),read_only
+ *   controller_mbuf_block_huge_pages                                boolean            -          default(false),read_only
+ *   controller_mbuf_block_size_classes                              boolean            -          default(false),read_only
+ *   controller_mbuf_block_slab_size                                 unsigned integer   -          default(0),read_only
  *   controller_min_spare_clients                                    unsigned integer   -          default(0)
+ *   controller_pipelined_requests_limit                             unsigned integer   -          default(0)
  *   controller_request_freelist_limit                               unsigned integer   -          default(1024)
+ *   controller_reuse_port                                           boolean            -          default(false),read_only
  *   controller_secure_headers_password                              any                -          secret
  *   controller_socket_backlog                                       unsigned integer   -          default(2048),read_only
  *   controller_start_reading_after_accept                           boolean            -          default(true)
@@ -144,6 +163,7 @@ using namespace std;
  *   pool_selfchecks                                                 boolean            -          default(false)
  *   prestart_urls                                                   array of strings   -          default([]),read_only
  *   response_buffer_high_watermark                                  unsigned integer   -          default(134217728)
+ *   response_splice_threshold                                       unsigned integer   -          default(262144)
  *   security_update_checker_certificate_path                        string             -          -
  *   security_update_checker_disabled                                boolean            -          default(false)
  *   security_update_checker_interval                                unsigned integer   -          default(86400)
@@ -156,6 +176,14 @@ using namespace std;
  *   single_app_mode_startup_file                                    string             -          read_only
  *   standalone_engine                                               string             -          default
  *   stat_throttle_rate                                              unsigned integer   -          default(10)
+ *   thread_session_slot_idle_time                                   unsigned integer   -          default(10),read_only
+ *   thread_session_slot_max_reuses                                  unsigned integer   -          default(100),read_only
+ *   thread_session_slots                                            unsigned integer   -          default(0),read_only
+ *   turbocache_compression                                          boolean            -          default(false),read_only
+ *   turbocache_max_entries                                          unsigned integer   -          default(1024),read_only
+ *   turbocache_max_memory                                           unsigned integer   -          default(16777216),read_only
+ *   turbocache_serve_stale                                          boolean            -          default(true),read_only
+ *   turbocache_shared                                               boolean            -          default(false),read_only
  *   turbocaching                                                    boolean            -          default(true),read_only
  *   user_switching                                                  boolean            -          default(true)
  *   ust_router_address                                              string             -          -
@@ -290,6 +318,14 @@ private:
 		if (config["controller_threads"].asUInt() < 1) {
 			errors.push_back(Error("'{{controller_threads}}' must be at least 1"));
 		}
+
+		ServerKit::AcceptLoadBalancingPolicy policy;
+		if (!ServerKit::parseAcceptLoadBalancingPolicy(
+			config["controller_accept_load_balancing_policy"].asString(), policy))
+		{
+			errors.push_back(Error("'{{controller_accept_load_balancing_policy}}' must be "
+				"one of 'round_robin', 'least_active_clients' or 'power_of_two_choices'"));
+		}
 	}
 
 	static void validateAddresses(const ConfigKit::Store &config, vector<ConfigKit::Error> &errors) {
@@ -448,6 +484,8 @@ public:
 		add("controller_addresses", STRING_ARRAY_TYPE, OPTIONAL | READ_ONLY, getDefaultControllerAddresses());
 		add("api_server_addresses", STRING_ARRAY_TYPE, OPTIONAL | READ_ONLY, Json::arrayValue);
 		add("controller_cpu_affine", BOOL_TYPE, OPTIONAL | READ_ONLY, false);
+		add("controller_reuse_port", BOOL_TYPE, OPTIONAL | READ_ONLY, false);
+		add("controller_accept_load_balancing_policy", STRING_TYPE, OPTIONAL | READ_ONLY, "round_robin");
 		add("file_descriptor_ulimit", UINT_TYPE, OPTIONAL | READ_ONLY, 0);
 
 		addValidator(validateMultiAppMode);
@@ -53,6 +53,8 @@
 
 #include <sys/types.h>
 #include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
 #include <utility>
 #include <typeinfo>
 #include <cstdio>
@@ -144,6 +146,47 @@ private:
 	friend class ResponseCache<Request>;
 	struct ev_check checkWatcher;
 	TurboCaching<Request> turboCaching;
+	/**
+	 * Number of session checkouts that completed on this Controller's
+	 * event loop thread, versus those that completed on another thread
+	 * (i.e. from the get wait list) and had to be handed over through
+	 * `SafeLibev::runLater()`. Only accessed from the event loop thread.
+	 */
+	unsigned long sessionCheckoutsOnEventLoopThread;
+	unsigned long sessionCheckoutsFromAnotherThread;
+	/**
+	 * Sessions that finished a request and that this thread keeps, instead
+	 * of closing them, so that a following request to the same app group
+	 * can use them without going through the pool's get wait list and
+	 * without a cross-thread hop. The pool still decides whether a session
+	 * may be kept (see Session::recycle()). A slot is closed by
+	 * `idleSessionSlotsTimer` once it has been idle for
+	 * `idleSessionSlotIdleTime`, and a session is closed for good after
+	 * `maxIdleSessionSlotReuses` reuses, so that a thread never holds on to
+	 * process concurrency for long.
+	 */
+	struct IdleSessionSlot {
+		AbstractSessionPtr session;
+		ev_tstamp expiresAt;
+	};
+
+	vector<IdleSessionSlot> idleSessionSlots;
+	unsigned int maxIdleSessionSlots;
+	unsigned int maxIdleSessionSlotReuses;
+	ev_tstamp idleSessionSlotIdleTime;
+	unsigned long idleSessionSlotHits;
+	unsigned long idleSessionSlotMisses;
+	unsigned long idleSessionSlotOverflows;
+	struct ev_timer idleSessionSlotsTimer;
+	/**
+	 * Number of app response bodies that have been forwarded with splice(),
+	 * the number of body bytes that were forwarded that way, and the number
+	 * of bodies for which we switched back to buffering because the client
+	 * was too slow. Only accessed from the event loop thread.
+	 */
+	unsigned long splicedResponseBodies;
+	unsigned long long totalBytesSpliced;
+	unsigned long spliceFallbacks;
 	ConfigKit::Store *singleAppModeConfig;
 
 	#ifdef DEBUG_CC_EVENT_LOOP_BLOCKING
@@ -161,8 +204,12 @@ private:
 
 	struct RequestAnalysis;
 
+	void analyzeRequest(Request *req, RequestAnalysis &analysis);
 	void initializeFlags(Client *client, Request *req, RequestAnalysis &analysis);
 	bool respondFromTurboCache(Client *client, Request *req);
+	static void resumeRequestWaitingForTurboCache(Request *req);
+	bool respondFromStaleTurboCacheEntry(Client *client, Request *req);
+	void endTurboCacheRevalidation(Client *client, Request *req, bool keepStaleEntry);
 	void initializePoolOptions(Client *client, Request *req, RequestAnalysis &analysis);
 	void fillPoolOptionsFromConfigCaches(Options &options, psg_pool_t *pool,
 		const ControllerRequestConfigPtr &requestConfigCache);
@@ -185,6 +232,8 @@ private:
 	void initializeUnionStation(Client *client, Request *req, RequestAnalysis &analysis);
 	void setStickySessionId(Client *client, Request *req);
 	const LString *getStickySessionCookieName(Request *req);
+	void continueRequestAfterTurboCaching(Client *client, Request *req,
+		RequestAnalysis &analysis);
 
 
 	/****** Stage: buffering body ******/
@@ -198,6 +247,7 @@ private:
 	/****** Stage: checkout session ******/
 
 	void checkoutSession(Client *client, Request *req);
+	bool checkoutIdleSession(Client *client, Request *req);
 	static void sessionCheckedOut(const AbstractSessionPtr &session,
 		const ExceptionPtr &e, void *userData);
 	void sessionCheckedOutFromAnotherThread(Client *client, Request *req,
@@ -286,12 +336,18 @@ private:
 	void markResponsePartForTurboCaching(Client *client, Request *req,
 		const MemoryKit::mbuf &buffer);
 	void maybeThrottleAppSource(Client *client, Request *req);
+	bool maybeSpliceAppResponseBody(Client *client, Request *req);
+	static void _onSpliceWatcherEvent(EV_P_ ev_io *io, int revents);
+	void spliceAppResponseBody(Client *client, Request *req);
+	void stopSplicingAppResponseBody(Request *req);
+	void bufferSplicedAppResponseBody(Client *client, Request *req);
 	static void _outputBuffersFlushed(FileBufferedChannel *_channel);
 	void outputBuffersFlushed(Client *client, Request *req);
 	static void _outputDataFlushed(FileBufferedChannel *_channel);
 	void outputDataFlushed(Client *client, Request *req);
 	void handleAppResponseBodyEnd(Client *client, Request *req);
 	OXT_FORCE_INLINE void keepAliveAppConnection(Client *client, Request *req);
+	void closeOrKeepIdleSession(Client *client, Request *req, bool wantKeepAlive);
 	void storeAppResponseInTurboCache(Client *client, Request *req);
 	void finalizeUnionStationWithSuccess(Client *client, Request *req);
 
@@ -304,6 +360,8 @@ private:
 		static void onEventLoopPrepare(EV_P_ struct ev_prepare *w, int revents);
 	#endif
 	static void onEventLoopCheck(EV_P_ struct ev_check *w, int revents);
+	static void onIdleSessionSlotsTimeout(EV_P_ struct ev_timer *w, int revents);
+	void releaseIdleSessionSlots(bool all);
 
 
 	/****** Internal utility functions ******/
@@ -355,6 +413,7 @@ protected:
 		const MemoryKit::mbuf &buffer, int errcode);
 	virtual void onNextRequestEarlyReadError(Client *client, Request *req, int errcode);
 	virtual bool shouldDisconnectClientOnShutdown(Client *client);
+	virtual void onShutdown(bool forceDisconnect);
 	virtual bool supportsUpgrade(Client *client, Request *req);
 
 
@@ -371,6 +430,8 @@ public:
 	ResourceLocator *resourceLocator;
 	PoolPtr appPool;
 	UnionStation::ContextPtr unionStationContext;
+	/** If not NULL, turbocaching uses this storage, shared with other threads. */
+	ResponseCacheStorage *sharedTurbocacheStorage;
 
 
 	/****** Initialization and shutdown ******/
@@ -390,8 +451,20 @@ public:
 		  poolOptionsCache(4),
 
 		  turboCaching(),
+		  sessionCheckoutsOnEventLoopThread(0),
+		  sessionCheckoutsFromAnotherThread(0),
+		  maxIdleSessionSlots(0),
+		  maxIdleSessionSlotReuses(0),
+		  idleSessionSlotIdleTime(0),
+		  idleSessionSlotHits(0),
+		  idleSessionSlotMisses(0),
+		  idleSessionSlotOverflows(0),
+		  splicedResponseBodies(0),
+		  totalBytesSpliced(0),
+		  spliceFallbacks(0),
 		  singleAppModeConfig(NULL),
-		  resourceLocator(NULL)
+		  resourceLocator(NULL),
+		  sharedTurbocacheStorage(NULL)
 		  /**************************/
 	{
 		if (mainConfig.singleAppMode) {
@@ -66,6 +66,10 @@ Controller::checkoutSession(Client *client, Request *req) {
 
 	options.currentTime = SystemTime::getUsec();
 
+	if (maxIdleSessionSlots > 0 && checkoutIdleSession(client, req)) {
+		return;
+	}
+
 	refRequest(req, __FILE__, __LINE__);
 	#ifdef DEBUG_CC_EVENT_LOOP_BLOCKING
 		req->timeBeforeAccessingApplicationPool = ev_now(getLoop());
@@ -81,6 +85,80 @@ Controller::checkoutSession(Client *client, Request *req) {
 	#endif
 }
 
+/**
+ * Tries to serve the checkout from a session that this thread kept after
+ * an earlier request. Returns false if there is no reusable one for the
+ * request's app group, in which case the caller must fall back to the pool.
+ * Slots whose process stopped accepting requests in the mean time are
+ * closed along the way.
+ */
+bool
+Controller::checkoutIdleSession(Client *client, Request *req) {
+	const Options &options = req->options;
+
+	if (options.stickySessionId != 0 || options.noop) {
+		idleSessionSlotMisses++;
+		return false;
+	}
+
+	const HashedStaticString &appGroupName = options.getAppGroupName();
+	unsigned int i = 0;
+	while (i < idleSessionSlots.size()) {
+		if (idleSessionSlots[i].session->getGroupName() != appGroupName) {
+			i++;
+			continue;
+		}
+
+		AbstractSessionPtr session;
+		session.swap(idleSessionSlots[i].session);
+		idleSessionSlots.erase(idleSessionSlots.begin() + i);
+		if (session->isReusable()) {
+			idleSessionSlotHits++;
+			SKC_TRACE(client, 2, "Reusing idle session from this thread's slots");
+			sessionCheckedOutFromEventLoopThread(client, req, session,
+				ExceptionPtr());
+			return true;
+		} else {
+			SKC_TRACE(client, 2, "Closing idle session because its process "
+				"no longer accepts requests");
+			session->close(true, true);
+		}
+	}
+
+	idleSessionSlotMisses++;
+	return false;
+}
+
+/**
+ * Closes the sessions in the idle session slots that have been idle for
+ * `idleSessionSlotIdleTime`, or all of them if `all` is true, and schedules
+ * `idleSessionSlotsTimer` for the next slot to expire. Slots are kept in
+ * the order in which they were filled, so they also expire in that order.
+ */
+void
+Controller::releaseIdleSessionSlots(bool all) {
+	ev_tstamp now = ev_now(getLoop());
+
+	while (!idleSessionSlots.empty()
+		&& (all || idleSessionSlots.front().expiresAt <= now))
+	{
+		AbstractSessionPtr session;
+		session.swap(idleSessionSlots.front().session);
+		idleSessionSlots.erase(idleSessionSlots.begin());
+		// A session only keeps its connection open when the
+		// application allowed keep-alive, so closing with
+		// wantKeepAlive is correct either way.
+		session->close(true, true);
+	}
+
+	ev_timer_stop(getLoop(), &idleSessionSlotsTimer);
+	if (!idleSessionSlots.empty()) {
+		ev_timer_set(&idleSessionSlotsTimer,
+			idleSessionSlots.front().expiresAt - now, 0);
+		ev_timer_start(getLoop(), &idleSessionSlotsTimer);
+	}
+}
+
 void
 Controller::asyncGetFromApplicationPool(Request *req, ApplicationPool2::GetCallback callback) {
 	appPool->asyncGet(req->options, callback, true,
@@ -98,6 +176,7 @@ Controller::sessionCheckedOut(const AbstractSessionPtr &session, const Exception
 	Controller *self = static_cast<Controller *>(getServerFromClient(client));
 
 	if (self->getContext()->libev->onEventLoopThread()) {
+		self->sessionCheckoutsOnEventLoopThread++;
 		self->sessionCheckedOutFromEventLoopThread(client, req, session, e);
 		self->unrefRequest(req, __FILE__, __LINE__);
 	} else {
@@ -112,6 +191,7 @@ Controller::sessionCheckedOutFromAnotherThread(Client *client, Request *req,
 	AbstractSessionPtr session, ExceptionPtr e)
 {
 	SKC_LOG_EVENT(Controller, client, "sessionCheckedOutFromAnotherThread");
+	sessionCheckoutsFromAnotherThread++;
 	sessionCheckedOutFromEventLoopThread(client, req, session, e);
 	unrefRequest(req, __FILE__, __LINE__);
 }
@@ -233,6 +313,9 @@ Controller::reportSessionCheckoutError(Client *client, Request *req,
 	const ExceptionPtr &e)
 {
 	TRACE_POINT();
+	if (respondFromStaleTurboCacheEntry(client, req)) {
+		return;
+	}
 	{
 		boost::shared_ptr<RequestQueueFullException> e2 =
 			dynamic_pointer_cast<RequestQueueFullException>(e);
@@ -109,13 +109,23 @@ parseControllerBenchmarkMode(const StaticString &mode) {
  *   integration_mode                                    string             -          default("standalone"),read_only
  *   min_spare_clients                                   unsigned integer   -          default(0)
  *   multi_app                                           boolean            -          default(true),read_only
+ *   pipelined_requests_limit                            unsigned integer   -          default(0)
  *   request_freelist_limit                              unsigned integer   -          default(1024)
  *   response_buffer_high_watermark                      unsigned integer   -          default(134217728)
+ *   response_splice_threshold                           unsigned integer   -          default(262144)
  *   server_software                                     string             -          default("Phusion_Passenger/5.1.13")
  *   show_version_in_header                              boolean            -          default(true)
  *   start_reading_after_accept                          boolean            -          default(true)
  *   stat_throttle_rate                                  unsigned integer   -          default(10)
  *   thread_number                                       unsigned integer   required   read_only
+ *   thread_session_slot_idle_time                       unsigned integer   -          default(10),read_only
+ *   thread_session_slot_max_reuses                      unsigned integer   -          default(100),read_only
+ *   thread_session_slots                                unsigned integer   -          default(0),read_only
+ *   turbocache_compression                              boolean            -          default(false),read_only
+ *   turbocache_max_entries                              unsigned integer   -          default(1024),read_only
+ *   turbocache_max_memory                               unsigned integer   -          default(16777216),read_only
+ *   turbocache_serve_stale                              boolean            -          default(true),read_only
+ *   turbocache_shared                                   boolean            -          default(false),read_only
  *   turbocaching                                        boolean            -          default(true),read_only
  *   user_switching                                      boolean            -          default(true)
  *   ust_router_address                                  string             -          -
@@ -132,12 +142,21 @@ private:
 		add("thread_number", UINT_TYPE, REQUIRED | READ_ONLY);
 		add("multi_app", BOOL_TYPE, OPTIONAL | READ_ONLY, true);
 		add("turbocaching", BOOL_TYPE, OPTIONAL | READ_ONLY, true);
+		add("turbocache_max_entries", UINT_TYPE, OPTIONAL | READ_ONLY, 1024);
+		add("turbocache_max_memory", UINT_TYPE, OPTIONAL | READ_ONLY, 1024 * 1024 * 16);
+		add("turbocache_shared", BOOL_TYPE, OPTIONAL | READ_ONLY, false);
+		add("turbocache_serve_stale", BOOL_TYPE, OPTIONAL | READ_ONLY, true);
+		add("turbocache_compression", BOOL_TYPE, OPTIONAL | READ_ONLY, false);
 		add("integration_mode", STRING_TYPE, OPTIONAL | READ_ONLY, DEFAULT_INTEGRATION_MODE);
+		add("thread_session_slots", UINT_TYPE, OPTIONAL | READ_ONLY, 0);
+		add("thread_session_slot_max_reuses", UINT_TYPE, OPTIONAL | READ_ONLY, 100);
+		add("thread_session_slot_idle_time", UINT_TYPE, OPTIONAL | READ_ONLY, 10);
 
 		add("user_switching", BOOL_TYPE, OPTIONAL, true);
 		add("stat_throttle_rate", UINT_TYPE, OPTIONAL, DEFAULT_STAT_THROTTLE_RATE);
 		add("show_version_in_header", BOOL_TYPE, OPTIONAL, true);
 		add("response_buffer_high_watermark", UINT_TYPE, OPTIONAL, DEFAULT_RESPONSE_BUFFER_HIGH_WATERMARK);
+		add("response_splice_threshold", UINT_TYPE, OPTIONAL, 1024 * 256);
 		add("graceful_exit", BOOL_TYPE, OPTIONAL, true);
 		add("benchmark_mode", STRING_TYPE, OPTIONAL);
 
@@ -200,6 +219,10 @@ private:
 			errors.push_back(Error("'{{benchmark_mode}}' is not set to a valid value"));
 		}
 
+		if (config["turbocache_max_entries"].asUInt() == 0) {
+			errors.push_back(Error("'{{turbocache_max_entries}}' must be at least 1"));
+		}
+
 		/*******************/
 	}
 
@@ -309,6 +332,7 @@ public:
 	unsigned int threadNumber;
 	unsigned int statThrottleRate;
 	unsigned int responseBufferHighWatermark;
+	unsigned int responseSpliceThreshold;
 	StaticString integrationMode;
 	StaticString serverLogName;
 	ControllerBenchmarkMode benchmarkMode: 3;
@@ -326,6 +350,7 @@ public:
 		  threadNumber(config["thread_number"].asUInt()),
 		  statThrottleRate(config["stat_throttle_rate"].asUInt()),
 		  responseBufferHighWatermark(config["response_buffer_high_watermark"].asUInt()),
+		  responseSpliceThreshold(config["response_splice_threshold"].asUInt()),
 		  integrationMode(psg_pstrdup(pool, config["integration_mode"].asString())),
 		  serverLogName(createServerLogName()),
 		  benchmarkMode(parseControllerBenchmarkMode(config["benchmark_mode"].asString())),
@@ -355,6 +380,7 @@ public:
 		std::swap(threadNumber, other.threadNumber);
 		std::swap(statThrottleRate, other.statThrottleRate);
 		std::swap(responseBufferHighWatermark, other.responseBufferHighWatermark);
+		std::swap(responseSpliceThreshold, other.responseSpliceThreshold);
 		std::swap(integrationMode, other.integrationMode);
 		std::swap(serverLogName, other.serverLogName);
 		SWAP_BITFIELD(ControllerBenchmarkMode, benchmarkMode);
@@ -95,6 +95,8 @@ Controller::onAppSourceData(Client *client, Request *req, const MemoryKit::mbuf
 				return Channel::Result(ret, false);
 			case AppResponse::PARSING_BODY_WITH_LENGTH:
 				SKC_TRACE(client, 2, "Expecting an app response body with fixed length");
+				req->appSource.setSizeHint(resp->aux.bodyInfo.contentLength,
+					buffer.size() - ret);
 				onAppResponseBegin(client, req);
 				return Channel::Result(ret, false);
 			case AppResponse::PARSING_BODY_UNTIL_EOF:
@@ -165,7 +167,7 @@ Controller::onAppSourceData(Client *client, Request *req, const MemoryKit::mbuf
 						SKC_TRACE(client, 2, "End of application response body reached");
 						handleAppResponseBodyEnd(client, req);
 						endRequest(&client, &req);
-					} else {
+					} else if (!maybeSpliceAppResponseBody(client, req)) {
 						maybeThrottleAppSource(client, req);
 					}
 				}
@@ -368,6 +370,12 @@ Controller::onAppResponseBegin(Client *client, Request *req) {
 		req->wantKeepAlive = false;
 	}
 
+	if (OXT_UNLIKELY(turboCaching.responseCache.statusCodeAllowsStaleIfError(resp->statusCode))
+	 && respondFromStaleTurboCacheEntry(client, req))
+	{
+		return;
+	}
+
 	prepareAppResponseCaching(client, req);
 
 	if (OXT_UNLIKELY(oobw)) {
@@ -406,10 +414,10 @@ Controller::prepareAppResponseCaching(Client *client, Request *req) {
 		 && turboCaching.responseCache.prepareRequestForStoring(req))
 		{
 			if (resp->bodyType == AppResponse::RBT_CONTENT_LENGTH
-			 && resp->aux.bodyInfo.contentLength > ResponseCache<Request>::MAX_BODY_SIZE)
+			 && resp->aux.bodyInfo.contentLength > turboCaching.responseCache.getMaxBodySize())
 			{
 				SKC_DEBUG(client, "Response body larger than " <<
-					ResponseCache<Request>::MAX_BODY_SIZE <<
+					turboCaching.responseCache.getMaxBodySize() <<
 					" bytes, so response is not eligible for turbocaching");
 				// Decrease store success ratio.
 				turboCaching.responseCache.incStores();
@@ -865,7 +873,8 @@ Controller::sendResponseHeaderWithBuffering(Client *client, Request *req,
 	logResponseHeaders(client, req, buffers, nbuffers, dataSize);
 	markHeaderBuffersForTurboCaching(client, req, buffers, nCacheableBuffers);
 
-	MemoryKit::mbuf_pool &mbuf_pool = getContext()->mbuf_pool;
+	MemoryKit::mbuf_pool &mbuf_pool = *MemoryKit::mbuf_pool_for_size(
+		&getContext()->mbuf_pool, dataSize);
 	const unsigned int MBUF_MAX_SIZE = mbuf_pool_data_size(&mbuf_pool);
 	if (dataSize <= MBUF_MAX_SIZE) {
 		UPDATE_TRACE_POINT();
@@ -995,9 +1004,9 @@ Controller::markResponsePartForTurboCaching(Client *client, Request *req,
 {
 	if (!req->ended() && turboCaching.isEnabled() && !req->cacheKey.empty()) {
 		unsigned int totalSize = req->appResponse.bodyCacheBuffer.size + buffer.size();
-		if (totalSize > ResponseCache<Request>::MAX_BODY_SIZE) {
+		if (totalSize > turboCaching.responseCache.getMaxBodySize()) {
 			SKC_DEBUG(client, "Response body larger than " <<
-				ResponseCache<Request>::MAX_HEADER_SIZE <<
+				turboCaching.responseCache.getMaxBodySize() <<
 				" bytes, so response is not eligible for turbocaching");
 			// Decrease store success ratio.
 			turboCaching.responseCache.incStores();
@@ -1078,11 +1087,272 @@ Controller::outputDataFlushed(Client *client, Request *req) {
 	}
 }
 
+/**
+ * Switches forwarding of the remainder of a fixed-length app response body
+ * from mbufs to splice(): app socket -> pipe -> client socket, without
+ * copying the data into userspace. This is only possible when nothing else
+ * needs to see the body (turbocaching, dechunking), when the client output
+ * channel has nothing buffered and when appSource hasn't read ahead, so that
+ * no data can be reordered or lost. Otherwise
+ * we keep using the normal mbuf-based path, which also takes care of
+ * buffering to disk.
+ *
+ * Must be called from the appSource data callback, after the entire buffer
+ * has been written to the client. Returns whether splicing has started.
+ */
+bool
+Controller::maybeSpliceAppResponseBody(Client *client, Request *req) {
+	#if defined(__linux__) && defined(SPLICE_F_NONBLOCK)
+		AppResponse *resp = &req->appResponse;
+
+		if (mainConfig.responseSpliceThreshold == 0
+		 || req->splicing.disabled
+		 || mainConfig.benchmarkMode != BM_NONE
+		 || resp->bodyType != AppResponse::RBT_CONTENT_LENGTH
+		 || !req->cacheKey.empty()
+		 || resp->aux.bodyInfo.contentLength - resp->bodyAlreadyRead
+		    < mainConfig.responseSpliceThreshold
+		 || client->output.getTotalBytesBuffered() > 0
+		 || client->output.ended()
+		 || req->appSource.hasPendingBuffers())
+		{
+			return false;
+		}
+
+		if (pipe2(req->splicing.pipe, O_NONBLOCK | O_CLOEXEC) == -1) {
+			int e = errno;
+			SKC_WARN(client, "Cannot create a pipe for splicing the application response body: " <<
+				strerror(e) << " (errno=" << e << "). Forwarding it through buffers instead");
+			req->splicing.pipe[0] = -1;
+			req->splicing.pipe[1] = -1;
+			return false;
+		}
+
+		SKC_DEBUG(client, "Forwarding the remaining " <<
+			(resp->aux.bodyInfo.contentLength - resp->bodyAlreadyRead) <<
+			" bytes of the application response body with splice()");
+		req->appSource.stop();
+		req->splicing.bytesInPipe = 0;
+		ev_io_set(&req->splicing.appWatcher, req->session->fd(), EV_READ);
+		ev_io_set(&req->splicing.clientWatcher, client->getFd(), EV_WRITE);
+		ev_io_start(getLoop(), &req->splicing.appWatcher);
+		splicedResponseBodies++;
+		return true;
+	#else
+		return false;
+	#endif
+}
+
+void
+Controller::_onSpliceWatcherEvent(EV_P_ ev_io *io, int revents) {
+	Request *req = static_cast<Request *>(io->data);
+	Client *client = static_cast<Client *>(req->client);
+	Controller *self = static_cast<Controller *>(getServerFromClient(client));
+	ServerKit::RefGuard guard(&req->hooks, req, __FILE__, __LINE__);
+	self->spliceAppResponseBody(client, req);
+}
+
+void
+Controller::spliceAppResponseBody(Client *client, Request *req) {
+	#if defined(__linux__) && defined(SPLICE_F_NONBLOCK)
+		TRACE_POINT();
+		AppResponse *resp = &req->appResponse;
+		int appFd = req->splicing.appWatcher.fd;
+		int clientFd = req->splicing.clientWatcher.fd;
+		boost::uint64_t remaining;
+		ssize_t ret;
+		unsigned int i;
+		bool progress = true;
+		bool clientWouldBlock = false;
+
+		if (ev_is_active(&req->splicing.appWatcher)) {
+			ev_io_stop(getLoop(), &req->splicing.appWatcher);
+		}
+		if (ev_is_active(&req->splicing.clientWatcher)) {
+			ev_io_stop(getLoop(), &req->splicing.clientWatcher);
+		}
+
+		// Limit the amount of work per event loop iteration so that other
+		// clients are not starved. The watchers are level-triggered, so we
+		// are called again for the rest.
+		for (i = 0; i < 16 && progress; i++) {
+			progress = false;
+			remaining = resp->aux.bodyInfo.contentLength - resp->bodyAlreadyRead;
+
+			if (remaining > 0) {
+				UPDATE_TRACE_POINT();
+				do {
+					ret = splice(appFd, NULL, req->splicing.pipe[1], NULL,
+						std::min<boost::uint64_t>(remaining, 1024 * 1024),
+						SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+				} while (OXT_UNLIKELY(ret == -1 && errno == EINTR));
+				if (ret > 0) {
+					req->splicing.bytesInPipe += ret;
+					resp->bodyAlreadyRead += ret;
+					totalBytesSpliced += ret;
+					progress = true;
+				} else if (ret == 0 || errno == ECONNRESET) {
+					SKC_WARN(client, "Application sent EOF before finishing response body: " <<
+						resp->bodyAlreadyRead << " bytes already read, " <<
+						resp->aux.bodyInfo.contentLength << " bytes expected");
+					stopSplicingAppResponseBody(req);
+					endRequestWithAppSocketIncompleteResponse(&client, &req);
+					return;
+				} else if (errno != EAGAIN) {
+					// EAGAIN means that either the app socket has no data,
+					// or that the pipe is full. In both cases we just
+					// move on to writing to the client.
+					int e = errno;
+					stopSplicingAppResponseBody(req);
+					endRequestWithAppSocketReadError(&client, &req, e);
+					return;
+				}
+			}
+
+			if (req->splicing.bytesInPipe > 0) {
+				UPDATE_TRACE_POINT();
+				do {
+					ret = splice(req->splicing.pipe[0], NULL, clientFd, NULL,
+						req->splicing.bytesInPipe, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+				} while (OXT_UNLIKELY(ret == -1 && errno == EINTR));
+				if (ret > 0) {
+					req->splicing.bytesInPipe -= ret;
+					progress = true;
+					clientWouldBlock = false;
+				} else if (ret == -1 && errno == EAGAIN) {
+					clientWouldBlock = true;
+				} else {
+					int e = (ret == -1) ? errno : EPIPE;
+					stopSplicingAppResponseBody(req);
+					disconnectWithClientSocketWriteError(&client, e);
+					return;
+				}
+			}
+
+			if (req->splicing.bytesInPipe == 0 && resp->bodyFullyRead()) {
+				UPDATE_TRACE_POINT();
+				SKC_TRACE(client, 2, "End of application response body reached");
+				stopSplicingAppResponseBody(req);
+				handleAppResponseBodyEnd(client, req);
+				endRequest(&client, &req);
+				return;
+			}
+		}
+
+		// If the client isn't writable while the application is waiting
+		// for us to make room in the pipe (or is already done) then the
+		// client is slower than the application. Waiting for it would hold
+		// up the application process, so buffer the rest of the body like
+		// we would have done without splicing.
+		if (clientWouldBlock && req->splicing.bytesInPipe > 0) {
+			int appBytesAvailable = 0;
+			if (resp->bodyFullyRead()
+			 || (ioctl(appFd, FIONREAD, &appBytesAvailable) == 0
+			     && appBytesAvailable > 0))
+			{
+				bufferSplicedAppResponseBody(client, req);
+				return;
+			}
+		}
+
+		// If the pipe still contains data then we're waiting for the client,
+		// either because it's not writable or because we ran out of our work
+		// limit. If the client isn't writable then also wait for the
+		// application to send more, so that we get to re-evaluate the
+		// fallback above. Otherwise the pipe is empty, so if the app socket
+		// gave us EAGAIN then it really had no data.
+		if (req->splicing.bytesInPipe > 0) {
+			ev_io_start(getLoop(), &req->splicing.clientWatcher);
+			if (clientWouldBlock && !resp->bodyFullyRead()) {
+				ev_io_start(getLoop(), &req->splicing.appWatcher);
+			}
+		} else {
+			ev_io_start(getLoop(), &req->splicing.appWatcher);
+		}
+	#endif
+}
+
+void
+Controller::stopSplicingAppResponseBody(Request *req) {
+	if (ev_is_active(&req->splicing.appWatcher)) {
+		ev_io_stop(getLoop(), &req->splicing.appWatcher);
+	}
+	if (ev_is_active(&req->splicing.clientWatcher)) {
+		ev_io_stop(getLoop(), &req->splicing.clientWatcher);
+	}
+	if (req->splicing.pipe[0] != -1) {
+		safelyClose(req->splicing.pipe[0]);
+		safelyClose(req->splicing.pipe[1]);
+		req->splicing.pipe[0] = -1;
+		req->splicing.pipe[1] = -1;
+	}
+	req->splicing.bytesInPipe = 0;
+}
+
+/**
+ * Stops splicing because the client can't keep up, and continues forwarding
+ * the app response body through `client->output`, which buffers it (to disk
+ * if necessary) so that the application doesn't have to wait for the client.
+ * The data that is still in the pipe is moved to `client->output` first.
+ * As with any other response, appSource is throttled once
+ * `response_buffer_high_watermark` bytes are buffered.
+ */
+void
+Controller::bufferSplicedAppResponseBody(Client *client, Request *req) {
+	TRACE_POINT();
+	AppResponse *resp = &req->appResponse;
+
+	SKC_DEBUG(client, "Client is slower than the application; buffering the remaining " <<
+		(req->splicing.bytesInPipe + resp->aux.bodyInfo.contentLength - resp->bodyAlreadyRead) <<
+		" bytes of the application response body instead of splicing them");
+	spliceFallbacks++;
+
+	while (req->splicing.bytesInPipe > 0) {
+		MemoryKit::mbuf buffer(MemoryKit::mbuf_get(&getContext()->mbuf_pool));
+		ssize_t ret;
+
+		do {
+			ret = read(req->splicing.pipe[0], buffer.start,
+				std::min<unsigned int>(buffer.size(), req->splicing.bytesInPipe));
+		} while (OXT_UNLIKELY(ret == -1 && errno == EINTR));
+		if (OXT_UNLIKELY(ret <= 0)) {
+			int e = (ret == -1) ? errno : EPIPE;
+			stopSplicingAppResponseBody(req);
+			disconnectWithError(&client, "cannot read from the splice pipe: "
+				+ string(strerror(e)) + " (errno=" + toString(e) + ")");
+			return;
+		}
+
+		req->splicing.bytesInPipe -= ret;
+		writeResponse(client, MemoryKit::mbuf(buffer, 0, ret));
+		if (req->ended()) {
+			stopSplicingAppResponseBody(req);
+			return;
+		}
+	}
+
+	stopSplicingAppResponseBody(req);
+	req->splicing.disabled = true;
+
+	if (resp->bodyFullyRead()) {
+		SKC_TRACE(client, 2, "End of application response body reached");
+		handleAppResponseBodyEnd(client, req);
+		endRequest(&client, &req);
+	} else {
+		req->appSource.start();
+		maybeThrottleAppSource(client, req);
+	}
+}
+
 void
 Controller::handleAppResponseBodyEnd(Client *client, Request *req) {
 	keepAliveAppConnection(client, req);
 	storeAppResponseInTurboCache(client, req);
 	finalizeUnionStationWithSuccess(client, req);
+	SKC_TRACE(client, 3, "Client output write stats: " << client->output.getWriteStats().buffers
+		<< " buffers written with " << client->output.getWriteStats().syscalls
+		<< " system calls, " << client->output.getWriteStats().partialWrites
+		<< " partial writes");
 	assert(!req->ended());
 }
 
@@ -1091,7 +1361,7 @@ Controller::keepAliveAppConnection(Client *client, Request *req) {
 	if (req->halfClosePolicy == Request::HALF_CLOSE_PERFORMED) {
 		SKC_TRACE(client, 2, "Not keep-aliving application session connection"
 			" because it had been half-closed before");
-		req->session->close(true, false);
+		closeOrKeepIdleSession(client, req, false);
 	} else {
 		// halfClosePolicy is initialized in sendHeaderToApp(). That method is
 		// called immediately after checking out a session, before any events
@@ -1099,12 +1369,43 @@ Controller::keepAliveAppConnection(Client *client, Request *req) {
 		assert(req->halfClosePolicy != Request::HALF_CLOSE_POLICY_UNINITIALIZED);
 		if (req->appResponse.wantKeepAlive) {
 			SKC_TRACE(client, 2, "Keep-aliving application session connection");
-			req->session->close(true, true);
+			closeOrKeepIdleSession(client, req, true);
 		} else {
 			SKC_TRACE(client, 2, "Not keep-aliving application session connection"
 				" because application did not allow it");
-			req->session->close(true, false);
+			closeOrKeepIdleSession(client, req, false);
+		}
+	}
+}
+
+/**
+ * Closes the request's session, unless it can be kept in one of this
+ * thread's idle session slots for reuse by a later request.
+ */
+void
+Controller::closeOrKeepIdleSession(Client *client, Request *req, bool wantKeepAlive) {
+	if (maxIdleSessionSlots == 0
+	 || req->stickySession
+	 || req->options.maxRequests > 0
+	 || req->session->getRecycleCount() >= maxIdleSessionSlotReuses
+	 || serverState != ACTIVE)
+	{
+		req->session->close(true, wantKeepAlive);
+	} else if (idleSessionSlots.size() >= maxIdleSessionSlots) {
+		idleSessionSlotOverflows++;
+		req->session->close(true, wantKeepAlive);
+	} else if (req->session->recycle(true, wantKeepAlive)) {
+		SKC_TRACE(client, 2, "Keeping application session in an idle session slot");
+		IdleSessionSlot slot;
+		slot.session = req->session;
+		slot.expiresAt = ev_now(getLoop()) + idleSessionSlotIdleTime;
+		idleSessionSlots.push_back(slot);
+		if (!ev_is_active(&idleSessionSlotsTimer)) {
+			ev_timer_set(&idleSessionSlotsTimer, idleSessionSlotIdleTime, 0);
+			ev_timer_start(getLoop(), &idleSessionSlotsTimer);
 		}
+	} else {
+		req->session->close(true, wantKeepAlive);
 	}
 }
 
@@ -1121,24 +1422,18 @@ Controller::storeAppResponseInTurboCache(Client *client, Request *req) {
 		}
 		ResponseCache<Request>::Entry entry(
 			turboCaching.responseCache.store(req, ev_now(getLoop()),
-				headerSize, resp->bodyCacheBuffer.size));
+				headerSize, &resp->bodyCacheBuffer));
 		if (entry.valid()) {
 			UPDATE_TRACE_POINT();
 			SKC_DEBUG(client, "Storing app response in turbocache");
 			SKC_TRACE(client, 2, "Turbocache entries:\n" << turboCaching.responseCache.inspect());
 
-			gatherBuffers(entry.body->httpHeaderData,
-				ResponseCache<Request>::MAX_HEADER_SIZE,
+			// The body has already been stored by the response cache.
+			gatherBuffers(entry.response->getHttpHeaderData(), headerSize,
 				resp->headerCacheBuffers, resp->nHeaderCacheBuffers);
 
-			char *pos = entry.body->httpBodyData;
-			const char *end = entry.body->httpBodyData
-				+ ResponseCache<Request>::MAX_BODY_SIZE;
-			const LString::Part *part = resp->bodyCacheBuffer.start;
-			while (part != NULL) {
-				pos = appendData(pos, end, part->data, part->size);
-				part = part->next;
-			}
+			turboCaching.responseCache.commit(entry);
+			endTurboCacheRevalidation(client, req, false);
 		} else {
 			SKC_DEBUG(client, "Could not store app response for turbocaching");
 		}
@@ -79,6 +79,12 @@ Controller::onEventLoopCheck(EV_P_ struct ev_check *w, int revents) {
 	#endif
 }
 
+void
+Controller::onIdleSessionSlotsTimeout(EV_P_ struct ev_timer *w, int revents) {
+	Controller *self = static_cast<Controller *>(w->data);
+	self->releaseIdleSessionSlots(false);
+}
+
 
 /****************************
  *
@@ -104,6 +110,11 @@ Controller::onRequestObjectCreated(Client *client, Request *req) {
 	req->appSource.setHooks(&req->hooks);
 	req->appSource.setDataCallback(_onAppSourceData);
 
+	ev_io_init(&req->splicing.appWatcher, _onSpliceWatcherEvent, -1, EV_READ);
+	req->splicing.appWatcher.data = req;
+	ev_io_init(&req->splicing.clientWatcher, _onSpliceWatcherEvent, -1, EV_WRITE);
+	req->splicing.clientWatcher.data = req;
+
 	req->bodyBuffer.setContext(getContext());
 	req->bodyBuffer.setHooks(&req->hooks);
 	req->bodyBuffer.setDataCallback(onBodyBufferData);
@@ -140,7 +151,9 @@ Controller::reinitializeRequest(Client *client, Request *req) {
 	req->cacheKey = HashedStaticString();
 	req->cacheControl = NULL;
 	req->varyCookie = NULL;
+	req->acceptedEncodings = 0;
 	req->envvars = NULL;
+	req->splicing.disabled = false;
 
 	#ifdef DEBUG_CC_EVENT_LOOP_BLOCKING
 		req->timedAppPoolGet = false;
@@ -167,9 +180,12 @@ Controller::deinitializeRequest(Client *client, Request *req) {
 	req->appSink.setConsumedCallback(NULL);
 	req->appSink.deinitialize();
 	req->appSource.deinitialize();
+	stopSplicingAppResponseBody(req);
 	req->bodyBuffer.clearBuffersFlushedCallback();
 	req->bodyBuffer.deinitialize();
 
+	endTurboCacheRevalidation(client, req, false);
+
 	/***************/
 	/***************/
 
@@ -280,6 +296,12 @@ Controller::shouldDisconnectClientOnShutdown(Client *client) {
 		|| !mainConfig.gracefulExit;
 }
 
+void
+Controller::onShutdown(bool forceDisconnect) {
+	ParentClass::onShutdown(forceDisconnect);
+	releaseIdleSessionSlots(true);
+}
+
 bool
 Controller::supportsUpgrade(Client *client, Request *req) {
 	return true;
@@ -99,6 +99,16 @@ Controller::initializeFlags(Client *client, Request *req, RequestAnalysis &analy
 	}
 }
 
+void
+Controller::analyzeRequest(Request *req, RequestAnalysis &analysis) {
+	analysis.flags = req->secureHeaders.lookup(FLAGS);
+	analysis.appGroupNameCell = mainConfig.singleAppMode
+		? NULL
+		: req->secureHeaders.lookupCell(PASSENGER_APP_GROUP_NAME);
+	analysis.unionStationSupport = unionStationContext != NULL
+		&& getBoolOption(req, UNION_STATION_SUPPORT, false);
+}
+
 bool
 Controller::respondFromTurboCache(Client *client, Request *req) {
 	if (!turboCaching.isEnabled() || !turboCaching.responseCache.prepareRequest(this, req)) {
@@ -110,16 +120,27 @@ Controller::respondFromTurboCache(Client *client, Request *req) {
 	SKC_TRACE(client, 2, "Turbocache entries:\n" << turboCaching.responseCache.inspect());
 
 	if (turboCaching.responseCache.requestAllowsFetching(req)) {
+		ResponseCache<Request>::ReadGuard guard(turboCaching.responseCache);
 		ResponseCache<Request>::Entry entry(turboCaching.responseCache.fetch(req,
 			ev_now(getLoop())));
 		if (entry.valid()) {
 			SKC_TRACE(client, 2, "Turbocaching: cache hit (key \"" <<
 				cEscapeString(req->cacheKey) << "\")");
 			turboCaching.writeResponse(this, client, req, entry);
+			// writeResponse() copied the entry, so it's safe to leave the
+			// read section before ending the request.
+			guard.release();
 			if (!req->ended()) {
 				endRequest(&client, &req);
 			}
 			return true;
+		} else if (entry.cacheMissReason == ResponseCache<Request>::Entry::REVALIDATING) {
+			SKC_TRACE(client, 2, "Turbocaching: waiting for another request to"
+				" revalidate the cache entry (key \"" << cEscapeString(req->cacheKey) << "\")");
+			req->state = Request::WAITING_FOR_TURBOCACHE;
+			refRequest(req, __FILE__, __LINE__);
+			turboCaching.responseCache.waitForRevalidation(req);
+			return true;
 		} else {
 			SKC_TRACE(client, 2, "Turbocaching: cache miss: " <<
 				entry.getCacheMissReasonString() <<
@@ -132,6 +153,69 @@ Controller::respondFromTurboCache(Client *client, Request *req) {
 	}
 }
 
+void
+Controller::resumeRequestWaitingForTurboCache(Request *req) {
+	Client *client = static_cast<Client *>(req->client);
+	Controller *self = static_cast<Controller *>(
+		Controller::getServerFromClient(client));
+	SKC_LOG_EVENT_FROM_STATIC(self, Controller, client, "resumeRequestWaitingForTurboCache");
+
+	if (!req->ended()) {
+		P_ASSERT_EQ(req->state, Request::WAITING_FOR_TURBOCACHE);
+		req->state = Request::ANALYZING_REQUEST;
+		if (!self->respondFromTurboCache(client, req)) {
+			RequestAnalysis analysis;
+			self->analyzeRequest(req, analysis);
+			self->continueRequestAfterTurboCaching(client, req, analysis);
+		}
+	}
+	self->unrefRequest(req, __FILE__, __LINE__);
+}
+
+/**
+ * Called when a request that is revalidating a turbocache entry fails
+ * before its response has begun. Responds with the stale entry if its
+ * stale-if-error window allows it.
+ */
+bool
+Controller::respondFromStaleTurboCacheEntry(Client *client, Request *req) {
+	if (!turboCaching.responseCache.isRevalidating(req)) {
+		return false;
+	}
+
+	ResponseCache<Request>::ReadGuard guard(turboCaching.responseCache);
+	ResponseCache<Request>::Entry entry(turboCaching.responseCache.fetchStaleIfError(
+		req, ev_now(getLoop())));
+	if (!entry.valid()) {
+		return false;
+	}
+
+	SKC_DEBUG(client, "Turbocaching: application failed; replying with stale cache entry");
+	turboCaching.writeResponse(this, client, req, entry);
+	guard.release();
+	endTurboCacheRevalidation(client, req, true);
+	if (!req->ended()) {
+		endRequest(&client, &req);
+	}
+	return true;
+}
+
+void
+Controller::endTurboCacheRevalidation(Client *client, Request *req, bool keepStaleEntry) {
+	vector<Request *> waiters;
+	turboCaching.responseCache.endRevalidation(req, ev_now(getLoop()), waiters,
+		keepStaleEntry);
+
+	vector<Request *>::iterator it, end = waiters.end();
+	for (it = waiters.begin(); it != end; it++) {
+		getContext()->libev->runLater(boost::bind(resumeRequestWaitingForTurboCache, *it));
+	}
+	if (!waiters.empty()) {
+		SKC_TRACE(client, 2, "Turbocaching: revalidation ended; resuming " <<
+			waiters.size() << " waiting requests");
+	}
+}
+
 void
 Controller::initializePoolOptions(Client *client, Request *req, RequestAnalysis &analysis) {
 	boost::shared_ptr<Options> *options;
@@ -455,6 +539,28 @@ Controller::getStickySessionCookieName(Request *req) {
 	}
 }
 
+void
+Controller::continueRequestAfterTurboCaching(Client *client, Request *req,
+	RequestAnalysis &analysis)
+{
+	initializePoolOptions(client, req, analysis);
+	if (req->ended()) {
+		return;
+	}
+	initializeUnionStation(client, req, analysis);
+	if (req->ended()) {
+		return;
+	}
+	setStickySessionId(client, req);
+
+	if (!req->hasBody() || !req->requestBodyBuffering) {
+		req->requestBodyBuffering = false;
+		checkoutSession(client, req);
+	} else {
+		beginBufferingBody(client, req);
+	}
+}
+
 
 /****************************
  *
@@ -473,12 +579,7 @@ Controller::onRequestBegin(Client *client, Request *req) {
 		// Perform hash table operations as close to header parsing as possible,
 		// and localize them as much as possible, for better CPU caching.
 		RequestAnalysis analysis;
-		analysis.flags = req->secureHeaders.lookup(FLAGS);
-		analysis.appGroupNameCell = mainConfig.singleAppMode
-			? NULL
-			: req->secureHeaders.lookupCell(PASSENGER_APP_GROUP_NAME);
-		analysis.unionStationSupport = unionStationContext != NULL
-			&& getBoolOption(req, UNION_STATION_SUPPORT, false);
+		analyzeRequest(req, analysis);
 		req->stickySession = getBoolOption(req, PASSENGER_STICKY_SESSIONS,
 			mainConfig.defaultStickySessions);
 		req->host = req->headers.lookup(HTTP_HOST);
@@ -494,22 +595,7 @@ Controller::onRequestBegin(Client *client, Request *req) {
 		if (respondFromTurboCache(client, req)) {
 			return;
 		}
-		initializePoolOptions(client, req, analysis);
-		if (req->ended()) {
-			return;
-		}
-		initializeUnionStation(client, req, analysis);
-		if (req->ended()) {
-			return;
-		}
-		setStickySessionId(client, req);
-	}
-
-	if (!req->hasBody() || !req->requestBodyBuffering) {
-		req->requestBodyBuffering = false;
-		checkoutSession(client, req);
-	} else {
-		beginBufferingBody(client, req);
+		continueRequestAfterTurboCaching(client, req, analysis);
 	}
 }
 
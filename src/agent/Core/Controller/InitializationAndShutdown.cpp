@@ -46,6 +46,7 @@ using namespace boost;
 
 Controller::~Controller() {
 	ev_check_stop(getLoop(), &checkWatcher);
+	releaseIdleSessionSlots(true);
 	delete singleAppModeConfig;
 }
 
@@ -56,6 +57,10 @@ Controller::preinitialize() {
 	ev_check_start(getLoop(), &checkWatcher);
 	checkWatcher.data = this;
 
+	// Only started while there are idle session slots.
+	ev_timer_init(&idleSessionSlotsTimer, onIdleSessionSlotsTimeout, 0, 0);
+	idleSessionSlotsTimer.data = this;
+
 	#ifdef DEBUG_CC_EVENT_LOOP_BLOCKING
 		ev_prepare_init(&prepareWatcher, onEventLoopPrepare);
 		ev_prepare_start(getLoop(), &prepareWatcher);
@@ -103,7 +108,19 @@ Controller::initialize() {
 	}
 
 	ParentClass::initialize();
-	turboCaching.initialize(config["turbocaching"].asBool());
+	turboCaching.initialize(config["turbocaching"].asBool(),
+		config["turbocache_max_entries"].asUInt(),
+		config["turbocache_max_memory"].asUInt(),
+		sharedTurbocacheStorage,
+		mainConfig.threadNumber - 1);
+	turboCaching.responseCache.setStaleServingEnabled(
+		config["turbocache_serve_stale"].asBool());
+	turboCaching.responseCache.setCompressionEnabled(
+		config["turbocache_compression"].asBool());
+	maxIdleSessionSlots = config["thread_session_slots"].asUInt();
+	maxIdleSessionSlotReuses = config["thread_session_slot_max_reuses"].asUInt();
+	idleSessionSlotIdleTime = config["thread_session_slot_idle_time"].asUInt() / 1000.0;
+	idleSessionSlots.reserve(maxIdleSessionSlots);
 
 	if (mainConfig.singleAppMode) {
 		boost::shared_ptr<Options> options = boost::make_shared<Options>();
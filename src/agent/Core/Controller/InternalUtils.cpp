@@ -86,6 +86,9 @@ Controller::disconnectWithAppSocketWriteError(Client **client, int e) {
 void
 Controller::endRequestWithAppSocketIncompleteResponse(Client **client, Request **req) {
 	if (!(*req)->responseBegun) {
+		if (respondFromStaleTurboCacheEntry(*client, *req)) {
+			return;
+		}
 		// The application might have decided to abort the response because it thinks the client
 		// is already gone (Passenger relays socket half-close events from clients), so don't
 		// make a big warning out of that situation.
@@ -106,6 +109,9 @@ void
 Controller::endRequestWithAppSocketReadError(Client **client, Request **req, int e) {
 	Client *c = *client;
 	if (!(*req)->responseBegun) {
+		if (respondFromStaleTurboCacheEntry(*client, *req)) {
+			return;
+		}
 		SKC_WARN(*client, "Sending 502 response: application socket read error");
 		endRequestWithSimpleResponse(client, req, "<h2>Application socket read error</h2>", 502);
 	} else {
@@ -133,7 +139,7 @@ void
 Controller::endRequestAsBadGateway(Client **client, Request **req) {
 	if ((*req)->responseBegun) {
 		disconnectWithError(client, "bad gateway");
-	} else {
+	} else if (!respondFromStaleTurboCacheEntry(*client, *req)) {
 		ServerKit::HeaderTable headers;
 		headers.insert((*req)->pool, "cache-control", "no-cache, no-store, must-revalidate");
 		writeSimpleResponse(*client, 502, &headers, "<h1>Bad Gateway</h1>");
@@ -57,7 +57,8 @@ public:
 		CHECKING_OUT_SESSION,
 		SENDING_HEADER_TO_APP,
 		FORWARDING_BODY_TO_APP,
-		WAITING_FOR_APP_OUTPUT
+		WAITING_FOR_APP_OUTPUT,
+		WAITING_FOR_TURBOCACHE
 	};
 
 	enum HalfClosePolicy {
@@ -94,6 +95,19 @@ public:
 	ServerKit::FileBufferedChannel bodyBuffer;
 	boost::uint64_t bodyBytesBuffered; // After dechunking
 
+	// State for forwarding the app response body from the app socket to the
+	// client socket through a pipe with splice(), without copying it into
+	// mbufs. See Controller::maybeSpliceAppResponseBody().
+	struct {
+		ev_io appWatcher;
+		ev_io clientWatcher;
+		int pipe[2];
+		unsigned int bytesInPipe;
+		// Set when we switched back to buffering, so that we don't
+		// start splicing again for the rest of this response.
+		bool disabled;
+	} splicing;
+
 	struct {
 		UnionStation::StopwatchLog *requestProcessing;
 		UnionStation::StopwatchLog *bufferingRequestBody;
@@ -104,6 +118,8 @@ public:
 	HashedStaticString cacheKey;
 	LString *cacheControl;
 	LString *varyCookie;
+	// A set of ResponseCache::AcceptedEncoding bits.
+	boost::uint8_t acceptedEncodings;
 	// Value of the `!~PASSENGER_ENV_VARS` header. This is different
 	// from `options.environmentVariables`. If `!~PASSENGER_ENV_VARS`
 	// is not set or is empty, then `envvars` is NULL, while
@@ -124,6 +140,10 @@ public:
 		: BaseHttpRequest()
 	{
 		memset(&stopwatchLogs, 0, sizeof(stopwatchLogs));
+		splicing.pipe[0] = -1;
+		splicing.pipe[1] = -1;
+		splicing.bytesInPipe = 0;
+		splicing.disabled = false;
 	}
 
 	const char *getStateString() const {
@@ -140,6 +160,8 @@ public:
 			return "FORWARDING_BODY_TO_APP";
 		case WAITING_FOR_APP_OUTPUT:
 			return "WAITING_FOR_APP_OUTPUT";
+		case WAITING_FOR_TURBOCACHE:
+			return "WAITING_FOR_TURBOCACHE";
 		default:
 			return "UNKNOWN";
 		}
@@ -169,7 +169,8 @@ Controller::sendHeaderToAppWithSessionProtocol(Client *client, Request *req) {
 
 	unsigned int bufferSize = determineHeaderSizeForSessionProtocol(req,
 		state, deltaMonotonic);
-	MemoryKit::mbuf_pool &mbuf_pool = getContext()->mbuf_pool;
+	MemoryKit::mbuf_pool &mbuf_pool = *MemoryKit::mbuf_pool_for_size(
+		&getContext()->mbuf_pool, bufferSize);
 	const unsigned int MBUF_MAX_SIZE = mbuf_pool_data_size(&mbuf_pool);
 	bool ok;
 
@@ -931,7 +932,8 @@ Controller::sendHeaderToAppWithHttpProtocolWithBuffering(Request *req,
 	assert(ok);
 	(void) ok; // Shut up compiler warning
 
-	MemoryKit::mbuf_pool &mbuf_pool = getContext()->mbuf_pool;
+	MemoryKit::mbuf_pool &mbuf_pool = *MemoryKit::mbuf_pool_for_size(
+		&getContext()->mbuf_pool, dataSize);
 	const unsigned int MBUF_MAX_SIZE = mbuf_pool_data_size(&mbuf_pool);
 	if (dataSize <= MBUF_MAX_SIZE) {
 		MemoryKit::mbuf buffer(MemoryKit::mbuf_get(&mbuf_pool));
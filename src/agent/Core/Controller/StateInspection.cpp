@@ -54,6 +54,22 @@ Controller::getThreadNumber() const {
 Json::Value
 Controller::inspectStateAsJson() const {
 	Json::Value doc = ParentClass::inspectStateAsJson();
+	Json::Value checkoutsDoc;
+	checkoutsDoc["on_event_loop_thread"] = (Json::UInt64) sessionCheckoutsOnEventLoopThread;
+	checkoutsDoc["from_another_thread"] = (Json::UInt64) sessionCheckoutsFromAnotherThread;
+	doc["session_checkouts"] = checkoutsDoc;
+	if (maxIdleSessionSlots > 0) {
+		Json::Value slotsDoc;
+		slotsDoc["max"] = maxIdleSessionSlots;
+		slotsDoc["idle"] = (Json::UInt) idleSessionSlots.size();
+		slotsDoc["hits"] = (Json::UInt64) idleSessionSlotHits;
+		slotsDoc["misses"] = (Json::UInt64) idleSessionSlotMisses;
+		slotsDoc["overflows"] = (Json::UInt64) idleSessionSlotOverflows;
+		doc["idle_session_slots"] = slotsDoc;
+	}
+	doc["spliced_response_bodies"] = (Json::UInt64) splicedResponseBodies;
+	doc["total_bytes_spliced"] = (Json::UInt64) totalBytesSpliced;
+	doc["splice_fallbacks"] = (Json::UInt64) spliceFallbacks;
 	if (turboCaching.isEnabled()) {
 		Json::Value subdoc;
 		subdoc["fetches"] = turboCaching.responseCache.getFetches();
@@ -62,6 +78,16 @@ Controller::inspectStateAsJson() const {
 		subdoc["stores"] = turboCaching.responseCache.getStores();
 		subdoc["store_successes"] = turboCaching.responseCache.getStoreSuccesses();
 		subdoc["store_success_ratio"] = turboCaching.responseCache.getStoreSuccessRatio();
+		subdoc["evictions"] = turboCaching.responseCache.getEvictions();
+		subdoc["entries"] = turboCaching.responseCache.getEntryCount();
+		subdoc["max_entries"] = turboCaching.responseCache.getMaxEntries();
+		subdoc["memory_usage"] = (Json::UInt64) turboCaching.responseCache.getMemoryUsage();
+		subdoc["max_memory"] = (Json::UInt64) turboCaching.responseCache.getMaxMemory();
+		subdoc["shared"] = turboCaching.responseCache.usesSharedStorage();
+		subdoc["serve_stale"] = turboCaching.responseCache.isStaleServingEnabled();
+		subdoc["revalidations"] = turboCaching.responseCache.getRevalidationCount();
+		subdoc["compression"] = turboCaching.responseCache.isCompressionEnabled();
+		subdoc["compressions"] = turboCaching.responseCache.getCompressions();
 		doc["turbocaching"] = subdoc;
 	}
 	return doc;
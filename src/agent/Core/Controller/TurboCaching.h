@@ -28,9 +28,13 @@
 
 #include <oxt/backtrace.hpp>
 #include <ev++.h>
+#include <sys/uio.h>
 #include <ctime>
 #include <cstddef>
 #include <cassert>
+#include <cerrno>
+#include <climits>
+#include <algorithm>
 #include <MemoryKit/mbuf.h>
 #include <ServerKit/Context.h>
 #include <Constants.h>
@@ -105,14 +109,14 @@ private:
 		prep.entry = &entry;
 		prep.now   = (time_t) ev_now(server->getLoop());
 
-		if (prep.now >= entry.header->date) {
-			prep.age = prep.now - entry.header->date;
+		if (prep.now >= entry.response->date) {
+			prep.age = prep.now - entry.response->date;
 		} else {
 			prep.age = 0;
 		}
 
 		prep.ageValueSize = integerSizeInOtherBase<time_t, 10>(prep.age);
-		prep.contentLengthStrSize = uintSizeAsString(entry.body->httpBodySize);
+		prep.contentLengthStrSize = uintSizeAsString(entry.response->httpBodySize);
 		prep.showVersionInHeader = req->config->showVersionInHeader;
 	}
 
@@ -136,16 +140,16 @@ private:
 		char *pos = output;
 		const char *end = output + outputSize;
 
-		result += entry->body->httpHeaderSize;
+		result += entry->response->httpHeaderSize;
 		if (output != NULL) {
-			pos = appendData(pos, end, entry->body->httpHeaderData,
-				entry->body->httpHeaderSize);
+			pos = appendData(pos, end, entry->response->getHttpHeaderData(),
+				entry->response->httpHeaderSize);
 		}
 
 		PUSH_STATIC_STRING("Content-Length: ");
 		result += prep.contentLengthStrSize;
 		if (output != NULL) {
-			uintToString(entry->body->httpBodySize, pos, end - pos);
+			uintToString(entry->response->httpBodySize, pos, end - pos);
 			pos += prep.contentLengthStrSize;
 		}
 		PUSH_STATIC_STRING("\r\n");
@@ -158,6 +162,10 @@ private:
 		}
 		PUSH_STATIC_STRING("\r\n");
 
+		if (entry->stale) {
+			PUSH_STATIC_STRING("Warning: 110 - \"Response is Stale\"\r\n");
+		}
+
 		if (prep.showVersionInHeader) {
 			PUSH_STATIC_STRING("X-Powered-By: " PROGRAM_NAME " " PASSENGER_VERSION "\r\n");
 		} else {
@@ -189,6 +197,65 @@ private:
 		#undef PUSH_STATIC_STRING
 	}
 
+	/**
+	 * Writes the header and the body mbufs of an entry with a single
+	 * writev(). Whatever the client socket doesn't accept right away is
+	 * passed to the client output channel by reference, not copied.
+	 * If the output channel still has data from a previous response, then
+	 * everything is passed to the output channel to preserve ordering.
+	 */
+	template<typename Server, typename Client>
+	void writeResponseWithBodyBuffers(Server *server, Client *client, Request *req,
+		const ResponsePreparation &prep, unsigned int headerSize)
+	{
+		const ResponseCacheStorage::StoredResponse *response = prep.entry->response;
+		const MemoryKit::mbuf *bodyBuffers = response->getHttpBodyBuffers();
+		MemoryKit::mbuf header(MemoryKit::mbuf_get_with_size(
+			&server->getContext()->mbuf_pool, headerSize));
+		buildResponseHeader(prep, server, header.start, headerSize);
+
+		unsigned int nbuffers = std::min<unsigned int>(
+			response->nHttpBodyBuffers + 1, IOV_MAX);
+		struct iovec *buffers = (struct iovec *) psg_palloc(req->pool,
+			sizeof(struct iovec) * nbuffers);
+		buffers[0].iov_base = header.start;
+		buffers[0].iov_len  = headerSize;
+		for (unsigned int i = 1; i < nbuffers; i++) {
+			buffers[i].iov_base = bodyBuffers[i - 1].start;
+			buffers[i].iov_len  = bodyBuffers[i - 1].size();
+		}
+
+		ssize_t ret = 0;
+		if (client->output.getTotalBytesBuffered() == 0) {
+			do {
+				ret = writev(client->getFd(), buffers, nbuffers);
+			} while (ret == -1 && errno == EINTR);
+		}
+		// Errors other than EAGAIN are reported by the output channel
+		// once it tries to write the rest.
+		size_t written = (ret > 0) ? ret : 0;
+		req->responseBegun = true;
+		req->lastDataSendTime = ev_now(server->getLoop());
+
+		if (written < headerSize) {
+			server->writeResponse(client, MemoryKit::mbuf(header, written,
+				headerSize - written));
+			written = 0;
+		} else {
+			written -= headerSize;
+		}
+		for (unsigned int i = 0; i < response->nHttpBodyBuffers; i++) {
+			size_t size = bodyBuffers[i].size();
+			if (written >= size) {
+				written -= size;
+			} else {
+				server->writeResponse(client, MemoryKit::mbuf(bodyBuffers[i],
+					written, size - written));
+				written = 0;
+			}
+		}
+	}
+
 public:
 	ResponseCache<Request> responseCache;
 
@@ -198,8 +265,23 @@ public:
 		  nextTimeout(0)
 		{ }
 
-	void initialize(bool initiallyEnabled) {
+	/**
+	 * If `sharedStorage` is given, then the response cache stores its
+	 * entries there instead of in a private storage of the given capacity.
+	 * `readerIndex` identifies this thread among the shared storage's readers.
+	 */
+	void initialize(bool initiallyEnabled,
+		unsigned int maxEntries = ResponseCacheStorage::DEFAULT_MAX_ENTRIES,
+		size_t maxMemory = ResponseCacheStorage::DEFAULT_MAX_MEMORY,
+		ResponseCacheStorage *sharedStorage = NULL,
+		unsigned int readerIndex = 0)
+	{
 		state = initiallyEnabled ? ENABLED : DISABLED;
+		if (sharedStorage != NULL) {
+			responseCache.useSharedStorage(sharedStorage, readerIndex);
+		} else {
+			responseCache.setCapacity(maxEntries, maxMemory);
+		}
 		lastTimeout = (ev_tstamp) time(NULL);
 		nextTimeout = (ev_tstamp) time(NULL) + ENABLED_TIMEOUT;
 	}
@@ -243,11 +325,16 @@ public:
 				state = TEMPORARILY_DISABLED;
 				nextTimeout = now + TEMPORARY_DISABLE_TIMEOUT;
 			} else {
-				P_DEBUG("Clearing turbocache");
 				nextTimeout = now + ENABLED_TIMEOUT;
 			}
 			responseCache.resetStatistics();
-			responseCache.clear();
+			// A private cache cannot see invalidations that happen on other
+			// threads, so we clear it periodically to bound staleness.
+			// A shared cache is invalidated directly by all threads.
+			if (!responseCache.usesSharedStorage()) {
+				P_DEBUG("Clearing turbocache");
+				responseCache.clear();
+			}
 			break;
 		case TEMPORARILY_DISABLED:
 			P_INFO("Re-enabling turbocaching");
@@ -264,30 +351,35 @@ public:
 
 	template<typename Server, typename Client>
 	void writeResponse(Server *server, Client *client, Request *req, ResponseCacheEntryType &entry) {
-		MemoryKit::mbuf_pool &mbuf_pool = server->getContext()->mbuf_pool;
-		const unsigned int MBUF_MAX_SIZE = mbuf_pool_data_size(&mbuf_pool);
 		ResponsePreparation prep;
 		unsigned int headerSize;
 
 		prepareResponseHeader(prep, server, req, entry);
 		headerSize = buildResponseHeader(prep, server, NULL, 0);
 
-		if (headerSize + entry.body->httpBodySize <= MBUF_MAX_SIZE) {
+		MemoryKit::mbuf_pool &mbuf_pool = *MemoryKit::mbuf_pool_for_size(
+			&server->getContext()->mbuf_pool,
+			headerSize + entry.response->httpBodySize);
+		const unsigned int MBUF_MAX_SIZE = mbuf_pool_data_size(&mbuf_pool);
+
+		if (entry.response->hasHttpBodyBuffers()) {
+			writeResponseWithBodyBuffers(server, client, req, prep, headerSize);
+		} else if (headerSize + entry.response->httpBodySize <= MBUF_MAX_SIZE) {
 			// Header and body fit inside a single mbuf
 			MemoryKit::mbuf buffer(MemoryKit::mbuf_get(&mbuf_pool));
-			buffer = MemoryKit::mbuf(buffer, 0, headerSize + entry.body->httpBodySize);
+			buffer = MemoryKit::mbuf(buffer, 0, headerSize + entry.response->httpBodySize);
 
 			buildResponseHeader(prep, server, buffer.start, buffer.size());
-			memcpy(buffer.start + headerSize, entry.body->httpBodyData, entry.body->httpBodySize);
+			memcpy(buffer.start + headerSize, entry.response->getHttpBodyData(), entry.response->httpBodySize);
 
 			server->writeResponse(client, buffer);
 		} else {
-			char *buffer = (char *) psg_pnalloc(req->pool, headerSize + entry.body->httpBodySize);
+			char *buffer = (char *) psg_pnalloc(req->pool, headerSize + entry.response->httpBodySize);
 			buildResponseHeader(prep, server, buffer,
-				headerSize + entry.body->httpBodySize);
-			memcpy(buffer + headerSize, entry.body->httpBodyData, entry.body->httpBodySize);
+				headerSize + entry.response->httpBodySize);
+			memcpy(buffer + headerSize, entry.response->getHttpBodyData(), entry.response->httpBodySize);
 
-			server->writeResponse(client, buffer, headerSize + entry.body->httpBodySize);
+			server->writeResponse(client, buffer, headerSize + entry.response->httpBodySize);
 		}
 	}
 };
@@ -29,6 +29,7 @@
 #endif
 #ifdef __linux__
 	#define SUPPORTS_PER_THREAD_CPU_AFFINITY
+	#define SUPPORTS_REUSE_PORT_LOAD_BALANCING
 	#include <sched.h>
 	#include <pthread.h>
 #endif
@@ -140,6 +141,16 @@ namespace Core {
 	struct WorkingObjects {
 		int serverFds[SERVER_KIT_MAX_SERVER_ENDPOINTS];
 		int apiServerFds[SERVER_KIT_MAX_SERVER_ENDPOINTS];
+		/**
+		 * When `controller_reuse_port` is enabled, every controller thread
+		 * except the first one gets its own SO_REUSEPORT listener for each
+		 * TCP address. `reusePortServerFds[i][j]` is the listener of thread
+		 * `j + 2` for `controller_addresses[i]`; the first thread uses
+		 * `serverFds[i]`. Empty for addresses that go through the
+		 * AcceptLoadBalancer.
+		 */
+		vector<int> reusePortServerFds[SERVER_KIT_MAX_SERVER_ENDPOINTS];
+		bool useLoadBalancer;
 		string controllerSecureHeadersPassword;
 
 		boost::mutex configSyncher;
@@ -153,6 +164,8 @@ namespace Core {
 		Json::Value singleAppModeConfig;
 
 		ServerKit::AcceptLoadBalancer<Controller> loadBalancer;
+		/** Shared by all controllers if `turbocache_shared` is enabled, NULL otherwise. */
+		boost::scoped_ptr<ResponseCacheStorage> sharedTurbocacheStorage;
 		vector<ThreadWorkingObjects> threadWorkingObjects;
 		struct ev_signal sigintWatcher;
 		struct ev_signal sigtermWatcher;
@@ -171,7 +184,8 @@ namespace Core {
 		oxt::thread *adminPanelConnectorThread;
 
 		WorkingObjects()
-			: exitEvent(__FILE__, __LINE__, "WorkingObjects: exitEvent"),
+			: useLoadBalancer(false),
+			  exitEvent(__FILE__, __LINE__, "WorkingObjects: exitEvent"),
 			  allClientsDisconnectedEvent(__FILE__, __LINE__, "WorkingObjects: allClientsDisconnectedEvent"),
 			  terminationCount(0),
 			  shutdownCounter(0),
@@ -406,15 +420,100 @@ makeFileWorldReadableAndWritable(const string &path) {
 	}
 #endif
 
+#ifdef SUPPORTS_PER_THREAD_CPU_AFFINITY
+	/**
+	 * Returns the number of CPUs that core threads can be assigned to
+	 * round-robin, or 0 if that's not possible because the CPU count is
+	 * unknown or doesn't fit in a cpu_set_t.
+	 */
+	static unsigned int
+	getAssignableCpuCount() {
+		unsigned int maxCpus = boost::thread::hardware_concurrency();
+		if (maxCpus > CPU_SETSIZE) {
+			return 0;
+		} else {
+			return maxCpus;
+		}
+	}
+#endif
+
+#if defined(SUPPORTS_PER_THREAD_CPU_AFFINITY) && defined(SO_INCOMING_CPU)
+	static void
+	setIncomingCpu(int fd, unsigned int threadIndex) {
+		unsigned int maxCpus = getAssignableCpuCount();
+		if (maxCpus == 0) {
+			return;
+		}
+
+		int cpu = threadIndex % maxCpus;
+		if (syscalls::setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU,
+			&cpu, sizeof(cpu)) == -1)
+		{
+			int e = errno;
+			P_WARN("Cannot set SO_INCOMING_CPU on the listener of core thread "
+				<< (threadIndex + 1) << ": " << strerror(e) << " (errno=" << e << ")");
+		}
+	}
+#endif
+
+static int
+createControllerServer(const string &address, unsigned int backlog, bool reusePort) {
+	if (reusePort) {
+		string host;
+		unsigned short port;
+
+		parseTcpSocketAddress(address, host, port);
+		return createReusePortTcpServer(host.c_str(), port, backlog,
+			__FILE__, __LINE__);
+	} else {
+		return createServer(address, backlog, true, __FILE__, __LINE__);
+	}
+}
+
+#ifdef SUPPORTS_REUSE_PORT_LOAD_BALANCING
+	/**
+	 * Whether the controller threads should each accept clients on
+	 * their own SO_REUSEPORT listener for the given address, instead of
+	 * going through the AcceptLoadBalancer.
+	 */
+	static bool
+	shouldReusePort(const string &address) {
+		if (coreConfig->get("controller_threads").asUInt() == 1
+		 || !coreConfig->get("controller_reuse_port").asBool()
+		 || getSocketAddressType(address) != SAT_TCP)
+		{
+			return false;
+		}
+
+		string host;
+		unsigned short port;
+		parseTcpSocketAddress(address, host, port);
+		// With port 0 every socket would be bound to a different random port.
+		return port != 0;
+	}
+#endif
+
 static void
 startListening() {
 	TRACE_POINT();
 	WorkingObjects *wo = workingObjects;
 	const Json::Value addresses = coreConfig->get("controller_addresses");
 	const Json::Value apiAddresses = coreConfig->get("api_server_addresses");
+	unsigned int nthreads = coreConfig->get("controller_threads").asUInt();
+	unsigned int backlog = coreConfig->get("controller_socket_backlog").asUInt();
 	Json::Value::const_iterator it;
 	unsigned int i;
 
+	#ifndef SUPPORTS_REUSE_PORT_LOAD_BALANCING
+		if (coreConfig->get("controller_reuse_port").asBool()) {
+			P_WARN("SO_REUSEPORT load balancing is not supported on this platform. "
+				"Falling back to a single accept thread.");
+		}
+	#endif
+	#if defined(SUPPORTS_PER_THREAD_CPU_AFFINITY) && defined(SO_INCOMING_CPU)
+		bool cpuAffine = coreConfig->get("controller_cpu_affine").asBool();
+	#endif
+
 	#ifdef USE_SELINUX
 		// Set SELinux context on the first socket that we create
 		// so that the web server can access it.
@@ -422,9 +521,13 @@ startListening() {
 	#endif
 
 	for (it = addresses.begin(), i = 0; it != addresses.end(); it++, i++) {
-		wo->serverFds[i] = createServer(it->asString(),
-			coreConfig->get("controller_socket_backlog").asUInt(), true,
-			__FILE__, __LINE__);
+		#ifdef SUPPORTS_REUSE_PORT_LOAD_BALANCING
+			bool reusePort = shouldReusePort(it->asString());
+		#else
+			bool reusePort = false;
+		#endif
+
+		wo->serverFds[i] = createControllerServer(it->asString(), backlog, reusePort);
 		#ifdef USE_SELINUX
 			resetSelinuxSocketContext();
 			if (i == 0 && getSocketAddressType(it->asString()) == SAT_UNIX) {
@@ -440,6 +543,24 @@ startListening() {
 		if (getSocketAddressType(it->asString()) == SAT_UNIX) {
 			makeFileWorldReadableAndWritable(parseUnixSocketAddress(it->asString()));
 		}
+
+		if (reusePort) {
+			wo->reusePortServerFds[i].reserve(nthreads - 1);
+			for (unsigned int j = 1; j < nthreads; j++) {
+				int fd = createControllerServer(it->asString(), backlog, true);
+				wo->reusePortServerFds[i].push_back(fd);
+				P_LOG_FILE_DESCRIPTOR_PURPOSE(fd,
+					"Server address: " << it->asString() << " (thread " << (j + 1) << ")");
+			}
+			#if defined(SUPPORTS_PER_THREAD_CPU_AFFINITY) && defined(SO_INCOMING_CPU)
+				if (cpuAffine) {
+					setIncomingCpu(wo->serverFds[i], 0);
+					for (unsigned int j = 1; j < nthreads; j++) {
+						setIncomingCpu(wo->reusePortServerFds[i][j - 1], j);
+					}
+				}
+			#endif
+		}
 	}
 	for (it = apiAddresses.begin(), i = 0; it != apiAddresses.end(); it++, i++) {
 		wo->apiServerFds[i] = createServer(it->asString(), 0, true,
@@ -497,7 +618,13 @@ inspectControllerConfigAsJson(Controller *controller, string *result) {
 
 static void
 getMbufStats(struct MemoryKit::mbuf_pool *input, struct MemoryKit::mbuf_pool *result) {
-	*result = *input;
+	// Copy the statistics only: the pool itself is not copyable.
+	result->nfree_mbuf_blockq = input->nfree_mbuf_blockq;
+	result->nactive_mbuf_blockq = input->nactive_mbuf_blockq;
+	result->mbuf_block_chunk_size = input->mbuf_block_chunk_size;
+	result->nhits = input->nhits;
+	result->nmisses = input->nmisses;
+	result->nremote_frees = input->nremote_frees;
 }
 
 static void
@@ -543,6 +670,9 @@ printInfoInThread() {
 	cerr << "nfree_mbuf_blockq    : " << stats.nfree_mbuf_blockq << "\n";
 	cerr << "nactive_mbuf_blockq  : " << stats.nactive_mbuf_blockq << "\n";
 	cerr << "mbuf_block_chunk_size: " << stats.mbuf_block_chunk_size << "\n";
+	cerr << "nhits                : " << stats.nhits << "\n";
+	cerr << "nmisses              : " << stats.nmisses << "\n";
+	cerr << "nremote_frees        : " << stats.nremote_frees << "\n";
 	cerr << "\n";
 	cerr.flush();
 
@@ -691,6 +821,16 @@ initializeNonPrivilegedWorkingObjects() {
 	UPDATE_TRACE_POINT();
 	unsigned int nthreads = coreConfig->get("controller_threads").asUInt();
 	BackgroundEventLoop *firstLoop = NULL; // Avoid compiler warning
+	if (nthreads > 1
+	 && coreConfig->get("turbocaching").asBool()
+	 && coreConfig->get("turbocache_shared").asBool())
+	{
+		P_DEBUG("Sharing a single turbocache between " << nthreads << " controller threads");
+		wo->sharedTurbocacheStorage.reset(new ResponseCacheStorage(
+			coreConfig->get("turbocache_max_entries").asUInt(),
+			coreConfig->get("turbocache_max_memory").asUInt(),
+			nthreads));
+	}
 	wo->threadWorkingObjects.reserve(nthreads);
 	for (unsigned int i = 0; i < nthreads; i++) {
 		UPDATE_TRACE_POINT();
@@ -728,6 +868,7 @@ initializeNonPrivilegedWorkingObjects() {
 		two.controller->resourceLocator = &wo->resourceLocator;
 		two.controller->appPool = wo->appPool;
 		two.controller->unionStationContext = wo->unionStationContext;
+		two.controller->sharedTurbocacheStorage = wo->sharedTurbocacheStorage.get();
 		two.controller->shutdownFinishCallback = controllerShutdownFinished;
 		two.controller->initialize();
 		wo->shutdownCounter.fetch_add(1, boost::memory_order_relaxed);
@@ -788,20 +929,35 @@ initializeNonPrivilegedWorkingObjects() {
 		if (nthreads == 1) {
 			ThreadWorkingObjects *two = &wo->threadWorkingObjects[0];
 			two->controller->listen(wo->serverFds[i]);
+		} else if (!wo->reusePortServerFds[i].empty()) {
+			// Every thread accepts from its own SO_REUSEPORT listener,
+			// and the kernel distributes clients over them.
+			wo->threadWorkingObjects[0].controller->listen(wo->serverFds[i]);
+			for (unsigned int j = 1; j < nthreads; j++) {
+				ThreadWorkingObjects *two = &wo->threadWorkingObjects[j];
+				two->controller->listen(wo->reusePortServerFds[i][j - 1]);
+			}
 		} else {
 			wo->loadBalancer.listen(wo->serverFds[i]);
+			wo->useLoadBalancer = true;
 		}
 	}
 	for (unsigned int i = 0; i < nthreads; i++) {
 		ThreadWorkingObjects *two = &wo->threadWorkingObjects[i];
 		two->controller->createSpareClients();
 	}
-	if (nthreads > 1) {
+	if (wo->useLoadBalancer) {
 		wo->loadBalancer.servers.reserve(nthreads);
 		for (unsigned int i = 0; i < nthreads; i++) {
 			ThreadWorkingObjects *two = &wo->threadWorkingObjects[i];
 			wo->loadBalancer.servers.push_back(two->controller);
 		}
+		ServerKit::parseAcceptLoadBalancingPolicy(
+			coreConfig->get("controller_accept_load_balancing_policy").asString(),
+			wo->loadBalancer.policy);
+		if (wo->apiWorkingObjects.apiServer != NULL) {
+			wo->apiWorkingObjects.apiServer->acceptLoadBalancer = &wo->loadBalancer;
+		}
 	}
 	for (unsigned int i = 0; i < apiAddresses.size(); i++) {
 		wo->apiWorkingObjects.apiServer->listen(wo->apiServerFds[i]);
@@ -1010,14 +1166,19 @@ reportInitializationInfo() {
 	}
 }
 
+static void
+bindMbufPoolToCurrentThread(ThreadWorkingObjects *two, bool numaLocal) {
+	two->serverKitContext->bindMbufPoolsToCurrentThread(numaLocal);
+}
+
 static void
 mainLoop() {
 	TRACE_POINT();
 	WorkingObjects *wo = workingObjects;
 	#ifdef SUPPORTS_PER_THREAD_CPU_AFFINITY
-		unsigned int maxCpus = boost::thread::hardware_concurrency();
+		unsigned int maxCpus = getAssignableCpuCount();
 		bool cpuAffine = coreConfig->get("controller_cpu_affine").asBool()
-			&& maxCpus <= CPU_SETSIZE;
+			&& maxCpus > 0;
 	#endif
 
 	Agent::Fundamentals::context->abortHandlerConfig.diagnosticsDumper = dumpDiagnosticsOnCrash;
@@ -1042,12 +1203,17 @@ mainLoop() {
 						<< ": " << strerror(result) << " (errno=" << result << ")");
 				}
 			}
+			two->bgloop->safe->runLater(boost::bind(bindMbufPoolToCurrentThread,
+				two, cpuAffine));
+		#else
+			two->bgloop->safe->runLater(boost::bind(bindMbufPoolToCurrentThread,
+				two, false));
 		#endif
 	}
 	if (wo->apiWorkingObjects.apiServer != NULL) {
 		wo->apiWorkingObjects.bgloop->start("API event loop", 0);
 	}
-	if (wo->threadWorkingObjects.size() > 1) {
+	if (wo->useLoadBalancer) {
 		wo->loadBalancer.start();
 	}
 	waitForExitEvent();
@@ -1158,7 +1324,7 @@ waitForExitEvent() {
 			ThreadWorkingObjects *two = &wo->threadWorkingObjects[i];
 			two->bgloop->safe->runLater(boost::bind(shutdownController, two));
 		}
-		if (wo->threadWorkingObjects.size() > 1) {
+		if (wo->useLoadBalancer) {
 			wo->loadBalancer.shutdown();
 		}
 		if (wo->apiWorkingObjects.apiServer != NULL) {
@@ -1220,6 +1386,9 @@ cleanup() {
 		if (wo->apiServerFds[i] != -1) {
 			close(wo->apiServerFds[i]);
 		}
+		for (unsigned int j = 0; j < wo->reusePortServerFds[i].size(); j++) {
+			close(wo->reusePortServerFds[i][j]);
+		}
 	}
 	deletePidFile();
 	delete workingObjects;
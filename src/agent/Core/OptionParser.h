@@ -27,6 +27,8 @@
 #define _PASSENGER_CORE_OPTION_PARSER_H_
 
 #include <boost/thread.hpp>
+#include <cerrno>
+#include <climits>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -169,6 +171,36 @@ coreUsage() {
 	printf("                            Vary the turbocache by the cookie of the given name\n");
 	printf("      --disable-turbocaching\n");
 	printf("                            Disable turbocaching\n");
+	printf("      --turbocache-max-entries NUMBER\n");
+	printf("                            Maximum number of responses in the turbocache of\n");
+	printf("                            each thread. Default: 1024\n");
+	printf("      --turbocache-max-memory BYTES\n");
+	printf("                            Maximum amount of memory used by the turbocache\n");
+	printf("                            of each thread. Default: 16777216\n");
+	printf("      --turbocache-shared   Share a single turbocache between all controller\n");
+	printf("                            threads. The limits above then apply to the\n");
+	printf("                            shared cache\n");
+	printf("      --disable-turbocache-stale-serving\n");
+	printf("                            Do not serve expired turbocache entries within\n");
+	printf("                            their stale-while-revalidate and stale-if-error\n");
+	printf("                            windows\n");
+	printf("      --turbocache-compression\n");
+	printf("                            Store uncompressed turbocacheable responses\n");
+	printf("                            gzipped for clients that accept gzip\n");
+	printf("      --response-splice-threshold BYTES\n");
+	printf("                            Forward app response bodies of at least this\n");
+	printf("                            size with splice() instead of through userspace\n");
+	printf("                            buffers (Linux only). 0 disables. Default: 262144\n");
+	printf("      --thread-session-slots NUMBER\n");
+	printf("                            Number of finished application sessions that\n");
+	printf("                            each controller thread may keep for reuse by\n");
+	printf("                            later requests. 0 disables. Default: 0\n");
+	printf("      --thread-session-slot-max-reuses NUMBER\n");
+	printf("                            Close a kept session after it has been reused\n");
+	printf("                            this many times. Default: 100\n");
+	printf("      --thread-session-slot-idle-time MSEC\n");
+	printf("                            Close a kept session if no request reused it\n");
+	printf("                            within this time. Default: 10\n");
 	printf("      --no-abort-websockets-on-process-shutdown\n");
 	printf("                            Do not abort WebSocket connections on process\n");
 	printf("                            shutdown or restart\n");
@@ -186,6 +218,33 @@ coreUsage() {
 	printf("      --data-buffer-dir PATH\n");
 	printf("                            Directory to store data buffers in. Default:\n");
 	printf("                            %s\n", getSystemTempDir());
+	printf("      --data-buffer-io-uring\n");
+	printf("                            Use io_uring instead of a thread pool for\n");
+	printf("                            data buffer file I/O, if the kernel supports it\n");
+	printf("      --data-buffer-file-pool-size NUMBER\n");
+	printf("                            Number of anonymous data buffer files to\n");
+	printf("                            preallocate and reuse per thread (Linux only).\n");
+	printf("                            Default: 0\n");
+	printf("      --data-buffer-memory-budget BYTES\n");
+	printf("                            Let each thread buffer up to this many bytes in\n");
+	printf("                            memory in total before buffering data to disk.\n");
+	printf("                            0 means that each buffer is limited to 128 KB.\n");
+	printf("                            At most 2147483647.\n");
+	printf("                            Default: 0\n");
+	printf("      --readv-buffers NUMBER\n");
+	printf("                            Read from client and application sockets into\n");
+	printf("                            up to this many buffers (max 8) per system call.\n");
+	printf("                            Default: 1\n");
+	printf("      --mbuf-slab-size BYTES\n");
+	printf("                            Allocate memory buffers in slabs of this size\n");
+	printf("                            instead of one by one. Default: 0 (disabled)\n");
+	printf("      --mbuf-huge-pages     Back memory buffer slabs with huge pages where\n");
+	printf("                            possible. Default slab size: 2 MB\n");
+	printf("      --mbuf-size-classes   Allocate memory buffers in several sizes, picked\n");
+	printf("                            by the expected amount of data\n");
+	printf("      --pipelined-requests-limit NUMBER\n");
+	printf("                            Parse up to this many pipelined requests ahead\n");
+	printf("                            of the one being handled. Default: 0 (disabled)\n");
 	printf("      --no-graceful-exit    When exiting, exit immediately instead of waiting\n");
 	printf("                            for all connections to terminate\n");
 	printf("      --benchmark MODE      Enable benchmark mode. Available modes:\n");
@@ -198,6 +257,14 @@ coreUsage() {
 	printf("                            Default: number of CPU cores (%d)\n",
 		boost::thread::hardware_concurrency());
 	printf("      --cpu-affine          Enable per-thread CPU affinity (Linux only)\n");
+	printf("      --reuse-port          Give every thread its own SO_REUSEPORT listener\n");
+	printf("                            on TCP addresses instead of distributing\n");
+	printf("                            clients from a single accept thread\n");
+	printf("                            (Linux only)\n");
+	printf("      --accept-load-balancing-policy NAME\n");
+	printf("                            How accepted clients are distributed over\n");
+	printf("                            threads: round_robin, least_active_clients or\n");
+	printf("                            power_of_two_choices. Default: round_robin\n");
 	printf("      --core-file-descriptor-ulimit NUMBER\n");
 	printf("                            Set custom file descriptor ulimit for the core\n");
 	printf("      --admin-panel-url URL\n");
@@ -339,6 +406,33 @@ parseCoreOption(int argc, const char *argv[], int &i, Json::Value &updates) {
 	} else if (p.isFlag(argv[i], '\0', "--disable-turbocaching")) {
 		updates["turbocaching"] = false;
 		i++;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--turbocache-max-entries")) {
+		updates["turbocache_max_entries"] = atoi(argv[i + 1]);
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--turbocache-max-memory")) {
+		updates["turbocache_max_memory"] = atoi(argv[i + 1]);
+		i += 2;
+	} else if (p.isFlag(argv[i], '\0', "--turbocache-shared")) {
+		updates["turbocache_shared"] = true;
+		i++;
+	} else if (p.isFlag(argv[i], '\0', "--disable-turbocache-stale-serving")) {
+		updates["turbocache_serve_stale"] = false;
+		i++;
+	} else if (p.isFlag(argv[i], '\0', "--turbocache-compression")) {
+		updates["turbocache_compression"] = true;
+		i++;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--response-splice-threshold")) {
+		updates["response_splice_threshold"] = atoi(argv[i + 1]);
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--thread-session-slots")) {
+		updates["thread_session_slots"] = atoi(argv[i + 1]);
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--thread-session-slot-max-reuses")) {
+		updates["thread_session_slot_max_reuses"] = atoi(argv[i + 1]);
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--thread-session-slot-idle-time")) {
+		updates["thread_session_slot_idle_time"] = atoi(argv[i + 1]);
+		i += 2;
 	} else if (p.isFlag(argv[i], '\0', "--no-abort-websockets-on-process-shutdown")) {
 		updates["default_abort_websockets_on_process_shutdown"] = false;
 		i++;
@@ -375,6 +469,46 @@ parseCoreOption(int argc, const char *argv[], int &i, Json::Value &updates) {
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--data-buffer-dir")) {
 		updates["controller_file_buffered_channel_buffer_dir"] = atoi(argv[i + 1]);
 		i += 2;
+	} else if (p.isFlag(argv[i], '\0', "--data-buffer-io-uring")) {
+		updates["controller_file_buffered_channel_io_uring"] = true;
+		i++;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--data-buffer-file-pool-size")) {
+		updates["controller_file_buffered_channel_buffer_file_pool_size"] = atoi(argv[i + 1]);
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--data-buffer-memory-budget")) {
+		// The configuration schema doesn't accept unsigned
+		// integers that don't fit in a signed int.
+		const char *value = argv[i + 1];
+		char *end;
+		unsigned long long budget;
+
+		errno = 0;
+		budget = strtoull(value, &end, 10);
+		if (*value == '\0' || strchr(value, '-') != NULL || *end != '\0'
+		 || errno == ERANGE || budget > (unsigned long long) INT_MAX)
+		{
+			fprintf(stderr, "ERROR: invalid value for --data-buffer-memory-budget: %s. "
+				"It must be a number of bytes between 0 and %d.\n",
+				value, INT_MAX);
+			exit(1);
+		}
+		updates["controller_file_buffered_channel_memory_budget"] = (Json::UInt) budget;
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--readv-buffers")) {
+		updates["controller_fd_source_channel_readv_buffers"] = atoi(argv[i + 1]);
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--mbuf-slab-size")) {
+		updates["controller_mbuf_block_slab_size"] = atoi(argv[i + 1]);
+		i += 2;
+	} else if (p.isFlag(argv[i], '\0', "--mbuf-huge-pages")) {
+		updates["controller_mbuf_block_huge_pages"] = true;
+		i++;
+	} else if (p.isFlag(argv[i], '\0', "--mbuf-size-classes")) {
+		updates["controller_mbuf_block_size_classes"] = true;
+		i++;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--pipelined-requests-limit")) {
+		updates["controller_pipelined_requests_limit"] = atoi(argv[i + 1]);
+		i += 2;
 	} else if (p.isFlag(argv[i], '\0', "--no-graceful-exit")) {
 		updates["graceful_exit"] = false;
 		i++;
@@ -390,6 +524,12 @@ parseCoreOption(int argc, const char *argv[], int &i, Json::Value &updates) {
 	} else if (p.isFlag(argv[i], '\0', "--cpu-affine")) {
 		updates["controller_cpu_affine"] = true;
 		i++;
+	} else if (p.isFlag(argv[i], '\0', "--reuse-port")) {
+		updates["controller_reuse_port"] = true;
+		i++;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--accept-load-balancing-policy")) {
+		updates["controller_accept_load_balancing_policy"] = argv[i + 1];
+		i += 2;
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--core-file-descriptor-ulimit")) {
 		updates["file_descriptor_ulimit"] = atoi(argv[i + 1]);
 		i += 2;
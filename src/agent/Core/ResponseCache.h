@@ -27,89 +27,97 @@
 #define _PASSENGER_RESPONSE_CACHE_H_
 
 #include <boost/cstdint.hpp>
+#include <oxt/macros.hpp>
 #include <time.h>
+#include <zlib.h>
 #include <cassert>
 #include <cstring>
+#include <algorithm>
+#include <vector>
 #include <DataStructures/HashedStaticString.h>
 #include <ServerKit/http_parser.h>
 #include <ServerKit/CookieUtils.h>
 #include <StaticString.h>
 #include <Utils/DateParsing.h>
 #include <Utils/StrIntUtils.h>
+#include <Core/ResponseCacheStorage.h>
 
 namespace Passenger {
 
 /**
+ * A per-thread HTTP response cache, used by turbocaching. This class decides
+ * which requests and responses are cacheable and keeps per-thread statistics.
+ * The entries themselves live in a ResponseCacheStorage, which is either
+ * private to this cache or shared with the caches of other threads (see
+ * `useSharedStorage()`).
+ *
+ * Each entry is a single heap allocation that holds the key, the HTTP header
+ * data and the dechunked HTTP body data, so bodies can have any size up to
+ * getMaxBodySize().
+ *
+ * When a GET request finds an expired entry, it becomes the leader of a
+ * revalidation: it goes to the application, while other requests for the
+ * same key on this thread either wait for it (see `waitForRevalidation()`)
+ * or, within the entry's stale-while-revalidate window, are served the
+ * stale entry. If the leader fails, it may be served the stale entry
+ * within the entry's stale-if-error window.
+ *
+ * Responses are cached separately for each set of content codings that the
+ * request accepts (see `AcceptedEncoding`), so responses with
+ * `Vary: Accept-Encoding` are cacheable. If compression is enabled, then an
+ * uncompressed response to a request that accepts gzip is stored gzipped,
+ * so that later requests are served the compressed variant.
+ *
  * Relevant RFCs:
+ * https://tools.ietf.org/html/rfc7231    HTTP 1.1 Semantics and Content
  * https://tools.ietf.org/html/rfc7234    HTTP 1.1 Caching
+ * https://tools.ietf.org/html/rfc5861    HTTP Cache-Control Extensions for Stale Content
  * https://tools.ietf.org/html/rfc2109    HTTP State Management Mechanism
  */
 template<typename Request>
 class ResponseCache {
 public:
-	static const unsigned int MAX_ENTRIES     = 8; // Fits in exactly 2 cache lines
 	static const unsigned int MAX_KEY_LENGTH  = 256;
 	static const unsigned int MAX_HEADER_SIZE = 4096;
-	static const unsigned int MAX_BODY_SIZE   = 1024 * 32;
 	static const unsigned int DEFAULT_HEURISTIC_FRESHNESS = 10;
 	static const unsigned int MIN_HEURISTIC_FRESHNESS = 1;
+	static const unsigned int MIN_COMPRESSIBLE_BODY_SIZE = 256;
 
-	struct Header {
-		bool valid;
-		unsigned short keySize;
-		boost::uint32_t hash;
-		time_t date;
-
-		Header()
-			: valid(false),
-			  keySize(0),
-			  hash(0),
-			  date(0)
-			{ }
+	/**
+	 * Bits in `Request::acceptedEncodings`. Only content codings that
+	 * applications commonly produce are distinguished.
+	 */
+	enum AcceptedEncoding {
+		ACCEPTS_GZIP = 1,
+		ACCEPTS_BROTLI = 2,
+		ACCEPTED_ENCODINGS_MAX = ACCEPTS_GZIP | ACCEPTS_BROTLI
 	};
 
-	struct Body {
-		unsigned short httpHeaderSize;
-		unsigned short httpBodySize;
-		time_t expiryDate;
-		char key[MAX_KEY_LENGTH];
-		char httpHeaderData[MAX_HEADER_SIZE];
-		// This data is dechunked.
-		char httpBodyData[MAX_BODY_SIZE];
-
-		Body()
-			: httpHeaderSize(0),
-			  httpBodySize(0),
-			  expiryDate(0)
-		{
-			key[0] = httpHeaderData[0] = httpBodyData[0] = '\0';
-		}
-	};
+	typedef ResponseCacheStorage::StoredResponse StoredResponse;
 
 	struct Entry {
-		unsigned int index;
-		Header *header;
-		Body *body;
+		StoredResponse *response;
 		enum {
 			NOT_FOUND,
-			NOT_FRESH
+			NOT_FRESH,
+			REVALIDATING
 		} cacheMissReason;
+		/** Whether the response has expired and is served anyway. */
+		bool stale;
 
 		Entry()
-			: index(0),
-			  header(NULL),
-			  body(NULL)
+			: response(NULL),
+			  stale(false)
 			{ }
 
-		Entry(unsigned int i, Header *h, Body *b)
-			: index(i),
-			  header(h),
-			  body(b)
+		Entry(StoredResponse *r)
+			: response(r),
+			  stale(false)
 			{ }
 
 		OXT_FORCE_INLINE
 		bool valid() const {
-			return header != NULL;
+			return response != NULL;
 		}
 
 		const char *getCacheMissReasonString() const {
@@ -118,18 +126,62 @@ public:
 				return "NOT_FOUND";
 			case NOT_FRESH:
 				return "NOT_FRESH";
+			case REVALIDATING:
+				return "REVALIDATING";
 			default:
 				return "UNKNOWN";
 			}
 		}
 	};
 
+	/**
+	 * While a ReadGuard exists, entries returned by `fetch()` stay valid
+	 * even if another thread removes them from a shared storage.
+	 */
+	class ReadGuard {
+	private:
+		ResponseCache *cache;
+
+	public:
+		ReadGuard(ResponseCache &_cache)
+			: cache(&_cache)
+		{
+			cache->storage->beginRead(cache->readerIndex);
+		}
+
+		~ReadGuard() {
+			release();
+		}
+
+		void release() {
+			if (cache != NULL) {
+				cache->storage->endRead(cache->readerIndex);
+				cache = NULL;
+			}
+		}
+	};
+
 private:
+	/**
+	 * A request that is fetching a new version of an expired entry
+	 * from the application.
+	 */
+	struct Revalidation {
+		// Points to the leader's cache key, which lives in its pool.
+		HashedStaticString key;
+		Request *leader;
+		std::vector<Request *> waiters;
+	};
+
 	HashedStaticString HOST;
 	HashedStaticString CACHE_CONTROL;
 	HashedStaticString PRAGMA_CONST;
 	HashedStaticString AUTHORIZATION;
 	HashedStaticString VARY;
+	HashedStaticString ACCEPT_ENCODING;
+	HashedStaticString CONTENT_ENCODING;
+	HashedStaticString CONTENT_TYPE;
+	HashedStaticString ETAG;
 	HashedStaticString WWW_AUTHENTICATE;
 	HashedStaticString X_SENDFILE;
 	HashedStaticString X_ACCEL_REDIRECT;
@@ -140,10 +192,19 @@ private:
 	HashedStaticString COOKIE;
 	HashedStaticString PASSENGER_VARY_TURBOCACHE_BY_COOKIE;
 
-	unsigned int fetches, hits, stores, storeSuccesses;
+	unsigned int fetches, hits, stores, storeSuccesses, compressions;
 
-	Header headers[MAX_ENTRIES];
-	Body bodies[MAX_ENTRIES];
+	ResponseCacheStorage privateStorage;
+	ResponseCacheStorage *storage;
+	unsigned int readerIndex;
+
+	std::vector<Revalidation> revalidations;
+	bool staleServingEnabled;
+	bool compressionEnabled;
+
+	// Non-copyable.
+	ResponseCache(const ResponseCache &);
+	ResponseCache &operator=(const ResponseCache &);
 
 	unsigned int calculateKeyLength(const LString * restrict host,
 		const LString * restrict varyCookie,
@@ -151,6 +212,7 @@ private:
 	{
 		unsigned int size =
 			1  // protocol flag
+			+ 1  // accepted encodings flag
 			+ ((host != NULL) ? host->size : 0)
 			+ 1  // '\n'
 			+ path.size()
@@ -162,7 +224,8 @@ private:
 		}
 	}
 
-	void generateKey(bool https, const StaticString &path,
+	void generateKey(bool https, unsigned int acceptedEncodings,
+		const StaticString &path,
 		const LString * restrict host,
 		const LString * restrict varyCookie,
 		char * restrict output,
@@ -178,6 +241,9 @@ private:
 			pos = appendData(pos, end, "H", 1);
 		}
 
+		char encodingsFlag = (char) ('0' + acceptedEncodings);
+		pos = appendData(pos, end, &encodingsFlag, 1);
+
 		if (host != NULL) {
 			part = host->start;
 			while (part != NULL) {
@@ -216,37 +282,6 @@ private:
 		}
 	}
 
-	Entry lookup(const HashedStaticString &cacheKey) {
-		for (unsigned int i = 0; i < MAX_ENTRIES; i++) {
-			if (headers[i].valid
-			 && headers[i].hash == cacheKey.hash()
-			 && cacheKey == StaticString(bodies[i].key, headers[i].keySize))
-			{
-				return Entry(i, &headers[i], &bodies[i]);
-			}
-		}
-		return Entry();
-	}
-
-	Entry lookupInvalidOrOldest() {
-		int oldest = -1;
-
-		for (unsigned int i = 0; i < MAX_ENTRIES; i++) {
-			if (!headers[i].valid) {
-				return Entry(i, &headers[i], &bodies[i]);
-			} else if (oldest == -1 || headers[i].date < headers[oldest].date) {
-				oldest = i;
-			}
-		}
-
-		return Entry(oldest, &headers[oldest], &bodies[oldest]);
-	}
-
-	OXT_FORCE_INLINE
-	void erase(unsigned int index) {
-		headers[index].valid = false;
-	}
-
 	time_t parseDate(psg_pool_t *pool, const LString *date, ev_tstamp now) const {
 		if (date == NULL || date->size == 0) {
 			return (time_t) now;
@@ -313,8 +348,352 @@ private:
 		return now + DEFAULT_HEURISTIC_FRESHNESS;
 	}
 
-	bool isFresh(const Entry &entry, ev_tstamp now) const {
-		return entry.body->expiryDate > now;
+	bool isFresh(const StoredResponse *response, ev_tstamp now) const {
+		return response->expiryDate > now;
+	}
+
+	/**
+	 * Returns the value of a `name=delta-seconds` Cache-Control directive,
+	 * or 0 if it is absent or invalid.
+	 */
+	unsigned int parseDeltaSecondsDirective(const StaticString &cacheControl,
+		const StaticString &name) const
+	{
+		string::size_type pos = cacheControl.find(name);
+		if (pos == string::npos
+		 || cacheControl.size() <= pos + name.size() + 1
+		 || cacheControl[pos + name.size()] != '=')
+		{
+			return 0;
+		}
+		return stringToUint(cacheControl.substr(pos + name.size() + 1));
+	}
+
+	static StaticString trimWhitespace(const StaticString &str) {
+		const char *pos = str.data();
+		const char *end = str.data() + str.size();
+		while (pos < end && (*pos == ' ' || *pos == '\t')) {
+			pos++;
+		}
+		while (end > pos && (end[-1] == ' ' || end[-1] == '\t')) {
+			end--;
+		}
+		return StaticString(pos, end - pos);
+	}
+
+	// Returns a lowercase, contiguous copy of the given header value.
+	static StaticString lowercaseHeaderValue(psg_pool_t *pool, const LString *value) {
+		value = psg_lstr_make_contiguous(value, pool);
+		char *data = (char *) psg_pnalloc(pool, value->size);
+		convertLowerCase((const unsigned char *) value->start->data,
+			(unsigned char *) data, value->size);
+		return StaticString(data, value->size);
+	}
+
+	/**
+	 * Parses an Accept-Encoding header into a set of AcceptedEncoding bits.
+	 * Codings with a q-value of 0 are not acceptable.
+	 */
+	static unsigned int parseAcceptedEncodings(psg_pool_t *pool, const LString *value) {
+		if (value == NULL || value->size == 0) {
+			return 0;
+		}
+
+		StaticString header = lowercaseHeaderValue(pool, value);
+		string::size_type start = 0;
+		unsigned int result = 0;
+
+		while (start < header.size()) {
+			string::size_type end = header.find(',', start);
+			if (end == string::npos) {
+				end = header.size();
+			}
+
+			StaticString element = header.substr(start, end - start);
+			string::size_type paramsStart = element.find(';');
+			StaticString coding = trimWhitespace(element.substr(0, paramsStart));
+			if (paramsStart == string::npos
+			 || !qValueIsZero(element.substr(paramsStart + 1)))
+			{
+				if (coding == "gzip" || coding == "x-gzip") {
+					result |= ACCEPTS_GZIP;
+				} else if (coding == "br") {
+					result |= ACCEPTS_BROTLI;
+				}
+			}
+
+			start = end + 1;
+		}
+
+		return result;
+	}
+
+	// `params` is the lowercase part of an Accept-Encoding element after ';'.
+	static bool qValueIsZero(const StaticString &params) {
+		string::size_type pos = params.find(P_STATIC_STRING("q="));
+		if (pos == string::npos) {
+			return false;
+		}
+
+		StaticString qvalue = trimWhitespace(params.substr(pos + 2));
+		if (qvalue.empty() || qvalue[0] != '0') {
+			return false;
+		}
+		for (string::size_type i = 1; i < qvalue.size(); i++) {
+			if (qvalue[i] != '.' && qvalue[i] != '0') {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * Responses are cached per set of accepted encodings, so a Vary header
+	 * is only acceptable if it names nothing but Accept-Encoding.
+	 */
+	static bool varyAllowsStoring(psg_pool_t *pool, const LString *value) {
+		if (value == NULL) {
+			return true;
+		} else if (value->size == 0) {
+			return false;
+		}
+
+		StaticString header = lowercaseHeaderValue(pool, value);
+		string::size_type start = 0;
+
+		while (start < header.size()) {
+			string::size_type end = header.find(',', start);
+			if (end == string::npos) {
+				end = header.size();
+			}
+			if (trimWhitespace(header.substr(start, end - start)) != "accept-encoding") {
+				return false;
+			}
+			start = end + 1;
+		}
+
+		return true;
+	}
+
+	static bool contentTypeIsCompressible(psg_pool_t *pool, const LString *value) {
+		if (value == NULL || value->size == 0) {
+			return false;
+		}
+
+		StaticString header = lowercaseHeaderValue(pool, value);
+		StaticString type = trimWhitespace(header.substr(0, header.find(';')));
+		return startsWith(type, P_STATIC_STRING("text/"))
+			|| type == "application/json"
+			|| type == "application/javascript"
+			|| type == "application/x-javascript"
+			|| type == "application/xml"
+			|| (type.size() > 5 && type.substr(type.size() - 5) == "+json")
+			|| (type.size() > 4 && type.substr(type.size() - 4) == "+xml");
+	}
+
+	/**
+	 * Compresses the given body in gzip format into memory allocated from
+	 * `pool`. Returns false if that fails or doesn't make the body smaller.
+	 */
+	static bool gzipBody(psg_pool_t *pool, const LString *body, char *&output,
+		unsigned int &outputSize)
+	{
+		z_stream stream;
+		const LString::Part *part;
+		int ret;
+
+		memset(&stream, 0, sizeof(stream));
+		// 15 + 16: default window size, with a gzip header instead of a zlib header.
+		if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16,
+			8, Z_DEFAULT_STRATEGY) != Z_OK)
+		{
+			return false;
+		}
+
+		uLong capacity = std::min<uLong>(deflateBound(&stream, body->size), body->size);
+		output = (char *) psg_pnalloc(pool, capacity);
+		stream.next_out  = (Bytef *) output;
+		stream.avail_out = capacity;
+
+		ret = Z_OK;
+		for (part = body->start; part != NULL && ret == Z_OK; part = part->next) {
+			stream.next_in  = (Bytef *) part->data;
+			stream.avail_in = part->size;
+			ret = deflate(&stream, (part->next == NULL) ? Z_FINISH : Z_NO_FLUSH);
+			if (ret == Z_OK && stream.avail_in > 0) {
+				// Output doesn't fit in less than the body size.
+				ret = Z_BUF_ERROR;
+			}
+		}
+
+		outputSize = stream.total_out;
+		deflateEnd(&stream);
+		return ret == Z_STREAM_END && outputSize < body->size;
+	}
+
+	/**
+	 * Checks whether an entry should reference the mbufs of the given body
+	 * instead of copying it. That is only possible with a private storage,
+	 * and only worth it if the mbufs don't keep alive much more memory than
+	 * the body itself, e.g. because a small body sits in a large mbuf block.
+	 */
+	bool shouldReferenceBodyBuffers(const LString *body, unsigned int &nBuffers,
+		size_t &memoryUsage) const
+	{
+		const struct MemoryKit::mbuf_block *lastBlock = NULL;
+		const LString::Part *part;
+
+		if (usesSharedStorage() || body->size == 0) {
+			return false;
+		}
+
+		nBuffers = 0;
+		memoryUsage = 0;
+		for (part = body->start; part != NULL; part = part->next) {
+			if (part->mbuf_block == NULL) {
+				return false;
+			}
+			if (part->mbuf_block != lastBlock) {
+				memoryUsage += sizeof(struct MemoryKit::mbuf_block) + part->mbuf_block->end
+					- part->mbuf_block->start;
+				lastBlock = part->mbuf_block;
+			}
+			nBuffers++;
+		}
+		return memoryUsage <= 2 * (size_t) body->size;
+	}
+
+	StoredResponse *allocateWithBodyBuffers(const HashedStaticString &key,
+		unsigned int headerSize, const LString *body, unsigned int nBuffers,
+		size_t memoryUsage)
+	{
+		StoredResponse *response = storage->allocateWithBodyBuffers(key,
+			headerSize, body->size, nBuffers, memoryUsage);
+		if (response != NULL) {
+			MemoryKit::mbuf *buffers = response->getHttpBodyBuffers();
+			const LString::Part *part = body->start;
+			for (unsigned int i = 0; i < nBuffers; i++, part = part->next) {
+				buffers[i] = MemoryKit::mbuf_block_subset(part->mbuf_block,
+					part->data - part->mbuf_block->start, part->size);
+			}
+		}
+		return response;
+	}
+
+	Entry storeResponse(Request *req, ev_tstamp now, unsigned int headerSize,
+		unsigned int bodySize, const LString *body)
+	{
+		stores++;
+
+		if (headerSize > MAX_HEADER_SIZE || bodySize > getMaxBodySize()) {
+			return Entry();
+		}
+
+		time_t responseDate = parseDate(req->pool, req->appResponse.date, now);
+		if (responseDate == (time_t) -1) {
+			return Entry();
+		}
+
+		time_t expiryDate = determineExpiryDate(req, responseDate, now);
+		if (expiryDate == (time_t) -1) {
+			return Entry();
+		}
+
+		StoredResponse *response;
+		unsigned int nBodyBuffers;
+		size_t bodyMemoryUsage;
+		if (body != NULL && shouldReferenceBodyBuffers(body, nBodyBuffers, bodyMemoryUsage)) {
+			response = allocateWithBodyBuffers(req->cacheKey, headerSize,
+				body, nBodyBuffers, bodyMemoryUsage);
+		} else {
+			response = storage->allocate(req->cacheKey, headerSize, bodySize);
+		}
+		if (OXT_UNLIKELY(response == NULL)) {
+			return Entry();
+		}
+		response->date       = responseDate;
+		response->expiryDate = expiryDate;
+		response->staleWhileRevalidateUntil = expiryDate;
+		response->staleIfErrorUntil = expiryDate;
+		if (req->appResponse.cacheControl != NULL && req->appResponse.cacheControl->size > 0) {
+			// Made contiguous by prepareRequestForStoring().
+			StaticString cacheControl(req->appResponse.cacheControl->start->data,
+				req->appResponse.cacheControl->size);
+			response->staleWhileRevalidateUntil += parseDeltaSecondsDirective(
+				cacheControl, P_STATIC_STRING("stale-while-revalidate"));
+			response->staleIfErrorUntil += parseDeltaSecondsDirective(
+				cacheControl, P_STATIC_STRING("stale-if-error"));
+		}
+
+		storeSuccesses++;
+		return Entry(response);
+	}
+
+	bool responseShouldBeCompressed(Request *req, const LString *body) {
+		if (!compressionEnabled
+		 || !(req->acceptedEncodings & ACCEPTS_GZIP)
+		 || req->appResponse.statusCode != 200
+		 || body->size < MIN_COMPRESSIBLE_BODY_SIZE)
+		{
+			return false;
+		}
+
+		ServerKit::HeaderTable &respHeaders = req->appResponse.headers;
+		const LString *etag = respHeaders.lookup(ETAG);
+		if (etag != NULL) {
+			// A strong validator must not be reused for another
+			// representation, so only weak ones are allowed.
+			etag = psg_lstr_make_contiguous(etag, req->pool);
+			if (!startsWith(StaticString(etag->start->data, etag->size),
+				P_STATIC_STRING("W/")))
+			{
+				return false;
+			}
+		}
+
+		return respHeaders.lookup(CONTENT_ENCODING) == NULL
+			&& contentTypeIsCompressible(req->pool, respHeaders.lookup(CONTENT_TYPE));
+	}
+
+	Entry storeCompressedResponse(Request *req, ev_tstamp now, unsigned int headerSize,
+		const char *body, unsigned int bodySize)
+	{
+		StaticString extraHeaders;
+		if (req->appResponse.headers.lookup(VARY) == NULL) {
+			extraHeaders = P_STATIC_STRING("Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n");
+		} else {
+			extraHeaders = P_STATIC_STRING("Content-Encoding: gzip\r\n");
+		}
+
+		Entry entry(storeResponse(req, now, headerSize + extraHeaders.size(),
+			bodySize, NULL));
+		if (entry.valid()) {
+			memcpy(entry.response->getHttpHeaderData() + headerSize,
+				extraHeaders.data(), extraHeaders.size());
+			memcpy(entry.response->getHttpBodyData(), body, bodySize);
+			compressions++;
+		}
+		return entry;
+	}
+
+	typename std::vector<Revalidation>::iterator findRevalidation(const HashedStaticString &key) {
+		typename std::vector<Revalidation>::iterator it, end = revalidations.end();
+		for (it = revalidations.begin(); it != end; it++) {
+			if (it->key.hash() == key.hash() && it->key == key) {
+				break;
+			}
+		}
+		return it;
+	}
+
+	typename std::vector<Revalidation>::iterator findRevalidation(const Request *leader) {
+		typename std::vector<Revalidation>::iterator it, end = revalidations.end();
+		for (it = revalidations.begin(); it != end; it++) {
+			if (it->leader == leader) {
+				break;
+			}
+		}
+		return it;
 	}
 
 	StaticString extractHostNameWithPortFromParsedUrl(struct http_parser_url &url,
@@ -399,21 +778,31 @@ private:
 			return;
 		}
 
-		char *key = (char *) psg_pnalloc(req->pool, keySize);
-		generateKey(https, path, req->host, req->varyCookie, key, keySize);
+		removeAllVariants(https, path, req, keySize);
+	}
 
-		Entry entry(lookup(StaticString(key, keySize)));
-		if (entry.valid()) {
-			entry.header->valid = false;
+	// Removes the entries for all sets of accepted encodings.
+	void removeAllVariants(bool https, const StaticString &path, Request *req,
+		unsigned int keySize)
+	{
+		char *key = (char *) psg_pnalloc(req->pool, keySize);
+		for (unsigned int encodings = 0; encodings <= ACCEPTED_ENCODINGS_MAX; encodings++) {
+			generateKey(https, encodings, path, req->host, req->varyCookie, key, keySize);
+			storage->remove(StaticString(key, keySize));
 		}
 	}
 
 public:
-	ResponseCache()
+	ResponseCache(unsigned int maxEntries = ResponseCacheStorage::DEFAULT_MAX_ENTRIES,
+		size_t maxMemory = ResponseCacheStorage::DEFAULT_MAX_MEMORY)
 		: CACHE_CONTROL("cache-control"),
 		  PRAGMA_CONST("pragma"),
 		  AUTHORIZATION("authorization"),
 		  VARY("vary"),
+		  ACCEPT_ENCODING("accept-encoding"),
+		  CONTENT_ENCODING("content-encoding"),
+		  CONTENT_TYPE("content-type"),
+		  ETAG("etag"),
 		  WWW_AUTHENTICATE("www-authenticate"),
 		  X_SENDFILE("x-sendfile"),
 		  X_ACCEL_REDIRECT("x-accel-redirect"),
@@ -426,9 +815,91 @@ public:
 		  fetches(0),
 		  hits(0),
 		  stores(0),
-		  storeSuccesses(0)
+		  storeSuccesses(0),
+		  compressions(0),
+		  privateStorage(maxEntries, maxMemory),
+		  storage(&privateStorage),
+		  readerIndex(0),
+		  staleServingEnabled(true),
+		  compressionEnabled(false)
 		{ }
 
+	/**
+	 * Changes the capacity of the private storage. Existing entries are evicted.
+	 */
+	void setCapacity(unsigned int maxEntries, size_t maxMemory) {
+		privateStorage.setCapacity(maxEntries, maxMemory);
+	}
+
+	/**
+	 * Stores entries in the given shared storage instead of in a private
+	 * one. `readerIndex` identifies the calling thread among the storage's
+	 * readers. Must be called before the cache is used.
+	 */
+	void useSharedStorage(ResponseCacheStorage *sharedStorage, unsigned int _readerIndex) {
+		assert(sharedStorage->isShared());
+		assert(_readerIndex < sharedStorage->getReaderCount());
+		privateStorage.setCapacity(1, 0);
+		storage = sharedStorage;
+		readerIndex = _readerIndex;
+	}
+
+	OXT_FORCE_INLINE
+	bool usesSharedStorage() const {
+		return storage != &privateStorage;
+	}
+
+	/**
+	 * Sets whether expired entries may be served within their
+	 * stale-while-revalidate and stale-if-error windows.
+	 */
+	void setStaleServingEnabled(bool enabled) {
+		staleServingEnabled = enabled;
+	}
+
+	OXT_FORCE_INLINE
+	bool isStaleServingEnabled() const {
+		return staleServingEnabled;
+	}
+
+	/**
+	 * Sets whether uncompressed responses to requests that accept gzip
+	 * are stored gzipped.
+	 */
+	void setCompressionEnabled(bool enabled) {
+		compressionEnabled = enabled;
+	}
+
+	OXT_FORCE_INLINE
+	bool isCompressionEnabled() const {
+		return compressionEnabled;
+	}
+
+	OXT_FORCE_INLINE
+	unsigned int getMaxEntries() const {
+		return storage->getMaxEntries();
+	}
+
+	OXT_FORCE_INLINE
+	size_t getMaxMemory() const {
+		return storage->getMaxMemory();
+	}
+
+	OXT_FORCE_INLINE
+	size_t getMaxBodySize() const {
+		return storage->getMaxBodySize();
+	}
+
+	OXT_FORCE_INLINE
+	unsigned int getEntryCount() const {
+		return storage->getEntryCount();
+	}
+
+	OXT_FORCE_INLINE
+	size_t getMemoryUsage() const {
+		return storage->getMemoryUsage();
+	}
+
 	OXT_FORCE_INLINE
 	unsigned int getFetches() const {
 		return fetches;
@@ -446,7 +917,7 @@ public:
 
 	OXT_FORCE_INLINE
 	unsigned int getStores() const {
-		return fetches;
+		return stores;
 	}
 
 	OXT_FORCE_INLINE
@@ -459,6 +930,21 @@ public:
 		return storeSuccesses / (double) stores;
 	}
 
+	OXT_FORCE_INLINE
+	unsigned int getCompressions() const {
+		return compressions;
+	}
+
+	OXT_FORCE_INLINE
+	unsigned int getEvictions() const {
+		return storage->getEvictions();
+	}
+
+	OXT_FORCE_INLINE
+	unsigned int getRevalidationCount() const {
+		return revalidations.size();
+	}
+
 	// For decreasing the store success ratio without calling store().
 	OXT_FORCE_INLINE
 	void incStores() {
@@ -470,12 +956,11 @@ public:
 		hits = 0;
 		stores = 0;
 		storeSuccesses = 0;
+		compressions = 0;
 	}
 
 	void clear() {
-		for (unsigned int i = 0; i < MAX_ENTRIES; i++) {
-			headers[i].valid = false;
-		}
+		storage->clear();
 	}
 
 
@@ -506,6 +991,9 @@ public:
 			}
 		}
 
+		req->acceptedEncodings = parseAcceptedEncodings(req->pool,
+			req->headers.lookup(ACCEPT_ENCODING));
+
 		unsigned int size = calculateKeyLength(req->host,
 			req->varyCookie,
 			StaticString(req->path.start->data, req->path.size));
@@ -523,7 +1011,8 @@ public:
 		}
 
 		char *key = (char *) psg_pnalloc(req->pool, size);
-		generateKey(req->https, StaticString(req->path.start->data, req->path.size),
+		generateKey(req->https, req->acceptedEncodings,
+			StaticString(req->path.start->data, req->path.size),
 			req->host, req->varyCookie, key, size);
 		req->cacheKey = HashedStaticString(key, size);
 		return true;
@@ -537,7 +1026,19 @@ public:
 			&& !req->hasPragmaHeader;
 	}
 
-	// @pre requestAllowsFetching()
+	/**
+	 * If the cache uses a shared storage, then the caller must hold a
+	 * ReadGuard for as long as it uses the returned entry.
+	 *
+	 * If the entry has expired and a GET request is given, then that
+	 * request becomes the leader of a revalidation. The caller must call
+	 * `endRevalidation()` when the leader is done. If another request is
+	 * already revalidating the entry, then either the stale entry is
+	 * returned, or the cache miss reason is REVALIDATING and the caller
+	 * should `waitForRevalidation()`.
+	 *
+	 * @pre requestAllowsFetching()
+	 */
 	Entry fetch(Request *req, ev_tstamp now) {
 		fetches++;
 		if (OXT_UNLIKELY(fetches == 0)) {
@@ -546,21 +1047,115 @@ public:
 			hits = 0;
 		}
 
-		Entry entry(lookup(req->cacheKey));
-		if (entry.valid()) {
+		StoredResponse *response = storage->lookup(req->cacheKey);
+		if (response != NULL) {
 			hits++;
-			if (isFresh(entry, now)) {
-				return entry;
+			if (isFresh(response, now)) {
+				response->referenced.store(true, boost::memory_order_relaxed);
+				return Entry(response);
+			} else if (findRevalidation(req->cacheKey) != revalidations.end()) {
+				if (staleServingEnabled && response->staleWhileRevalidateUntil > now) {
+					response->referenced.store(true, boost::memory_order_relaxed);
+					Entry result(response);
+					result.stale = true;
+					return result;
+				} else {
+					Entry result;
+					result.cacheMissReason = Entry::REVALIDATING;
+					return result;
+				}
 			} else {
-				erase(entry.index);
+				if (req->method == HTTP_GET) {
+					// Keep the stale entry around for the other requests
+					// and in case the application fails.
+					revalidations.push_back(Revalidation());
+					revalidations.back().key = req->cacheKey;
+					revalidations.back().leader = req;
+				} else {
+					storage->remove(req->cacheKey, response);
+				}
 				Entry result;
 				result.cacheMissReason = Entry::NOT_FRESH;
 				return result;
 			}
 		} else {
-			entry.cacheMissReason = Entry::NOT_FOUND;
-			return entry;
+			Entry result;
+			result.cacheMissReason = Entry::NOT_FOUND;
+			return result;
+		}
+	}
+
+
+	OXT_FORCE_INLINE
+	bool isRevalidating(const Request *req) {
+		return findRevalidation(req) != revalidations.end();
+	}
+
+	/**
+	 * Registers a request whose fetch failed with the cache miss reason
+	 * REVALIDATING, so that `endRevalidation()` returns it.
+	 */
+	void waitForRevalidation(Request *req) {
+		typename std::vector<Revalidation>::iterator it = findRevalidation(req->cacheKey);
+		assert(it != revalidations.end());
+		it->waiters.push_back(req);
+	}
+
+	/**
+	 * Returns the expired entry that the given leader is revalidating,
+	 * provided that it is still within its stale-if-error window. The
+	 * same ReadGuard rules apply as for `fetch()`.
+	 */
+	Entry fetchStaleIfError(Request *req, ev_tstamp now) {
+		typename std::vector<Revalidation>::iterator it = findRevalidation(req);
+		if (!staleServingEnabled || it == revalidations.end()) {
+			return Entry();
+		}
+
+		StoredResponse *response = storage->lookup(it->key);
+		if (response != NULL && !isFresh(response, now)
+		 && response->staleIfErrorUntil > now)
+		{
+			Entry result(response);
+			result.stale = true;
+			return result;
+		} else {
+			return Entry();
+		}
+	}
+
+	/**
+	 * Ends the revalidation led by the given request, if any, and appends
+	 * the requests that were waiting for it to `waiters`. Unless
+	 * `keepStaleEntry` is true, the entry is removed if the leader did
+	 * not replace it with a fresh one.
+	 */
+	void endRevalidation(Request *req, ev_tstamp now, std::vector<Request *> &waiters,
+		bool keepStaleEntry = false)
+	{
+		typename std::vector<Revalidation>::iterator it = findRevalidation(req);
+		if (it == revalidations.end()) {
+			return;
+		}
+
+		if (!keepStaleEntry) {
+			ReadGuard guard(*this);
+			StoredResponse *response = storage->lookup(it->key);
+			if (response != NULL && !isFresh(response, now)) {
+				storage->remove(it->key, response);
+			}
 		}
+
+		waiters.insert(waiters.end(), it->waiters.begin(), it->waiters.end());
+		revalidations.erase(it);
+	}
+
+	/**
+	 * Whether a response with the given status code from a revalidating
+	 * request may be replaced by a stale entry.
+	 */
+	bool statusCodeAllowsStaleIfError(unsigned int code) const {
+		return code == 500 || code == 502 || code == 503 || code == 504;
 	}
 
 
@@ -595,7 +1190,7 @@ public:
 		}
 
 		if (req->headers.lookup(AUTHORIZATION) != NULL
-		 || respHeaders.lookup(VARY) != NULL
+		 || !varyAllowsStoring(req->pool, respHeaders.lookup(VARY))
 		 || respHeaders.lookup(WWW_AUTHENTICATE) != NULL
 		 || respHeaders.lookup(X_SENDFILE) != NULL
 		 || respHeaders.lookup(X_ACCEL_REDIRECT) != NULL)
@@ -625,42 +1220,63 @@ public:
 			|| req->appResponse.expiresHeader != NULL;
 	}
 
-	// @pre requestAllowsStoring()
-	// @pre prepareRequestForStoring()
+	/**
+	 * Allocates an entry for the response of the given request. The caller
+	 * must fill the returned entry's HTTP header and body data, which are
+	 * `headerSize` and `bodySize` bytes large, and then call `commit()`.
+	 *
+	 * @pre requestAllowsStoring()
+	 * @pre prepareRequestForStoring()
+	 */
 	Entry store(Request *req, ev_tstamp now, unsigned int headerSize, unsigned int bodySize) {
-		stores++;
-
-		if (headerSize > MAX_HEADER_SIZE || bodySize > MAX_BODY_SIZE) {
-			return Entry();
-		}
+		return storeResponse(req, now, headerSize, bodySize, NULL);
+	}
 
-		time_t responseDate = parseDate(req->pool, req->appResponse.date, now);
-		if (responseDate == (time_t) -1) {
-			return Entry();
-		}
+	/**
+	 * Like the other `store()`, but the body is given as an LString of
+	 * mbuf parts, such as the parts collected while forwarding the
+	 * response, and this method takes care of the body data. If possible,
+	 * the entry references those mbufs instead of copying the body. If
+	 * compression is enabled, the body may be stored gzipped instead, in
+	 * which case the entry's HTTP header data is larger than `headerSize`
+	 * and ends with the extra headers. Either way, the caller must only
+	 * fill the first `headerSize` bytes of HTTP header data.
+	 *
+	 * @pre requestAllowsStoring()
+	 * @pre prepareRequestForStoring()
+	 */
+	Entry store(Request *req, ev_tstamp now, unsigned int headerSize, const LString *body) {
+		char *compressedBody;
+		unsigned int compressedBodySize;
 
-		time_t expiryDate = determineExpiryDate(req, responseDate, now);
-		if (expiryDate == (time_t) -1) {
-			return Entry();
+		if (responseShouldBeCompressed(req, body)
+		 && gzipBody(req->pool, body, compressedBody, compressedBodySize))
+		{
+			return storeCompressedResponse(req, now, headerSize,
+				compressedBody, compressedBodySize);
 		}
 
-		const HashedStaticString &cacheKey = req->cacheKey;
-		Entry entry(lookup(cacheKey));
-		if (!entry.valid()) {
-			entry = lookupInvalidOrOldest();
-			entry.header->valid   = true;
-			entry.header->hash    = cacheKey.hash();
-			entry.header->keySize = cacheKey.size();
-			memcpy(entry.body->key, cacheKey.data(), cacheKey.size());
+		Entry entry(storeResponse(req, now, headerSize, body->size, body));
+		if (entry.valid() && !entry.response->hasHttpBodyBuffers()) {
+			char *pos = entry.response->getHttpBodyData();
+			const char *end = pos + entry.response->httpBodySize;
+			const LString::Part *part;
+			for (part = body->start; part != NULL; part = part->next) {
+				pos = appendData(pos, end, part->data, part->size);
+			}
 		}
-		entry.header->date     = responseDate;
-		entry.body->expiryDate = expiryDate;
-		entry.body->httpHeaderSize = headerSize;
-		entry.body->httpBodySize   = bodySize;
-		storeSuccesses++;
 		return entry;
 	}
 
+	/**
+	 * Makes an entry returned by `store()` available for fetching.
+	 *
+	 * @pre entry.valid()
+	 */
+	void commit(const Entry &entry) {
+		storage->publish(entry.response);
+	}
+
 
 	// @pre prepareRequest() returned true
 	// @pre !requestAllowsStoring() || !prepareRequestForStoring()
@@ -670,10 +1286,9 @@ public:
 
 	// @pre requestAllowsInvalidating()
 	void invalidate(Request *req) {
-		Entry entry(lookup(req->cacheKey));
-		if (entry.valid()) {
-			entry.header->valid = false;
-		}
+		removeAllVariants(req->https,
+			StaticString(req->path.start->data, req->path.size),
+			req, req->cacheKey.size());
 
 		invalidateLocation(req, LOCATION);
 		invalidateLocation(req, CONTENT_LOCATION);
@@ -681,16 +1296,7 @@ public:
 
 
 	string inspect() const {
-		stringstream stream;
-		for (unsigned int i = 0; i < MAX_ENTRIES; i++) {
-			time_t expiryDate = bodies[i].expiryDate;
-			stream << " #" << i << ": valid=" << headers[i].valid
-				<< ", hash=" << headers[i].hash
-				<< ", expiryDate=" << expiryDate
-				<< ", keySize=" << headers[i].keySize << ", key=\""
-				<< cEscapeString(StaticString(bodies[i].key, headers[i].keySize)) << "\"\n";
-		}
-		return stream.str();
+		return storage->inspect();
 	}
 };
 
@@ -0,0 +1,671 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_RESPONSE_CACHE_STORAGE_H_
+#define _PASSENGER_RESPONSE_CACHE_STORAGE_H_
+
+#include <boost/cstdint.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+#include <oxt/macros.hpp>
+#include <algorithm>
+#include <new>
+#include <sstream>
+#include <string>
+#include <time.h>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <psg_sysqueue.h>
+#include <DataStructures/HashedStaticString.h>
+#include <MemoryKit/mbuf.h>
+#include <StaticString.h>
+#include <Utils/StrIntUtils.h>
+
+namespace Passenger {
+
+using namespace std;
+
+
+/**
+ * The entry storage of a ResponseCache: a hash table on the cache key plus a
+ * CLOCK ring for eviction, bounded both in number of entries and in total
+ * memory. Every entry has a "referenced" bit that is set on a cache hit; when
+ * room is needed the clock hand sweeps over the entries, clearing bits until
+ * it finds one that hasn't been referenced since the last sweep.
+ *
+ * ## Private and shared mode
+ *
+ * A storage object constructed with a reader count of 0 is private: it may
+ * only be used by a single thread, and entries are freed as soon as they
+ * are removed.
+ *
+ * A storage object constructed with a non-zero reader count may be shared
+ * by that many threads. Lookups are lock-free; everything that modifies
+ * the storage is serialized by a mutex. Removed entries are reclaimed with
+ * epoch-based reclamation: a reader must call `beginRead()` before
+ * `lookup()` and `endRead()` after it is done with the returned entry, and
+ * a removed entry is only freed once no reader that could have seen it is
+ * inside a read section anymore.
+ *
+ * Entries are filled in before they are published, so readers never see
+ * partially written data:
+ *
+ *     StoredResponse *response = storage.allocate(key, headerSize, bodySize);
+ *     ... fill response->getHttpHeaderData() and response->getHttpBodyData() ...
+ *     storage.publish(response);
+ *
+ * A private storage can also hold entries whose body is not copied into
+ * the entry, but referenced as a list of mbufs (see
+ * `allocateWithBodyBuffers()`). mbuf reference counts are not thread-safe,
+ * so shared storages don't support this.
+ */
+class ResponseCacheStorage {
+public:
+	static const unsigned int DEFAULT_MAX_ENTRIES = 1024;
+	static const unsigned int DEFAULT_MAX_MEMORY  = 1024 * 1024 * 16;
+
+	/**
+	 * A cached response. The key, the HTTP header data and the HTTP body
+	 * data are stored directly after this structure, in the same allocation.
+	 */
+	struct StoredResponse {
+		/** Only modified while holding the write lock. Readers may follow it. */
+		boost::atomic<StoredResponse *> nextInBucket;
+		/** Links the entry into either the CLOCK ring or the retired list. */
+		TAILQ_ENTRY(StoredResponse) nextInClock;
+		boost::uint64_t retireEpoch;
+		boost::uint32_t hash;
+		unsigned short keySize;
+		boost::atomic<bool> referenced;
+		time_t date;
+		time_t expiryDate;
+		/** Until when the entry may be served while it is being revalidated. */
+		time_t staleWhileRevalidateUntil;
+		/** Until when the entry may be served if revalidation fails. */
+		time_t staleIfErrorUntil;
+		unsigned int httpHeaderSize;
+		unsigned int httpBodySize;
+		/**
+		 * If non-zero, the body is not stored in the entry, but in this
+		 * many mbufs that are stored after the HTTP header data.
+		 */
+		unsigned int nHttpBodyBuffers;
+		size_t memoryUsage;
+
+		static size_t calculateMemoryUsage(unsigned int keySize,
+			unsigned int headerSize, unsigned int bodySize)
+		{
+			return sizeof(StoredResponse) + keySize + headerSize + bodySize;
+		}
+
+		static size_t calculateHttpBodyBuffersOffset(unsigned int keySize,
+			unsigned int headerSize)
+		{
+			const size_t alignment = boost::alignment_of<MemoryKit::mbuf>::value;
+			return (calculateMemoryUsage(keySize, headerSize, 0) + alignment - 1)
+				& ~(alignment - 1);
+		}
+
+		size_t getMemoryUsage() const {
+			return memoryUsage;
+		}
+
+		bool hasHttpBodyBuffers() const {
+			return nHttpBodyBuffers > 0;
+		}
+
+		StaticString getKey() const {
+			return StaticString((const char *) (this + 1), keySize);
+		}
+
+		char *getHttpHeaderData() {
+			return (char *) (this + 1) + keySize;
+		}
+
+		const char *getHttpHeaderData() const {
+			return (const char *) (this + 1) + keySize;
+		}
+
+		// This data is dechunked.
+		char *getHttpBodyData() {
+			return getHttpHeaderData() + httpHeaderSize;
+		}
+
+		const char *getHttpBodyData() const {
+			return getHttpHeaderData() + httpHeaderSize;
+		}
+
+		// @pre hasHttpBodyBuffers()
+		MemoryKit::mbuf *getHttpBodyBuffers() {
+			return (MemoryKit::mbuf *) ((char *) this
+				+ calculateHttpBodyBuffersOffset(keySize, httpHeaderSize));
+		}
+
+		// @pre hasHttpBodyBuffers()
+		const MemoryKit::mbuf *getHttpBodyBuffers() const {
+			return (const MemoryKit::mbuf *) ((const char *) this
+				+ calculateHttpBodyBuffersOffset(keySize, httpHeaderSize));
+		}
+	};
+
+private:
+	TAILQ_HEAD(StoredResponseList, StoredResponse);
+
+	static const boost::uint64_t NOT_READING = ~(boost::uint64_t) 0;
+
+	/**
+	 * The read section state of one reader thread. Padded to a cache
+	 * line so that readers don't contend with each other.
+	 */
+	struct ReaderSlot {
+		/** The global epoch at the start of the read section, or NOT_READING. */
+		boost::atomic<boost::uint64_t> epoch;
+		/** Only accessed by the owning reader. Read sections may be nested. */
+		unsigned int depth;
+		char padding[64 - sizeof(boost::atomic<boost::uint64_t>) - sizeof(unsigned int)];
+	};
+
+	mutable boost::mutex syncher;
+	const unsigned int readerCount;
+	ReaderSlot *readers;
+	boost::atomic<boost::uint64_t> epoch;
+
+	unsigned int maxEntries;
+	size_t maxMemory;
+	unsigned int entryCount;
+	size_t memoryUsage;
+	unsigned int evictions;
+
+	/** Hash table on the cache key. bucketCount is a power of 2. */
+	boost::atomic<StoredResponse *> *buckets;
+	unsigned int bucketCount;
+
+	/** All entries in insertion order, used as the CLOCK ring. */
+	StoredResponseList clock;
+	/** The next entry to be considered for eviction. NULL means the first one. */
+	StoredResponse *clockHand;
+	/** Removed entries that readers may still be looking at, oldest first. */
+	StoredResponseList retired;
+
+	// Non-copyable.
+	ResponseCacheStorage(const ResponseCacheStorage &);
+	ResponseCacheStorage &operator=(const ResponseCacheStorage &);
+
+	static unsigned int calculateBucketCount(unsigned int maxEntries) {
+		unsigned int result = 16;
+		while (result < maxEntries) {
+			result *= 2;
+		}
+		return result;
+	}
+
+	void allocateBuckets() {
+		bucketCount = calculateBucketCount(maxEntries);
+		buckets = new boost::atomic<StoredResponse *>[bucketCount];
+		for (unsigned int i = 0; i < bucketCount; i++) {
+			buckets[i].store(NULL, boost::memory_order_relaxed);
+		}
+	}
+
+	boost::atomic<StoredResponse *> *getBucket(boost::uint32_t hash) const {
+		return &buckets[hash & (bucketCount - 1)];
+	}
+
+	void lockIfShared(boost::unique_lock<boost::mutex> &l) const {
+		if (isShared()) {
+			l = boost::unique_lock<boost::mutex>(syncher);
+		}
+	}
+
+	StoredResponse *lookupWhileWriting(const HashedStaticString &key) const {
+		StoredResponse *response = getBucket(key.hash())->load(boost::memory_order_relaxed);
+		while (response != NULL) {
+			if (response->hash == key.hash() && key == response->getKey()) {
+				return response;
+			}
+			response = response->nextInBucket.load(boost::memory_order_relaxed);
+		}
+		return NULL;
+	}
+
+	void insert(StoredResponse *response) {
+		boost::atomic<StoredResponse *> *bucket = getBucket(response->hash);
+		response->nextInBucket.store(bucket->load(boost::memory_order_relaxed),
+			boost::memory_order_relaxed);
+		// Publishes the entry's contents to readers.
+		bucket->store(response, boost::memory_order_release);
+
+		// Insert right behind the clock hand, so that the new entry
+		// is the last one to be considered for eviction.
+		if (clockHand == NULL) {
+			TAILQ_INSERT_TAIL(&clock, response, nextInClock);
+		} else {
+			TAILQ_INSERT_BEFORE(clockHand, response, nextInClock);
+		}
+
+		entryCount++;
+		memoryUsage += response->getMemoryUsage();
+	}
+
+	void erase(StoredResponse *response) {
+		boost::atomic<StoredResponse *> *link = getBucket(response->hash);
+		StoredResponse *current;
+		while ((current = link->load(boost::memory_order_relaxed)) != response) {
+			assert(current != NULL);
+			link = &current->nextInBucket;
+		}
+		// `response->nextInBucket` is left intact so that readers that
+		// are currently looking at `response` can continue walking the chain.
+		link->store(response->nextInBucket.load(boost::memory_order_relaxed),
+			boost::memory_order_release);
+
+		if (clockHand == response) {
+			clockHand = TAILQ_NEXT(response, nextInClock);
+		}
+		TAILQ_REMOVE(&clock, response, nextInClock);
+
+		entryCount--;
+		memoryUsage -= response->getMemoryUsage();
+		retire(response);
+	}
+
+	void retire(StoredResponse *response) {
+		if (!isShared()) {
+			destroy(response);
+			return;
+		}
+
+		// Readers that enter after this point see an epoch greater than
+		// `retireEpoch`, and cannot find `response` anymore.
+		response->retireEpoch = epoch.fetch_add(1, boost::memory_order_seq_cst);
+		TAILQ_INSERT_TAIL(&retired, response, nextInClock);
+		reclaim();
+	}
+
+	/**
+	 * Frees all retired entries that no reader can be looking at anymore.
+	 */
+	void reclaim() {
+		boost::uint64_t oldestReader = NOT_READING;
+		StoredResponse *response;
+
+		boost::atomic_thread_fence(boost::memory_order_seq_cst);
+		for (unsigned int i = 0; i < readerCount; i++) {
+			oldestReader = std::min(oldestReader,
+				readers[i].epoch.load(boost::memory_order_seq_cst));
+		}
+
+		while ((response = TAILQ_FIRST(&retired)) != NULL
+			&& response->retireEpoch < oldestReader)
+		{
+			TAILQ_REMOVE(&retired, response, nextInClock);
+			destroy(response);
+		}
+	}
+
+	static StoredResponse *create(const HashedStaticString &key, size_t allocationSize,
+		unsigned int headerSize, unsigned int bodySize)
+	{
+		void *memory = malloc(allocationSize);
+		if (OXT_UNLIKELY(memory == NULL)) {
+			return NULL;
+		}
+		StoredResponse *response = new (memory) StoredResponse();
+		response->nextInBucket.store(NULL, boost::memory_order_relaxed);
+		response->retireEpoch = 0;
+		response->hash       = key.hash();
+		response->keySize    = key.size();
+		response->referenced.store(false, boost::memory_order_relaxed);
+		response->date       = 0;
+		response->expiryDate = 0;
+		response->staleWhileRevalidateUntil = 0;
+		response->staleIfErrorUntil = 0;
+		response->httpHeaderSize = headerSize;
+		response->httpBodySize   = bodySize;
+		response->nHttpBodyBuffers = 0;
+		response->memoryUsage    = allocationSize;
+		memcpy((char *) (response + 1), key.data(), key.size());
+		return response;
+	}
+
+	static void destroy(StoredResponse *response) {
+		if (response->hasHttpBodyBuffers()) {
+			MemoryKit::mbuf *buffers = response->getHttpBodyBuffers();
+			for (unsigned int i = 0; i < response->nHttpBodyBuffers; i++) {
+				buffers[i].~mbuf();
+			}
+		}
+		response->~StoredResponse();
+		free(response);
+	}
+
+	void evictOne() {
+		assert(entryCount > 0);
+		while (true) {
+			if (clockHand == NULL) {
+				clockHand = TAILQ_FIRST(&clock);
+			}
+			if (clockHand->referenced.load(boost::memory_order_relaxed)) {
+				clockHand->referenced.store(false, boost::memory_order_relaxed);
+				clockHand = TAILQ_NEXT(clockHand, nextInClock);
+			} else {
+				evictions++;
+				erase(clockHand);
+				return;
+			}
+		}
+	}
+
+	void makeRoomFor(size_t size) {
+		while (entryCount > 0
+		 && (entryCount >= maxEntries || memoryUsage + size > maxMemory))
+		{
+			evictOne();
+		}
+	}
+
+	void clearWhileLocked() {
+		StoredResponse *response;
+
+		while ((response = TAILQ_FIRST(&clock)) != NULL) {
+			erase(response);
+		}
+		clockHand = NULL;
+	}
+
+public:
+	/**
+	 * @param readerCount The number of threads that may share this storage,
+	 *                    or 0 if it is private to a single thread.
+	 */
+	ResponseCacheStorage(unsigned int _maxEntries = DEFAULT_MAX_ENTRIES,
+		size_t _maxMemory = DEFAULT_MAX_MEMORY,
+		unsigned int _readerCount = 0)
+		: readerCount(_readerCount),
+		  readers(NULL),
+		  maxEntries(std::max(_maxEntries, 1u)),
+		  maxMemory(_maxMemory),
+		  entryCount(0),
+		  memoryUsage(0),
+		  evictions(0),
+		  clockHand(NULL)
+	{
+		epoch.store(0, boost::memory_order_relaxed);
+		TAILQ_INIT(&clock);
+		TAILQ_INIT(&retired);
+		allocateBuckets();
+		if (readerCount > 0) {
+			readers = new ReaderSlot[readerCount];
+			for (unsigned int i = 0; i < readerCount; i++) {
+				readers[i].epoch.store(NOT_READING, boost::memory_order_relaxed);
+				readers[i].depth = 0;
+			}
+		}
+	}
+
+	~ResponseCacheStorage() {
+		StoredResponse *response;
+
+		clearWhileLocked();
+		while ((response = TAILQ_FIRST(&retired)) != NULL) {
+			TAILQ_REMOVE(&retired, response, nextInClock);
+			destroy(response);
+		}
+		delete[] buckets;
+		delete[] readers;
+	}
+
+	/**
+	 * Changes the capacity. Existing entries are evicted. May only be
+	 * called while no other thread uses this storage.
+	 */
+	void setCapacity(unsigned int _maxEntries, size_t _maxMemory) {
+		clearWhileLocked();
+		reclaim();
+		delete[] buckets;
+		maxEntries = std::max(_maxEntries, 1u);
+		maxMemory = _maxMemory;
+		allocateBuckets();
+	}
+
+	OXT_FORCE_INLINE
+	bool isShared() const {
+		return readerCount > 0;
+	}
+
+	OXT_FORCE_INLINE
+	unsigned int getReaderCount() const {
+		return readerCount;
+	}
+
+	/**
+	 * Enters a read section. Entries returned by `lookup()` stay valid
+	 * until the matching `endRead()`. Read sections may be nested.
+	 * No-op in private mode.
+	 */
+	void beginRead(unsigned int readerIndex) {
+		if (!isShared()) {
+			return;
+		}
+		assert(readerIndex < readerCount);
+		ReaderSlot &slot = readers[readerIndex];
+		if (slot.depth++ == 0) {
+			slot.epoch.store(epoch.load(boost::memory_order_relaxed),
+				boost::memory_order_seq_cst);
+			boost::atomic_thread_fence(boost::memory_order_seq_cst);
+		}
+	}
+
+	void endRead(unsigned int readerIndex) {
+		if (!isShared()) {
+			return;
+		}
+		assert(readerIndex < readerCount);
+		ReaderSlot &slot = readers[readerIndex];
+		assert(slot.depth > 0);
+		if (--slot.depth == 0) {
+			slot.epoch.store(NOT_READING, boost::memory_order_release);
+		}
+	}
+
+	/**
+	 * Looks up the entry with the given key, or NULL if there is none.
+	 * In shared mode, must be called inside a read section.
+	 */
+	StoredResponse *lookup(const HashedStaticString &key) const {
+		StoredResponse *response = getBucket(key.hash())->load(boost::memory_order_acquire);
+		while (response != NULL) {
+			if (response->hash == key.hash() && key == response->getKey()) {
+				return response;
+			}
+			response = response->nextInBucket.load(boost::memory_order_acquire);
+		}
+		return NULL;
+	}
+
+	/**
+	 * Allocates an entry that is not visible to readers yet. Returns NULL
+	 * if the entry would not fit in the memory budget. The caller must
+	 * fill the HTTP header and body data and then either `publish()` or
+	 * `discard()` the entry.
+	 */
+	StoredResponse *allocate(const HashedStaticString &key, unsigned int headerSize,
+		unsigned int bodySize)
+	{
+		size_t size = StoredResponse::calculateMemoryUsage(key.size(),
+			headerSize, bodySize);
+		if (size > maxMemory) {
+			return NULL;
+		}
+		return create(key, size, headerSize, bodySize);
+	}
+
+	/**
+	 * Like `allocate()`, but the body is not stored in the entry. Instead,
+	 * the caller must assign `nBodyBuffers` mbufs that together contain
+	 * the body to `getHttpBodyBuffers()`. `bodyMemoryUsage` is the amount
+	 * of memory that those mbufs keep alive.
+	 *
+	 * @pre !isShared()
+	 * @pre nBodyBuffers > 0
+	 */
+	StoredResponse *allocateWithBodyBuffers(const HashedStaticString &key,
+		unsigned int headerSize, unsigned int bodySize, unsigned int nBodyBuffers,
+		size_t bodyMemoryUsage)
+	{
+		assert(!isShared());
+		assert(nBodyBuffers > 0);
+		size_t allocationSize = StoredResponse::calculateHttpBodyBuffersOffset(
+			key.size(), headerSize) + nBodyBuffers * sizeof(MemoryKit::mbuf);
+		if (allocationSize + bodyMemoryUsage > maxMemory) {
+			return NULL;
+		}
+
+		StoredResponse *response = create(key, allocationSize, headerSize, bodySize);
+		if (OXT_UNLIKELY(response == NULL)) {
+			return NULL;
+		}
+		MemoryKit::mbuf *buffers = response->getHttpBodyBuffers();
+		for (unsigned int i = 0; i < nBodyBuffers; i++) {
+			new (&buffers[i]) MemoryKit::mbuf();
+		}
+		response->nHttpBodyBuffers = nBodyBuffers;
+		response->memoryUsage += bodyMemoryUsage;
+		return response;
+	}
+
+	void discard(StoredResponse *response) {
+		destroy(response);
+	}
+
+	/**
+	 * Makes an entry obtained from `allocate()` visible to readers,
+	 * replacing any existing entry with the same key. Evicts entries
+	 * as necessary to stay within capacity.
+	 */
+	void publish(StoredResponse *response) {
+		boost::unique_lock<boost::mutex> l;
+		lockIfShared(l);
+
+		StoredResponse *existing = lookupWhileWriting(
+			HashedStaticString(response->getKey().data(), response->keySize,
+				response->hash));
+		if (existing != NULL) {
+			erase(existing);
+		}
+		makeRoomFor(response->getMemoryUsage());
+		insert(response);
+	}
+
+	/**
+	 * Removes the entry with the given key. If `expected` is given, only
+	 * removes the entry if it is still that one. Returns whether an entry
+	 * was removed.
+	 */
+	bool remove(const HashedStaticString &key, const StoredResponse *expected = NULL) {
+		boost::unique_lock<boost::mutex> l;
+		lockIfShared(l);
+
+		StoredResponse *response = lookupWhileWriting(key);
+		if (response != NULL && (expected == NULL || response == expected)) {
+			erase(response);
+			return true;
+		} else {
+			return false;
+		}
+	}
+
+	void clear() {
+		boost::unique_lock<boost::mutex> l;
+		lockIfShared(l);
+		clearWhileLocked();
+	}
+
+	OXT_FORCE_INLINE
+	unsigned int getMaxEntries() const {
+		return maxEntries;
+	}
+
+	OXT_FORCE_INLINE
+	size_t getMaxMemory() const {
+		return maxMemory;
+	}
+
+	/**
+	 * A single entry may use at most 1/8th of the memory budget, so that
+	 * one large response cannot flush the entire cache.
+	 */
+	OXT_FORCE_INLINE
+	size_t getMaxBodySize() const {
+		return maxMemory / 8;
+	}
+
+	// The statistics below are read without locking in shared mode, so
+	// they are approximate when read from another thread.
+
+	OXT_FORCE_INLINE
+	unsigned int getEntryCount() const {
+		return entryCount;
+	}
+
+	OXT_FORCE_INLINE
+	size_t getMemoryUsage() const {
+		return memoryUsage;
+	}
+
+	OXT_FORCE_INLINE
+	unsigned int getEvictions() const {
+		return evictions;
+	}
+
+	string inspect() const {
+		boost::unique_lock<boost::mutex> l;
+		lockIfShared(l);
+
+		stringstream stream;
+		const StoredResponse *response;
+		unsigned int i = 0;
+
+		TAILQ_FOREACH(response, &clock, nextInClock) {
+			time_t expiryDate = response->expiryDate;
+			stream << " #" << i << ": hash=" << response->hash
+				<< ", referenced=" << response->referenced.load(boost::memory_order_relaxed)
+				<< ", expiryDate=" << expiryDate
+				<< ", size=" << response->getMemoryUsage()
+				<< ", bodyBuffers=" << response->nHttpBodyBuffers
+				<< ", keySize=" << response->keySize << ", key=\""
+				<< cEscapeString(response->getKey()) << "\"\n";
+			i++;
+		}
+		return stream.str();
+	}
+};
+
+
+} // namespace Passenger
+
+#endif /* _PASSENGER_RESPONSE_CACHE_STORAGE_H_ */
@@ -60,6 +60,7 @@ using namespace std;
  *   client_freelist_limit        unsigned integer   -          default(0)
  *   fd_passing_password          string             required   secret
  *   min_spare_clients            unsigned integer   -          default(0)
+ *   pipelined_requests_limit     unsigned integer   -          default(0)
  *   request_freelist_limit       unsigned integer   -          default(1024)
  *   start_reading_after_accept   boolean            -          default(true)
  *
@@ -63,19 +63,29 @@ using namespace std;
  *   app_output_log_level                                                     string             -          default("notice")
  *   benchmark_mode                                                           string             -          -
  *   controller_accept_burst_count                                            unsigned integer   -          default(32)
+ *   controller_accept_load_balancing_policy                                  string             -          default("round_robin"),read_only
  *   controller_addresses                                                     array of strings   -          default,read_only
  *   controller_client_freelist_limit                                         unsigned integer   -          default(0)
  *   controller_cpu_affine                                                    boolean            -          default(false),read_only
+ *   controller_fd_source_channel_readv_buffers                               unsigned integer   -          default(1)
  *   controller_file_buffered_channel_auto_start_mover                        boolean            -          default(true)
  *   controller_file_buffered_channel_auto_truncate_file                      boolean            -          default(true)
  *   controller_file_buffered_channel_buffer_dir                              string             -          default
+ *   controller_file_buffered_channel_buffer_file_pool_size                   unsigned integer   -          default(0),read_only
  *   controller_file_buffered_channel_delay_in_file_mode_switching            unsigned integer   -          default(0)
+ *   controller_file_buffered_channel_io_uring                                boolean            -          default(false),read_only
  *   controller_file_buffered_channel_max_disk_chunk_read_size                unsigned integer   -          default(0)
+ *   controller_file_buffered_channel_memory_budget                           unsigned integer   -          default(0)
  *   controller_file_buffered_channel_threshold                               unsigned integer   -          default(131072)
  *   controller_mbuf_block_chunk_size                                         unsigned integer   -          default(4096),read_only
+ *   controller_mbuf_block_huge_pages                                         boolean            -          default(false),read_only
+ *   controller_mbuf_block_size_classes                                       boolean            -          default(false),read_only
+ *   controller_mbuf_block_slab_size                                          unsigned integer   -          default(0),read_only
  *   controller_min_spare_clients                                             unsigned integer   -          default(0)
  *   controller_pid_file                                                      string             -          default,read_only
+ *   controller_pipelined_requests_limit                                      unsigned integer   -          default(0)
  *   controller_request_freelist_limit                                        unsigned integer   -          default(1024)
+ *   controller_reuse_port                                                    boolean            -          default(false),read_only
  *   controller_secure_headers_password                                       string             -          default,secret
  *   controller_socket_backlog                                                unsigned integer   -          default(2048),read_only
  *   controller_start_reading_after_accept                                    boolean            -          default(true)
@@ -84,14 +94,22 @@ using namespace std;
  *   core_api_server_addresses                                                array of strings   -          default([]),read_only
  *   core_api_server_authorizations                                           array              -          default("[FILTERED]"),secret
  *   core_api_server_client_freelist_limit                                    unsigned integer   -          default(0)
+ *   core_api_server_fd_source_channel_readv_buffers                          unsigned integer   -          default(1)
  *   core_api_server_file_buffered_channel_auto_start_mover                   boolean            -          default(true)
  *   core_api_server_file_buffered_channel_auto_truncate_file                 boolean            -          default(true)
  *   core_api_server_file_buffered_channel_buffer_dir                         string             -          default
+ *   core_api_server_file_buffered_channel_buffer_file_pool_size              unsigned integer   -          default(0),read_only
  *   core_api_server_file_buffered_channel_delay_in_file_mode_switching       unsigned integer   -          default(0)
+ *   core_api_server_file_buffered_channel_io_uring                           boolean            -          default(false),read_only
  *   core_api_server_file_buffered_channel_max_disk_chunk_read_size           unsigned integer   -          default(0)
+ *   core_api_server_file_buffered_channel_memory_budget                      unsigned integer   -          default(0)
  *   core_api_server_file_buffered_channel_threshold                          unsigned integer   -          default(131072)
  *   core_api_server_mbuf_block_chunk_size                                    unsigned integer   -          default(4096),read_only
+ *   core_api_server_mbuf_block_huge_pages                                    boolean            -          default(false),read_only
+ *   core_api_server_mbuf_block_size_classes                                  boolean            -          default(false),read_only
+ *   core_api_server_mbuf_block_slab_size                                     unsigned integer   -          default(0),read_only
  *   core_api_server_min_spare_clients                                        unsigned integer   -          default(0)
+ *   core_api_server_pipelined_requests_limit                                 unsigned integer   -          default(0)
  *   core_api_server_request_freelist_limit                                   unsigned integer   -          default(1024)
  *   core_api_server_start_reading_after_accept                               boolean            -          default(true)
  *   core_file_descriptor_ulimit                                              unsigned integer   -          default(0),read_only
@@ -136,6 +154,7 @@ using namespace std;
  *   pool_selfchecks                                                          boolean            -          default(false)
  *   prestart_urls                                                            array of strings   -          default([]),read_only
  *   response_buffer_high_watermark                                           unsigned integer   -          default(134217728)
+ *   response_splice_threshold                                                unsigned integer   -          default(262144)
  *   security_update_checker_certificate_path                                 string             -          -
  *   security_update_checker_disabled                                         boolean            -          default(false)
  *   security_update_checker_interval                                         unsigned integer   -          default(86400)
@@ -150,6 +169,14 @@ using namespace std;
  *   standalone_engine                                                        string             -          default
  *   startup_report_file                                                      string             -          -
  *   stat_throttle_rate                                                       unsigned integer   -          default(10)
+ *   thread_session_slot_idle_time                                            unsigned integer   -          default(10),read_only
+ *   thread_session_slot_max_reuses                                           unsigned integer   -          default(100),read_only
+ *   thread_session_slots                                                     unsigned integer   -          default(0),read_only
+ *   turbocache_compression                                                   boolean            -          default(false),read_only
+ *   turbocache_max_entries                                                   unsigned integer   -          default(1024),read_only
+ *   turbocache_max_memory                                                    unsigned integer   -          default(16777216),read_only
+ *   turbocache_serve_stale                                                   boolean            -          default(true),read_only
+ *   turbocache_shared                                                        boolean            -          default(false),read_only
  *   turbocaching                                                             boolean            -          default(true),read_only
  *   user                                                                     string             -          default,read_only
  *   user_switching                                                           boolean            -          default(true)
@@ -160,14 +187,22 @@ using namespace std;
  *   watchdog_api_server_addresses                                            array of strings   -          default([]),read_only
  *   watchdog_api_server_authorizations                                       array              -          default("[FILTERED]"),secret
  *   watchdog_api_server_client_freelist_limit                                unsigned integer   -          default(0)
+ *   watchdog_api_server_fd_source_channel_readv_buffers                      unsigned integer   -          default(1)
  *   watchdog_api_server_file_buffered_channel_auto_start_mover               boolean            -          default(true)
  *   watchdog_api_server_file_buffered_channel_auto_truncate_file             boolean            -          default(true)
  *   watchdog_api_server_file_buffered_channel_buffer_dir                     string             -          default
+ *   watchdog_api_server_file_buffered_channel_buffer_file_pool_size          unsigned integer   -          default(0),read_only
  *   watchdog_api_server_file_buffered_channel_delay_in_file_mode_switching   unsigned integer   -          default(0)
+ *   watchdog_api_server_file_buffered_channel_io_uring                       boolean            -          default(false),read_only
  *   watchdog_api_server_file_buffered_channel_max_disk_chunk_read_size       unsigned integer   -          default(0)
+ *   watchdog_api_server_file_buffered_channel_memory_budget                  unsigned integer   -          default(0)
  *   watchdog_api_server_file_buffered_channel_threshold                      unsigned integer   -          default(131072)
  *   watchdog_api_server_mbuf_block_chunk_size                                unsigned integer   -          default(4096),read_only
+ *   watchdog_api_server_mbuf_block_huge_pages                                boolean            -          default(false),read_only
+ *   watchdog_api_server_mbuf_block_size_classes                              boolean            -          default(false),read_only
+ *   watchdog_api_server_mbuf_block_slab_size                                 unsigned integer   -          default(0),read_only
  *   watchdog_api_server_min_spare_clients                                    unsigned integer   -          default(0)
+ *   watchdog_api_server_pipelined_requests_limit                             unsigned integer   -          default(0)
  *   watchdog_api_server_request_freelist_limit                               unsigned integer   -          default(1024)
  *   watchdog_api_server_start_reading_after_accept                           boolean            -          default(true)
  *   watchdog_pid_file                                                        string             -          read_only
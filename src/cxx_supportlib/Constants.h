@@ -59,6 +59,7 @@
 #define DEFAULT_MAX_PRELOADER_IDLE_TIME 300
 #define DEFAULT_MAX_REQUEST_QUEUE_SIZE 100
 #define DEFAULT_MBUF_CHUNK_SIZE 4096
+#define DEFAULT_MBUF_SLAB_SIZE 2097152
 #define DEFAULT_NODEJS "node"
 #define DEFAULT_POOL_IDLE_TIME 300
 #define DEFAULT_PYTHON "python"
@@ -18,6 +18,11 @@
 
 #include <cstdlib>
 #include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __linux__
+	#include <sys/syscall.h>
+#endif
 #include <oxt/macros.hpp>
 #include <oxt/thread.hpp>
 #include <oxt/backtrace.hpp>
@@ -33,6 +38,37 @@ namespace MemoryKit {
 
 //#define MBUF_DEBUG_REFCOUNTS
 
+#if defined(__linux__) && defined(SYS_mbind) && defined(SYS_getcpu)
+	#define MBUF_HAVE_NUMA
+	// From <linux/mempolicy.h>
+	#ifndef MPOL_PREFERRED
+		#define MPOL_PREFERRED 1
+	#endif
+#endif
+
+#ifndef MAP_ANONYMOUS
+	#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define MBUF_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/*
+ * A large memory region that normal mbuf_blocks are carved out of, one
+ * chunk after another. Carved chunks are never given back individually:
+ * they're either active or on the pool's freelist. Once all of them are
+ * on the freelist, mbuf_pool_compact() unmaps the entire slab.
+ */
+struct mbuf_slab {
+	struct mbuf_slab *next;
+	void            *mapping;       /* mmap()ed region (const) */
+	size_t           mapping_size;  /* (const) */
+	char            *start;         /* start of first chunk (const) */
+	boost::uint32_t  nchunks;       /* # chunks that fit (const) */
+	boost::uint32_t  ncarved;       /* # chunks carved so far */
+	boost::uint32_t  nactive;       /* # carved chunks that are not on the freelist */
+	bool             huge;          /* backed by huge pages (const) */
+};
+
 #define ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, expr) \
 	do { \
 		if (OXT_UNLIKELY(!(expr))) { \
@@ -50,18 +86,22 @@ static void
 _mbuf_block_mark_as_active(struct mbuf_pool *pool, struct mbuf_block *mbuf_block)
 {
 	STAILQ_NEXT(mbuf_block, next) = NULL;
+	if (mbuf_block->slab != NULL) {
+		mbuf_block->slab->nactive++;
+	}
 	#ifdef MBUF_ENABLE_DEBUGGING
 		TAILQ_INSERT_HEAD(&pool->active_mbuf_blockq, mbuf_block, active_q);
 	#endif
 	#ifdef MBUF_ENABLE_BACKTRACES
 		mbuf_block->backtrace = strdup(oxt::thread::current_backtrace().c_str());
 	#endif
-	mbuf_block->refcount = 1;
+	mbuf_block->refcount.store(1, boost::memory_order_relaxed);
 	pool->nactive_mbuf_blockq++;
 }
 
 static struct mbuf_block *
-_mbuf_block_init(struct mbuf_pool *pool, char *buf, size_t block_offset)
+_mbuf_block_init(struct mbuf_pool *pool, char *buf, size_t block_offset,
+	struct mbuf_slab *slab = NULL)
 {
 	struct mbuf_block *mbuf_block;
 
@@ -113,18 +153,218 @@ _mbuf_block_init(struct mbuf_pool *pool, char *buf, size_t block_offset)
 	mbuf_block = (struct mbuf_block *)(buf + block_offset);
 	mbuf_block->magic = MBUF_BLOCK_MAGIC;
 	mbuf_block->pool  = pool;
+	mbuf_block->slab  = slab;
 	mbuf_block->offset = 0;
 
 	_mbuf_block_mark_as_active(pool, mbuf_block);
 	return mbuf_block;
 }
 
+static void
+_mbuf_pool_bind_to_numa_node(struct mbuf_pool *pool, void *buf, size_t size)
+{
+	#ifdef MBUF_HAVE_NUMA
+		if (pool->numa_node >= 0) {
+			unsigned long nodemask = 1UL << pool->numa_node;
+			syscall(SYS_mbind, buf, size, MPOL_PREFERRED,
+				&nodemask, sizeof(nodemask) * 8, 0);
+		}
+	#endif
+}
+
+/*
+ * Allocates memory for a normal mbuf_block. If the pool is bound to a NUMA
+ * node then we ask the kernel to place the pages on that node. This is only
+ * a preference: pages that malloc has already faulted in elsewhere stay where
+ * they are.
+ */
+static char *
+_mbuf_pool_alloc_chunk(struct mbuf_pool *pool)
+{
+	#ifdef MBUF_HAVE_NUMA
+		if (pool->numa_node >= 0) {
+			static const long page_size = sysconf(_SC_PAGESIZE);
+			void *buf;
+
+			if (posix_memalign(&buf, page_size, pool->mbuf_block_chunk_size) != 0) {
+				return NULL;
+			}
+			_mbuf_pool_bind_to_numa_node(pool, buf, pool->mbuf_block_chunk_size);
+			return (char *) buf;
+		}
+	#endif
+	return (char *) malloc(pool->mbuf_block_chunk_size);
+}
+
+/*
+ * Maps a new slab. With huge pages, we first try explicit huge pages
+ * (MAP_HUGETLB), which only works if the administrator has reserved some.
+ * Otherwise we map a region that is aligned to the huge page size, so that
+ * transparent huge pages can back it, and advise the kernel to do so.
+ */
+static struct mbuf_slab *
+_mbuf_pool_new_slab(struct mbuf_pool *pool)
+{
+	struct mbuf_slab *slab;
+	size_t size = pool->mbuf_block_slab_size;
+	void *mapping = MAP_FAILED;
+	size_t mapping_size = size;
+	char *start;
+	bool huge = false;
+
+	slab = (struct mbuf_slab *) malloc(sizeof(struct mbuf_slab));
+	if (OXT_UNLIKELY(slab == NULL)) {
+		return NULL;
+	}
+
+	#ifdef MAP_HUGETLB
+		if (pool->mbuf_block_huge_pages && size % MBUF_HUGE_PAGE_SIZE == 0) {
+			mapping = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			huge = mapping != MAP_FAILED;
+		}
+	#endif
+	if (mapping == MAP_FAILED) {
+		if (pool->mbuf_block_huge_pages) {
+			mapping_size = size + MBUF_HUGE_PAGE_SIZE;
+		}
+		mapping = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (OXT_UNLIKELY(mapping == MAP_FAILED)) {
+			free(slab);
+			return NULL;
+		}
+	}
+
+	start = (char *) mapping;
+	if (pool->mbuf_block_huge_pages && !huge) {
+		uintptr_t addr = (uintptr_t) mapping;
+		start = (char *) ((addr + MBUF_HUGE_PAGE_SIZE - 1) & ~((uintptr_t) MBUF_HUGE_PAGE_SIZE - 1));
+		#ifdef MADV_HUGEPAGE
+			huge = madvise(start, size, MADV_HUGEPAGE) == 0;
+		#endif
+	}
+	_mbuf_pool_bind_to_numa_node(pool, start, size);
+
+	slab->mapping = mapping;
+	slab->mapping_size = mapping_size;
+	slab->start = start;
+	slab->nchunks = size / pool->mbuf_block_chunk_size;
+	slab->ncarved = 0;
+	slab->nactive = 0;
+	slab->huge = huge;
+	slab->next = pool->slabs;
+	pool->slabs = slab;
+	pool->nslabs++;
+	if (huge) {
+		pool->nhuge_slabs++;
+	}
+	return slab;
+}
+
+static void
+_mbuf_pool_free_slab(struct mbuf_pool *pool, struct mbuf_slab *slab)
+{
+	assert(slab->nactive == 0);
+	munmap(slab->mapping, slab->mapping_size);
+	pool->nslabs--;
+	if (slab->huge) {
+		pool->nhuge_slabs--;
+	}
+	pool->nreclaimed_slabs++;
+	free(slab);
+}
+
+static struct mbuf_block *
+_mbuf_pool_carve_from_slab(struct mbuf_pool *pool)
+{
+	struct mbuf_slab *slab = pool->current_slab;
+	char *buf;
+
+	if (slab == NULL || slab->ncarved == slab->nchunks) {
+		slab = _mbuf_pool_new_slab(pool);
+		if (OXT_UNLIKELY(slab == NULL)) {
+			return NULL;
+		}
+		pool->current_slab = slab;
+	}
+
+	buf = slab->start + slab->ncarved * pool->mbuf_block_chunk_size;
+	slab->ncarved++;
+	return _mbuf_block_init(pool, buf, pool->mbuf_block_offset, slab);
+}
+
+static bool
+_mbuf_block_is_remote(struct mbuf_block *mbuf_block)
+{
+	struct mbuf_pool *pool = mbuf_block->pool;
+	return pool->bound && !pthread_equal(pool->owner, pthread_self());
+}
+
+/*
+ * Called by a thread other than the pool's owner when an mbuf_block's
+ * refcount drops to 0. Pushes it on the pool's lock-free remote free queue,
+ * so that the owner can put it back on the freelist later.
+ */
+static void
+_mbuf_block_put_remote(struct mbuf_block *mbuf_block)
+{
+	struct mbuf_pool *pool = mbuf_block->pool;
+	struct mbuf_block *head = pool->remote_free_blockq.load(boost::memory_order_relaxed);
+
+	do {
+		STAILQ_NEXT(mbuf_block, next) = head;
+	} while (!pool->remote_free_blockq.compare_exchange_weak(head, mbuf_block,
+		boost::memory_order_release, boost::memory_order_relaxed));
+}
+
+static void mbuf_block_free(struct mbuf_block *mbuf_block);
+static void _mbuf_block_put_local(struct mbuf_block *mbuf_block);
+
+/*
+ * Takes all mbuf_blocks from the remote free queue and puts them back on the
+ * freelist (or frees them, if they're standalone). Must be called from the
+ * owner thread.
+ */
+static unsigned int
+_mbuf_pool_drain_remote_frees(struct mbuf_pool *pool)
+{
+	struct mbuf_block *mbuf_block, *next;
+	unsigned int count = 0;
+
+	if (pool->remote_free_blockq.load(boost::memory_order_relaxed) == NULL) {
+		return 0;
+	}
+
+	mbuf_block = pool->remote_free_blockq.exchange(NULL, boost::memory_order_acquire);
+	while (mbuf_block != NULL) {
+		next = STAILQ_NEXT(mbuf_block, next);
+		STAILQ_NEXT(mbuf_block, next) = NULL;
+		if (mbuf_block->offset > 0) {
+			ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, pool->nactive_mbuf_blockq > 0);
+			pool->nactive_mbuf_blockq--;
+			mbuf_block_free(mbuf_block);
+		} else {
+			_mbuf_block_put_local(mbuf_block);
+		}
+		mbuf_block = next;
+		count++;
+	}
+
+	pool->nremote_frees += count;
+	return count;
+}
+
 static struct mbuf_block *
 _mbuf_block_get(struct mbuf_pool *pool)
 {
 	struct mbuf_block *mbuf_block;
 	char *buf;
 
+	if (STAILQ_EMPTY(&pool->free_mbuf_blockq)) {
+		_mbuf_pool_drain_remote_frees(pool);
+	}
+
 	if (!STAILQ_EMPTY(&pool->free_mbuf_blockq)) {
 		assert(pool->nfree_mbuf_blockq > 0);
 
@@ -133,12 +373,18 @@ _mbuf_block_get(struct mbuf_pool *pool)
 		ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, mbuf_block->refcount == 0);
 
 		pool->nfree_mbuf_blockq--;
+		pool->nhits++;
 		STAILQ_REMOVE_HEAD(&pool->free_mbuf_blockq, next);
 		_mbuf_block_mark_as_active(pool, mbuf_block);
 		return mbuf_block;
 	}
 
-	buf = (char *) malloc(pool->mbuf_block_chunk_size);
+	pool->nmisses++;
+	if (pool->mbuf_block_slab_size > 0) {
+		return _mbuf_pool_carve_from_slab(pool);
+	}
+
+	buf = _mbuf_pool_alloc_chunk(pool);
 	if (OXT_UNLIKELY(buf == NULL)) {
 		return NULL;
 	}
@@ -213,6 +459,7 @@ mbuf_block_free(struct mbuf_block *mbuf_block)
 
 	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, STAILQ_NEXT(mbuf_block, next) == NULL);
 	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, mbuf_block->magic == MBUF_BLOCK_MAGIC);
+	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, mbuf_block->slab == NULL);
 
 	#ifdef MBUF_ENABLE_DEBUGGING
 		TAILQ_REMOVE(&mbuf_block->pool->active_mbuf_blockq, mbuf_block, active_q);
@@ -239,9 +486,23 @@ mbuf_block_put(struct mbuf_block *mbuf_block)
 	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, STAILQ_NEXT(mbuf_block, next) == NULL);
 	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, mbuf_block->magic == MBUF_BLOCK_MAGIC);
 	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, mbuf_block->refcount == 0);
-	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, mbuf_block->pool->nactive_mbuf_blockq > 0);
 	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, mbuf_block->offset == 0);
 
+	if (OXT_UNLIKELY(_mbuf_block_is_remote(mbuf_block))) {
+		_mbuf_block_put_remote(mbuf_block);
+	} else {
+		_mbuf_block_put_local(mbuf_block);
+	}
+}
+
+static void
+_mbuf_block_put_local(struct mbuf_block *mbuf_block)
+{
+	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, mbuf_block->pool->nactive_mbuf_blockq > 0);
+
+	if (mbuf_block->slab != NULL) {
+		mbuf_block->slab->nactive--;
+	}
 	mbuf_block->pool->nfree_mbuf_blockq++;
 	mbuf_block->pool->nactive_mbuf_blockq--;
 	STAILQ_INSERT_HEAD(&mbuf_block->pool->free_mbuf_blockq, mbuf_block, next);
@@ -280,6 +541,112 @@ mbuf_pool_init(struct mbuf_pool *pool)
 	#endif
 
 	pool->mbuf_block_offset = pool->mbuf_block_chunk_size - MBUF_BLOCK_HSIZE;
+
+	pool->remote_free_blockq.store(NULL, boost::memory_order_relaxed);
+	pool->bound = false;
+	pool->numa_node = -1;
+	pool->nhits = 0;
+	pool->nmisses = 0;
+	pool->nremote_frees = 0;
+
+	pool->mbuf_block_slab_size = 0;
+	pool->mbuf_block_huge_pages = false;
+	pool->slabs = NULL;
+	pool->current_slab = NULL;
+	pool->nslabs = 0;
+	pool->nhuge_slabs = 0;
+	pool->nreclaimed_slabs = 0;
+
+	pool->nsize_classes = 0;
+}
+
+/*
+ * Makes the pool carve normal mbuf_blocks out of slabs of `slab_size` bytes
+ * (rounded up to a multiple of the chunk size). If `huge_pages` is true then
+ * slabs are backed by huge pages where possible; use a multiple of 2 MB as
+ * slab size in that case. Must be called right after mbuf_pool_init().
+ */
+void
+mbuf_pool_enable_slabs(struct mbuf_pool *pool, size_t slab_size, bool huge_pages)
+{
+	assert(pool->nactive_mbuf_blockq == 0);
+	assert(pool->nfree_mbuf_blockq == 0);
+	size_t chunk_size = pool->mbuf_block_chunk_size;
+	pool->mbuf_block_slab_size = (slab_size + chunk_size - 1) / chunk_size * chunk_size;
+	pool->mbuf_block_huge_pages = huge_pages;
+}
+
+/*
+ * Registers `class_pool`, an initialized pool with a different chunk size,
+ * as a size class of `pool`. `class_pool` must outlive `pool`'s use of it
+ * and is not deinitialized by mbuf_pool_deinit(pool).
+ */
+void
+mbuf_pool_add_size_class(struct mbuf_pool *pool, struct mbuf_pool *class_pool)
+{
+	assert(pool->nsize_classes < MBUF_MAX_SIZE_CLASSES);
+	assert(class_pool != pool);
+	pool->size_classes[pool->nsize_classes++] = class_pool;
+}
+
+/*
+ * Returns the pool, out of `pool` and its size classes, with the smallest
+ * data size that can hold `size` bytes. If none of them is large enough
+ * then the one with the largest data size is returned.
+ */
+struct mbuf_pool *
+mbuf_pool_for_size(struct mbuf_pool *pool, size_t size)
+{
+	struct mbuf_pool *best = pool, *largest = pool;
+	bool fits = size <= mbuf_pool_data_size(pool);
+	boost::uint32_t i;
+
+	for (i = 0; i < pool->nsize_classes; i++) {
+		struct mbuf_pool *class_pool = pool->size_classes[i];
+		size_t data_size = mbuf_pool_data_size(class_pool);
+
+		if (size <= data_size
+		 && (!fits || data_size < mbuf_pool_data_size(best)))
+		{
+			best = class_pool;
+			fits = true;
+		}
+		if (data_size > mbuf_pool_data_size(largest)) {
+			largest = class_pool;
+		}
+	}
+
+	return fits ? best : largest;
+}
+
+/*
+ * Makes the calling thread the owner of the pool: mbuf_blocks released by
+ * other threads are from now on handed back through the remote free queue.
+ * If `numa_local` is true (which only makes sense if the thread is pinned to
+ * a CPU) and the system has multiple NUMA nodes, then new mbuf_blocks are
+ * allocated on the NUMA node that the calling thread runs on.
+ *
+ * Must be called before other threads start releasing mbuf_blocks from
+ * this pool.
+ */
+void
+mbuf_pool_bind_to_current_thread(struct mbuf_pool *pool, bool numa_local)
+{
+	pool->owner = pthread_self();
+	pool->bound = true;
+	pool->numa_node = -1;
+
+	#ifdef MBUF_HAVE_NUMA
+		unsigned int cpu, node;
+
+		if (numa_local
+		 && access("/sys/devices/system/node/node1", F_OK) == 0
+		 && syscall(SYS_getcpu, &cpu, &node, NULL) == 0
+		 && node < sizeof(unsigned long) * 8)
+		{
+			pool->numa_node = node;
+		}
+	#endif
 }
 
 void
@@ -298,10 +665,58 @@ mbuf_pool_data_size(struct mbuf_pool *pool)
 	return pool->mbuf_block_offset;
 }
 
+/*
+ * Removes all free mbuf_blocks that belong to slabs without active
+ * mbuf_blocks from the freelist, then unmaps those slabs. Free mbuf_blocks
+ * in slabs that are still partially in use stay on the freelist.
+ */
+static unsigned int
+_mbuf_pool_compact_slabs(struct mbuf_pool *pool)
+{
+	struct mhdr keep;
+	struct mbuf_slab **slab_ptr, *slab;
+	unsigned int count = 0;
+
+	STAILQ_INIT(&keep);
+	while (!STAILQ_EMPTY(&pool->free_mbuf_blockq)) {
+		struct mbuf_block *mbuf_block = STAILQ_FIRST(&pool->free_mbuf_blockq);
+		mbuf_block_remove(&pool->free_mbuf_blockq, mbuf_block);
+		if (mbuf_block->slab->nactive == 0) {
+			pool->nfree_mbuf_blockq--;
+			count++;
+		} else {
+			STAILQ_INSERT_TAIL(&keep, mbuf_block, next);
+		}
+	}
+	STAILQ_CONCAT(&pool->free_mbuf_blockq, &keep);
+
+	slab_ptr = &pool->slabs;
+	while (*slab_ptr != NULL) {
+		slab = *slab_ptr;
+		if (slab->nactive == 0) {
+			*slab_ptr = slab->next;
+			if (pool->current_slab == slab) {
+				pool->current_slab = NULL;
+			}
+			_mbuf_pool_free_slab(pool, slab);
+		} else {
+			slab_ptr = &slab->next;
+		}
+	}
+
+	return count;
+}
+
 unsigned int
 mbuf_pool_compact(struct mbuf_pool *pool)
 {
-	unsigned int count = pool->nfree_mbuf_blockq;
+	unsigned int count;
+
+	_mbuf_pool_drain_remote_frees(pool);
+	if (pool->mbuf_block_slab_size > 0) {
+		return _mbuf_pool_compact_slabs(pool);
+	}
+	count = pool->nfree_mbuf_blockq;
 
 	while (!STAILQ_EMPTY(&pool->free_mbuf_blockq)) {
 		struct mbuf_block *mbuf_block = STAILQ_FIRST(&pool->free_mbuf_blockq);
@@ -321,7 +736,7 @@ mbuf_block_ref(struct mbuf_block *mbuf_block)
 	#ifdef MBUF_DEBUG_REFCOUNTS
 		printf("[%p] mbuf_block ref %p: %u -> %u\n",
 			oxt::thread_signature, mbuf_block,
-			mbuf_block->refcount, mbuf_block->refcount + 1);
+			mbuf_block->refcount.load(), mbuf_block->refcount.load() + 1);
 	#endif
 	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, mbuf_block->refcount > 0);
 	#ifdef MBUF_ENABLE_BACKTRACES
@@ -332,7 +747,13 @@ mbuf_block_ref(struct mbuf_block *mbuf_block)
 	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, mbuf_block->magic == MBUF_BLOCK_MAGIC);
 	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, mbuf_block->pool->nactive_mbuf_blockq > 0);
 
-	mbuf_block->refcount++;
+	if (OXT_UNLIKELY(mbuf_block->pool->bound)) {
+		mbuf_block->refcount.fetch_add(1, boost::memory_order_relaxed);
+	} else {
+		mbuf_block->refcount.store(
+			mbuf_block->refcount.load(boost::memory_order_relaxed) + 1,
+			boost::memory_order_relaxed);
+	}
 }
 
 void
@@ -341,7 +762,7 @@ mbuf_block_unref(struct mbuf_block *mbuf_block)
 	#ifdef MBUF_DEBUG_REFCOUNTS
 		printf("[%p] mbuf_block unref %p: %u -> %u\n",
 			oxt::thread_signature, mbuf_block,
-			mbuf_block->refcount, mbuf_block->refcount - 1);
+			mbuf_block->refcount.load(), mbuf_block->refcount.load() - 1);
 	#endif
 
 	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, STAILQ_NEXT(mbuf_block, next) == NULL);
@@ -349,14 +770,25 @@ mbuf_block_unref(struct mbuf_block *mbuf_block)
 	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, mbuf_block->refcount > 0);
 	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, mbuf_block->pool->nactive_mbuf_blockq > 0);
 
-	mbuf_block->refcount--;
-	if (mbuf_block->refcount == 0) {
-		if (mbuf_block->offset > 0) {
+	boost::uint32_t refcount;
+	if (OXT_UNLIKELY(mbuf_block->pool->bound)) {
+		// Another thread may hold a reference too. Acquire/release so
+		// that whoever drops the last reference sees all writes made
+		// through the other references before the block is reused.
+		refcount = mbuf_block->refcount.fetch_sub(1, boost::memory_order_acq_rel) - 1;
+	} else {
+		refcount = mbuf_block->refcount.load(boost::memory_order_relaxed) - 1;
+		mbuf_block->refcount.store(refcount, boost::memory_order_relaxed);
+	}
+	if (refcount == 0) {
+		if (OXT_UNLIKELY(_mbuf_block_is_remote(mbuf_block))) {
+			_mbuf_block_put_remote(mbuf_block);
+		} else if (mbuf_block->offset > 0) {
 			ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, mbuf_block->pool->nactive_mbuf_blockq > 0);
 			mbuf_block->pool->nactive_mbuf_blockq--;
 			mbuf_block_free(mbuf_block);
 		} else {
-			mbuf_block_put(mbuf_block);
+			_mbuf_block_put_local(mbuf_block);
 		}
 	}
 }
@@ -383,6 +815,7 @@ mbuf
 mbuf_get_with_size(struct mbuf_pool *pool, size_t size)
 {
 	struct mbuf_block *block;
+	pool = mbuf_pool_for_size(pool, size);
 	if (size <= mbuf_pool_data_size(pool)) {
 		block = mbuf_block_get(pool);
 	} else {
@@ -406,7 +839,7 @@ mbuf_block_print(struct mbuf_block *mbuf_block, std::ostream &stream)
 		"mbuf_block.end: " << (void *) mbuf_block->end << "\n"
 		"mbuf_block.contents: \"" << cEscapeString(StaticString(mbuf_block->start,
 			mbuf_block->end - mbuf_block->start)) << "\"\n"
-		"mbuf_block.refcount: " << mbuf_block->refcount << "\n"
+		"mbuf_block.refcount: " << mbuf_block->refcount.load() << "\n"
 		"mbuf_block.offset: " << mbuf_block->offset << "\n"
 		"mbuf_block.pool: " << (void *) mbuf_block->pool << "\n"
 		"mbuf_block.pool.nfree_mbuf_blockq: " << mbuf_block->pool->nfree_mbuf_blockq << "\n"
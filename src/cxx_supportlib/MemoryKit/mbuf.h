@@ -24,8 +24,10 @@
 #include <cstddef>
 #include <cassert>
 #include <cstring>
+#include <pthread.h>
 #include <oxt/macros.hpp>
 #include <boost/cstdint.hpp>
+#include <boost/atomic.hpp>
 #include <boost/move/core.hpp>
 
 /** A memory buffer allocator system taken from twemproxy and modified to
@@ -54,6 +56,27 @@
  * This approach is similar to how Node.js manages buffer slices.
  * We also got rid of the global variables, and put them in an mbuf_pool
  * struct, which acts like a context structure.
+ *
+ * An mbuf_pool is not thread-safe, but it can be bound to an owner thread
+ * with mbuf_pool_bind_to_current_thread(). mbuf_blocks from a bound pool
+ * may then be referenced and released by other threads too: their refcounts
+ * are updated atomically, and mbuf_blocks whose last reference is released
+ * by another thread are pushed on a lock-free remote free queue, which the
+ * owner drains into its freelist once that runs empty. Binding also lets the
+ * pool allocate new mbuf_blocks on the owner thread's NUMA node. Refcounts of
+ * mbuf_blocks from unbound pools are updated without atomic instructions.
+ *
+ * By default every mbuf_block chunk is malloc()ed separately. With
+ * mbuf_pool_enable_slabs(), chunks are instead carved out of large mmap()ed
+ * slabs, optionally backed by huge pages, which cuts down on TLB misses and
+ * allocator fragmentation. Compaction then returns entire slabs whose chunks
+ * are all free to the OS.
+ *
+ * A pool can also be given other pools with different chunk sizes as size
+ * classes, with mbuf_pool_add_size_class(). mbuf_get_with_size() then takes
+ * the mbuf_block from the smallest class that fits, and readers that know
+ * how much data to expect can pick a class with mbuf_pool_for_size().
+ * mbuf_blocks are always returned to the pool that they came from.
  */
 
 //#define MBUF_ENABLE_DEBUGGING
@@ -67,6 +90,7 @@ using namespace boost;
 
 
 struct mbuf_block;
+struct mbuf_slab;
 struct mhdr;
 
 typedef void (*mbuf_block_copy_t)(struct mbuf_block *, void *);
@@ -84,11 +108,13 @@ struct mbuf_block {
 	char              *start;     /* start of buffer (const) */
 	char              *end;       /* end of buffer (const) */
 	struct mbuf_pool  *pool;      /* containing pool (const) */
-	boost::uint32_t    refcount;  /* number of references by mbuf subsets */
+	struct mbuf_slab  *slab;      /* containing slab, or NULL (const) */
+	boost::atomic<boost::uint32_t> refcount; /* number of references by mbuf subsets */
 	boost::uint32_t    offset;    /* standalone mbuf_block data size */
 };
 
 STAILQ_HEAD(mhdr, struct mbuf_block);
+#define MBUF_MAX_SIZE_CLASSES 4
 #ifdef MBUF_ENABLE_DEBUGGING
 	TAILQ_HEAD(active_mbuf_block_list, struct mbuf_block);
 #endif
@@ -103,6 +129,26 @@ struct mbuf_pool {
 
 	size_t mbuf_block_chunk_size; /* mbuf_block chunk size - header + data (const) */
 	size_t mbuf_block_offset;     /* mbuf_block offset in chunk (const) */
+
+	boost::atomic<struct mbuf_block *> remote_free_blockq; /* mbuf_blocks released by other threads */
+	pthread_t owner;              /* owner thread, if bound */
+	bool bound;                   /* whether bound to an owner thread */
+	int numa_node;                /* NUMA node to allocate on, or -1 */
+
+	boost::uint64_t nhits;        /* # mbuf_block_get() served from the freelist */
+	boost::uint64_t nmisses;      /* # mbuf_block_get() that had to allocate */
+	boost::uint64_t nremote_frees; /* # mbuf_blocks returned by other threads */
+
+	size_t mbuf_block_slab_size;  /* slab size, or 0 if slabs are disabled (const) */
+	bool mbuf_block_huge_pages;   /* whether to back slabs with huge pages (const) */
+	struct mbuf_slab *slabs;      /* all slabs */
+	struct mbuf_slab *current_slab; /* slab that new chunks are carved from */
+	boost::uint32_t nslabs;       /* # slabs */
+	boost::uint32_t nhuge_slabs;  /* # slabs backed by huge pages */
+	boost::uint64_t nreclaimed_slabs; /* # slabs returned to the OS */
+
+	struct mbuf_pool *size_classes[MBUF_MAX_SIZE_CLASSES]; /* pools with other chunk sizes */
+	boost::uint32_t nsize_classes; /* # size class pools */
 };
 
 #define MBUF_BLOCK_MAGIC      0xdeadbeef
@@ -116,6 +162,10 @@ struct mbuf_pool {
 
 void mbuf_pool_init(struct mbuf_pool *pool);
 void mbuf_pool_deinit(struct mbuf_pool *pool);
+void mbuf_pool_bind_to_current_thread(struct mbuf_pool *pool, bool numa_local);
+void mbuf_pool_enable_slabs(struct mbuf_pool *pool, size_t slab_size, bool huge_pages);
+void mbuf_pool_add_size_class(struct mbuf_pool *pool, struct mbuf_pool *class_pool);
+struct mbuf_pool *mbuf_pool_for_size(struct mbuf_pool *pool, size_t size);
 size_t mbuf_pool_data_size(struct mbuf_pool *pool);
 unsigned int mbuf_pool_compact(struct mbuf_pool *pool);
 
@@ -65,6 +65,10 @@ psg_create_pool(size_t size)
 	}
 
 	psg_init_pool(p, size);
+	p->peak_used = 0;
+	p->peak_blocks = 0;
+	p->peak_large = 0;
+	p->nrecycles = 0;
 
 	return p;
 }
@@ -153,6 +157,57 @@ psg_reset_pool(psg_pool_t *pool, size_t size)
 }
 
 
+void
+psg_recycle_pool(psg_pool_t *pool, size_t size)
+{
+	psg_pool_usage_t  usage;
+
+	psg_pool_get_usage(pool, &usage);
+	if (usage.used > pool->peak_used) {
+		pool->peak_used = usage.used;
+	}
+	if (usage.nblocks > pool->peak_blocks) {
+		pool->peak_blocks = usage.nblocks;
+	}
+	if (usage.nlarge > pool->peak_large) {
+		pool->peak_large = usage.nlarge;
+	}
+	pool->nrecycles++;
+
+	psg_deinit_pool(pool);
+	psg_init_pool(pool, size);
+}
+
+
+void
+psg_pool_get_usage(const psg_pool_t *pool, psg_pool_usage_t *usage)
+{
+	const psg_pool_t        *p;
+	const psg_pool_large_t  *l;
+
+	usage->used = 0;
+	usage->nblocks = 0;
+	usage->nlarge = 0;
+
+	for (p = pool; p; p = p->data.next) {
+		const char *start = (const char *) p;
+		if (p == pool) {
+			start += sizeof(psg_pool_t);
+		} else {
+			start += sizeof(psg_pool_data_t);
+		}
+		usage->used += p->data.last - start;
+		usage->nblocks++;
+	}
+
+	for (l = pool->large; l; l = l->next) {
+		if (l->alloc) {
+			usage->nlarge++;
+		}
+	}
+}
+
+
 void *
 psg_palloc(psg_pool_t *pool, size_t size)
 {
@@ -94,13 +94,38 @@ struct psg_pool_s {
 	size_t                max;      /* Read-only */
 	psg_pool_t           *current;
 	psg_pool_large_t     *large;
+
+	/*
+	 * High-water marks over the lifetime of the pool, updated by
+	 * psg_recycle_pool(). Useful for sizing the first block.
+	 */
+	size_t                peak_used;
+	unsigned int          peak_blocks;
+	unsigned int          peak_large;
+	unsigned int          nrecycles;
 };
 
+typedef struct {
+	size_t                used;     /* Bytes allocated from blocks. */
+	unsigned int          nblocks;  /* Number of blocks, including the first one. */
+	unsigned int          nlarge;   /* Number of large allocations. */
+} psg_pool_usage_t;
+
 
 psg_pool_t *psg_create_pool(size_t size);
 void psg_destroy_pool(psg_pool_t *pool);
 bool psg_reset_pool(psg_pool_t *pool, size_t size);
 
+/** Frees all large allocations and all blocks except the first one, and
+ * resets the first block for reuse. Unlike psg_reset_pool(), this always
+ * succeeds. Updates the pool's high-water marks first. `size` must be the
+ * size that the pool was created with.
+ */
+void psg_recycle_pool(psg_pool_t *pool, size_t size);
+
+/** Calculates how much of the pool is currently in use. */
+void psg_pool_get_usage(const psg_pool_t *pool, psg_pool_usage_t *usage);
+
 /** Allocate `size` bytes from the pool, aligned on platform word size. */
 void *psg_palloc(psg_pool_t *pool, size_t size);
 
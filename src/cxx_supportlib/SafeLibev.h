@@ -35,6 +35,8 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/function.hpp>
 #include <boost/bind.hpp>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
 #include <oxt/thread.hpp>
 #include <LoggingKit/LoggingKit.h>
 
@@ -46,24 +48,48 @@ using namespace boost;
 
 /**
  * Class for thread-safely using libev.
+ *
+ * Commands scheduled with `runLater()` from any thread are pushed onto a
+ * lock-free, intrusive multi-producer single-consumer queue. Only the producer
+ * that turns the queue from empty to non-empty wakes up the event loop, so a
+ * burst of commands results in a single `ev_async_send()`. The event loop
+ * thread drains the queue in batches.
+ *
+ * Command objects come from a preallocated pool, so that scheduling a
+ * command doesn't have to go through the memory allocator. The pool's free
+ * list is a lock-free stack whose head is tagged with a counter to avoid
+ * the ABA problem. When the pool is exhausted, commands are allocated on the
+ * heap instead.
  */
 class SafeLibev {
 private:
 	// 2^28-1. Command IDs are 28-bit so that we can pack DataSource's state and
 	// its planId in 32-bits total.
 	static const unsigned int MAX_COMMAND_ID = 268435455;
+	static const unsigned int COMMAND_POOL_SIZE = 256;
 
 	typedef boost::function<void ()> Callback;
 
 	struct Command {
+		Command *next;
 		Callback callback;
+		/**
+		 * While this command is in the pool's free list: 1 + the index of
+		 * the next free command, or 0 if this is the last one. Producers
+		 * may read this concurrently with another producer taking the
+		 * command, hence the atomic.
+		 */
+		boost::atomic<unsigned int> nextFree;
 		unsigned int id: 31;
 		bool canceled: 1;
-
-		Command(unsigned int _id, const Callback &_callback)
-			: callback(_callback),
-			  id(_id),
-			  canceled(false)
+		bool pooled;
+
+		Command()
+			: next(NULL),
+			  nextFree(0),
+			  id(0),
+			  canceled(false),
+			  pooled(false)
 			{ }
 	};
 
@@ -71,10 +97,34 @@ private:
 	pthread_t loopThread;
 	ev_async async;
 
+	/**
+	 * Commands pushed by producers, in LIFO order. Producers push with a
+	 * CAS loop; the consumer takes the entire stack at once.
+	 */
+	boost::atomic<Command *> incomingCommands;
+	boost::atomic<unsigned int> nextCommandId;
+
+	Command *commandPool;
+	/**
+	 * Head of the pool's free list. The lower 32 bits are 1 + the index of
+	 * the first free command (0 if the list is empty), the upper 32 bits
+	 * are incremented on every change.
+	 */
+	boost::atomic<boost::uint64_t> freeCommands;
+	boost::atomic<unsigned int> commandPoolMisses;
+
+	/**
+	 * Protects `readyCommands`, and is used together with `cond` for
+	 * synchronous operations. Producers never grab this lock.
+	 */
 	boost::mutex syncher;
 	boost::condition_variable cond;
-	vector<Command> commands;
-	unsigned int nextCommandId;
+	/**
+	 * Commands taken from `incomingCommands`, in FIFO order, that are yet
+	 * to be run by the event loop thread.
+	 */
+	Command *readyCommandsHead;
+	Command *readyCommandsTail;
 
 	static void asyncHandler(EV_P_ ev_async *w, int revents) {
 		SafeLibev *self = (SafeLibev *) w->data;
@@ -86,17 +136,140 @@ private:
 		(*callback)();
 	}
 
+	/**
+	 * Moves everything in `incomingCommands` to the end of `readyCommands`,
+	 * restoring FIFO order. Must be called while holding `syncher`.
+	 */
+	void drainIncomingCommands() {
+		Command *command = incomingCommands.exchange(NULL, boost::memory_order_acquire);
+		Command *reversed = NULL;
+		Command *tail = command;
+
+		while (command != NULL) {
+			Command *next = command->next;
+			command->next = reversed;
+			reversed = command;
+			command = next;
+		}
+
+		if (reversed != NULL) {
+			if (readyCommandsTail == NULL) {
+				readyCommandsHead = reversed;
+			} else {
+				readyCommandsTail->next = reversed;
+			}
+			readyCommandsTail = tail;
+		}
+	}
+
+	Command *popReadyCommand() {
+		Command *command = readyCommandsHead;
+		if (command != NULL) {
+			readyCommandsHead = command->next;
+			if (readyCommandsHead == NULL) {
+				readyCommandsTail = NULL;
+			}
+		}
+		return command;
+	}
+
+	/**
+	 * Runs all commands that were pushed before this call. Commands pushed
+	 * by the callbacks themselves are run in the next event loop iteration.
+	 * Every callback runs without holding `syncher`, and a command is only
+	 * removed from `readyCommands` right before it is run, so that
+	 * `cancelCommand()` keeps working for the rest of the batch.
+	 */
 	void runCommands() {
 		boost::unique_lock<boost::mutex> l(syncher);
-		vector<Command> commands = this->commands;
-		this->commands.clear();
-		l.unlock();
-
-		vector<Command>::const_iterator it, end = commands.end();
-		for (it = commands.begin(); it != end; it++) {
-			if (!it->canceled) {
-				it->callback();
+		drainIncomingCommands();
+		Command *last = readyCommandsTail;
+		Command *command;
+		bool done = last == NULL;
+
+		while (!done) {
+			command = popReadyCommand();
+			done = command == last;
+			l.unlock();
+			if (!command->canceled) {
+				command->callback();
+			}
+			freeCommand(command);
+			l.lock();
+		}
+	}
+
+	static boost::uint64_t makeFreeListHead(boost::uint64_t oldHead, unsigned int index) {
+		return (((oldHead >> 32) + 1) << 32) | index;
+	}
+
+	Command *allocateCommand() {
+		boost::uint64_t head = freeCommands.load(boost::memory_order_acquire);
+		Command *command;
+
+		do {
+			unsigned int index = (unsigned int) (head & 0xffffffff);
+			if (index == 0) {
+				commandPoolMisses.fetch_add(1, boost::memory_order_relaxed);
+				return new Command();
 			}
+			command = &commandPool[index - 1];
+		} while (!freeCommands.compare_exchange_weak(head,
+			makeFreeListHead(head, command->nextFree.load(boost::memory_order_relaxed)),
+			boost::memory_order_acquire, boost::memory_order_acquire));
+
+		return command;
+	}
+
+	void freeCommand(Command *command) {
+		if (!command->pooled) {
+			delete command;
+			return;
+		}
+
+		// Release whatever the callback has bound before the command
+		// becomes available to other threads.
+		command->callback.clear();
+		command->next = NULL;
+		command->canceled = false;
+
+		unsigned int index = command - commandPool + 1;
+		boost::uint64_t head = freeCommands.load(boost::memory_order_relaxed);
+		do {
+			command->nextFree.store((unsigned int) (head & 0xffffffff),
+				boost::memory_order_relaxed);
+		} while (!freeCommands.compare_exchange_weak(head, makeFreeListHead(head, index),
+			boost::memory_order_release, boost::memory_order_relaxed));
+	}
+
+	unsigned int pushCommand(const Callback &callback) {
+		unsigned int id = nextCommandId.fetch_add(1, boost::memory_order_relaxed)
+			% MAX_COMMAND_ID + 1;
+		Command *command = allocateCommand();
+		command->callback = callback;
+		command->id = id;
+		Command *head = incomingCommands.load(boost::memory_order_relaxed);
+
+		do {
+			command->next = head;
+		} while (!incomingCommands.compare_exchange_weak(head, command,
+			boost::memory_order_release, boost::memory_order_relaxed));
+
+		if (head == NULL) {
+			// Only the producer that made the queue non-empty has to wake
+			// up the event loop. Everybody else piggybacks on that wakeup.
+			ev_async_send(loop, &async);
+		}
+		return id;
+	}
+
+	void deleteAllCommands() {
+		boost::unique_lock<boost::mutex> l(syncher);
+		Command *command;
+
+		drainIncomingCommands();
+		while ((command = popReadyCommand()) != NULL) {
+			freeCommand(command);
 		}
 	}
 
@@ -124,20 +297,23 @@ private:
 		cond.notify_all();
 	}
 
-	void incNextCommandId() {
-		if (nextCommandId == MAX_COMMAND_ID) {
-			nextCommandId = 1;
-		} else {
-			nextCommandId++;
-		}
-	}
-
 public:
 	/** SafeLibev takes over ownership of the loop object. */
 	SafeLibev(struct ev_loop *loop) {
 		this->loop = loop;
 		loopThread = pthread_self();
-		nextCommandId = 1;
+		incomingCommands.store(NULL, boost::memory_order_relaxed);
+		nextCommandId.store(0, boost::memory_order_relaxed);
+		commandPool = new Command[COMMAND_POOL_SIZE];
+		for (unsigned int i = 0; i < COMMAND_POOL_SIZE; i++) {
+			commandPool[i].pooled = true;
+			commandPool[i].nextFree.store(i + 2 <= COMMAND_POOL_SIZE ? i + 2 : 0,
+				boost::memory_order_relaxed);
+		}
+		freeCommands.store(1, boost::memory_order_relaxed);
+		commandPoolMisses.store(0, boost::memory_order_relaxed);
+		readyCommandsHead = NULL;
+		readyCommandsTail = NULL;
 
 		ev_async_init(&async, asyncHandler);
 		ev_set_priority(&async, EV_MAXPRI);
@@ -147,6 +323,8 @@ public:
 
 	~SafeLibev() {
 		destroy();
+		deleteAllCommands();
+		delete[] commandPool;
 		P_LOG_FILE_DESCRIPTOR_CLOSE(ev_loop_get_pipe(loop, 0));
 		P_LOG_FILE_DESCRIPTOR_CLOSE(ev_loop_get_pipe(loop, 1));
 		P_LOG_FILE_DESCRIPTOR_CLOSE(ev_backend_fd(loop));
@@ -194,11 +372,8 @@ public:
 		} else {
 			boost::unique_lock<boost::mutex> l(syncher);
 			bool done = false;
-			commands.push_back(Command(nextCommandId,
-				boost::bind(&SafeLibev::startWatcherAndNotify<Watcher>,
-					this, &watcher, &done)));
-			incNextCommandId();
-			ev_async_send(loop, &async);
+			pushCommand(boost::bind(&SafeLibev::startWatcherAndNotify<Watcher>,
+				this, &watcher, &done));
 			while (!done) {
 				cond.wait(l);
 			}
@@ -212,11 +387,8 @@ public:
 		} else {
 			boost::unique_lock<boost::mutex> l(syncher);
 			bool done = false;
-			commands.push_back(Command(nextCommandId,
-				boost::bind(&SafeLibev::stopWatcherAndNotify<Watcher>,
-					this, &watcher, &done)));
-			incNextCommandId();
-			ev_async_send(loop, &async);
+			pushCommand(boost::bind(&SafeLibev::stopWatcherAndNotify<Watcher>,
+				this, &watcher, &done));
 			while (!done) {
 				cond.wait(l);
 			}
@@ -236,11 +408,8 @@ public:
 		assert(callback != NULL);
 		boost::unique_lock<boost::mutex> l(syncher);
 		bool done = false;
-		commands.push_back(Command(nextCommandId,
-			boost::bind(&SafeLibev::runAndNotify, this,
-				&callback, &done)));
-		incNextCommandId();
-		ev_async_send(loop, &async);
+		pushCommand(boost::bind(&SafeLibev::runAndNotify, this,
+			&callback, &done));
 		while (!done) {
 			cond.wait(l);
 		}
@@ -262,17 +431,13 @@ public:
 		}
 	}
 
+	/**
+	 * Schedules a callback to be run on the event loop thread. Thread-safe
+	 * and lock-free. Returns an ID that can be passed to `cancelCommand()`.
+	 */
 	unsigned int runLater(const Callback &callback) {
 		assert(callback != NULL);
-		unsigned int result;
-		{
-			boost::unique_lock<boost::mutex> l(syncher);
-			commands.push_back(Command(nextCommandId, callback));
-			result = nextCommandId;
-			incNextCommandId();
-		}
-		ev_async_send(loop, &async);
-		return result;
+		return pushCommand(callback);
 	}
 
 	/**
@@ -288,17 +453,29 @@ public:
 		}
 
 		boost::unique_lock<boost::mutex> l(syncher);
-		// TODO: we can do a binary search because the command ID
-		// is monotically increasing except on overflow.
-		vector<Command>::iterator it, end = commands.end();
-		for (it = commands.begin(); it != end; it++) {
-			if (it->id == id) {
-				it->canceled = true;
+		Command *command;
+
+		drainIncomingCommands();
+		for (command = readyCommandsHead; command != NULL; command = command->next) {
+			if (command->id == id && !command->canceled) {
+				command->canceled = true;
 				return true;
 			}
 		}
 		return false;
 	}
+
+	/**
+	 * Number of commands that had to be allocated on the heap because the
+	 * command pool was exhausted. For unit tests.
+	 */
+	unsigned int getCommandPoolMisses() const {
+		return commandPoolMisses.load(boost::memory_order_relaxed);
+	}
+
+	static unsigned int getCommandPoolSize() {
+		return COMMAND_POOL_SIZE;
+	}
 };
 
 typedef boost::shared_ptr<SafeLibev> SafeLibevPtr;
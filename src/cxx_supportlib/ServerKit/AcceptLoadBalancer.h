@@ -28,6 +28,8 @@
 
 #include <boost/bind.hpp>
 #include <boost/cstdint.hpp>
+#include <boost/atomic.hpp>
+#include <boost/scoped_array.hpp>
 #include <oxt/thread.hpp>
 #include <oxt/macros.hpp>
 #include <vector>
@@ -40,11 +42,15 @@
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <poll.h>
+#include <unistd.h>
 
+#include <jsoncpp/json.h>
 #include <Constants.h>
 #include <LoggingKit/LoggingKit.h>
+#include <StaticString.h>
 #include <Utils.h>
 #include <Utils/IOUtils.h>
+#include <Utils/SystemTime.h>
 
 namespace Passenger {
 namespace ServerKit {
@@ -53,9 +59,59 @@ using namespace std;
 using namespace boost;
 
 
+/**
+ * How AcceptLoadBalancer picks the Server that a newly accepted client
+ * is handed to.
+ */
+enum AcceptLoadBalancingPolicy {
+	/** Cycle through all servers, regardless of their load. */
+	ALB_ROUND_ROBIN,
+	/** Pick the server with the fewest active clients. */
+	ALB_LEAST_ACTIVE_CLIENTS,
+	/**
+	 * Pick two servers at random and use the one with the fewest active
+	 * clients. Nearly as well balanced as ALB_LEAST_ACTIVE_CLIENTS, but
+	 * only looks at two servers per client.
+	 */
+	ALB_POWER_OF_TWO_CHOICES
+};
+
+inline const char *
+acceptLoadBalancingPolicyToString(AcceptLoadBalancingPolicy policy) {
+	switch (policy) {
+	case ALB_ROUND_ROBIN:
+		return "round_robin";
+	case ALB_LEAST_ACTIVE_CLIENTS:
+		return "least_active_clients";
+	case ALB_POWER_OF_TWO_CHOICES:
+		return "power_of_two_choices";
+	default:
+		return "unknown";
+	}
+}
+
+/**
+ * Parses the output of acceptLoadBalancingPolicyToString(). Returns whether
+ * `name` is a valid policy name.
+ */
+inline bool
+parseAcceptLoadBalancingPolicy(const StaticString &name, AcceptLoadBalancingPolicy &policy) {
+	if (name == "round_robin") {
+		policy = ALB_ROUND_ROBIN;
+	} else if (name == "least_active_clients") {
+		policy = ALB_LEAST_ACTIVE_CLIENTS;
+	} else if (name == "power_of_two_choices") {
+		policy = ALB_POWER_OF_TWO_CHOICES;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+
 /**
  * Listens for client connections and load balances them to multiple
- * Server objects in a round-robin manner.
+ * Server objects, according to an AcceptLoadBalancingPolicy.
  *
  * Normally, the Server class listens for client connections directly.
  * But this is inefficient in multithreaded situations where you are
@@ -72,12 +128,19 @@ using namespace boost;
  *
  * The AcceptLoadBalancer solves this problem by being the sole entity
  * that listens on the server socket. All client sockets that it
- * accepts are distributed to all registered Server objects, in a
- * round-robin manner.
+ * accepts are distributed to all registered Server objects. By default
+ * this happens in a round-robin manner, but with keep-alive or long-polling
+ * clients that can still leave threads unbalanced, so the load-aware
+ * policies look at each Server's `activeClientCount` instead.
  *
  * Inside the "PassengerAgent core", we activate AcceptLoadBalancer
  * only if `core_threads > 1`, which is often the case because
  * `core_threads` defaults to the number of CPU cores.
+ *
+ * On Linux, the core can instead be configured with `controller_reuse_port`.
+ * Every thread then listens on its own SO_REUSEPORT socket for TCP addresses
+ * and the kernel does the distribution, which saves a thread hop per client.
+ * Unix domain socket addresses always go through the AcceptLoadBalancer.
  */
 template<typename Server>
 class AcceptLoadBalancer {
@@ -93,6 +156,15 @@ private:
 	boost::uint8_t nextServer;
 	bool accept4Available;
 	bool quit;
+	boost::uint32_t randomState;
+
+	/**
+	 * For every server, the number of clients that have been handed to it
+	 * with runLater(), but that it has not yet added to its
+	 * `activeClientCount`. Without this, the load-aware policies would send
+	 * an entire accept burst to the same server.
+	 */
+	boost::scoped_array< boost::atomic<unsigned int> > pendingClients;
 
 	int exitPipe[2];
 	oxt::thread *thread;
@@ -155,23 +227,91 @@ private:
 		}
 	}
 
+	unsigned int getLoad(unsigned int serverIndex) const {
+		return servers[serverIndex]->activeClientCount.load(boost::memory_order_relaxed)
+			+ pendingClients[serverIndex].load(boost::memory_order_relaxed);
+	}
+
+	boost::uint32_t random() {
+		// xorshift32. Only used by the load balancer thread.
+		randomState ^= randomState << 13;
+		randomState ^= randomState >> 17;
+		randomState ^= randomState << 5;
+		return randomState;
+	}
+
+	unsigned int selectLeastActiveServer() {
+		unsigned int result = nextServer;
+		unsigned int resultLoad = getLoad(result);
+
+		// Start scanning at nextServer so that ties are broken
+		// in a round-robin manner.
+		for (unsigned int i = 1; i < servers.size() && resultLoad > 0; i++) {
+			unsigned int candidate = (nextServer + i) % servers.size();
+			unsigned int candidateLoad = getLoad(candidate);
+			if (candidateLoad < resultLoad) {
+				result = candidate;
+				resultLoad = candidateLoad;
+			}
+		}
+		return result;
+	}
+
+	unsigned int selectServerFromTwoChoices() {
+		if (servers.size() == 1) {
+			return 0;
+		}
+
+		unsigned int first = random() % servers.size();
+		unsigned int second = random() % (servers.size() - 1);
+		if (second >= first) {
+			second++;
+		}
+		if (getLoad(second) < getLoad(first)) {
+			return second;
+		} else {
+			return first;
+		}
+	}
+
+	unsigned int selectServer() {
+		unsigned int result;
+
+		switch (policy) {
+		case ALB_LEAST_ACTIVE_CLIENTS:
+			result = selectLeastActiveServer();
+			break;
+		case ALB_POWER_OF_TWO_CHOICES:
+			result = selectServerFromTwoChoices();
+			break;
+		default:
+			result = nextServer;
+			break;
+		}
+
+		nextServer = (result + 1) % servers.size();
+		return result;
+	}
+
 	void distributeNewClients() {
 		unsigned int i;
 
 		for (i = 0; i < newClientCount; i++) {
-			ServerKit::Context *ctx = servers[nextServer]->getContext();
-			P_TRACE(2, "Feeding client to server thread " << (int) nextServer <<
+			unsigned int serverIndex = selectServer();
+			ServerKit::Context *ctx = servers[serverIndex]->getContext();
+			P_TRACE(2, "Feeding client to server thread " << serverIndex <<
 				": file descriptor " << newClients[i]);
-			ctx->libev->runLater(boost::bind(feedNewClient, servers[nextServer],
-				newClients[i]));
-			nextServer = (nextServer + 1) % servers.size();
+			pendingClients[serverIndex].fetch_add(1, boost::memory_order_relaxed);
+			ctx->libev->runLater(boost::bind(&AcceptLoadBalancer<Server>::feedNewClient,
+				this, serverIndex, newClients[i]));
 		}
 
 		newClientCount = 0;
 	}
 
-	static void feedNewClient(Server *server, int fd) {
-		server->feedNewClients(&fd, 1);
+	void feedNewClient(unsigned int serverIndex, int fd) {
+		servers[serverIndex]->feedNewClients(&fd, 1);
+		pendingClients[serverIndex].fetch_sub(1, boost::memory_order_relaxed);
 	}
 
 	int acceptNonBlockingSocket(int serverFd) {
@@ -243,7 +383,10 @@ private:
 	}
 
 public:
+	/** May only be modified before start() is called. */
 	vector<Server *> servers;
+	/** May only be modified before start() is called. */
+	AcceptLoadBalancingPolicy policy;
 
 	AcceptLoadBalancer()
 		: nEndpoints(0),
@@ -251,8 +394,13 @@ public:
 		  nextServer(0),
 		  accept4Available(true),
 		  quit(false),
-		  thread(NULL)
+		  randomState((boost::uint32_t) SystemTime::getUsec() ^ (boost::uint32_t) getpid()),
+		  thread(NULL),
+		  policy(ALB_ROUND_ROBIN)
 	{
+		if (randomState == 0) {
+			randomState = 1;
+		}
 		if (pipe(exitPipe) == -1) {
 			int e = errno;
 			throw SystemException("Cannot create pipe", e);
@@ -301,6 +449,11 @@ public:
 	}
 
 	void start() {
+		pendingClients.reset(new boost::atomic<unsigned int>[servers.size()]);
+		for (unsigned int i = 0; i < servers.size(); i++) {
+			pendingClients[i].store(0, boost::memory_order_relaxed);
+		}
+
 		boost::function<void ()> func = boost::bind(&AcceptLoadBalancer<Server>::mainLoop, this);
 		thread = new oxt::thread(boost::bind(runAndPrintExceptions, func, true),
 			"Load balancer");
@@ -320,6 +473,23 @@ public:
 			thread = NULL;
 		}
 	}
+
+	/**
+	 * May be called from any thread after start().
+	 */
+	Json::Value inspectStateAsJson() const {
+		Json::Value doc;
+		doc["policy"] = acceptLoadBalancingPolicyToString(policy);
+		doc["servers"] = (Json::UInt) servers.size();
+		if (pendingClients) {
+			Json::Value pending(Json::arrayValue);
+			for (unsigned int i = 0; i < servers.size(); i++) {
+				pending.append(pendingClients[i].load(boost::memory_order_relaxed));
+			}
+			doc["pending_client_counts"] = pending;
+		}
+		return doc;
+	}
 };
 
 
@@ -0,0 +1,235 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#include <ServerKit/BufferFilePool.h>
+#include <LoggingKit/LoggingKit.h>
+#include <Utils/StrIntUtils.h>
+#include <uv.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __linux__
+	#include <linux/falloc.h>
+#endif
+#if defined(O_TMPFILE) && defined(FALLOC_FL_PUNCH_HOLE)
+	#define HAVE_ANONYMOUS_BUFFER_FILES
+#endif
+
+namespace Passenger {
+namespace ServerKit {
+
+using namespace std;
+
+
+struct BufferFilePool::RecycleWork {
+	uv_work_t req;
+	/** NULL if the pool was destroyed before recycling finished. */
+	BufferFilePool *pool;
+	LIST_ENTRY(RecycleWork) next;
+	int fd;
+	int errcode;
+};
+
+
+BufferFilePool::BufferFilePool()
+	: libuv(NULL),
+	  nfiles(0),
+	  hits(0),
+	  misses(0),
+	  recycled(0),
+	  recycleErrors(0)
+{
+	LIST_INIT(&recycling);
+}
+
+BufferFilePool::~BufferFilePool() {
+	RecycleWork *work;
+
+	deinitialize();
+	// libuv will still call recycleDone() for these, even if we
+	// uv_cancel() them. Let it close the files without us.
+	while (!LIST_EMPTY(&recycling)) {
+		work = LIST_FIRST(&recycling);
+		LIST_REMOVE(work, next);
+		work->pool = NULL;
+	}
+}
+
+bool
+BufferFilePool::initialize(struct uv_loop_s *_libuv, const string &_dir, unsigned int size,
+	string &error)
+{
+	#ifdef HAVE_ANONYMOUS_BUFFER_FILES
+		freeFiles.reserve(size);
+		for (unsigned int i = 0; i < size; i++) {
+			int fd = open(_dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+			if (fd == -1) {
+				int e = errno;
+				error = "cannot create an anonymous file in " + _dir + ": "
+					+ strerror(e) + " (errno=" + toString(e) + ")";
+				deinitialize();
+				return false;
+			}
+			P_LOG_FILE_DESCRIPTOR_OPEN4(fd, __FILE__, __LINE__,
+				"FileBufferedChannel pooled buffer file");
+			freeFiles.push_back(fd);
+			nfiles++;
+		}
+		libuv = _libuv;
+		dir = _dir;
+		return true;
+	#else
+		error = "anonymous files are not supported on this platform";
+		return false;
+	#endif
+}
+
+void
+BufferFilePool::deinitialize() {
+	vector<int>::const_iterator it, end = freeFiles.end();
+
+	for (it = freeFiles.begin(); it != end; it++) {
+		P_LOG_FILE_DESCRIPTOR_CLOSE(*it);
+		close(*it);
+	}
+	nfiles -= freeFiles.size();
+	freeFiles.clear();
+	libuv = NULL;
+}
+
+int
+BufferFilePool::checkout() {
+	if (freeFiles.empty()) {
+		if (isInitialized()) {
+			misses++;
+		}
+		return -1;
+	} else {
+		int fd = freeFiles.back();
+		freeFiles.pop_back();
+		hits++;
+		return fd;
+	}
+}
+
+void
+BufferFilePool::checkin(int fd) {
+	RecycleWork *work;
+
+	if (isInitialized()) {
+		work = (RecycleWork *) malloc(sizeof(RecycleWork));
+	} else {
+		work = NULL;
+	}
+	if (work != NULL) {
+		work->req.data = work;
+		work->pool = this;
+		work->fd = fd;
+		work->errcode = 0;
+		if (uv_queue_work(libuv, &work->req, recycleInThread, recycleDone) == 0) {
+			LIST_INSERT_HEAD(&recycling, work, next);
+			return;
+		}
+		free(work);
+	}
+
+	P_LOG_FILE_DESCRIPTOR_CLOSE(fd);
+	close(fd);
+	nfiles--;
+}
+
+void
+BufferFilePool::recycleInThread(uv_work_t *req) {
+	#ifdef HAVE_ANONYMOUS_BUFFER_FILES
+		RecycleWork *work = static_cast<RecycleWork *>(req->data);
+		struct stat buf;
+
+		if (fstat(work->fd, &buf) == -1) {
+			work->errcode = errno;
+		} else if (buf.st_size > 0
+			&& fallocate(work->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+				0, buf.st_size) == -1)
+		{
+			if (errno == EOPNOTSUPP && ftruncate(work->fd, 0) == 0) {
+				return;
+			}
+			work->errcode = errno;
+		}
+	#endif
+}
+
+void
+BufferFilePool::recycleDone(uv_work_t *req, int status) {
+	RecycleWork *work = static_cast<RecycleWork *>(req->data);
+	BufferFilePool *self = work->pool;
+
+	if (self == NULL) {
+		P_LOG_FILE_DESCRIPTOR_CLOSE(work->fd);
+		close(work->fd);
+		free(work);
+		return;
+	}
+
+	LIST_REMOVE(work, next);
+	if (status == 0 && work->errcode == 0 && self->isInitialized()) {
+		self->freeFiles.push_back(work->fd);
+		self->recycled++;
+	} else {
+		if (status == 0 && work->errcode != 0) {
+			P_WARN("Cannot recycle FileBufferedChannel buffer file: "
+				<< strerror(work->errcode) << " (errno=" << work->errcode << ")");
+			self->recycleErrors++;
+		}
+		P_LOG_FILE_DESCRIPTOR_CLOSE(work->fd);
+		close(work->fd);
+		self->nfiles--;
+	}
+	free(work);
+}
+
+Json::Value
+BufferFilePool::inspectStateAsJson() const {
+	Json::Value doc;
+	doc["dir"] = dir;
+	doc["size"] = nfiles;
+	doc["available"] = (Json::UInt) freeFiles.size();
+	doc["hits"] = (Json::UInt64) hits;
+	doc["misses"] = (Json::UInt64) misses;
+	if (hits + misses > 0) {
+		doc["hit_rate"] = (double) hits / (hits + misses);
+	}
+	doc["recycled"] = (Json::UInt64) recycled;
+	doc["recycle_errors"] = (Json::UInt64) recycleErrors;
+	return doc;
+}
+
+
+} // namespace ServerKit
+} // namespace Passenger
@@ -0,0 +1,126 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_SERVER_KIT_BUFFER_FILE_POOL_H_
+#define _PASSENGER_SERVER_KIT_BUFFER_FILE_POOL_H_
+
+#include <psg_sysqueue.h>
+#include <boost/cstdint.hpp>
+#include <string>
+#include <vector>
+#include <jsoncpp/json.h>
+
+extern "C" {
+	struct uv_loop_s;
+	struct uv_work_s;
+}
+
+namespace Passenger {
+namespace ServerKit {
+
+using namespace std;
+
+
+/**
+ * A pool of anonymous (O_TMPFILE) buffer files for FileBufferedChannel, so
+ * that switching to in-file mode doesn't have to create and unlink a file
+ * in the buffer directory each time. Such files never appear in the
+ * directory, so nothing has to be cleaned up when we crash.
+ *
+ * All files are created up front by `initialize()`. A channel checks a file
+ * out when it switches to in-file mode, and checks it back in when it is done
+ * with it. The file is then emptied in the libuv threadpool by punching a
+ * hole over its entire contents (or by truncating it, if the filesystem
+ * doesn't support that) before it becomes available again. If no file is
+ * available, FileBufferedChannel falls back to creating a file.
+ *
+ * There is one pool per ServerKit::Context, so it is only accessed from
+ * that context's event loop thread.
+ */
+class BufferFilePool {
+private:
+	struct RecycleWork;
+	LIST_HEAD(RecycleWorkList, RecycleWork);
+
+	struct uv_loop_s *libuv;
+	string dir;
+	vector<int> freeFiles;
+	/**
+	 * Files that are being recycled in the libuv threadpool. Their
+	 * completion callbacks may run after this pool is destroyed, so the
+	 * destructor detaches them from the pool.
+	 */
+	RecycleWorkList recycling;
+	/** Number of files owned by this pool, whether available or not. */
+	unsigned int nfiles;
+
+	boost::uint64_t hits;
+	boost::uint64_t misses;
+	boost::uint64_t recycled;
+	boost::uint64_t recycleErrors;
+
+	static void recycleInThread(struct uv_work_s *req);
+	static void recycleDone(struct uv_work_s *req, int status);
+
+public:
+	BufferFilePool();
+	~BufferFilePool();
+
+	/**
+	 * Creates `size` anonymous files in `dir`. Returns false, with a
+	 * description in `error`, if the platform or filesystem doesn't support
+	 * anonymous files.
+	 */
+	bool initialize(struct uv_loop_s *libuv, const string &dir, unsigned int size,
+		string &error);
+	/**
+	 * Closes all available files. Files that are checked out or being
+	 * recycled are closed when they're checked back in, or when the
+	 * recycling finishes.
+	 */
+	void deinitialize();
+
+	bool isInitialized() const {
+		return libuv != NULL;
+	}
+
+	/**
+	 * Returns an empty file from the pool, or -1 if none is available.
+	 */
+	int checkout();
+	/**
+	 * Returns a file obtained through `checkout()` to the pool. Its contents
+	 * are discarded in the background.
+	 */
+	void checkin(int fd);
+
+	Json::Value inspectStateAsJson() const;
+};
+
+
+} // namespace ServerKit
+} // namespace Passenger
+
+#endif /* _PASSENGER_SERVER_KIT_BUFFER_FILE_POOL_H_ */
@@ -52,13 +52,20 @@ using namespace std;
  * (do not edit: following text is automatically generated
  * by 'rake configkit_schemas_inline_comments')
  *
+ *   fd_source_channel_readv_buffers                      unsigned integer   -   default(1)
  *   file_buffered_channel_auto_start_mover               boolean            -   default(true)
  *   file_buffered_channel_auto_truncate_file             boolean            -   default(true)
  *   file_buffered_channel_buffer_dir                     string             -   default
+ *   file_buffered_channel_buffer_file_pool_size          unsigned integer   -   default(0),read_only
  *   file_buffered_channel_delay_in_file_mode_switching   unsigned integer   -   default(0)
+ *   file_buffered_channel_io_uring                       boolean            -   default(false),read_only
  *   file_buffered_channel_max_disk_chunk_read_size       unsigned integer   -   default(0)
+ *   file_buffered_channel_memory_budget                  unsigned integer   -   default(0)
  *   file_buffered_channel_threshold                      unsigned integer   -   default(131072)
  *   mbuf_block_chunk_size                                unsigned integer   -   default(4096),read_only
+ *   mbuf_block_huge_pages                                boolean            -   default(false),read_only
+ *   mbuf_block_size_classes                              boolean            -   default(false),read_only
+ *   mbuf_block_slab_size                                 unsigned integer   -   default(0),read_only
  *   secure_mode_password                                 string             -   secret
  *
  * END
@@ -82,18 +89,26 @@ public:
 	Schema() {
 		using namespace ConfigKit;
 
+		add("fd_source_channel_readv_buffers", UINT_TYPE, OPTIONAL, 1);
+
 		addWithDynamicDefault("file_buffered_channel_buffer_dir", STRING_TYPE,
 			OPTIONAL | CACHE_DEFAULT_VALUE, getDefaultFileBufferedChannelBufferDir);
+		add("file_buffered_channel_buffer_file_pool_size", UINT_TYPE, OPTIONAL | READ_ONLY, 0);
 		add("file_buffered_channel_threshold", UINT_TYPE, OPTIONAL,
 			DEFAULT_FILE_BUFFERED_CHANNEL_THRESHOLD);
 		add("file_buffered_channel_delay_in_file_mode_switching", UINT_TYPE, OPTIONAL, 0);
 		add("file_buffered_channel_max_disk_chunk_read_size", UINT_TYPE, OPTIONAL, 0);
+		add("file_buffered_channel_memory_budget", UINT_TYPE, OPTIONAL, 0);
 		add("file_buffered_channel_auto_truncate_file", BOOL_TYPE, OPTIONAL, true);
+		add("file_buffered_channel_io_uring", BOOL_TYPE, OPTIONAL | READ_ONLY, false);
 		// For unit testing purposes
 		add("file_buffered_channel_auto_start_mover", BOOL_TYPE, OPTIONAL, true);
 
 		add("mbuf_block_chunk_size", UINT_TYPE, OPTIONAL | READ_ONLY,
 			DEFAULT_MBUF_CHUNK_SIZE);
+		add("mbuf_block_slab_size", UINT_TYPE, OPTIONAL | READ_ONLY, 0);
+		add("mbuf_block_huge_pages", BOOL_TYPE, OPTIONAL | READ_ONLY, false);
+		add("mbuf_block_size_classes", BOOL_TYPE, OPTIONAL | READ_ONLY, false);
 		add("secure_mode_password", STRING_TYPE, OPTIONAL | SECRET);
 
 		addNormalizer(normalize);
@@ -107,6 +122,7 @@ struct FileBufferedChannelConfig {
 	unsigned int threshold;
 	unsigned int delayInFileModeSwitching;
 	unsigned int maxDiskChunkReadSize;
+	unsigned int memoryBudget;
 	bool autoTruncateFile;
 	bool autoStartMover;
 
@@ -115,6 +131,7 @@ struct FileBufferedChannelConfig {
 		  threshold(config["file_buffered_channel_threshold"].asUInt()),
 		  delayInFileModeSwitching(config["file_buffered_channel_delay_in_file_mode_switching"].asUInt()),
 		  maxDiskChunkReadSize(config["file_buffered_channel_max_disk_chunk_read_size"].asUInt()),
+		  memoryBudget(config["file_buffered_channel_memory_budget"].asUInt()),
 		  autoTruncateFile(config["file_buffered_channel_auto_truncate_file"].asBool()),
 		  autoStartMover(config["file_buffered_channel_auto_start_mover"].asBool())
 		{ }
@@ -124,6 +141,7 @@ struct FileBufferedChannelConfig {
 		std::swap(threshold, other.threshold);
 		std::swap(delayInFileModeSwitching, other.delayInFileModeSwitching);
 		std::swap(maxDiskChunkReadSize, other.maxDiskChunkReadSize);
+		std::swap(memoryBudget, other.memoryBudget);
 		std::swap(autoTruncateFile, other.autoTruncateFile);
 		std::swap(autoStartMover, other.autoStartMover);
 	}
@@ -131,15 +149,18 @@ struct FileBufferedChannelConfig {
 
 struct Config {
 	string secureModePassword;
+	unsigned int fdSourceChannelReadvBuffers;
 	FileBufferedChannelConfig fileBufferedChannelConfig;
 
 	Config(const ConfigKit::Store &config)
 		: secureModePassword(config["secure_mode_password"].asString()),
+		  fdSourceChannelReadvBuffers(config["fd_source_channel_readv_buffers"].asUInt()),
 		  fileBufferedChannelConfig(config)
 		{ }
 
 	void swap(Config &other) BOOST_NOEXCEPT_OR_NOTHROW {
 		secureModePassword.swap(other.secureModePassword);
+		std::swap(fdSourceChannelReadvBuffers, other.fdSourceChannelReadvBuffers);
 		fileBufferedChannelConfig.swap(other.fileBufferedChannelConfig);
 	}
 };
@@ -30,8 +30,11 @@
 #include <boost/config.hpp>
 
 #include <ServerKit/Config.h>
+#include <ServerKit/IoUring.h>
+#include <ServerKit/BufferFilePool.h>
 #include <ConfigKit/ConfigKit.h>
 #include <MemoryKit/mbuf.h>
+#include <LoggingKit/LoggingKit.h>
 #include <LoggingKit/Assert.h>
 #include <SafeLibev.h>
 #include <Exceptions.h>
@@ -52,6 +55,61 @@ class Context {
 private:
 	ConfigKit::Store configStore;
 
+	static Json::Value inspectMbufPoolAsJson(const struct MemoryKit::mbuf_pool &pool) {
+		Json::Value doc;
+
+		doc["free_blocks"] = (Json::UInt) pool.nfree_mbuf_blockq;
+		doc["active_blocks"] = (Json::UInt) pool.nactive_mbuf_blockq;
+		doc["chunk_size"] = (Json::UInt) pool.mbuf_block_chunk_size;
+		doc["offset"] = (Json::UInt) pool.mbuf_block_offset;
+		doc["spare_memory"] = byteSizeToJson(pool.nfree_mbuf_blockq
+			* pool.mbuf_block_chunk_size);
+		doc["active_memory"] = byteSizeToJson(pool.nactive_mbuf_blockq
+			* pool.mbuf_block_chunk_size);
+		doc["hits"] = (Json::UInt64) pool.nhits;
+		doc["misses"] = (Json::UInt64) pool.nmisses;
+		if (pool.nhits + pool.nmisses > 0) {
+			doc["hit_rate"] = (double) pool.nhits
+				/ (pool.nhits + pool.nmisses);
+		}
+		doc["remote_frees"] = (Json::UInt64) pool.nremote_frees;
+		if (pool.mbuf_block_slab_size > 0) {
+			doc["slab_size"] = byteSizeToJson(pool.mbuf_block_slab_size);
+			doc["slabs"] = (Json::UInt) pool.nslabs;
+			doc["huge_page_slabs"] = (Json::UInt) pool.nhuge_slabs;
+			doc["reclaimed_slabs"] = (Json::UInt64) pool.nreclaimed_slabs;
+		}
+		if (pool.numa_node >= 0) {
+			doc["numa_node"] = pool.numa_node;
+		}
+		return doc;
+	}
+
+	void initializeMbufPool(struct MemoryKit::mbuf_pool *pool, unsigned int chunkSize) {
+		pool->mbuf_block_chunk_size = chunkSize;
+		MemoryKit::mbuf_pool_init(pool);
+		unsigned int slabSize = configStore["mbuf_block_slab_size"].asUInt();
+		bool hugePages = configStore["mbuf_block_huge_pages"].asBool();
+		if (slabSize > 0 || hugePages) {
+			MemoryKit::mbuf_pool_enable_slabs(pool,
+				(slabSize > 0) ? slabSize : DEFAULT_MBUF_SLAB_SIZE, hugePages);
+		}
+	}
+
+	void initializeMbufSizeClasses() {
+		static const unsigned int chunkSizes[] = { 512, 4096, 16384, 65536 };
+
+		for (unsigned int i = 0; i < sizeof(chunkSizes) / sizeof(chunkSizes[0]); i++) {
+			if (chunkSizes[i] == mbuf_pool.mbuf_block_chunk_size) {
+				continue;
+			}
+			struct MemoryKit::mbuf_pool *pool = &mbufSizeClassPools[nMbufSizeClassPools];
+			initializeMbufPool(pool, chunkSizes[i]);
+			MemoryKit::mbuf_pool_add_size_class(&mbuf_pool, pool);
+			nMbufSizeClassPools++;
+		}
+	}
+
 public:
 	typedef ServerKit::ConfigChangeRequest ConfigChangeRequest;
 
@@ -62,16 +120,41 @@ public:
 	// Others
 	Config config;
 	struct MemoryKit::mbuf_pool mbuf_pool;
+	/**
+	 * Size classes of `mbuf_pool`, only initialized if `mbuf_block_size_classes`
+	 * is enabled. Pick one with `MemoryKit::mbuf_pool_for_size(&mbuf_pool, ...)`.
+	 */
+	struct MemoryKit::mbuf_pool mbufSizeClassPools[MBUF_MAX_SIZE_CLASSES];
+	unsigned int nMbufSizeClassPools;
+	/** Only initialized if `file_buffered_channel_io_uring` is enabled and supported. */
+	IoUring ioUring;
+	/** Only initialized if `file_buffered_channel_buffer_file_pool_size` > 0 and supported. */
+	BufferFilePool bufferFilePool;
+	/**
+	 * Number of bytes that all FileBufferedChannels in this context
+	 * currently buffer in memory, which is checked against
+	 * `file_buffered_channel_memory_budget`.
+	 */
+	boost::uint64_t fileBufferedChannelMemoryUsage;
+	boost::uint64_t fileBufferedChannelPeakMemoryUsage;
 
 	Context(const Schema &schema, const Json::Value &initialConfig = Json::Value(),
 		const ConfigKit::Translator &translator = ConfigKit::DummyTranslator())
 		: configStore(schema, initialConfig, translator),
 		  libuv(NULL),
-		  config(configStore)
+		  config(configStore),
+		  nMbufSizeClassPools(0),
+		  fileBufferedChannelMemoryUsage(0),
+		  fileBufferedChannelPeakMemoryUsage(0)
 		{ }
 
 	~Context() {
+		bufferFilePool.deinitialize();
+		ioUring.deinitialize();
 		MemoryKit::mbuf_pool_deinit(&mbuf_pool);
+		for (unsigned int i = 0; i < nMbufSizeClassPools; i++) {
+			MemoryKit::mbuf_pool_deinit(&mbufSizeClassPools[i]);
+		}
 	}
 
 	void initialize() {
@@ -82,8 +165,44 @@ public:
 			throw RuntimeException("libuv must be non-NULL");
 		}
 
-		mbuf_pool.mbuf_block_chunk_size = configStore["mbuf_block_chunk_size"].asUInt();
-		MemoryKit::mbuf_pool_init(&mbuf_pool);
+		initializeMbufPool(&mbuf_pool, configStore["mbuf_block_chunk_size"].asUInt());
+		if (configStore["mbuf_block_size_classes"].asBool()) {
+			initializeMbufSizeClasses();
+		}
+
+		if (configStore["file_buffered_channel_io_uring"].asBool()) {
+			string error;
+			if (!ioUring.initialize(libev->getLoop(), &mbuf_pool,
+				IoUring::MAX_FIXED_BUFFERS, error))
+			{
+				P_WARN("Cannot use io_uring for buffering data to disk, "
+					"using the libuv threadpool instead: " << error);
+			}
+		}
+
+		unsigned int poolSize = configStore["file_buffered_channel_buffer_file_pool_size"].asUInt();
+		if (poolSize > 0) {
+			string error;
+			if (!bufferFilePool.initialize(libuv,
+				configStore["file_buffered_channel_buffer_dir"].asString(),
+				poolSize, error))
+			{
+				P_WARN("Cannot preallocate buffer files, creating them "
+					"on demand instead: " << error);
+			}
+		}
+	}
+
+	/**
+	 * Binds `mbuf_pool` and its size classes to the calling thread.
+	 * See `MemoryKit::mbuf_pool_bind_to_current_thread()`.
+	 */
+	void bindMbufPoolsToCurrentThread(bool numaLocal) {
+		MemoryKit::mbuf_pool_bind_to_current_thread(&mbuf_pool, numaLocal);
+		for (unsigned int i = 0; i < nMbufSizeClassPools; i++) {
+			MemoryKit::mbuf_pool_bind_to_current_thread(&mbufSizeClassPools[i],
+				numaLocal);
+		}
 	}
 
 	bool configure(const Json::Value &updates, vector<ConfigKit::Error> &errors) {
@@ -116,16 +235,8 @@ public:
 
 	Json::Value inspectStateAsJson() const {
 		Json::Value doc;
-		Json::Value mbufDoc;
-
-		mbufDoc["free_blocks"] = (Json::UInt) mbuf_pool.nfree_mbuf_blockq;
-		mbufDoc["active_blocks"] = (Json::UInt) mbuf_pool.nactive_mbuf_blockq;
-		mbufDoc["chunk_size"] = (Json::UInt) mbuf_pool.mbuf_block_chunk_size;
-		mbufDoc["offset"] = (Json::UInt) mbuf_pool.mbuf_block_offset;
-		mbufDoc["spare_memory"] = byteSizeToJson(mbuf_pool.nfree_mbuf_blockq
-			* mbuf_pool.mbuf_block_chunk_size);
-		mbufDoc["active_memory"] = byteSizeToJson(mbuf_pool.nactive_mbuf_blockq
-			* mbuf_pool.mbuf_block_chunk_size);
+		Json::Value mbufDoc = inspectMbufPoolAsJson(mbuf_pool);
+
 		#ifdef MBUF_ENABLE_DEBUGGING
 			struct MemoryKit::active_mbuf_block_list *list =
 				const_cast<struct MemoryKit::active_mbuf_block_list *>(
@@ -135,7 +246,7 @@ public:
 
 			TAILQ_FOREACH (block, list, active_q) {
 				Json::Value blockJson;
-				blockJson["refcount"] = block->refcount;
+				blockJson["refcount"] = block->refcount.load();
 				#ifdef MBUF_ENABLE_BACKTRACES
 					blockJson["backtrace"] =
 						(block->backtrace == NULL)
@@ -147,8 +258,30 @@ public:
 			mbufDoc["active_blocks_list"] = listJson;
 		#endif
 
+		if (nMbufSizeClassPools > 0) {
+			Json::Value classesDoc(Json::arrayValue);
+			for (unsigned int i = 0; i < nMbufSizeClassPools; i++) {
+				classesDoc.append(inspectMbufPoolAsJson(mbufSizeClassPools[i]));
+			}
+			mbufDoc["size_classes"] = classesDoc;
+		}
+
 		doc["mbuf_pool"] = mbufDoc;
 
+		Json::Value fbcDoc;
+		fbcDoc["memory_usage"] = byteSizeToJson(fileBufferedChannelMemoryUsage);
+		fbcDoc["peak_memory_usage"] = byteSizeToJson(fileBufferedChannelPeakMemoryUsage);
+		if (config.fileBufferedChannelConfig.memoryBudget > 0) {
+			fbcDoc["memory_budget"] = byteSizeToJson(config.fileBufferedChannelConfig.memoryBudget);
+		}
+		doc["file_buffered_channels"] = fbcDoc;
+		if (ioUring.isInitialized()) {
+			doc["io_uring"] = ioUring.inspectStateAsJson();
+		}
+		if (bufferFilePool.isInitialized()) {
+			doc["buffer_file_pool"] = bufferFilePool.inspectStateAsJson();
+		}
+
 		return doc;
 	}
 };
@@ -29,6 +29,7 @@
 #include <oxt/macros.hpp>
 #include <boost/move/move.hpp>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <ev.h>
 #include <jsoncpp/json.h>
@@ -42,15 +43,55 @@ namespace ServerKit {
 using namespace oxt;
 
 
+/**
+ * Reads data from a file descriptor and feeds it to the Channel.
+ *
+ * By default, every readable event results in one `read()` into one mbuf.
+ * If `fd_source_channel_readv_buffers` is larger than 1, then we `readv()`
+ * into that many mbufs at once, and feed the filled ones to the Channel one
+ * after another. That saves syscalls and event loop iterations when there is
+ * a lot of data available, such as with large request or response bodies.
+ * Buffers that the Channel cannot accept yet are kept in `batch` until it is
+ * done consuming.
+ *
+ * If the owner knows how much data to expect, e.g. from a Content-Length
+ * header, then it can pass that with `setSizeHint()`. New buffers are then
+ * taken from the mbuf size class that fits best, and readv() stops adding
+ * buffers once they can hold all the expected data.
+ */
 class FdSourceChannel: protected Channel {
+public:
+	static const unsigned int MAX_READV_BUFFERS = 8;
+
 private:
 	ev_io watcher;
 	MemoryKit::mbuf buffer;
+	MemoryKit::mbuf batch[MAX_READV_BUFFERS];
+	unsigned int batchPos;
+	unsigned int batchSize;
+	boost::uint64_t sizeHint;
 
 	static void _onReadable(EV_P_ ev_io *io, int revents) {
 		static_cast<FdSourceChannel *>(io->data)->onReadable(io, revents);
 	}
 
+	MemoryKit::mbuf newBuffer() {
+		if (sizeHint == 0) {
+			return MemoryKit::mbuf_get(&ctx->mbuf_pool);
+		} else {
+			return MemoryKit::mbuf_get(MemoryKit::mbuf_pool_for_size(
+				&ctx->mbuf_pool, sizeHint));
+		}
+	}
+
+	void consumeSizeHint(size_t size) {
+		if (sizeHint > size) {
+			sizeHint -= size;
+		} else {
+			sizeHint = 0;
+		}
+	}
+
 	void onReadable(ev_io *io, int revents) {
 		RefGuard guard(hooks, this, __FILE__, __LINE__);
 		onReadableWithoutRefGuard();
@@ -71,9 +112,22 @@ private:
 			return;
 		}
 
+		unsigned int readvBuffers = ctx->config.fdSourceChannelReadvBuffers;
+		if (readvBuffers > MAX_READV_BUFFERS) {
+			readvBuffers = MAX_READV_BUFFERS;
+		}
 		for (i = 0; i < burstReadCount && !done; i++) {
+			if (readvBuffers > 1) {
+				done = readvAndFeed(readvBuffers);
+				if (generation != this->generation) {
+					// Callback deinitialized this object.
+					return;
+				}
+				continue;
+			}
+
 			if (buffer.empty()) {
-				buffer = MemoryKit::mbuf_get(&ctx->mbuf_pool);
+				buffer = newBuffer();
 			}
 
 			origBufferSize = buffer.size();
@@ -81,6 +135,7 @@ private:
 				ret = ::read(watcher.fd, buffer.start, buffer.size());
 			} while (OXT_UNLIKELY(ret == -1 && errno == EINTR));
 			if (ret > 0) {
+				consumeSizeHint(ret);
 				MemoryKit::mbuf buffer2(buffer, 0, ret);
 				if (size_t(ret) == size_t(buffer.size())) {
 					// Unref mbuf_block
@@ -125,9 +180,148 @@ private:
 		}
 	}
 
+	/**
+	 * Reads into `count` buffers with a single `readv()` and feeds the filled
+	 * ones to the Channel. Returns whether the caller should stop reading.
+	 */
+	bool readvAndFeed(unsigned int count) {
+		struct iovec iov[MAX_READV_BUFFERS];
+		size_t capacity = 0, remaining;
+		unsigned int i;
+		ssize_t ret;
+		int e;
+
+		assert(batchSize == 0);
+		for (i = 0; i < count; i++) {
+			if (i == 0 && !buffer.empty()) {
+				batch[i] = boost::move(buffer);
+				buffer = MemoryKit::mbuf();
+			} else {
+				batch[i] = newBuffer();
+			}
+			iov[i].iov_base = batch[i].start;
+			iov[i].iov_len = batch[i].size();
+			capacity += batch[i].size();
+			if (sizeHint > 0 && capacity >= sizeHint) {
+				count = i + 1;
+			}
+		}
+
+		do {
+			ret = ::readv(watcher.fd, iov, count);
+		} while (OXT_UNLIKELY(ret == -1 && errno == EINTR));
+
+		if (ret > 0) {
+			consumeSizeHint(ret);
+			remaining = ret;
+			for (i = 0; i < count && remaining > 0; i++) {
+				if (remaining < batch[i].size()) {
+					// Keep the unused part of the last filled buffer
+					// for the next read.
+					buffer = MemoryKit::mbuf(batch[i], remaining);
+					batch[i] = MemoryKit::mbuf(batch[i], 0, remaining);
+					remaining = 0;
+				} else {
+					remaining -= batch[i].size();
+				}
+			}
+			batchSize = i;
+			for (; i < count; i++) {
+				batch[i] = MemoryKit::mbuf();
+			}
+
+			unsigned int generation = this->generation;
+			feedBatch();
+			if (generation != this->generation) {
+				return true;
+			}
+
+			if (!acceptingInput()) {
+				ev_io_stop(ctx->libev->getLoop(), &watcher);
+				if (mayAcceptInputLater()) {
+					consumedCallback = onChannelConsumed;
+				} else {
+					clearBatch();
+				}
+				return true;
+			} else {
+				// See the comment in onReadableWithoutRefGuard().
+				return (size_t) ret < capacity;
+			}
+
+		} else {
+			for (i = 0; i < count; i++) {
+				batch[i] = MemoryKit::mbuf();
+			}
+			if (ret == 0) {
+				ev_io_stop(ctx->libev->getLoop(), &watcher);
+				feedWithoutRefGuard(MemoryKit::mbuf());
+			} else {
+				e = errno;
+				if (e != EAGAIN && e != EWOULDBLOCK) {
+					ev_io_stop(ctx->libev->getLoop(), &watcher);
+					feedError(e);
+				}
+			}
+			return true;
+		}
+	}
+
+	/**
+	 * Feeds buffers from `batch` for as long as the Channel accepts input.
+	 * The data callback may deinitialize this object, so callers must check
+	 * `generation` afterwards.
+	 */
+	void feedBatch() {
+		unsigned int generation = this->generation;
+
+		while (batchPos < batchSize && acceptingInput()) {
+			MemoryKit::mbuf current(boost::move(batch[batchPos]));
+			batch[batchPos] = MemoryKit::mbuf();
+			batchPos++;
+			feedWithoutRefGuard(boost::move(current));
+			if (generation != this->generation) {
+				return;
+			}
+		}
+		if (batchPos == batchSize) {
+			batchPos = batchSize = 0;
+		}
+	}
+
+	void clearBatch() {
+		for (unsigned int i = batchPos; i < batchSize; i++) {
+			batch[i] = MemoryKit::mbuf();
+		}
+		batchPos = batchSize = 0;
+	}
+
 	static void onChannelConsumed(Channel *channel, unsigned int size) {
 		FdSourceChannel *self = static_cast<FdSourceChannel *>(channel);
 		self->consumedCallback = NULL;
+
+		if (self->batchSize > 0) {
+			if (!self->acceptingInput()) {
+				self->clearBatch();
+				return;
+			}
+
+			RefGuard guard(self->hooks, self, __FILE__, __LINE__);
+			unsigned int generation = self->generation;
+			self->feedBatch();
+			if (generation != self->generation) {
+				return;
+			}
+			if (!self->acceptingInput()) {
+				if (self->mayAcceptInputLater()) {
+					self->consumedCallback = onChannelConsumed;
+				} else {
+					self->clearBatch();
+				}
+				return;
+			}
+		}
+
 		if (self->acceptingInput()) {
 			ev_io_start(self->ctx->libev->getLoop(), &self->watcher);
 		}
@@ -135,6 +329,9 @@ private:
 
 	void initialize() {
 		burstReadCount = 1;
+		batchPos = 0;
+		batchSize = 0;
+		sizeHint = 0;
 		watcher.active = false;
 		watcher.fd = -1;
 		watcher.data = this;
@@ -168,10 +365,13 @@ public:
 	void reinitialize(int fd) {
 		Channel::reinitialize();
 		ev_io_init(&watcher, _onReadable, fd, EV_READ);
+		sizeHint = 0;
 	}
 
 	void deinitialize() {
 		buffer = MemoryKit::mbuf();
+		clearBatch();
+		sizeHint = 0;
 		if (ev_is_active(&watcher)) {
 			ev_io_stop(ctx->libev->getLoop(), &watcher);
 		}
@@ -212,6 +412,34 @@ public:
 		return watcher.fd;
 	}
 
+	/**
+	 * Whether data has been read from the file descriptor that hasn't been
+	 * fed to the Channel yet. Only possible with readv buffers.
+	 */
+	OXT_FORCE_INLINE
+	bool hasPendingBuffers() const {
+		return batchPos < batchSize;
+	}
+
+	/**
+	 * Tells the channel that `size` bytes are expected to arrive (0 if
+	 * unknown), of which `alreadyReceived` have already been read. The
+	 * hint decreases as more data is read.
+	 */
+	OXT_FORCE_INLINE
+	void setSizeHint(boost::uint64_t size, boost::uint64_t alreadyReceived = 0) {
+		if (size > alreadyReceived) {
+			sizeHint = size - alreadyReceived;
+		} else {
+			sizeHint = 0;
+		}
+	}
+
+	OXT_FORCE_INLINE
+	boost::uint64_t getSizeHint() const {
+		return sizeHint;
+	}
+
 	OXT_FORCE_INLINE
 	State getState() const {
 		return Channel::getState();
@@ -241,6 +469,12 @@ public:
 		Json::Value doc = Channel::inspectAsJson();
 		doc["initialized"] = watcher.fd != -1;
 		doc["io_watcher_active"] = (bool) watcher.active;
+		if (batchSize > 0) {
+			doc["pending_buffers"] = batchSize - batchPos;
+		}
+		if (sizeHint > 0) {
+			doc["size_hint"] = (Json::UInt64) sizeHint;
+		}
 		return doc;
 	}
 };
@@ -32,6 +32,7 @@
 #include <boost/move/move.hpp>
 #include <boost/atomic.hpp>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <uv.h>
 #include <jsoncpp/json.h>
 #include <cassert>
@@ -46,6 +47,8 @@
 #include <ServerKit/Config.h>
 #include <ServerKit/Errors.h>
 #include <ServerKit/Channel.h>
+#include <ServerKit/IoUring.h>
+#include <ServerKit/BufferFilePool.h>
 #include <Utils/JsonUtils.h>
 
 namespace Passenger {
@@ -206,8 +209,8 @@ public:
 
 private:
 	/**
-	 * A structure containing the details of a libuv asynchronous
-	 * filesystem I/O request.
+	 * A structure containing the details of an asynchronous filesystem
+	 * I/O request, performed either through io_uring or through libuv.
 	 *
 	 * The I/O callback is responsible for destroying its corresponding
 	 * FileIOContext object.
@@ -236,8 +239,16 @@ private:
 		 */
 		SafeLibevPtr libev;
 		uv_loop_t *libuv;
+		/**
+		 * NULL if io_uring is not in use. Operations submitted through
+		 * io_uring report their result in `req.result` too, so that the
+		 * callbacks don't have to care which one performed the operation.
+		 */
+		IoUring *ioUring;
 		/* req.data always refers back to the FileIOContext object itself. */
 		uv_fs_t req;
+		/* ioUringRequest.userData always refers back to the FileIOContext object itself. */
+		IoUring::Request ioUringRequest;
 
 		/**
 		 * Also a pointer to the FileBufferedChannel, but this is used for
@@ -251,11 +262,17 @@ private:
 			: self(_self),
 			  libev(_self->ctx->libev),
 			  libuv(_self->ctx->libuv),
+			  ioUring(_self->getIoUring()),
 			  logbase(_self)
 		{
+			// Allows uv_fs_req_cleanup() on requests that were performed
+			// through io_uring.
+			memset(&req, 0, sizeof(req));
 			req.type = UV_UNKNOWN_REQ;
 			req.result = -1;
 			req.data = this;
+			ioUringRequest.callback = NULL;
+			ioUringRequest.userData = this;
 		}
 
 		virtual ~FileIOContext() { }
@@ -263,8 +280,9 @@ private:
 		void cancel() {
 			if (!isCanceled()) {
 				// uv_cancel() fails if the work is already in progress
-				// or completed, so we set self to NULL as an extra
-				// indicator that this I/O operation is canceled.
+				// or completed, or if it's an io_uring operation, so we set
+				// self to NULL as an extra indicator that this I/O operation
+				// is canceled.
 				uv_cancel((uv_req_t *) &req);
 				self = NULL;
 			}
@@ -325,12 +343,22 @@ private:
 		 * The libuv loop associated with the FileBufferedChannel.
 		 */
 		uv_loop_t *libuv;
+		/**
+		 * The io_uring instance associated with the FileBufferedChannel,
+		 * or NULL if io_uring is not in use.
+		 */
+		IoUring *ioUring;
 
 		/**
 		 * The file descriptor of the temp file. It's -1 if the file is being
 		 * created.
 		 */
 		int fd;
+		/**
+		 * The pool that `fd` was checked out from, or NULL if we created
+		 * the file ourselves.
+		 */
+		BufferFilePool *bufferFilePool;
 
 
 		/***** Reader state *****/
@@ -375,9 +403,11 @@ private:
 		 */
 		boost::int64_t written;
 
-		InFileMode(uv_loop_t *_libuv)
+		InFileMode(uv_loop_t *_libuv, IoUring *_ioUring)
 			: libuv(_libuv),
+			  ioUring(_ioUring),
 			  fd(-1),
+			  bufferFilePool(NULL),
 			  readRequest(NULL),
 			  writerState(WS_INACTIVE),
 			  writerRequest(NULL),
@@ -388,12 +418,19 @@ private:
 		~InFileMode() {
 			P_ASSERT_EQ(readRequest, 0);
 			P_ASSERT_EQ(writerRequest, 0);
-			if (fd != -1) {
+			if (bufferFilePool != NULL) {
+				bufferFilePool->checkin(fd);
+			} else if (fd != -1) {
 				closeFdInBackground();
 			}
 		}
 
 		void closeFdInBackground() {
+			if (ioUring != NULL && ioUring->close(fd)) {
+				P_LOG_FILE_DESCRIPTOR_CLOSE(fd);
+				return;
+			}
+
 			uv_fs_t *req = (uv_fs_t *) malloc(sizeof(uv_fs_t));
 			if (req == NULL) {
 				P_CRITICAL("Cannot close file descriptor for FileBufferedChannel temp file: "
@@ -455,12 +492,103 @@ private:
 	boost::shared_ptr<InFileMode> inFileMode;
 
 
+	/***** Asynchronous file I/O *****/
+
+	IoUring *getIoUring() const {
+		if (ctx->ioUring.isInitialized()) {
+			return &ctx->ioUring;
+		} else {
+			return NULL;
+		}
+	}
+
+	/**
+	 * Adapts an io_uring completion to the libuv callback that would have
+	 * been called had the operation been performed through libuv.
+	 */
+	template<uv_fs_cb callback>
+	static void ioUringCompleted(void *userData, int result) {
+		FileIOContext *context = static_cast<FileIOContext *>(userData);
+		context->req.result = result;
+		callback(&context->req);
+	}
+
+	/*
+	 * The following methods start an operation through io_uring if it's in
+	 * use, and through the libuv threadpool otherwise (or if the io_uring
+	 * submission queue is full). Like the uv_fs_* functions, they return 0
+	 * or a negative error code, and call `callback` with `&context->req`
+	 * when done.
+	 */
+
+	template<uv_fs_cb callback>
+	int startOpen(FileIOContext *context, const char *path, int flags, int mode) {
+		if (context->ioUring != NULL) {
+			context->ioUringRequest.callback = ioUringCompleted<callback>;
+			if (context->ioUring->openat(path, flags, mode, &context->ioUringRequest)) {
+				return 0;
+			}
+		}
+		return uv_fs_open(ctx->libuv, &context->req, path, flags, mode, callback);
+	}
+
+	/**
+	 * If `fixedBufferIndex` is not -1, then `buf` lies inside the io_uring
+	 * fixed buffer with that index.
+	 */
+	template<uv_fs_cb callback>
+	int startRead(FileIOContext *context, int fd, uv_buf_t *buf, off_t offset,
+		int fixedBufferIndex = -1)
+	{
+		if (context->ioUring != NULL) {
+			bool submitted;
+			context->ioUringRequest.callback = ioUringCompleted<callback>;
+			if (fixedBufferIndex == -1) {
+				submitted = context->ioUring->read(fd, buf->base, buf->len,
+					offset, &context->ioUringRequest);
+			} else {
+				submitted = context->ioUring->readFixed(fd, buf->base, buf->len,
+					offset, fixedBufferIndex, &context->ioUringRequest);
+			}
+			if (submitted) {
+				return 0;
+			}
+		}
+		return uv_fs_read(ctx->libuv, &context->req, fd, buf, 1, offset, callback);
+	}
+
+	template<uv_fs_cb callback>
+	int startWrite(FileIOContext *context, int fd, uv_buf_t *buf, off_t offset) {
+		if (context->ioUring != NULL) {
+			context->ioUringRequest.callback = ioUringCompleted<callback>;
+			if (context->ioUring->write(fd, buf->base, buf->len, offset,
+				&context->ioUringRequest))
+			{
+				return 0;
+			}
+		}
+		return uv_fs_write(ctx->libuv, &context->req, fd, buf, 1, offset, callback);
+	}
+
+
 	/***** Buffer manipulation *****/
 
+	/**
+	 * All changes to `bytesBuffered` go through this method, so that the
+	 * context's total stays in sync. See `passedThreshold()`.
+	 */
+	void adjustBytesBuffered(boost::int64_t delta) {
+		bytesBuffered += delta;
+		ctx->fileBufferedChannelMemoryUsage += delta;
+		if (ctx->fileBufferedChannelMemoryUsage > ctx->fileBufferedChannelPeakMemoryUsage) {
+			ctx->fileBufferedChannelPeakMemoryUsage = ctx->fileBufferedChannelMemoryUsage;
+		}
+	}
+
 	void clearBuffers(bool mayCallCallbacks) {
 		unsigned int oldNbuffers = nbuffers;
 		nbuffers = 0;
-		bytesBuffered = 0;
+		adjustBytesBuffered(-(boost::int64_t) bytesBuffered);
 		firstBuffer = MemoryKit::mbuf();
 		if (!moreBuffers.empty()) {
 			// Some STL implementations, like OS X's, iterate through
@@ -482,13 +610,13 @@ private:
 			moreBuffers.push_back(buffer);
 		}
 		nbuffers++;
-		bytesBuffered += buffer.size();
+		adjustBytesBuffered(buffer.size());
 		FBC_DEBUG("pushBuffer() completed: nbuffers = " << nbuffers << ", bytesBuffered = " << bytesBuffered);
 	}
 
 	void popBuffer() {
 		assert(bytesBuffered >= firstBuffer.size());
-		bytesBuffered -= firstBuffer.size();
+		adjustBytesBuffered(-(boost::int64_t) firstBuffer.size());
 		nbuffers--;
 		FBC_DEBUG("popBuffer() completed: nbuffers = " << nbuffers << ", bytesBuffered = " << bytesBuffered);
 		if (moreBuffers.empty()) {
@@ -731,15 +859,22 @@ private:
 		FBC_DEBUG("Reader: reading next chunk from file, " << size << " bytes");
 		verifyInvariants();
 		ReadContext *readContext = new ReadContext(this);
-		readContext->buffer = MemoryKit::mbuf_get(&ctx->mbuf_pool);
+		int fixedBufferIndex = -1;
+		if (readContext->ioUring != NULL) {
+			fixedBufferIndex = readContext->ioUring->findFreeFixedBuffer();
+		}
+		if (fixedBufferIndex == -1) {
+			readContext->buffer = MemoryKit::mbuf_get(&ctx->mbuf_pool);
+		} else {
+			readContext->buffer = readContext->ioUring->getFixedBuffer(fixedBufferIndex);
+		}
 		readContext->inFileMode = inFileMode;
 		readContext->uvBuffer = uv_buf_init(readContext->buffer.start, size);
 		readerState = RS_READING_FROM_FILE;
 		inFileMode->readRequest = readContext;
 
-		uv_fs_read(ctx->libuv, &readContext->req, inFileMode->fd,
-			&readContext->uvBuffer, 1, inFileMode->readOffset,
-			_nextChunkDoneReading);
+		startRead<_nextChunkDoneReading>(readContext, inFileMode->fd,
+			&readContext->uvBuffer, inFileMode->readOffset, fixedBufferIndex);
 		verifyInvariants();
 	}
 
@@ -837,7 +972,7 @@ private:
 
 		FBC_DEBUG("Switching to in-file mode");
 		mode = IN_FILE_MODE;
-		inFileMode = boost::make_shared<InFileMode>(ctx->libuv);
+		inFileMode = boost::make_shared<InFileMode>(ctx->libuv, getIoUring());
 		createBufferFile();
 	}
 
@@ -876,6 +1011,11 @@ private:
 		P_ASSERT_EQ(inFileMode->writerState, WS_INACTIVE);
 		P_ASSERT_EQ(inFileMode->fd, -1);
 
+		if (config->delayInFileModeSwitching == 0 && takeBufferFileFromPool()) {
+			moveNextBufferToFile();
+			return;
+		}
+
 		FileCreationContext *fcContext = new FileCreationContext(this);
 		fcContext->path = config->bufferDir;
 		fcContext->path.append("/buffer.");
@@ -886,9 +1026,8 @@ private:
 
 		if (config->delayInFileModeSwitching == 0) {
 			FBC_DEBUG("Writer: creating file " << fcContext->path);
-			int result = uv_fs_open(ctx->libuv, &fcContext->req,
-				fcContext->path.c_str(), O_RDWR | O_CREAT | O_EXCL,
-				0600, _bufferFileCreated);
+			int result = startOpen<_bufferFileCreated>(fcContext,
+				fcContext->path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
 			if (result != 0) {
 				fcContext->req.result = result;
 				ctx->libev->runLater(boost::bind(_bufferFileCreated,
@@ -915,17 +1054,39 @@ private:
 	}
 
 	void bufferFileDoneDelaying(FileCreationContext *fcContext) {
+		if (takeBufferFileFromPool()) {
+			FBC_DEBUG("Writer: done delaying in-file mode switching");
+			delete fcContext;
+			inFileMode->writerRequest = NULL;
+			moveNextBufferToFile();
+			return;
+		}
+
 		FBC_DEBUG("Writer: done delaying in-file mode switching. "
 			"Creating file: " << fcContext->path);
-		int result = uv_fs_open(ctx->libuv, &fcContext->req,
-			fcContext->path.c_str(), O_RDWR | O_CREAT | O_EXCL,
-			0600, _bufferFileCreated);
+		int result = startOpen<_bufferFileCreated>(fcContext,
+			fcContext->path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
 		if (result != 0) {
 			fcContext->req.result = result;
 			_bufferFileCreated(&fcContext->req);
 		}
 	}
 
+	/**
+	 * Uses a file from the context's buffer file pool, if one is available.
+	 * Such a file is already empty and unlinked.
+	 */
+	bool takeBufferFileFromPool() {
+		int fd = ctx->bufferFilePool.checkout();
+		if (fd == -1) {
+			return false;
+		}
+		FBC_DEBUG("Writer: using file from buffer file pool");
+		inFileMode->fd = fd;
+		inFileMode->bufferFilePool = &ctx->bufferFilePool;
+		return true;
+	}
+
 	static void _bufferFileCreated(uv_fs_t *req) {
 		FileCreationContext *fcContext = static_cast<FileCreationContext *>(req->data);
 		uv_fs_req_cleanup(req);
@@ -979,6 +1140,10 @@ private:
 
 		assert(fcContext->req.result >= 0);
 
+		if (fcContext->ioUring != NULL && fcContext->ioUring->close(fcContext->req.result)) {
+			return;
+		}
+
 		uv_fs_t *closeReq = (uv_fs_t *) malloc(sizeof(uv_fs_t));
 		if (closeReq == NULL) {
 			FBC_CRITICAL_FROM_CALLBACK(fcContext,
@@ -1003,6 +1168,15 @@ private:
 		// here as a warning that we should not use the backpointer.
 		fcContext->self = NULL;
 
+		if (fcContext->ioUring != NULL) {
+			fcContext->ioUringRequest.callback = bufferFileUnlinkedThroughIoUring;
+			if (fcContext->ioUring->unlink(fcContext->path.c_str(),
+				&fcContext->ioUringRequest))
+			{
+				return;
+			}
+		}
+
 		uv_fs_t *unlinkReq = (uv_fs_t *) malloc(sizeof(uv_fs_t));
 		if (unlinkReq == NULL) {
 			FBC_ERROR_FROM_CALLBACK(fcContext,
@@ -1048,6 +1222,22 @@ private:
 		delete fcContext;
 	}
 
+	static void bufferFileUnlinkedThroughIoUring(void *userData, int result) {
+		FileCreationContext *fcContext = static_cast<FileCreationContext *>(userData);
+		assert(fcContext->self == NULL);
+
+		if (result >= 0) {
+			FBC_DEBUG_FROM_CALLBACK(fcContext,
+				"Writer: file " << fcContext->path << " deleted");
+		} else {
+			FBC_DEBUG_FROM_CALLBACK(fcContext,
+				"Writer: failed to delete " << fcContext->path <<
+				": " << uv_strerror(result) << " (errno=" << -result << ")");
+		}
+
+		delete fcContext;
+	}
+
 	static void bufferFileClosed(uv_fs_t *req) {
 		uv_fs_req_cleanup(req);
 		free(req);
@@ -1096,10 +1286,8 @@ private:
 
 		inFileMode->writerState = WS_MOVING;
 		inFileMode->writerRequest = moveContext;
-		int result = uv_fs_write(ctx->libuv, &moveContext->req, inFileMode->fd,
-			&moveContext->uvBuffer, 1,
-			inFileMode->readOffset + inFileMode->written,
-			_bufferWrittenToFile);
+		int result = startWrite<_bufferWrittenToFile>(moveContext, inFileMode->fd,
+			&moveContext->uvBuffer, inFileMode->readOffset + inFileMode->written);
 		if (result != 0) {
 			moveContext->req.result = result;
 			ctx->libev->runLater(boost::bind(_bufferWrittenToFile,
@@ -1155,10 +1343,9 @@ private:
 				moveContext->uvBuffer = uv_buf_init(
 					moveContext->buffer.start + moveContext->written,
 					moveContext->buffer.size() - moveContext->written);
-				int result = uv_fs_write(ctx->libuv, &moveContext->req,
-					inFileMode->fd, &moveContext->uvBuffer, 1,
-					inFileMode->readOffset + inFileMode->written,
-					_bufferWrittenToFile);
+				int result = startWrite<_bufferWrittenToFile>(moveContext,
+					inFileMode->fd, &moveContext->uvBuffer,
+					inFileMode->readOffset + inFileMode->written);
 				if (result != 0) {
 					moveContext->req.result = result;
 					ctx->libev->runLater(boost::bind(_bufferWrittenToFile,
@@ -1329,6 +1516,60 @@ private:
 		}
 	}
 
+protected:
+	/***** For use by data callbacks of subclasses *****/
+
+	/**
+	 * Fills `buffers` with at most `maxBuffers` of the non-empty buffers that are
+	 * queued in memory behind the buffer that is being fed to the data callback,
+	 * so that the data callback can process them together, e.g. with `writev()`.
+	 * Returns the number of buffers filled. Nothing is returned in the in-file
+	 * mode, because there the queued buffers belong to the writer.
+	 */
+	unsigned int peekQueuedBuffers(struct iovec *buffers, unsigned int maxBuffers) const {
+		if (mode != IN_MEMORY_MODE || nbuffers == 0 || maxBuffers == 0
+		 || firstBuffer.empty())
+		{
+			return 0;
+		}
+
+		unsigned int i = 0;
+		deque<MemoryKit::mbuf>::const_iterator it, end = moreBuffers.end();
+
+		buffers[i].iov_base = firstBuffer.start;
+		buffers[i].iov_len  = firstBuffer.size();
+		i++;
+		for (it = moreBuffers.begin(); it != end && i < maxBuffers && !it->empty(); it++) {
+			buffers[i].iov_base = it->start;
+			buffers[i].iov_len  = it->size();
+			i++;
+		}
+		return i;
+	}
+
+	/**
+	 * Removes the first `size` bytes of the buffers returned by
+	 * `peekQueuedBuffers()` from the queue, because the data callback has
+	 * processed them. This may call the buffers flushed callback.
+	 */
+	void consumeQueuedBuffers(size_t size) {
+		P_ASSERT_EQ(mode, IN_MEMORY_MODE);
+		while (size > 0) {
+			assert(nbuffers > 0);
+			assert(!firstBuffer.empty());
+			if (size >= firstBuffer.size()) {
+				size -= firstBuffer.size();
+				popBuffer();
+			} else {
+				firstBuffer = MemoryKit::mbuf(firstBuffer, size);
+				adjustBytesBuffered(-(boost::int64_t) size);
+				size = 0;
+			}
+		}
+		FBC_DEBUG("consumeQueuedBuffers() completed: nbuffers = " << nbuffers
+			<< ", bytesBuffered = " << bytesBuffered);
+	}
+
 public:
 	/**
 	 * Called when all the in-memory buffers have been popped. This could happen
@@ -1389,6 +1630,9 @@ public:
 		if (mode == IN_FILE_MODE) {
 			cancelWriter();
 		}
+		if (bytesBuffered > 0) {
+			adjustBytesBuffered(-(boost::int64_t) bytesBuffered);
+		}
 	}
 
 	// May only be called right after construction.
@@ -1539,8 +1783,28 @@ public:
 		return Channel::endAcked();
 	}
 
+	/**
+	 * Whether we should switch to in-file mode. Without a memory budget,
+	 * that's the case as soon as this channel buffers `threshold` bytes.
+	 * With a memory budget, channels keep buffering in memory for as long
+	 * as all channels in this context together stay within the budget.
+	 * Once it is exceeded, the threshold is scaled down by the factor by
+	 * which the total exceeds the budget. So at twice the budget, channels
+	 * that buffer half of `threshold` are moved to disk too. Otherwise many
+	 * channels that each buffer just under `threshold` could exceed the
+	 * budget without bounds.
+	 */
 	bool passedThreshold() const {
-		return bytesBuffered >= config->threshold;
+		boost::uint64_t usage = ctx->fileBufferedChannelMemoryUsage;
+
+		if (config->memoryBudget == 0) {
+			return bytesBuffered >= config->threshold;
+		} else if (usage < config->memoryBudget) {
+			return false;
+		} else {
+			return bytesBuffered >= (boost::uint64_t) config->threshold
+				* config->memoryBudget / usage;
+		}
 	}
 
 	OXT_FORCE_INLINE
@@ -1595,6 +1859,10 @@ public:
 			doc["writer_state"] = getWriterStateString();
 			doc["read_offset"] = byteSizeToJson(inFileMode->readOffset);
 			doc["written"] = signedByteSizeToJson(inFileMode->written);
+			if (ctx->bufferFilePool.isInitialized()) {
+				doc["buffer_file_from_pool"] = inFileMode->bufferFilePool != NULL;
+				doc["buffer_file_pool"] = ctx->bufferFilePool.inspectStateAsJson();
+			}
 			break;
 		case ERROR:
 			doc["mode"] = "ERROR";
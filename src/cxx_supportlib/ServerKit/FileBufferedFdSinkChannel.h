@@ -28,7 +28,9 @@
 
 #include <oxt/macros.hpp>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <climits>
 #include <LoggingKit/LoggingKit.h>
 #include <MemoryKit/mbuf.h>
 #include <ServerKit/FileBufferedChannel.h>
@@ -37,12 +39,41 @@ namespace Passenger {
 namespace ServerKit {
 
 
+/**
+ * A FileBufferedChannel that writes to a file descriptor. Each time the file
+ * descriptor is writable, the buffer being fed and the buffers queued in memory
+ * behind it are written with a single `writev()`.
+ */
 class FileBufferedFdSinkChannel: protected FileBufferedChannel {
 public:
 	typedef void (*ErrorCallback)(FileBufferedFdSinkChannel *channel, int errcode);
 
+	/**
+	 * The maximum number of buffers written by a single `writev()`. Beyond a
+	 * few dozen mbufs, the socket send buffer is full anyway.
+	 */
+	static const unsigned int MAX_WRITEV_BUFFERS = (IOV_MAX < 64) ? IOV_MAX : 64;
+
+	struct WriteStats {
+		/** Number of write system calls made. */
+		boost::uint64_t syscalls;
+		/** Number of buffers that those system calls were given. */
+		boost::uint64_t buffers;
+		/** Number of system calls that wrote less than they were given. */
+		boost::uint64_t partialWrites;
+		boost::uint64_t bytesWritten;
+
+		WriteStats()
+			: syscalls(0),
+			  buffers(0),
+			  partialWrites(0),
+			  bytesWritten(0)
+			{ }
+	};
+
 private:
 	ev_io watcher;
+	WriteStats writeStats;
 
 	static Channel::Result onDataCallback(Channel *channel, const MemoryKit::mbuf &buffer,
 		int errcode)
@@ -52,12 +83,45 @@ private:
 		// install a RefGuard before calling this callback.
 
 		if (buffer.size() > 0) {
+			struct iovec buffers[MAX_WRITEV_BUFFERS];
+			unsigned int nbuffers;
+			size_t totalSize = buffer.size();
 			ssize_t ret;
+
+			buffers[0].iov_base = buffer.start;
+			buffers[0].iov_len  = buffer.size();
+			nbuffers = 1 + self->peekQueuedBuffers(buffers + 1, MAX_WRITEV_BUFFERS - 1);
+			for (unsigned int i = 1; i < nbuffers; i++) {
+				totalSize += buffers[i].iov_len;
+			}
+
 			do {
-				ret = ::write(self->watcher.fd, buffer.start, buffer.size());
+				if (nbuffers == 1) {
+					ret = ::write(self->watcher.fd, buffer.start, buffer.size());
+				} else {
+					ret = ::writev(self->watcher.fd, buffers, nbuffers);
+				}
 			} while (OXT_UNLIKELY(ret == -1 && errno == EINTR));
+			self->writeStats.syscalls++;
+			self->writeStats.buffers += nbuffers;
+			if (ret != (ssize_t) totalSize) {
+				self->writeStats.partialWrites++;
+			}
+
 			if (ret != -1) {
-				return Channel::Result(ret, false);
+				self->writeStats.bytesWritten += ret;
+				if ((size_t) ret <= buffer.size()) {
+					return Channel::Result(ret, false);
+				}
+
+				// Drop the queued buffers that have been written as well.
+				unsigned int generation = self->generation;
+				self->consumeQueuedBuffers(ret - buffer.size());
+				if (generation != self->generation) {
+					// The buffers flushed callback deinitialized this object.
+					return Channel::Result(0, true);
+				}
+				return Channel::Result(buffer.size(), false);
 			} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
 				ev_io_start(self->ctx->libev->getLoop(), &self->watcher);
 				return Channel::Result(-1, false);
@@ -152,6 +216,7 @@ public:
 	 */
 	void reinitialize() {
 		FileBufferedChannel::reinitialize();
+		writeStats = WriteStats();
 		stop();
 	}
 
@@ -163,6 +228,7 @@ public:
 	 */
 	void reinitialize(int fd) {
 		FileBufferedChannel::reinitialize();
+		writeStats = WriteStats();
 		setFd(fd);
 	}
 
@@ -199,6 +265,16 @@ public:
 		return watcher.fd;
 	}
 
+	/**
+	 * Statistics about the writes performed since the last (re)initialization.
+	 * `buffers - syscalls` is the number of system calls that gathering
+	 * queued buffers into one `writev()` has saved.
+	 */
+	OXT_FORCE_INLINE
+	const WriteStats &getWriteStats() const {
+		return writeStats;
+	}
+
 	OXT_FORCE_INLINE
 	unsigned int getBytesBuffered() const {
 		return FileBufferedChannel::getBytesBuffered();
@@ -260,7 +336,14 @@ public:
 	}
 
 	Json::Value inspectAsJson() const {
-		return FileBufferedChannel::inspectAsJson();
+		Json::Value doc = FileBufferedChannel::inspectAsJson();
+		Json::Value stats;
+		stats["syscalls"] = (Json::UInt64) writeStats.syscalls;
+		stats["buffers"] = (Json::UInt64) writeStats.buffers;
+		stats["partial_writes"] = (Json::UInt64) writeStats.partialWrites;
+		stats["bytes_written"] = byteSizeToJson(writeStats.bytesWritten);
+		doc["write_stats"] = stats;
+		return doc;
 	}
 };
 
@@ -33,6 +33,7 @@
 #include <DataStructures/LString.h>
 #include <DataStructures/HashedStaticString.h>
 #include <StaticString.h>
+#include <Utils/Hasher.h>
 
 namespace Passenger {
 namespace ServerKit {
@@ -307,10 +308,10 @@ public:
 		const StaticString &value)
 	{
 		Header *header = (Header *) psg_palloc(pool, sizeof(Header));
+		Hasher hasher;
 
 		char *downcasedName = (char *) psg_pnalloc(pool, name.size());
-		convertLowerCase((const unsigned char *) name.data(),
-			(unsigned char *) downcasedName, name.size());
+		hasher.updateLowerCase(name.data(), downcasedName, name.size());
 		psg_lstr_init(&header->key);
 		psg_lstr_append(&header->key, pool, downcasedName, name.size());
 
@@ -320,7 +321,7 @@ public:
 		psg_lstr_init(&header->val);
 		psg_lstr_append(&header->val, pool, value.data(), value.size());
 
-		header->hash = HashedStaticString(downcasedName, name.size()).hash();
+		header->hash = hasher.finalize();
 		insert(&header, pool);
 		return header;
 	}
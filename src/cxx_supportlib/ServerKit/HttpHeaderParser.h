@@ -110,6 +110,19 @@ private:
 		return true;
 	}
 
+	/**
+	 * A header field that spans multiple buffers arrives in multiple parts.
+	 * Joining them once here keeps key comparisons in HeaderTable simple.
+	 */
+	void makeCurrentHeaderKeyContiguous() {
+		LString *key = &state->currentHeader->key;
+		if (OXT_UNLIKELY(key->start != key->end)) {
+			LString *contiguousKey = psg_lstr_make_contiguous(key, pool);
+			psg_lstr_deinit(key);
+			*key = *contiguousKey;
+		}
+	}
+
 	void insertCurrentHeader() {
 		if (!state->secureMode) {
 			message->headers.insert(&state->currentHeader, pool);
@@ -207,11 +220,9 @@ private:
 			self->state->hasher.update(data, len);
 		} else {
 			char *downcasedData = (char *) psg_pnalloc(self->pool, len);
-			convertLowerCase((const unsigned char *) data,
-				(unsigned char *) downcasedData, len);
+			self->state->hasher.updateLowerCase(data, downcasedData, len);
 			psg_lstr_append(&self->state->currentHeader->key, self->pool,
 				downcasedData, len);
-			self->state->hasher.update(downcasedData, len);
 		}
 
 		return 0;
@@ -230,12 +241,11 @@ private:
 				self->state->state = HttpHeaderParserState::PARSING_HEADER_VALUE;
 			}
 			self->state->currentHeader->hash = self->state->hasher.finalize();
-
+			self->makeCurrentHeaderKeyContiguous();
 		}
 
 		psg_lstr_append(&self->state->currentHeader->val, self->pool,
 			*self->currentBuffer, data, len);
-		self->state->hasher.update(data, len);
 
 		return 0;
 	}
@@ -281,6 +281,7 @@ public:
 	public: \
 	union { \
 		STAILQ_ENTRY(RequestType) freeRequest; \
+		STAILQ_ENTRY(RequestType) pipelinedRequest; \
 		LIST_ENTRY(RequestType) lingeringRequest; \
 	} nextRequest
 
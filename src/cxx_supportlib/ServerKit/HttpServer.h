@@ -68,6 +68,7 @@ extern const unsigned int DEFAULT_INTERNAL_SERVER_ERROR_RESPONSE_SIZE;
  *   accept_burst_count           unsigned integer   -   default(32)
  *   client_freelist_limit        unsigned integer   -   default(0)
  *   min_spare_clients            unsigned integer   -   default(0)
+ *   pipelined_requests_limit     unsigned integer   -   default(0)
  *   request_freelist_limit       unsigned integer   -   default(1024)
  *   start_reading_after_accept   boolean            -   default(true)
  *
@@ -79,6 +80,7 @@ private:
 		using namespace ConfigKit;
 
 		add("request_freelist_limit", UINT_TYPE, OPTIONAL, 1024);
+		add("pipelined_requests_limit", UINT_TYPE, OPTIONAL, 0);
 	}
 
 public:
@@ -98,13 +100,16 @@ public:
 
 struct HttpServerConfigRealization {
 	unsigned int requestFreelistLimit;
+	unsigned int pipelinedRequestsLimit;
 
 	HttpServerConfigRealization(const ConfigKit::Store &config)
-		: requestFreelistLimit(config["request_freelist_limit"].asUInt())
+		: requestFreelistLimit(config["request_freelist_limit"].asUInt()),
+		  pipelinedRequestsLimit(config["pipelined_requests_limit"].asUInt())
 		{ }
 
 	void swap(HttpServerConfigRealization &other) BOOST_NOEXCEPT_OR_NOTHROW {
 		std::swap(requestFreelistLimit, other.requestFreelistLimit);
+		std::swap(pipelinedRequestsLimit, other.pipelinedRequestsLimit);
 	}
 };
 
@@ -127,6 +132,12 @@ public:
 	unsigned int freeRequestCount;
 	unsigned long totalRequestsBegun, lastTotalRequestsBegun;
 	double requestBeginSpeed1m, requestBeginSpeed1h;
+	/**
+	 * High-water marks of request palloc pools, and the number of requests
+	 * that needed more than the first PSG_DEFAULT_POOL_SIZE block.
+	 */
+	psg_pool_usage_t requestPoolPeakUsage;
+	boost::uint64_t requestPoolOverflows;
 
 private:
 	/***** Types and nested classes *****/
@@ -284,10 +295,7 @@ private:
 		P_ASSERT_EQ(req->httpState, Request::WAITING_FOR_REFERENCES);
 		assert(req->pool != NULL);
 		c->currentRequest = NULL;
-		if (!psg_reset_pool(req->pool, PSG_DEFAULT_POOL_SIZE)) {
-			psg_destroy_pool(req->pool);
-			req->pool = NULL;
-		}
+		recycleRequestPool(req);
 		unrefRequest(req, __FILE__, __LINE__);
 		if (keepAlive) {
 			SKC_TRACE(c, 3, "Keeping alive connection, handling next request");
@@ -304,6 +312,11 @@ private:
 	void handleNextRequest(Client *client) {
 		Request *req;
 
+		if (!STAILQ_EMPTY(&client->pipelinedRequests)) {
+			handleNextPipelinedRequest(client);
+			return;
+		}
+
 		// A request object references its client object.
 		// This reference will be removed when the request ends,
 		// in requestReachedZeroRefcount().
@@ -319,6 +332,211 @@ private:
 	}
 
 
+	/***** Request pipelining *****/
+
+	Request *getLastPipelinedRequest(Client *client) const {
+		Request *req = STAILQ_FIRST(&client->pipelinedRequests);
+		if (req != NULL) {
+			while (STAILQ_NEXT(req, nextRequest.pipelinedRequest) != NULL) {
+				req = STAILQ_NEXT(req, nextRequest.pipelinedRequest);
+			}
+		}
+		return req;
+	}
+
+	/**
+	 * Whether we may parse another request from the client after `prev`,
+	 * which is either the current request or the last pipelined one.
+	 * We don't read ahead into request bodies, so only requests without
+	 * a (remaining) body can be followed by another one.
+	 */
+	bool canPipelineRequestAfter(Client *client, Request *prev) const {
+		return client->pipelinedRequestCount < configRlz.pipelinedRequestsLimit
+			&& prev->wantKeepAlive
+			&& (prev == client->currentRequest || prev->httpState == Request::COMPLETE);
+	}
+
+	Request *queuePipelinedRequest(Client *client) {
+		Request *req;
+
+		// Just like in handleNextRequest(), the request object references
+		// its client object.
+		this->refClient(client, __FILE__, __LINE__);
+
+		req = checkoutRequestObject(client);
+		req->client = client;
+		reinitializeRequest(client, req);
+		STAILQ_INSERT_TAIL(&client->pipelinedRequests, req,
+			nextRequest.pipelinedRequest);
+		client->pipelinedRequestCount++;
+		return req;
+	}
+
+	/**
+	 * Takes the place of detectNextRequestEarlyReadError() when pipelining
+	 * is enabled. Instead of leaving the data that the client sent after
+	 * the current request in the input channel, parses it into queued
+	 * request objects, which handleNextRequest() begins in order.
+	 */
+	Channel::Result processPipelinedClientData(Client *client, Request *req,
+		const MemoryKit::mbuf &buffer, int errcode)
+	{
+		Request *last = getLastPipelinedRequest(client);
+		size_t consumed = 0;
+
+		if (last == NULL && (buffer.empty() || !req->wantKeepAlive)) {
+			detectNextRequestEarlyReadError(client, req, buffer, errcode);
+			return Channel::Result(0, false);
+		} else if (buffer.empty()) {
+			// Reported to the last pipelined request once it becomes the
+			// current one; see handleNextPipelinedRequest().
+			SKC_TRACE(client, 3, "Early read EOF or error detected after "
+				<< client->pipelinedRequestCount << " pipelined requests");
+			client->input.stop();
+			last->nextRequestEarlyReadError = (errcode == 0)
+				? (int) EARLY_EOF_DETECTED
+				: errcode;
+			return Channel::Result(0, false);
+		}
+
+		while (consumed < buffer.size()) {
+			if (last == NULL || last->httpState != Request::PARSING_HEADERS) {
+				if (!canPipelineRequestAfter(client, (last == NULL) ? req : last)) {
+					SKC_TRACE(client, 3, "Not parsing more pipelined requests for now");
+					client->input.stop();
+					break;
+				}
+				last = queuePipelinedRequest(client);
+			}
+
+			MemoryKit::mbuf part(buffer, consumed, buffer.size() - consumed);
+			size_t ret;
+			SKC_TRACE(client, 3, "Parsing " << part.size() <<
+				" bytes of pipelined HTTP header: \"" << cEscapeString(StaticString(
+					part.start, part.size())) << "\"");
+			ret = createRequestHeaderParser(this->getContext(), last).feed(part);
+			last->lastDataReceiveTime = ev_now(this->getLoop());
+			if (last->httpState == Request::PARSING_HEADERS) {
+				consumed = buffer.size();
+			} else {
+				SKC_TRACE(client, 2, "Pipelined request received (" <<
+					client->pipelinedRequestCount << " queued)");
+				headerParserStatePool.destroy(last->parserState.headerParser);
+				last->parserState.headerParser = NULL;
+				consumed += ret;
+			}
+		}
+
+		return Channel::Result(consumed, false);
+	}
+
+	/**
+	 * Makes the first pipelined request the current one, and does for it
+	 * what processClientDataWhenParsingHeaders() would have done when it
+	 * finished parsing its header.
+	 */
+	void handleNextPipelinedRequest(Client *client) {
+		Request *req = STAILQ_FIRST(&client->pipelinedRequests);
+
+		STAILQ_REMOVE_HEAD(&client->pipelinedRequests, nextRequest.pipelinedRequest);
+		client->pipelinedRequestCount--;
+
+		client->output.deinitialize();
+		client->output.reinitialize(client->getFd());
+		client->currentRequest = req;
+
+		if (req->httpState == Request::PARSING_HEADERS) {
+			int errcode = req->nextRequestEarlyReadError;
+			if (errcode == 0) {
+				client->input.start();
+			} else {
+				req->nextRequestEarlyReadError = 0;
+				onClientDataReceived(client, MemoryKit::mbuf(), errcode);
+			}
+			return;
+		}
+
+		RequestRef ref(req, __FILE__, __LINE__);
+		SKC_TRACE(client, 2, "New request received: #" << (totalRequestsBegun + 1)
+			<< " (pipelined)");
+
+		if (HttpServer::serverState == HttpServer::SHUTTING_DOWN
+		 && shouldDisconnectClientOnShutdown(client))
+		{
+			endWithErrorResponse(&client, &req, 503, "Server shutting down\n");
+			return;
+		}
+
+		switch (req->httpState) {
+		case Request::COMPLETE:
+			if (req->nextRequestEarlyReadError == 0) {
+				req->detectingNextRequestEarlyReadError = true;
+				client->input.start();
+				onRequestBegin(client, req);
+			} else {
+				// The client sent EOF or an error right after this request.
+				// If the request ends before we get to report it, then
+				// doneWithCurrentRequest() passes it on instead.
+				onRequestBegin(client, req);
+				if (!req->ended()) {
+					onNextRequestEarlyReadError(client, req,
+						req->nextRequestEarlyReadError);
+				}
+			}
+			break;
+		case Request::PARSING_BODY:
+			SKC_TRACE(client, 2, "Expecting a request body");
+			client->input.setSizeHint(req->aux.bodyInfo.contentLength);
+			client->input.start();
+			onRequestBegin(client, req);
+			break;
+		case Request::PARSING_CHUNKED_BODY:
+			SKC_TRACE(client, 2, "Expecting a chunked request body");
+			prepareChunkedBodyParsing(client, req);
+			client->input.start();
+			onRequestBegin(client, req);
+			break;
+		case Request::UPGRADED:
+			assert(!req->wantKeepAlive);
+			if (supportsUpgrade(client, req)) {
+				SKC_TRACE(client, 2, "Expecting connection upgrade");
+				client->input.start();
+				onRequestBegin(client, req);
+			} else {
+				endWithErrorResponse(&client, &req, 422,
+					"Connection upgrading not allowed for this request");
+			}
+			break;
+		case Request::ERROR:
+			// Change state so that the response body will be written.
+			req->httpState = Request::COMPLETE;
+			if (req->aux.parseError == HTTP_VERSION_NOT_SUPPORTED) {
+				endWithErrorResponse(&client, &req, 505, "HTTP version not supported\n");
+			} else {
+				endAsBadRequest(&client, &req, getErrorDesc(req->aux.parseError));
+			}
+			break;
+		default:
+			P_BUG("Invalid request HTTP state " << (int) req->httpState);
+			break;
+		}
+	}
+
+	void discardPipelinedRequests(Client *client) {
+		while (!STAILQ_EMPTY(&client->pipelinedRequests)) {
+			Request *req = STAILQ_FIRST(&client->pipelinedRequests);
+			STAILQ_REMOVE_HEAD(&client->pipelinedRequests, nextRequest.pipelinedRequest);
+			client->pipelinedRequestCount--;
+
+			deinitializeRequest(client, req);
+			LIST_INSERT_HEAD(&client->lingeringRequests, req,
+				nextRequest.lingeringRequest);
+			client->lingeringRequestCount++;
+			unrefRequest(req, __FILE__, __LINE__);
+		}
+	}
+
+
 	/***** Client data handling *****/
 
 	Channel::Result processClientDataWhenParsingHeaders(Client *client, Request *req,
@@ -357,6 +575,8 @@ private:
 				return Channel::Result(ret, false);
 			case Request::PARSING_BODY:
 				SKC_TRACE(client, 2, "Expecting a request body");
+				client->input.setSizeHint(req->aux.bodyInfo.contentLength,
+					buffer.size() - ret);
 				onRequestBegin(client, req);
 				return Channel::Result(ret, false);
 			case Request::PARSING_CHUNKED_BODY:
@@ -775,6 +995,12 @@ protected:
 		if (!ended) {
 			req->lastDataReceiveTime = ev_now(this->getLoop());
 		}
+		if (req->detectingNextRequestEarlyReadError
+		 && (configRlz.pipelinedRequestsLimit > 0
+		  || !STAILQ_EMPTY(&client->pipelinedRequests)))
+		{
+			return processPipelinedClientData(client, req, buffer, errcode);
+		}
 		if (detectNextRequestEarlyReadError(client, req, buffer, errcode)) {
 			return Channel::Result(0, false);
 		}
@@ -825,11 +1051,13 @@ protected:
 			client->currentRequest = NULL;
 			unrefRequest(req, __FILE__, __LINE__);
 		}
+		discardPipelinedRequests(client);
 	}
 
 	virtual void deinitializeClient(Client *client) {
 		ParentClass::deinitializeClient(client);
 		client->currentRequest = NULL;
+		assert(STAILQ_EMPTY(&client->pipelinedRequests));
 	}
 
 	virtual bool shouldDisconnectClientOnShutdown(Client *client) {
@@ -936,6 +1164,29 @@ protected:
 		req->nextRequestEarlyReadError = 0;
 	}
 
+	/**
+	 * Keeps the request's palloc pool around, with its first block, for the
+	 * next request that uses this Request object.
+	 */
+	void recycleRequestPool(Request *req) {
+		psg_pool_usage_t usage;
+
+		psg_pool_get_usage(req->pool, &usage);
+		if (usage.used > requestPoolPeakUsage.used) {
+			requestPoolPeakUsage.used = usage.used;
+		}
+		if (usage.nblocks > requestPoolPeakUsage.nblocks) {
+			requestPoolPeakUsage.nblocks = usage.nblocks;
+		}
+		if (usage.nlarge > requestPoolPeakUsage.nlarge) {
+			requestPoolPeakUsage.nlarge = usage.nlarge;
+		}
+		if (usage.nblocks > 1 || usage.nlarge > 0) {
+			requestPoolOverflows++;
+		}
+		psg_recycle_pool(req->pool, PSG_DEFAULT_POOL_SIZE);
+	}
+
 	/**
 	 * Must be idempotent, because onClientDisconnecting() can call it
 	 * after endRequest() is called.
@@ -966,9 +1217,8 @@ protected:
 			it.next();
 		}
 
-		if (req->pool != NULL && !psg_reset_pool(req->pool, PSG_DEFAULT_POOL_SIZE)) {
-			psg_destroy_pool(req->pool);
-			req->pool = NULL;
+		if (req->pool != NULL) {
+			recycleRequestPool(req);
 		}
 
 		req->httpState = Request::WAITING_FOR_REFERENCES;
@@ -996,10 +1246,14 @@ public:
 		  lastTotalRequestsBegun(0),
 		  requestBeginSpeed1m(-1),
 		  requestBeginSpeed1h(-1),
+		  requestPoolOverflows(0),
 		  configRlz(ParentClass::config),
 		  headerParserStatePool(16, 256)
 	{
 		STAILQ_INIT(&freeRequests);
+		requestPoolPeakUsage.used = 0;
+		requestPoolPeakUsage.nblocks = 0;
+		requestPoolPeakUsage.nlarge = 0;
 	}
 
 
@@ -1267,6 +1521,11 @@ public:
 		doc["request_begin_speed"]["1h"] = averageSpeedToJson(
 			capFloatPrecision(requestBeginSpeed1h * 60),
 			"minute", "1 hour", -1);
+		doc["request_pools"]["block_size"] = byteSizeToJson(PSG_DEFAULT_POOL_SIZE);
+		doc["request_pools"]["peak_usage"] = byteSizeToJson(requestPoolPeakUsage.used);
+		doc["request_pools"]["peak_blocks"] = requestPoolPeakUsage.nblocks;
+		doc["request_pools"]["peak_large_allocations"] = requestPoolPeakUsage.nlarge;
+		doc["request_pools"]["overflows"] = (Json::UInt64) requestPoolOverflows;
 		return doc;
 	}
 
@@ -1277,6 +1536,7 @@ public:
 		}
 		doc["requests_begun"] = client->requestsBegun;
 		doc["lingering_request_count"] = client->lingeringRequestCount;
+		doc["pipelined_request_count"] = client->pipelinedRequestCount;
 		return doc;
 	}
 
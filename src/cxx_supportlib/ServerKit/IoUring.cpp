@@ -0,0 +1,553 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#include <ServerKit/IoUring.h>
+#include <LoggingKit/LoggingKit.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __linux__
+	#include <linux/version.h>
+	// IORING_OP_UNLINKAT is the newest operation that we use.
+	#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 11, 0)
+		#define HAVE_IO_URING
+		#include <linux/io_uring.h>
+		#include <sys/mman.h>
+		#include <sys/syscall.h>
+		#include <sys/eventfd.h>
+	#endif
+#endif
+
+namespace Passenger {
+namespace ServerKit {
+
+using namespace std;
+
+
+#ifdef HAVE_IO_URING
+	static int
+	sysSetup(unsigned int entries, struct io_uring_params *params) {
+		return (int) syscall(__NR_io_uring_setup, entries, params);
+	}
+
+	static int
+	sysEnter(int fd, unsigned int toSubmit, unsigned int minComplete, unsigned int flags) {
+		return (int) syscall(__NR_io_uring_enter, fd, toSubmit, minComplete,
+			flags, NULL, 0);
+	}
+
+	static int
+	sysRegister(int fd, unsigned int opcode, const void *arg, unsigned int nrArgs) {
+		return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+	}
+#endif
+
+
+IoUring::IoUring()
+	: loop(NULL),
+	  ringFd(-1),
+	  eventFd(-1),
+	  sqRing(NULL),
+	  cqRing(NULL),
+	  sqRingSize(0),
+	  cqRingSize(0),
+	  sqesSize(0),
+	  sqHead(NULL),
+	  sqTail(NULL),
+	  sqArray(NULL),
+	  sqMask(0),
+	  sqEntries(0),
+	  cqHead(NULL),
+	  cqTail(NULL),
+	  cqMask(0),
+	  sqes(NULL),
+	  cqes(NULL),
+	  unsubmitted(0),
+	  processingCompletions(false),
+	  nFixedBuffers(0),
+	  nextFixedBuffer(0),
+	  submissions(0),
+	  completions(0),
+	  enterCalls(0),
+	  fixedBufferReads(0)
+	{ }
+
+IoUring::~IoUring() {
+	deinitialize();
+}
+
+bool
+IoUring::initialize(struct ev_loop *_loop, struct MemoryKit::mbuf_pool *pool,
+	unsigned int nFixedBuffers, string &error)
+{
+	#ifdef HAVE_IO_URING
+		struct io_uring_params params;
+
+		memset(&params, 0, sizeof(params));
+		ringFd = sysSetup(QUEUE_DEPTH, &params);
+		if (ringFd == -1) {
+			error = "cannot create ring: " + string(strerror(errno));
+			return false;
+		}
+		P_LOG_FILE_DESCRIPTOR_OPEN4(ringFd, __FILE__, __LINE__, "io_uring");
+		fcntl(ringFd, F_SETFD, FD_CLOEXEC);
+
+		if (!mapRings(params, error) || !supportsRequiredOperations(error)) {
+			deinitialize();
+			return false;
+		}
+
+		eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (eventFd == -1) {
+			error = "cannot create eventfd: " + string(strerror(errno));
+			deinitialize();
+			return false;
+		}
+		P_LOG_FILE_DESCRIPTOR_OPEN4(eventFd, __FILE__, __LINE__, "io_uring eventfd");
+		if (sysRegister(ringFd, IORING_REGISTER_EVENTFD, &eventFd, 1) != 0) {
+			error = "cannot register eventfd: " + string(strerror(errno));
+			deinitialize();
+			return false;
+		}
+
+		registerFixedBuffers(pool, nFixedBuffers);
+
+		loop = _loop;
+		ev_io_init(&eventWatcher, onEventFdReadable, eventFd, EV_READ);
+		eventWatcher.data = this;
+		ev_io_start(loop, &eventWatcher);
+		ev_prepare_init(&prepareWatcher, onPrepare);
+		prepareWatcher.data = this;
+		ev_prepare_start(loop, &prepareWatcher);
+		return true;
+	#else
+		error = "io_uring is not supported on this platform";
+		return false;
+	#endif
+}
+
+void
+IoUring::deinitialize() {
+	#ifdef HAVE_IO_URING
+		if (loop != NULL) {
+			ev_io_stop(loop, &eventWatcher);
+			ev_prepare_stop(loop, &prepareWatcher);
+			loop = NULL;
+		}
+		if (sqes != NULL) {
+			munmap(sqes, sqesSize);
+			sqes = NULL;
+		}
+		if (cqRing != NULL && cqRing != sqRing) {
+			munmap(cqRing, cqRingSize);
+		}
+		cqRing = NULL;
+		if (sqRing != NULL) {
+			munmap(sqRing, sqRingSize);
+			sqRing = NULL;
+		}
+		if (ringFd != -1) {
+			// Closing the ring waits for the kernel to finish with
+			// the fixed buffers, so we can only release them afterwards.
+			P_LOG_FILE_DESCRIPTOR_CLOSE(ringFd);
+			::close(ringFd);
+			ringFd = -1;
+		}
+		if (eventFd != -1) {
+			P_LOG_FILE_DESCRIPTOR_CLOSE(eventFd);
+			::close(eventFd);
+			eventFd = -1;
+		}
+		for (unsigned int i = 0; i < nFixedBuffers; i++) {
+			fixedBuffers[i] = MemoryKit::mbuf();
+		}
+		nFixedBuffers = 0;
+		unsubmitted = 0;
+	#endif
+}
+
+bool
+IoUring::mapRings(const struct io_uring_params &params, string &error) {
+	#ifdef HAVE_IO_URING
+		sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+		cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+		if (params.features & IORING_FEAT_SINGLE_MMAP) {
+			sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+		}
+
+		sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+		if (sqRing == MAP_FAILED) {
+			sqRing = NULL;
+			error = "cannot map submission queue: " + string(strerror(errno));
+			return false;
+		}
+		if (params.features & IORING_FEAT_SINGLE_MMAP) {
+			cqRing = sqRing;
+		} else {
+			cqRing = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+			if (cqRing == MAP_FAILED) {
+				cqRing = NULL;
+				error = "cannot map completion queue: " + string(strerror(errno));
+				return false;
+			}
+		}
+
+		sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+		void *sqesMemory = mmap(NULL, sqesSize, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+		if (sqesMemory == MAP_FAILED) {
+			error = "cannot map submission queue entries: " + string(strerror(errno));
+			return false;
+		}
+		sqes = (struct io_uring_sqe *) sqesMemory;
+
+		char *sq = (char *) sqRing;
+		char *cq = (char *) cqRing;
+		sqHead  = (unsigned int *) (sq + params.sq_off.head);
+		sqTail  = (unsigned int *) (sq + params.sq_off.tail);
+		sqArray = (unsigned int *) (sq + params.sq_off.array);
+		sqMask  = *(unsigned int *) (sq + params.sq_off.ring_mask);
+		sqEntries = params.sq_entries;
+		cqHead  = (unsigned int *) (cq + params.cq_off.head);
+		cqTail  = (unsigned int *) (cq + params.cq_off.tail);
+		cqMask  = *(unsigned int *) (cq + params.cq_off.ring_mask);
+		cqes    = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+		return true;
+	#else
+		return false;
+	#endif
+}
+
+bool
+IoUring::supportsRequiredOperations(string &error) {
+	#ifdef HAVE_IO_URING
+		static const unsigned char required[] = {
+			IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_READ_FIXED,
+			IORING_OP_WRITE, IORING_OP_CLOSE, IORING_OP_UNLINKAT
+		};
+		const unsigned int nops = 256;
+		size_t size = sizeof(struct io_uring_probe) + nops * sizeof(struct io_uring_probe_op);
+		struct io_uring_probe *probe = (struct io_uring_probe *) calloc(1, size);
+		bool result = true;
+
+		if (probe == NULL) {
+			error = "cannot allocate memory";
+			return false;
+		}
+		if (sysRegister(ringFd, IORING_REGISTER_PROBE, probe, nops) != 0) {
+			error = "cannot probe supported operations: " + string(strerror(errno));
+			free(probe);
+			return false;
+		}
+		for (unsigned int i = 0; i < sizeof(required) && result; i++) {
+			result = required[i] <= probe->last_op
+				&& (probe->ops[required[i]].flags & IO_URING_OP_SUPPORTED);
+		}
+		if (!result) {
+			error = "the kernel does not support all required operations";
+		}
+		free(probe);
+		return result;
+	#else
+		return false;
+	#endif
+}
+
+void
+IoUring::registerFixedBuffers(struct MemoryKit::mbuf_pool *pool, unsigned int count) {
+	#ifdef HAVE_IO_URING
+		struct iovec iov[MAX_FIXED_BUFFERS];
+		unsigned int i;
+
+		count = std::min(count, MAX_FIXED_BUFFERS);
+		for (i = 0; i < count; i++) {
+			fixedBuffers[i] = MemoryKit::mbuf_get(pool);
+			iov[i].iov_base = fixedBuffers[i].start;
+			iov[i].iov_len  = fixedBuffers[i].size();
+		}
+		if (count > 0 && sysRegister(ringFd, IORING_REGISTER_BUFFERS, iov, count) == 0) {
+			nFixedBuffers = count;
+		} else {
+			if (count > 0) {
+				int e = errno;
+				P_DEBUG("io_uring: cannot register fixed buffers, reading into "
+					"ordinary buffers instead: " << strerror(e) << " (errno=" << e << ")");
+			}
+			for (i = 0; i < count; i++) {
+				fixedBuffers[i] = MemoryKit::mbuf();
+			}
+		}
+	#endif
+}
+
+/**
+ * Returns a zeroed submission queue entry, or NULL if the queue is
+ * full even after submitting everything that is pending. The entry
+ * is only handed to the kernel after `commitSqe()`.
+ */
+struct io_uring_sqe *
+IoUring::prepareSqe() {
+	#ifdef HAVE_IO_URING
+		unsigned int tail = *sqTail;
+		if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+			submitPending();
+			if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+				return NULL;
+			}
+		}
+		struct io_uring_sqe *sqe = &sqes[tail & sqMask];
+		memset(sqe, 0, sizeof(*sqe));
+		return sqe;
+	#else
+		return NULL;
+	#endif
+}
+
+void
+IoUring::commitSqe(struct io_uring_sqe *sqe, Request *req) {
+	#ifdef HAVE_IO_URING
+		unsigned int tail = *sqTail;
+		unsigned int index = tail & sqMask;
+
+		assert(sqe == &sqes[index]);
+		sqe->user_data = (boost::uint64_t) (uintptr_t) req;
+		sqArray[index] = index;
+		__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+		unsubmitted++;
+		submissions++;
+	#endif
+}
+
+void
+IoUring::processCompletions() {
+	#ifdef HAVE_IO_URING
+		// Callbacks may submit new operations, which may in turn
+		// try to make room in the completion queue.
+		if (processingCompletions) {
+			return;
+		}
+		processingCompletions = true;
+
+		unsigned int head = *cqHead;
+		while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+			struct io_uring_cqe *cqe = &cqes[head & cqMask];
+			Request *req = (Request *) (uintptr_t) cqe->user_data;
+			int result = cqe->res;
+
+			head++;
+			__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+			completions++;
+			if (req != NULL) {
+				req->callback(req->userData, result);
+			}
+		}
+
+		processingCompletions = false;
+	#endif
+}
+
+void
+IoUring::onEventFdReadable(struct ev_loop *loop, ev_io *io, int revents) {
+	IoUring *self = static_cast<IoUring *>(io->data);
+	boost::uint64_t value;
+	ssize_t ret;
+
+	do {
+		ret = ::read(self->eventFd, &value, sizeof(value));
+	} while (ret == -1 && errno == EINTR);
+	self->processCompletions();
+}
+
+void
+IoUring::onPrepare(struct ev_loop *loop, ev_prepare *prepare, int revents) {
+	static_cast<IoUring *>(prepare->data)->submitPending();
+}
+
+void
+IoUring::submitPending() {
+	#ifdef HAVE_IO_URING
+		while (unsubmitted > 0) {
+			int ret = sysEnter(ringFd, unsubmitted, 0, 0);
+			enterCalls++;
+			if (ret >= 0) {
+				unsubmitted -= std::min<unsigned int>(ret, unsubmitted);
+				if (ret == 0) {
+					break;
+				}
+			} else if (errno == EBUSY) {
+				// The completion queue is full. Make room and try again
+				// when the event loop is about to block.
+				processCompletions();
+				break;
+			} else if (errno != EINTR) {
+				int e = errno;
+				if (e != EAGAIN) {
+					P_WARN("io_uring: cannot submit operations: " << strerror(e) <<
+						" (errno=" << e << ")");
+				}
+				break;
+			}
+		}
+	#endif
+}
+
+bool
+IoUring::openat(const char *path, int flags, mode_t mode, Request *req) {
+	#ifdef HAVE_IO_URING
+		struct io_uring_sqe *sqe = prepareSqe();
+		if (sqe == NULL) {
+			return false;
+		}
+		sqe->opcode = IORING_OP_OPENAT;
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (boost::uint64_t) (uintptr_t) path;
+		sqe->len = mode;
+		sqe->open_flags = flags;
+		commitSqe(sqe, req);
+		return true;
+	#else
+		return false;
+	#endif
+}
+
+bool
+IoUring::read(int fd, char *buf, unsigned int size, boost::uint64_t offset, Request *req) {
+	#ifdef HAVE_IO_URING
+		struct io_uring_sqe *sqe = prepareSqe();
+		if (sqe == NULL) {
+			return false;
+		}
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = fd;
+		sqe->addr = (boost::uint64_t) (uintptr_t) buf;
+		sqe->len = size;
+		sqe->off = offset;
+		commitSqe(sqe, req);
+		return true;
+	#else
+		return false;
+	#endif
+}
+
+bool
+IoUring::readFixed(int fd, char *buf, unsigned int size, boost::uint64_t offset,
+	unsigned int index, Request *req)
+{
+	#ifdef HAVE_IO_URING
+		assert(index < nFixedBuffers);
+		assert(buf >= fixedBuffers[index].start);
+		assert(buf + size <= fixedBuffers[index].end);
+		struct io_uring_sqe *sqe = prepareSqe();
+		if (sqe == NULL) {
+			return false;
+		}
+		sqe->opcode = IORING_OP_READ_FIXED;
+		sqe->fd = fd;
+		sqe->addr = (boost::uint64_t) (uintptr_t) buf;
+		sqe->len = size;
+		sqe->off = offset;
+		sqe->buf_index = index;
+		commitSqe(sqe, req);
+		fixedBufferReads++;
+		return true;
+	#else
+		return false;
+	#endif
+}
+
+bool
+IoUring::write(int fd, const char *buf, unsigned int size, boost::uint64_t offset,
+	Request *req)
+{
+	#ifdef HAVE_IO_URING
+		struct io_uring_sqe *sqe = prepareSqe();
+		if (sqe == NULL) {
+			return false;
+		}
+		sqe->opcode = IORING_OP_WRITE;
+		sqe->fd = fd;
+		sqe->addr = (boost::uint64_t) (uintptr_t) buf;
+		sqe->len = size;
+		sqe->off = offset;
+		commitSqe(sqe, req);
+		return true;
+	#else
+		return false;
+	#endif
+}
+
+bool
+IoUring::close(int fd, Request *req) {
+	#ifdef HAVE_IO_URING
+		struct io_uring_sqe *sqe = prepareSqe();
+		if (sqe == NULL) {
+			return false;
+		}
+		sqe->opcode = IORING_OP_CLOSE;
+		sqe->fd = fd;
+		commitSqe(sqe, req);
+		return true;
+	#else
+		return false;
+	#endif
+}
+
+bool
+IoUring::unlink(const char *path, Request *req) {
+	#ifdef HAVE_IO_URING
+		struct io_uring_sqe *sqe = prepareSqe();
+		if (sqe == NULL) {
+			return false;
+		}
+		sqe->opcode = IORING_OP_UNLINKAT;
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (boost::uint64_t) (uintptr_t) path;
+		commitSqe(sqe, req);
+		return true;
+	#else
+		return false;
+	#endif
+}
+
+Json::Value
+IoUring::inspectStateAsJson() const {
+	Json::Value doc;
+	doc["submissions"] = (Json::UInt64) submissions;
+	doc["completions"] = (Json::UInt64) completions;
+	doc["enter_calls"] = (Json::UInt64) enterCalls;
+	doc["fixed_buffers"] = nFixedBuffers;
+	doc["fixed_buffer_reads"] = (Json::UInt64) fixedBufferReads;
+	return doc;
+}
+
+
+} // namespace ServerKit
+} // namespace Passenger
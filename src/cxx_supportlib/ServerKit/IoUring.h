@@ -0,0 +1,207 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_SERVER_KIT_IO_URING_H_
+#define _PASSENGER_SERVER_KIT_IO_URING_H_
+
+#include <boost/cstdint.hpp>
+#include <sys/types.h>
+#include <ev.h>
+#include <cassert>
+#include <cstddef>
+#include <string>
+#include <jsoncpp/json.h>
+#include <MemoryKit/mbuf.h>
+
+// Defined in <linux/io_uring.h>, which we only include in IoUring.cpp
+// because it drags in macros (such as BLOCK_SIZE) that clash with our code.
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_params;
+
+namespace Passenger {
+namespace ServerKit {
+
+using namespace std;
+
+
+/**
+ * A minimal io_uring engine for the file operations that FileBufferedChannel
+ * performs on its buffer file: open, read, write, close and unlink. It is an
+ * alternative to the libuv threadpool, which needs a thread handoff and a
+ * malloc per operation.
+ *
+ * Submissions are batched until the event loop is about to block (through an
+ * ev_prepare watcher), and completions are delivered on the event loop
+ * through an eventfd. All methods must be called from the event loop thread,
+ * except `initialize()`, which must be called before the event loop runs.
+ *
+ * A small number of mbuf_blocks can be pinned and registered with the kernel
+ * as fixed buffers, so that reads into them don't have to map the destination
+ * pages every time. A fixed buffer is free when nobody but this object
+ * references its mbuf_block anymore.
+ *
+ * `initialize()` fails when the kernel (or the headers we were compiled
+ * against) lack io_uring or any of the operations that we need. Callers
+ * should then keep using libuv.
+ */
+class IoUring {
+public:
+	/**
+	 * Called on the event loop thread when an operation completes. `result`
+	 * is what the system call would have returned, or a negative errno.
+	 */
+	typedef void (*Callback)(void *userData, int result);
+
+	/**
+	 * Identifies an operation and its completion callback. Owned by the caller,
+	 * and must stay alive until the callback has been called.
+	 */
+	struct Request {
+		Callback callback;
+		void *userData;
+	};
+
+	static const unsigned int QUEUE_DEPTH = 128;
+	static const unsigned int MAX_FIXED_BUFFERS = 32;
+
+private:
+	struct ev_loop *loop;
+	int ringFd;
+	int eventFd;
+	ev_io eventWatcher;
+	ev_prepare prepareWatcher;
+
+	void *sqRing;
+	void *cqRing;
+	size_t sqRingSize;
+	size_t cqRingSize;
+	size_t sqesSize;
+	unsigned int *sqHead;
+	unsigned int *sqTail;
+	unsigned int *sqArray;
+	unsigned int sqMask;
+	unsigned int sqEntries;
+	unsigned int *cqHead;
+	unsigned int *cqTail;
+	unsigned int cqMask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned int unsubmitted;
+	bool processingCompletions;
+
+	MemoryKit::mbuf fixedBuffers[MAX_FIXED_BUFFERS];
+	unsigned int nFixedBuffers;
+	unsigned int nextFixedBuffer;
+
+	boost::uint64_t submissions;
+	boost::uint64_t completions;
+	boost::uint64_t enterCalls;
+	boost::uint64_t fixedBufferReads;
+
+	bool mapRings(const struct io_uring_params &params, string &error);
+	bool supportsRequiredOperations(string &error);
+	void registerFixedBuffers(struct MemoryKit::mbuf_pool *pool, unsigned int count);
+	struct io_uring_sqe *prepareSqe();
+	void commitSqe(struct io_uring_sqe *sqe, Request *req);
+	void processCompletions();
+
+	static void onEventFdReadable(struct ev_loop *loop, ev_io *io, int revents);
+	static void onPrepare(struct ev_loop *loop, ev_prepare *prepare, int revents);
+
+public:
+	IoUring();
+	~IoUring();
+
+	/**
+	 * Sets up the ring and registers up to `nFixedBuffers` mbuf_blocks from
+	 * `pool` as fixed buffers. Returns false, with a description in `error`,
+	 * if io_uring cannot be used on this system.
+	 */
+	bool initialize(struct ev_loop *loop, struct MemoryKit::mbuf_pool *pool,
+		unsigned int nFixedBuffers, string &error);
+	void deinitialize();
+
+	bool isInitialized() const {
+		return loop != NULL;
+	}
+
+	/** Hands all prepared operations to the kernel. */
+	void submitPending();
+
+	/*
+	 * The following methods start an operation and return true, or return
+	 * false if the submission queue is full, in which case the caller
+	 * should fall back to another mechanism. The arguments (including the
+	 * path) must stay valid until completion.
+	 */
+
+	bool openat(const char *path, int flags, mode_t mode, Request *req);
+	bool read(int fd, char *buf, unsigned int size, boost::uint64_t offset, Request *req);
+	/**
+	 * Reads into fixed buffer `index`, which must have been obtained through
+	 * `findFreeFixedBuffer()`. `buf` must point inside that buffer.
+	 */
+	bool readFixed(int fd, char *buf, unsigned int size, boost::uint64_t offset,
+		unsigned int index, Request *req);
+	bool write(int fd, const char *buf, unsigned int size, boost::uint64_t offset,
+		Request *req);
+	/** `req` may be NULL if the caller is not interested in the result. */
+	bool close(int fd, Request *req = NULL);
+	bool unlink(const char *path, Request *req);
+
+	/**
+	 * Returns the index of a fixed buffer that nobody else references, or -1
+	 * if there is none. Take a reference with `getFixedBuffer()` for as long
+	 * as the buffer is in use; that also marks it as busy.
+	 */
+	int findFreeFixedBuffer() {
+		for (unsigned int i = 0; i < nFixedBuffers; i++) {
+			unsigned int index = (nextFixedBuffer + i) % nFixedBuffers;
+			if (fixedBuffers[index].mbuf_block->refcount == 1) {
+				nextFixedBuffer = index + 1;
+				return index;
+			}
+		}
+		return -1;
+	}
+
+	const MemoryKit::mbuf &getFixedBuffer(unsigned int index) const {
+		assert(index < nFixedBuffers);
+		return fixedBuffers[index];
+	}
+
+	unsigned int getFixedBufferCount() const {
+		return nFixedBuffers;
+	}
+
+	Json::Value inspectStateAsJson() const;
+};
+
+
+} // namespace ServerKit
+} // namespace Passenger
+
+#endif /* _PASSENGER_SERVER_KIT_IO_URING_H_ */
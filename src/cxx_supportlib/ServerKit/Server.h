@@ -31,6 +31,7 @@
 #include <boost/cstdint.hpp>
 #include <boost/config.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/atomic.hpp>
 #include <oxt/system_calls.hpp>
 #include <oxt/backtrace.hpp>
 #include <oxt/macros.hpp>
@@ -292,7 +293,13 @@ public:
 	State serverState;
 	FreeClientList freeClients;
 	ClientList activeClients, disconnectedClients;
-	unsigned int freeClientCount, activeClientCount, disconnectedClientCount;
+	unsigned int freeClientCount;
+	/**
+	 * Only modified by the event loop thread, but may be read from other
+	 * threads, e.g. by AcceptLoadBalancer to find the least loaded server.
+	 */
+	boost::atomic<unsigned int> activeClientCount;
+	unsigned int disconnectedClientCount;
 	unsigned int peakActiveClientCount;
 	unsigned long totalClientsAccepted, lastTotalClientsAccepted;
 	unsigned long long totalBytesConsumed;
@@ -354,7 +361,7 @@ private:
 			client = checkoutClientObject();
 			TAILQ_INSERT_HEAD(&activeClients, client, nextClient.activeOrDisconnectedClient);
 			acceptedClients[acceptCount] = client;
-			activeClientCount++;
+			activeClientCount.fetch_add(1, boost::memory_order_relaxed);
 			acceptCount++;
 			totalClientsAccepted++;
 			client->number = getNextClientNumber();
@@ -627,7 +634,8 @@ protected:
 	virtual void onClientsAccepted(Client **clients, unsigned int size) {
 		unsigned int i;
 
-		peakActiveClientCount = std::max(peakActiveClientCount, activeClientCount);
+		peakActiveClientCount = std::max(peakActiveClientCount,
+			activeClientCount.load(boost::memory_order_relaxed));
 
 		for (i = 0; i < size; i++) {
 			Client *client = clients[i];
@@ -864,7 +872,7 @@ public:
 		assert(size <= MAX_ACCEPT_BURST_COUNT);
 		P_ASSERT_EQ(serverState, ACTIVE);
 
-		activeClientCount += size;
+		activeClientCount.fetch_add(size, boost::memory_order_relaxed);
 		totalClientsAccepted += size;
 
 		for (unsigned int i = 0; i < size; i++) {
@@ -1049,7 +1057,7 @@ public:
 
 		c->setConnState(ClientType::DISCONNECTED);
 		TAILQ_REMOVE(&activeClients, c, nextClient.activeOrDisconnectedClient);
-		activeClientCount--;
+		activeClientCount.fetch_sub(1, boost::memory_order_relaxed);
 		TAILQ_INSERT_HEAD(&disconnectedClients, c, nextClient.activeOrDisconnectedClient);
 		disconnectedClientCount++;
 
@@ -1132,7 +1140,7 @@ public:
 		doc["server_state"] = getServerStateString();
 		doc["free_client_count"] = freeClientCount;
 		Json::Value &activeClientsDoc = doc["active_clients"] = Json::Value(Json::objectValue);
-		doc["active_client_count"] = activeClientCount;
+		doc["active_client_count"] = activeClientCount.load(boost::memory_order_relaxed);
 		Json::Value &disconnectedClientsDoc = doc["disconnected_clients"] = Json::Value(Json::objectValue);
 		doc["disconnected_client_count"] = disconnectedClientCount;
 		doc["peak_active_client_count"] = peakActiveClientCount;
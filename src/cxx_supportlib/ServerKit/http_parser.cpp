@@ -402,6 +402,209 @@ do {                                                                 \
 #endif
 
 
+/* Passenger addition: vectorized scanning.
+ *
+ * The parser below is a byte-at-a-time state machine. In a few hot states
+ * (header names, header values, the request path and the query string) the
+ * common case is a long run of bytes that leave the parser state unchanged.
+ * Once such a state has processed the current byte, SCAN_AHEAD() finds the
+ * next byte that may need attention and lets the loop continue from there.
+ * The byte that it stops at is always processed by the state machine, so the
+ * stop sets of the SIMD routines only need to be a superset of the bytes
+ * that matter. Callbacks, errors and the header size limit behave exactly
+ * as if every byte had been processed individually.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+# define HTTP_PARSER_HAVE_SIMD 1
+# include <emmintrin.h>
+# include <nmmintrin.h>
+# include <immintrin.h>
+#else
+# define HTTP_PARSER_HAVE_SIMD 0
+#endif
+
+static enum http_parser_scan_level
+detect_scan_level(void)
+{
+#if HTTP_PARSER_HAVE_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return HTTP_PARSER_SCAN_AVX2;
+  }
+  if (__builtin_cpu_supports("sse4.2")) {
+    return HTTP_PARSER_SCAN_SSE42;
+  }
+#endif
+  return HTTP_PARSER_SCAN_SCALAR;
+}
+
+static const enum http_parser_scan_level max_scan_level = detect_scan_level();
+static enum http_parser_scan_level scan_level = max_scan_level;
+
+#if HTTP_PARSER_HAVE_SIMD
+/* Byte ranges (pairs of inclusive bounds) for PCMPESTRI. Each set contains
+ * at least every byte that the corresponding state does not simply skip.
+ * The arrays are one byte longer than a vector to hold the literal's NUL.
+ */
+static const char non_token_ranges[17] __attribute__((aligned(16))) =
+  "\x00 "  /* control characters and SP */
+  "\"\""
+  "()"
+  ",,"
+  "//"
+  ":@"
+  "[]"
+  "{\xff"; /* also covers '|' and '~', which the scalar loop skips */
+static const char non_url_ranges[17] __attribute__((aligned(16))) =
+  "\x00 "
+  "##"
+  "??"
+  "\x7f\xff";
+static const char non_query_ranges[17] __attribute__((aligned(16))) =
+  "\x00 "
+  "##"
+  "\x7f\xff";
+
+__attribute__((target("sse4.2")))
+static const char *
+find_ranges_sse42(const char *p, const char *end, const char *ranges, int ranges_len)
+{
+  __m128i r = _mm_load_si128((const __m128i *) ranges);
+
+  while (end - p >= 16) {
+    __m128i b = _mm_loadu_si128((const __m128i *) p);
+    int i = _mm_cmpestri(r, ranges_len, b, 16,
+      _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+    if (i != 16) {
+      return p + i;
+    }
+    p += 16;
+  }
+  return p;
+}
+
+static const char *
+find_crlf_sse2(const char *p, const char *end)
+{
+  const __m128i cr = _mm_set1_epi8(CR);
+  const __m128i lf = _mm_set1_epi8(LF);
+
+  while (end - p >= 16) {
+    __m128i b = _mm_loadu_si128((const __m128i *) p);
+    int mask = _mm_movemask_epi8(_mm_or_si128(
+      _mm_cmpeq_epi8(b, cr), _mm_cmpeq_epi8(b, lf)));
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+    p += 16;
+  }
+  return p;
+}
+
+__attribute__((target("avx2")))
+static const char *
+find_crlf_avx2(const char *p, const char *end)
+{
+  const __m256i cr = _mm256_set1_epi8(CR);
+  const __m256i lf = _mm256_set1_epi8(LF);
+
+  while (end - p >= 32) {
+    __m256i b = _mm256_loadu_si256((const __m256i *) p);
+    unsigned int mask = (unsigned int) _mm256_movemask_epi8(_mm256_or_si256(
+      _mm256_cmpeq_epi8(b, cr), _mm256_cmpeq_epi8(b, lf)));
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+    p += 32;
+  }
+  return p;
+}
+#endif
+
+/* Each of the following returns the first byte in [p, end) that the
+ * corresponding state must process itself, or `end`. The SIMD routines
+ * handle whole vectors and the scalar loops finish off the tail.
+ */
+static const char *
+find_header_value_end(const char *p, const char *end)
+{
+#if HTTP_PARSER_HAVE_SIMD
+  if (scan_level >= HTTP_PARSER_SCAN_AVX2) {
+    p = find_crlf_avx2(p, end);
+  }
+  if (scan_level >= HTTP_PARSER_SCAN_SSE42) {
+    p = find_crlf_sse2(p, end);
+  }
+#endif
+  while (p != end && *p != CR && *p != LF) {
+    p++;
+  }
+  return p;
+}
+
+static const char *
+find_header_field_end(const char *p, const char *end)
+{
+#if HTTP_PARSER_HAVE_SIMD
+  if (scan_level >= HTTP_PARSER_SCAN_SSE42) {
+    p = find_ranges_sse42(p, end, non_token_ranges, 16);
+  }
+#endif
+  while (p != end && TOKEN(*p)) {
+    p++;
+  }
+  return p;
+}
+
+static const char *
+find_path_end(const char *p, const char *end)
+{
+#if HTTP_PARSER_HAVE_SIMD
+  if (scan_level >= HTTP_PARSER_SCAN_SSE42) {
+    p = find_ranges_sse42(p, end, non_url_ranges, 8);
+  }
+#endif
+  while (p != end && IS_URL_CHAR(*p)) {
+    p++;
+  }
+  return p;
+}
+
+static const char *
+find_query_string_end(const char *p, const char *end)
+{
+#if HTTP_PARSER_HAVE_SIMD
+  if (scan_level >= HTTP_PARSER_SCAN_SSE42) {
+    p = find_ranges_sse42(p, end, non_query_ranges, 6);
+  }
+#endif
+  while (p != end && (IS_URL_CHAR(*p) || *p == '?')) {
+    p++;
+  }
+  return p;
+}
+
+/* Skips the bytes after `p` that FIND() says the current state would leave
+ * alone, without crossing the end of the buffer or the header size limit.
+ * Only used in header states, in which the current byte is already counted
+ * in `parser->nread`.
+ */
+#define SCAN_AHEAD(FIND)                                             \
+do {                                                                 \
+  if (scan_level != HTTP_PARSER_SCAN_BYTEWISE) {                     \
+    const char *scan_end = data + len;                               \
+    size_t scan_room = (HTTP_MAX_HEADER_SIZE) - parser->nread;       \
+    size_t skip;                                                     \
+    if ((size_t) (scan_end - (p + 1)) > scan_room) {                 \
+      scan_end = p + 1 + scan_room;                                  \
+    }                                                                \
+    skip = FIND(p + 1, scan_end) - (p + 1);                          \
+    parser->nread += skip;                                           \
+    p += skip;                                                       \
+  }                                                                  \
+} while (0)
+
+
 /* Map errno values to strings for human-readable output */
 #define HTTP_STRERROR_GEN(n, s) { "HPE_" #n, s },
 static struct {
@@ -1100,6 +1303,11 @@ size_t http_parser_execute (http_parser *parser,
               SET_ERRNO(HPE_INVALID_URL);
               goto error;
             }
+            if (parser->state == s_req_path) {
+              SCAN_AHEAD(find_path_end);
+            } else if (parser->state == s_req_query_string) {
+              SCAN_AHEAD(find_query_string_end);
+            }
         }
         break;
       }
@@ -1381,6 +1589,10 @@ size_t http_parser_execute (http_parser *parser,
               assert(0 && "Unknown header_state");
               break;
           }
+
+          if (parser->header_state == h_general) {
+            SCAN_AHEAD(find_header_field_end);
+          }
           break;
         }
 
@@ -1492,6 +1704,7 @@ size_t http_parser_execute (http_parser *parser,
 
         switch (parser->header_state) {
           case h_general:
+            SCAN_AHEAD(find_header_value_end);
             break;
 
           case h_connection:
@@ -2257,6 +2470,17 @@ http_body_is_final(const struct http_parser *parser) {
     return parser->state == s_message_done;
 }
 
+enum http_parser_scan_level
+http_parser_get_scan_level(void) {
+  return scan_level;
+}
+
+enum http_parser_scan_level
+http_parser_set_scan_level(enum http_parser_scan_level level) {
+  scan_level = (level > max_scan_level) ? max_scan_level : level;
+  return scan_level;
+}
+
 unsigned long
 http_parser_version(void) {
   return HTTP_PARSER_VERSION_MAJOR * 0x10000 |
@@ -324,6 +324,27 @@ void http_parser_pause(http_parser *parser, int paused);
 /* Checks if this is the final chunk of the body. */
 int http_body_is_final(const http_parser *parser);
 
+/* Passenger addition: how http_parser_execute() skips over runs of bytes
+ * that do not change the parser state, such as most of a header value.
+ * The default is the best level that the CPU supports. The result of
+ * parsing is the same at every level.
+ */
+enum http_parser_scan_level
+  { HTTP_PARSER_SCAN_BYTEWISE = 0 /* no skipping, the original behavior */
+  , HTTP_PARSER_SCAN_SCALAR
+  , HTTP_PARSER_SCAN_SSE42
+  , HTTP_PARSER_SCAN_AVX2
+  };
+
+enum http_parser_scan_level http_parser_get_scan_level(void);
+
+/* Sets the scan level for all parsers, capped to what the CPU supports.
+ * Returns the level that is actually used. Not thread-safe; meant for
+ * startup and for tests.
+ */
+enum http_parser_scan_level http_parser_set_scan_level(
+  enum http_parser_scan_level level);
+
 #ifdef __cplusplus
 }
 #endif
@@ -27,21 +27,68 @@
 // Implementation is in its own file so that we can enable compiler optimizations for these functions only.
 
 #include <Utils/Hasher.h>
+#include <oxt/macros.hpp>
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
 
 namespace Passenger {
 
+OXT_FORCE_INLINE
+static boost::uint32_t
+jenkinsHashStep(boost::uint32_t hash, char ch) {
+	hash += ch;
+	hash += (hash << 10);
+	hash ^= (hash >> 6);
+	return hash;
+}
+
 void
 JenkinsHash::update(const char *data, unsigned int size) {
 	const char *end = data + size;
 
 	while (data < end) {
-		hash += *data;
-		hash += (hash << 10);
-		hash ^= (hash >> 6);
+		hash = jenkinsHashStep(hash, *data);
 		data++;
 	}
 }
 
+void
+JenkinsHash::updateLowerCase(const char *data, char *output, unsigned int size) {
+	boost::uint32_t h = hash;
+	unsigned int i = 0;
+
+	#ifdef __SSE2__
+		// Lowercase 16 bytes at a time, then hash them while they're still
+		// in L1. Bytes >= 0x80 compare as negative, so they're left alone.
+		const __m128i beforeA = _mm_set1_epi8('A' - 1);
+		const __m128i afterZ = _mm_set1_epi8('Z' + 1);
+		const __m128i caseBit = _mm_set1_epi8(0x20);
+
+		for (; i + 16 <= size; i += 16) {
+			__m128i in = _mm_loadu_si128((const __m128i *) (data + i));
+			__m128i isUpper = _mm_and_si128(_mm_cmpgt_epi8(in, beforeA),
+				_mm_cmplt_epi8(in, afterZ));
+			_mm_storeu_si128((__m128i *) (output + i),
+				_mm_or_si128(in, _mm_and_si128(isUpper, caseBit)));
+			for (unsigned int j = i; j < i + 16; j++) {
+				h = jenkinsHashStep(h, output[j]);
+			}
+		}
+	#endif
+
+	for (; i < size; i++) {
+		char ch = data[i];
+		if (ch >= 'A' && ch <= 'Z') {
+			ch |= 0x20;
+		}
+		output[i] = ch;
+		h = jenkinsHashStep(h, ch);
+	}
+
+	hash = h;
+}
+
 boost::uint32_t
 JenkinsHash::finalize() {
 	hash += (hash << 3);
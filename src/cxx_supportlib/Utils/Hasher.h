@@ -44,6 +44,14 @@ struct JenkinsHash {
 		{ }
 
 	void update(const char *data, unsigned int size);
+
+	/**
+	 * Writes the lowercase version of `data` to `output` and updates the
+	 * hash with that, in a single pass. Equivalent to `convertLowerCase()`
+	 * followed by `update(output, size)`.
+	 */
+	void updateLowerCase(const char *data, char *output, unsigned int size);
+
 	boost::uint32_t finalize();
 
 	void reset() {
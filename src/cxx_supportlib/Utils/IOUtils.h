@@ -208,6 +208,25 @@ int createTcpServer(const char *address = "0.0.0.0",
 	const char *file = __FILE__,
 	unsigned int line = __LINE__);
 
+/**
+ * Like createTcpServer(), but also sets SO_REUSEPORT on the socket. This allows
+ * multiple sockets, each created by this function, to be bound to the same
+ * address and port. On Linux the kernel then distributes incoming connections
+ * over all of those sockets, so that each one can be accepted from by a
+ * different thread without any further coordination.
+ *
+ * @throws RuntimeException SO_REUSEPORT is not supported on this platform.
+ * @throws SystemException Something went wrong while creating the server socket.
+ * @throws ArgumentException The given address cannot be parsed.
+ * @throws boost::thread_interrupted A system call has been interrupted.
+ * @ingroup Support
+ */
+int createReusePortTcpServer(const char *address,
+	unsigned short port,
+	unsigned int backlogSize = 0,
+	const char *file = __FILE__,
+	unsigned int line = __LINE__);
+
 /**
  * Connect to a server at the given address in a blocking manner.
  *
@@ -110,6 +110,14 @@
     offsetof(passenger_main_conf_t, autogenerated.core_file_descriptor_ulimit),
     NULL
 },
+{
+    ngx_string("passenger_core_keepalive_connections"),
+    NGX_HTTP_MAIN_CONF | NGX_CONF_TAKE1,
+    passenger_conf_set_core_keepalive_connections,
+    NGX_HTTP_MAIN_CONF_OFFSET,
+    offsetof(passenger_main_conf_t, autogenerated.core_keepalive_connections),
+    NULL
+},
 {
     ngx_string("passenger_disable_security_update_check"),
     NGX_HTTP_MAIN_CONF | NGX_CONF_FLAG,
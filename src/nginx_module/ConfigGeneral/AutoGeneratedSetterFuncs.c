@@ -181,6 +181,18 @@ passenger_conf_set_core_file_descriptor_ulimit(ngx_conf_t *cf, ngx_command_t *cm
     return ngx_conf_set_num_slot(cf, cmd, conf);
 }
 
+static char *
+passenger_conf_set_core_keepalive_connections(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
+    passenger_main_conf_t *passenger_conf = conf;
+
+    passenger_conf->autogenerated.core_keepalive_connections_explicitly_set = 1;
+    record_main_conf_source_location(cf,
+        &passenger_conf->autogenerated.core_keepalive_connections_source_file,
+        &passenger_conf->autogenerated.core_keepalive_connections_source_line);
+
+    return ngx_conf_set_num_slot(cf, cmd, conf);
+}
+
 static char *
 passenger_conf_set_disable_security_update_check(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
     passenger_main_conf_t *passenger_conf = conf;
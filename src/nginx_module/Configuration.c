@@ -37,6 +37,7 @@
 #include "ngx_http_passenger_module.h"
 #include "Configuration.h"
 #include "ContentHandler.h"
+#include "CoreConnectionPool.h"
 #include "ConfigGeneral/AutoGeneratedSetterFuncs.c"
 #include "MainConfig/AutoGeneratedCreateFunction.c"
 #include "LocationConfig/AutoGeneratedCreateFunction.c"
@@ -89,6 +90,7 @@ passenger_create_main_conf(ngx_conf_t *cf)
 
     conf->default_ruby.data = NULL;
     conf->default_ruby.len = 0;
+    conf->core_connection_pool = NULL;
 
     passenger_create_autogenerated_main_conf(&conf->autogenerated);
 
@@ -114,6 +116,11 @@ passenger_init_main_conf(ngx_conf_t *cf, void *conf_pointer)
         conf->autogenerated.show_version_in_header = 1;
     }
 
+    if (conf->autogenerated.core_keepalive_connections == NGX_CONF_UNSET_UINT) {
+        conf->autogenerated.core_keepalive_connections =
+            PASSENGER_DEFAULT_CORE_KEEPALIVE_CONNECTIONS;
+    }
+
     if (conf->autogenerated.default_user.len == 0) {
         conf->autogenerated.default_user.len  = sizeof(DEFAULT_WEB_APP_USER) - 1;
         conf->autogenerated.default_user.data = (u_char *) DEFAULT_WEB_APP_USER;
@@ -1103,6 +1110,11 @@ passenger_enabled(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         if (passenger_conf->upstream_config.upstream == NULL) {
             return NGX_CONF_ERROR;
         }
+        if (passenger_install_core_connection_pool(cf,
+                passenger_conf->upstream_config.upstream) != NGX_OK)
+        {
+            return NGX_CONF_ERROR;
+        }
 
         clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
         clcf->handler = passenger_content_handler;
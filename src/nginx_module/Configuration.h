@@ -37,6 +37,8 @@
 typedef struct {
     passenger_autogenerated_main_conf_t autogenerated;
     ngx_str_t    default_ruby;
+    /* Opaque; owned by CoreConnectionPool.c. */
+    void        *core_connection_pool;
 } passenger_main_conf_t;
 
 typedef struct {
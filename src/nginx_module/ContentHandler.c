@@ -30,6 +30,7 @@
 #include "ngx_http_passenger_module.h"
 #include "ContentHandler.h"
 #include "StaticContentHandler.h"
+#include "CoreConnectionPool.h"
 #include "Configuration.h"
 #include "cxx_supportlib/Constants.h"
 #include "cxx_supportlib/FileTools/PathManipCBindings.h"
@@ -50,6 +51,9 @@ static ngx_int_t process_status_line(ngx_http_request_t *r);
 static ngx_int_t parse_status_line(ngx_http_request_t *r,
     passenger_context_t *context);
 static ngx_int_t process_header(ngx_http_request_t *r);
+static ngx_int_t input_filter_init(void *data);
+static ngx_int_t copy_filter(ngx_event_pipe_t *p, ngx_buf_t *buf);
+static ngx_int_t non_buffered_copy_filter(void *data, ssize_t bytes);
 static void abort_request(ngx_http_request_t *r);
 static void finalize_request(ngx_http_request_t *r, ngx_int_t rc);
 
@@ -251,12 +255,12 @@ fix_peer_address(ngx_http_request_t *r) {
     const char                       *core_address;
     unsigned int                      core_address_len;
 
-    if (r->upstream->peer.get != ngx_http_upstream_get_round_robin_peer) {
+    rrp = passenger_core_connection_pool_get_rr_peer_data(r->upstream);
+    if (rrp == NULL) {
         /* This function only supports the round-robin upstream method. */
         return;
     }
 
-    rrp        = r->upstream->peer.data;
     peers      = rrp->peers;
     core_address =
         psg_watchdog_launcher_get_core_address(psg_watchdog_launcher,
@@ -528,7 +532,14 @@ construct_request_buffer(ngx_http_request_t *r, passenger_loc_conf_t *slcf,
         total_size += r->args.len + 1;
     }
 
-    PUSH_STATIC_STR(" HTTP/1.1\r\nConnection: close\r\n");
+    /* Without "Connection: close" the core keeps the connection open after
+     * the response, so that it can be put in the core connection pool.
+     */
+    if (passenger_main_conf.autogenerated.core_keepalive_connections > 0) {
+        PUSH_STATIC_STR(" HTTP/1.1\r\n");
+    } else {
+        PUSH_STATIC_STR(" HTTP/1.1\r\nConnection: close\r\n");
+    }
 
     part = &r->headers_in.headers.part;
     header = part->elts;
@@ -719,6 +730,12 @@ construct_request_buffer(ngx_http_request_t *r, passenger_loc_conf_t *slcf,
     total_size += state->app_type.len;
     PUSH_STATIC_STR("\r\n");
 
+    /* TODO: now that connections to the core are kept alive (see
+     * CoreConnectionPool.c), the per-location options could be sent once per
+     * connection instead of once per request. That needs a framing that the
+     * core understands, and it needs to know which connection the request
+     * goes over, while this buffer is built before the balancer picks one.
+     */
     if (b != NULL) {
         b->last = ngx_copy(b->last, slcf->options_cache.data, slcf->options_cache.len);
     }
@@ -1294,6 +1311,159 @@ process_header(ngx_http_request_t *r)
 }
 
 
+/**
+ * The input filters below only differ from Nginx's default ones in that they
+ * stop at the end of the response body instead of at EOF, so that the
+ * connection to the core can be reused (see CoreConnectionPool.c). The
+ * core only keeps the connection open if the response has a Content-Length;
+ * otherwise it sends "Connection: close" and we read until EOF as before.
+ */
+static ngx_int_t
+input_filter_init(void *data)
+{
+    ngx_http_request_t   *r = data;
+    ngx_http_upstream_t  *u;
+
+    u = r->upstream;
+
+    if (u->headers_in.status_n == NGX_HTTP_NO_CONTENT
+        || u->headers_in.status_n == NGX_HTTP_NOT_MODIFIED
+        || r->method == NGX_HTTP_HEAD
+        || u->headers_in.content_length_n == 0)
+    {
+        /* The filters won't be called for an empty body. */
+        u->pipe->length = 0;
+        u->length = 0;
+        u->keepalive = !u->headers_in.connection_close;
+
+    } else {
+        /* Either the content length, or -1 to read until EOF. */
+        u->pipe->length = u->headers_in.content_length_n;
+        u->length = u->headers_in.content_length_n;
+    }
+
+    return NGX_OK;
+}
+
+static ngx_int_t
+copy_filter(ngx_event_pipe_t *p, ngx_buf_t *buf)
+{
+    ngx_buf_t           *b;
+    ngx_chain_t         *cl;
+    ngx_http_request_t  *r;
+
+    if (buf->pos == buf->last) {
+        return NGX_OK;
+    }
+
+    r = p->input_ctx;
+
+    if (p->length == 0) {
+        p->upstream_done = 1;
+        ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                      "upstream sent more data than specified in "
+                      "\"Content-Length\" header");
+        return NGX_OK;
+    }
+
+    cl = ngx_chain_get_free_buf(p->pool, &p->free);
+    if (cl == NULL) {
+        return NGX_ERROR;
+    }
+
+    b = cl->buf;
+
+    ngx_memcpy(b, buf, sizeof(ngx_buf_t));
+    b->shadow = buf;
+    b->tag = p->tag;
+    b->last_shadow = 1;
+    b->recycled = 1;
+    buf->shadow = b;
+
+    if (p->in) {
+        *p->last_in = cl;
+    } else {
+        p->in = cl;
+    }
+    p->last_in = &cl->next;
+
+    if (p->length == -1) {
+        return NGX_OK;
+    }
+
+    if (b->last - b->pos > p->length) {
+        ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                      "upstream sent more data than specified in "
+                      "\"Content-Length\" header");
+        b->last = b->pos + p->length;
+        p->upstream_done = 1;
+        return NGX_OK;
+    }
+
+    p->length -= b->last - b->pos;
+
+    if (p->length == 0) {
+        p->upstream_done = 1;
+        r->upstream->keepalive = !r->upstream->headers_in.connection_close;
+    }
+
+    return NGX_OK;
+}
+
+static ngx_int_t
+non_buffered_copy_filter(void *data, ssize_t bytes)
+{
+    ngx_http_request_t   *r = data;
+    ngx_buf_t            *b;
+    ngx_chain_t          *cl, **ll;
+    ngx_http_upstream_t  *u;
+
+    u = r->upstream;
+
+    for (cl = u->out_bufs, ll = &u->out_bufs; cl; cl = cl->next) {
+        ll = &cl->next;
+    }
+
+    cl = ngx_chain_get_free_buf(r->pool, &u->free_bufs);
+    if (cl == NULL) {
+        return NGX_ERROR;
+    }
+
+    *ll = cl;
+
+    cl->buf->flush = 1;
+    cl->buf->memory = 1;
+
+    b = &u->buffer;
+
+    cl->buf->pos = b->last;
+    b->last += bytes;
+    cl->buf->last = b->last;
+    cl->buf->tag = u->output.tag;
+
+    if (u->length == -1) {
+        return NGX_OK;
+    }
+
+    if (bytes > u->length) {
+        ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                      "upstream sent more data than specified in "
+                      "\"Content-Length\" header");
+        cl->buf->last = cl->buf->pos + u->length;
+        u->length = 0;
+        return NGX_OK;
+    }
+
+    u->length -= bytes;
+
+    if (u->length == 0) {
+        u->keepalive = !u->headers_in.connection_close;
+    }
+
+    return NGX_OK;
+}
+
+
 static void
 abort_request(ngx_http_request_t *r)
 {
@@ -1485,9 +1655,13 @@ passenger_content_handler(ngx_http_request_t *r)
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
-    u->pipe->input_filter = ngx_event_pipe_copy_input_filter;
+    u->pipe->input_filter = copy_filter;
     u->pipe->input_ctx = r;
 
+    u->input_filter_init = input_filter_init;
+    u->input_filter = non_buffered_copy_filter;
+    u->input_filter_ctx = r;
+
     rc = ngx_http_read_client_request_body(r, ngx_http_upstream_init);
 
     fix_peer_address(r);
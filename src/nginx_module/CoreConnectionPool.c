@@ -0,0 +1,374 @@
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) 2007 Manlio Perillo (manlio.perillo@gmail.com)
+ * Copyright (c) 2010-2017 Phusion Holding B.V.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "CoreConnectionPool.h"
+#include "Configuration.h"
+#include "ngx_http_passenger_module.h"
+
+/*
+ * The Passenger core socket is the only peer of the placeholder upstream, so
+ * unlike ngx_http_upstream_keepalive_module we don't need to match cached
+ * connections against the peer address that the balancer picked: any idle
+ * connection will do. The pool lives in our main configuration, which every
+ * worker process inherits its own copy of, so each worker has its own cache.
+ */
+
+typedef struct {
+    ngx_uint_t                          max_cached;
+    ngx_queue_t                         cache;
+    ngx_queue_t                         free;
+    ngx_http_upstream_init_pt           original_init_upstream;
+    ngx_http_upstream_init_peer_pt      original_init_peer;
+} core_connection_pool_t;
+
+typedef struct {
+    core_connection_pool_t             *pool;
+    ngx_queue_t                         queue;
+    ngx_connection_t                   *connection;
+} cached_connection_t;
+
+typedef struct {
+    core_connection_pool_t             *pool;
+    ngx_http_upstream_t                *upstream;
+    ngx_uint_t                          request_has_body;
+    void                               *data;
+    ngx_event_get_peer_pt               original_get_peer;
+    ngx_event_free_peer_pt              original_free_peer;
+} peer_data_t;
+
+
+static ngx_int_t init_upstream(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t init_peer(ngx_http_request_t *r, ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t get_peer(ngx_peer_connection_t *pc, void *data);
+static void free_peer(ngx_peer_connection_t *pc, void *data, ngx_uint_t state);
+static void dummy_handler(ngx_event_t *ev);
+static void close_handler(ngx_event_t *ev);
+static void close_connection(ngx_connection_t *c);
+
+
+ngx_int_t
+passenger_install_core_connection_pool(ngx_conf_t *cf,
+                                       ngx_http_upstream_srv_conf_t *uscf)
+{
+    passenger_main_conf_t  *main_conf;
+    core_connection_pool_t *pool;
+
+    if (uscf->peer.init_upstream == init_upstream) {
+        return NGX_OK;
+    }
+
+    pool = ngx_pcalloc(cf->pool, sizeof(core_connection_pool_t));
+    if (pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    pool->original_init_upstream = uscf->peer.init_upstream
+                                   ? uscf->peer.init_upstream
+                                   : ngx_http_upstream_init_round_robin;
+    uscf->peer.init_upstream = init_upstream;
+
+    /* There is only one placeholder upstream per configuration. */
+    main_conf = ngx_http_conf_get_module_main_conf(cf, ngx_http_passenger_module);
+    main_conf->core_connection_pool = pool;
+
+    return NGX_OK;
+}
+
+ngx_http_upstream_rr_peer_data_t *
+passenger_core_connection_pool_get_rr_peer_data(ngx_http_upstream_t *u)
+{
+    peer_data_t *pd;
+
+    if (u->peer.get == get_peer) {
+        pd = u->peer.data;
+        if (pd->original_get_peer == ngx_http_upstream_get_round_robin_peer) {
+            return pd->data;
+        }
+    } else if (u->peer.get == ngx_http_upstream_get_round_robin_peer) {
+        return u->peer.data;
+    }
+
+    return NULL;
+}
+
+
+static ngx_int_t
+init_upstream(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
+{
+    passenger_main_conf_t  *main_conf;
+    core_connection_pool_t *pool;
+    cached_connection_t    *cached;
+    ngx_uint_t              i;
+
+    main_conf = ngx_http_conf_get_module_main_conf(cf, ngx_http_passenger_module);
+    pool = main_conf->core_connection_pool;
+
+    /* The upstream module initializes its upstreams before our own
+     * main configuration is finalized, so apply the default here too.
+     */
+    pool->max_cached = main_conf->autogenerated.core_keepalive_connections;
+    if (pool->max_cached == NGX_CONF_UNSET_UINT) {
+        pool->max_cached = PASSENGER_DEFAULT_CORE_KEEPALIVE_CONNECTIONS;
+    }
+
+    if (pool->original_init_upstream(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (pool->max_cached == 0) {
+        return NGX_OK;
+    }
+
+    pool->original_init_peer = us->peer.init;
+    us->peer.init = init_peer;
+
+    cached = ngx_pcalloc(cf->pool, sizeof(cached_connection_t) * pool->max_cached);
+    if (cached == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_queue_init(&pool->cache);
+    ngx_queue_init(&pool->free);
+
+    for (i = 0; i < pool->max_cached; i++) {
+        cached[i].pool = pool;
+        ngx_queue_insert_head(&pool->free, &cached[i].queue);
+    }
+
+    return NGX_OK;
+}
+
+static ngx_int_t
+init_peer(ngx_http_request_t *r, ngx_http_upstream_srv_conf_t *us)
+{
+    passenger_main_conf_t  *main_conf;
+    core_connection_pool_t *pool;
+    peer_data_t            *pd;
+
+    main_conf = ngx_http_get_module_main_conf(r, ngx_http_passenger_module);
+    pool = main_conf->core_connection_pool;
+
+    pd = ngx_palloc(r->pool, sizeof(peer_data_t));
+    if (pd == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (pool->original_init_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    pd->pool = pool;
+    pd->upstream = r->upstream;
+    pd->request_has_body = r->headers_in.content_length_n > 0
+                           || r->headers_in.chunked;
+    pd->data = r->upstream->peer.data;
+    pd->original_get_peer = r->upstream->peer.get;
+    pd->original_free_peer = r->upstream->peer.free;
+
+    r->upstream->peer.data = pd;
+    r->upstream->peer.get = get_peer;
+    r->upstream->peer.free = free_peer;
+
+    return NGX_OK;
+}
+
+static ngx_int_t
+get_peer(ngx_peer_connection_t *pc, void *data)
+{
+    peer_data_t         *pd = data;
+    cached_connection_t *item;
+    ngx_queue_t         *q;
+    ngx_connection_t    *c;
+    ngx_int_t            rc;
+
+    pc->cached = 0;
+    pc->connection = NULL;
+
+    /* Let the balancer decide first, so that its failure accounting
+     * (max_fails, fail_timeout) keeps working.
+     */
+    rc = pd->original_get_peer(pc, pd->data);
+    if (rc != NGX_OK || ngx_queue_empty(&pd->pool->cache)) {
+        return rc;
+    }
+
+    q = ngx_queue_head(&pd->pool->cache);
+    item = ngx_queue_data(q, cached_connection_t, queue);
+    c = item->connection;
+
+    ngx_queue_remove(q);
+    ngx_queue_insert_head(&pd->pool->free, q);
+
+    c->idle = 0;
+    c->sent = 0;
+    c->data = NULL;
+    c->log = pc->log;
+    c->read->log = pc->log;
+    c->write->log = pc->log;
+    c->pool->log = pc->log;
+
+    pc->connection = c;
+    pc->cached = 1;
+
+    return NGX_DONE;
+}
+
+static void
+free_peer(ngx_peer_connection_t *pc, void *data, ngx_uint_t state)
+{
+    peer_data_t         *pd = data;
+    cached_connection_t *item;
+    ngx_queue_t         *q;
+    ngx_connection_t    *c;
+    ngx_http_upstream_t *u;
+
+    c = pc->connection;
+    u = pd->upstream;
+
+    /* u->keepalive is only set once the entire response body has been
+     * read and the core did not ask us to close the connection.
+     * If the core responded before we were done sending the request body
+     * then the rest of the body is still pending, so the connection cannot
+     * be reused. Nginx only tracks that since 1.15.3; with older versions
+     * we don't reuse connections that carried a request body at all.
+     */
+    if (state & NGX_PEER_FAILED
+        || c == NULL
+        || !u->keepalive
+        #if NGINX_VERSION_NUM >= 1015003
+            || !u->request_body_sent
+        #else
+            || pd->request_has_body
+        #endif
+        || c->read->eof
+        || c->read->error
+        || c->read->timedout
+        || c->write->error
+        || c->write->timedout
+        || ngx_terminate
+        || ngx_exiting)
+    {
+        goto done;
+    }
+
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        goto done;
+    }
+
+    if (ngx_queue_empty(&pd->pool->free)) {
+        /* Evict the connection that has been idle for the longest time. */
+        q = ngx_queue_last(&pd->pool->cache);
+        ngx_queue_remove(q);
+        item = ngx_queue_data(q, cached_connection_t, queue);
+        close_connection(item->connection);
+    } else {
+        q = ngx_queue_head(&pd->pool->free);
+        ngx_queue_remove(q);
+        item = ngx_queue_data(q, cached_connection_t, queue);
+    }
+
+    ngx_queue_insert_head(&pd->pool->cache, q);
+    item->connection = c;
+    pc->connection = NULL;
+
+    if (c->read->timer_set) {
+        ngx_del_timer(c->read);
+    }
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    c->write->handler = dummy_handler;
+    c->read->handler = close_handler;
+
+    c->data = item;
+    c->idle = 1;
+    c->log = ngx_cycle->log;
+    c->read->log = ngx_cycle->log;
+    c->write->log = ngx_cycle->log;
+    c->pool->log = ngx_cycle->log;
+
+    if (c->read->ready) {
+        close_handler(c->read);
+    }
+
+done:
+    pd->original_free_peer(pc, pd->data, state);
+}
+
+static void
+dummy_handler(ngx_event_t *ev)
+{
+    /* Nothing to write on an idle connection. */
+}
+
+/**
+ * Called when an idle connection becomes readable. The core never sends
+ * anything unsolicited, so this means that it closed the connection (e.g.
+ * because it is shutting down), or that something went wrong.
+ */
+static void
+close_handler(ngx_event_t *ev)
+{
+    cached_connection_t *item;
+    ngx_connection_t    *c;
+    ssize_t              n;
+    char                 buf[1];
+
+    c = ev->data;
+
+    if (c->close) {
+        goto close;
+    }
+
+    n = recv(c->fd, buf, 1, MSG_PEEK);
+
+    if (n == -1 && ngx_socket_errno == NGX_EAGAIN) {
+        ev->ready = 0;
+
+        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+            goto close;
+        }
+
+        return;
+    }
+
+close:
+
+    item = c->data;
+    close_connection(c);
+
+    ngx_queue_remove(&item->queue);
+    ngx_queue_insert_head(&item->pool->free, &item->queue);
+}
+
+static void
+close_connection(ngx_connection_t *c)
+{
+    ngx_destroy_pool(c->pool);
+    ngx_close_connection(c);
+}
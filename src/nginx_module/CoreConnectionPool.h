@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) 2007 Manlio Perillo (manlio.perillo@gmail.com)
+ * Copyright (c) 2010-2017 Phusion Holding B.V.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PASSENGER_NGINX_CORE_CONNECTION_POOL_H_
+#define _PASSENGER_NGINX_CORE_CONNECTION_POOL_H_
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+/**
+ * The default maximum number of idle connections to the Passenger core that
+ * each Nginx worker process keeps open, used if
+ * `passenger_core_keepalive_connections` is not set.
+ */
+#define PASSENGER_DEFAULT_CORE_KEEPALIVE_CONNECTIONS 32
+
+/**
+ * Makes the given upstream (the placeholder upstream that points to the
+ * Passenger core) keep idle connections open after a request is done, so that
+ * later requests in the same Nginx worker process don't have to connect again.
+ * Works like the `keepalive` directive of ngx_http_upstream_keepalive_module,
+ * but is wrapped around whatever balancer the upstream is otherwise set up with.
+ * Installing the pool multiple times on the same upstream is a no-op.
+ */
+ngx_int_t passenger_install_core_connection_pool(ngx_conf_t *cf,
+                                                 ngx_http_upstream_srv_conf_t *uscf);
+
+/**
+ * Returns the round-robin peer data of the given upstream request, looking
+ * through the connection pool if it is installed. Returns NULL if the upstream
+ * does not use the round-robin balancer.
+ */
+ngx_http_upstream_rr_peer_data_t *passenger_core_connection_pool_get_rr_peer_data(
+    ngx_http_upstream_t *u);
+
+#endif /* _PASSENGER_NGINX_CORE_CONNECTION_POOL_H_ */
@@ -341,6 +341,14 @@ def locate_source_file(path)
     :source   => 'ServerKit/Implementation.cpp',
     :category => :other,
     :optimize => true
+  define_component 'ServerKit/BufferFilePool.o',
+    :source   => 'ServerKit/BufferFilePool.cpp',
+    :category => :other,
+    :optimize => true
+  define_component 'ServerKit/IoUring.o',
+    :source   => 'ServerKit/IoUring.cpp',
+    :category => :other,
+    :optimize => true
   define_component 'DataStructures/LString.o',
     :source   => 'DataStructures/LString.cpp',
     :category => :other
@@ -80,6 +80,9 @@ module SharedConstants
     # also introduce context switching and smaller transfer writes. The size is picked
     # to balance this out.
     DEFAULT_MBUF_CHUNK_SIZE = 1024 * 4
+    # Slab size used when mbuf huge pages are enabled without an explicit slab
+    # size. This is the size of a huge page on x86-64.
+    DEFAULT_MBUF_SLAB_SIZE = 1024 * 1024 * 2
     # Affects input and output buffering (between app and client). Threshold is picked
     # such that it fits most output (i.e. html page size, not assets), and allows for
     # high concurrency with low mem overhead. On the upload side there is a penalty
@@ -142,6 +142,12 @@
     :context  => [:main],
     :struct   => 'NGX_HTTP_MAIN_CONF_OFFSET'
   },
+  {
+    :name     => 'passenger_core_keepalive_connections',
+    :type     => :uinteger,
+    :context  => [:main],
+    :struct   => 'NGX_HTTP_MAIN_CONF_OFFSET'
+  },
   {
     :name     => 'passenger_disable_security_update_check',
     :type     => :flag,
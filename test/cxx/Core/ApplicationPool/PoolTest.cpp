@@ -2024,6 +2024,24 @@ namespace tut {
 		currentSession.reset();
 	}
 
+	TEST_METHOD(80) {
+		// The pool's capacity budget is kept in sync with the capacity
+		// used by the individual groups.
+		Options options1 = createOptions();
+		Options options2 = createOptions();
+		options2.appRoot = "stub/wsgi";
+		pool->setMax(3);
+
+		pool->get(options1, &ticket).reset();
+		pool->get(options2, &ticket).reset();
+		ensure_equals(pool->capacityUsed(), 2u);
+
+		ensure(pool->detachGroupByName("stub/rack"));
+		ensure_equals(pool->capacityUsed(), 1u);
+		ensure(pool->detachGroupByName("stub/wsgi"));
+		ensure_equals(pool->capacityUsed(), 0u);
+	}
+
 	// TODO: Persistent connections.
 	// TODO: If one closes the session before it has reached EOF, and process's maximum concurrency
 	//       has already been reached, then the pool should ping the process so that it can detect
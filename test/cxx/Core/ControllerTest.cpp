@@ -5,6 +5,8 @@
 #include <Utils/MessageIO.h>
 #include <Core/ApplicationPool/TestSession.h>
 #include <Core/Controller.h>
+#include <Core/ResponseCacheStorage.h>
+#include <time.h>
 
 using namespace std;
 using namespace boost;
@@ -18,6 +20,8 @@ namespace tut {
 			virtual void asyncGetFromApplicationPool(Request *req,
 				ApplicationPool2::GetCallback callback)
 			{
+				asyncGetCalls++;
+				lastAppGroupName = req->options.getAppGroupName();
 				callback(sessionToReturn, exceptionToReturn);
 				sessionToReturn.reset();
 			}
@@ -25,6 +29,8 @@ namespace tut {
 		public:
 			ApplicationPool2::AbstractSessionPtr sessionToReturn;
 			ApplicationPool2::ExceptionPtr exceptionToReturn;
+			unsigned int asyncGetCalls;
+			string lastAppGroupName;
 
 			MyController(ServerKit::Context *context,
 				const Core::ControllerSchema &schema,
@@ -32,7 +38,8 @@ namespace tut {
 				const Core::ControllerSingleAppModeSchema &singleAppModeSchema,
 				const Json::Value &singleAppModeConfig)
 				: Core::Controller(context, schema, initialConfig, ConfigKit::DummyTranslator(),
-					&singleAppModeSchema, &singleAppModeConfig, ConfigKit::DummyTranslator())
+					&singleAppModeSchema, &singleAppModeConfig, ConfigKit::DummyTranslator()),
+				  asyncGetCalls(0)
 				{ }
 		};
 
@@ -46,6 +53,7 @@ namespace tut {
 		SpawningKit::FactoryPtr spawningKitFactory;
 		PoolPtr appPool;
 		Json::Value config, singleAppModeConfig;
+		boost::scoped_ptr<ResponseCacheStorage> turbocacheStorage;
 		int serverSocket;
 		TestSession testSession;
 		FileDescriptor clientConnection;
@@ -115,6 +123,7 @@ namespace tut {
 				singleAppModeSchema, singleAppModeConfig);
 			controller->resourceLocator = resourceLocator;
 			controller->appPool = appPool;
+			controller->sharedTurbocacheStorage = turbocacheStorage.get();
 			controller->initialize();
 			controller->listen(serverSocket);
 			startLoop();
@@ -140,12 +149,24 @@ namespace tut {
 			ensure_equals(getTotalBytesConsumed(), totalBytesConsumed + data.size());
 		}
 
-		void useTestSessionObject() {
-			bg.safe->runSync(boost::bind(&Core_ControllerTest::_setTestSessionObject, this));
+		void useTestSessionObject(TestSession *session = NULL) {
+			if (session == NULL) {
+				session = &testSession;
+			}
+			bg.safe->runSync(boost::bind(&Core_ControllerTest::_setTestSessionObject,
+				this, session));
+		}
+
+		void _setTestSessionObject(TestSession *session) {
+			controller->sessionToReturn.reset(session, false);
 		}
 
-		void _setTestSessionObject() {
-			controller->sessionToReturn.reset(&testSession, false);
+		void useException(const ApplicationPool2::ExceptionPtr &e) {
+			bg.safe->runSync(boost::bind(&Core_ControllerTest::_setException, this, e));
+		}
+
+		void _setException(ApplicationPool2::ExceptionPtr e) {
+			controller->exceptionToReturn = e;
 		}
 
 		MyController::State getServerState() {
@@ -170,6 +191,17 @@ namespace tut {
 			*result = controller->totalBytesConsumed;
 		}
 
+		Json::Value inspectState() {
+			Json::Value result;
+			bg.safe->runSync(boost::bind(&Core_ControllerTest::_inspectState,
+				this, &result));
+			return result;
+		}
+
+		void _inspectState(Json::Value *result) {
+			*result = controller->inspectStateAsJson();
+		}
+
 		string readPeerRequestHeader(string *peerRequestHeader = NULL) {
 			if (peerRequestHeader == NULL) {
 				peerRequestHeader = &this->peerRequestHeader;
@@ -239,6 +271,39 @@ namespace tut {
 			);
 		}
 
+		unsigned int getAsyncGetCalls() {
+			unsigned int result;
+			bg.safe->runSync(boost::bind(&Core_ControllerTest::_getAsyncGetCalls,
+				this, &result));
+			return result;
+		}
+
+		void _getAsyncGetCalls(unsigned int *result) {
+			*result = controller->asyncGetCalls;
+		}
+
+		string getLastAppGroupName() {
+			string result;
+			bg.safe->runSync(boost::bind(&Core_ControllerTest::_getLastAppGroupName,
+				this, &result));
+			return result;
+		}
+
+		void _getLastAppGroupName(string *result) {
+			*result = controller->lastAppGroupName;
+		}
+
+		// Called on the event loop thread, so that the controller sees
+		// both responses in the same event loop iteration.
+		void _sendPeerResponses(TestSession *session1, TestSession *session2,
+			StaticString data)
+		{
+			writeExact(session1->peerFd(), data);
+			session1->closePeerFd();
+			writeExact(session2->peerFd(), data);
+			session2->closePeerFd();
+		}
+
 		string readHeader(BufferedIO &io) {
 			string result;
 			do {
@@ -258,9 +323,41 @@ namespace tut {
 		string readResponseBody() {
 			return clientConnectionIO.readAll();
 		}
+
+		string formatHttpDate(time_t t) {
+			struct tm tm;
+			char buf[64];
+			gmtime_r(&t, &tm);
+			size_t size = strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+			return string(buf, size);
+		}
+
+		// Makes the turbocache contain an expired response for "/hello".
+		void storeExpiredResponseInTurboCache(const string &cacheControl) {
+			useTestSessionObject();
+			testSession.setProtocol("http_session");
+
+			connectToServer();
+			sendRequest(
+				"GET /hello HTTP/1.1\r\n"
+				"Host: localhost\r\n"
+				"Connection: close\r\n"
+				"\r\n");
+			waitUntilSessionInitiated();
+
+			readPeerRequestHeader();
+			sendPeerResponse(
+				"HTTP/1.1 200 OK\r\n"
+				"Cache-Control: " + cacheControl + "\r\n"
+				"Expires: " + formatHttpDate(time(NULL) - 10) + "\r\n"
+				"Content-Length: 3\r\n\r\n"
+				"old");
+			readResponseHeader();
+			ensure_equals(readResponseBody(), "old");
+		}
 	};
 
-	DEFINE_TEST_GROUP(Core_ControllerTest);
+	DEFINE_TEST_GROUP_WITH_LIMIT(Core_ControllerTest, 60);
 
 
 	/***** Passing request information to the app *****/
@@ -865,4 +962,441 @@ namespace tut {
 		string header = readResponseHeader();
 		ensure(containsSubstring(header, "HTTP/1.1 502"));
 	}
+
+
+	/***** Turbocaching *****/
+
+	TEST_METHOD(45) {
+		set_test_name("Requests for an expired turbocache entry wait for the "
+			"request that is revalidating it");
+
+		turbocacheStorage.reset(new ResponseCacheStorage(
+			ResponseCacheStorage::DEFAULT_MAX_ENTRIES,
+			ResponseCacheStorage::DEFAULT_MAX_MEMORY, 1));
+		init();
+		storeExpiredResponseInTurboCache("public");
+
+		TestSession leaderSession;
+		leaderSession.setProtocol("http_session");
+		useTestSessionObject(&leaderSession);
+		FileDescriptor leader(connectToUnixServer("tmp.server", __FILE__, __LINE__), NULL, 0);
+		BufferedIO leaderIO(leader);
+		writeExact(leader,
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		EVENTUALLY(5,
+			result = leaderSession.fd() != -1;
+		);
+		readHeader(leaderSession.getPeerBufferedIO());
+
+		// If this request went to the application, it would get an error.
+		useException(boost::make_shared<RequestQueueFullException>(1));
+		connectToServer();
+		sendRequestAndWait(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+
+		writeExact(leaderSession.peerFd(),
+			"HTTP/1.1 200 OK\r\n"
+			"Cache-Control: public,max-age=60\r\n"
+			"Content-Length: 3\r\n\r\n"
+			"new");
+		leaderSession.closePeerFd();
+		string header = readHeader(leaderIO);
+		ensure("(1)", containsSubstring(header, "HTTP/1.1 200 OK\r\n"));
+		ensure_equals("(2)", leaderIO.readAll(), "new");
+
+		header = readResponseHeader();
+		ensure("(3)", containsSubstring(header, "HTTP/1.1 200 OK\r\n"));
+		ensure("(4)", containsSubstring(header, "Age: "));
+		ensure_equals("(5)", readResponseBody(), "new");
+	}
+
+	TEST_METHOD(46) {
+		set_test_name("If revalidating a turbocache entry fails, the stale entry "
+			"is served within its stale-if-error window");
+
+		turbocacheStorage.reset(new ResponseCacheStorage(
+			ResponseCacheStorage::DEFAULT_MAX_ENTRIES,
+			ResponseCacheStorage::DEFAULT_MAX_MEMORY, 1));
+		init();
+		storeExpiredResponseInTurboCache("public,stale-if-error=3600");
+
+		useException(boost::make_shared<RequestQueueFullException>(1));
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+
+		string header = readResponseHeader();
+		ensure("(1)", containsSubstring(header, "HTTP/1.1 200 OK\r\n"));
+		ensure("(2)", containsSubstring(header, "Warning: 110 - \"Response is Stale\"\r\n"));
+		ensure_equals("(3)", readResponseBody(), "old");
+	}
+
+
+	/***** Splicing application response bodies *****/
+
+	TEST_METHOD(47) {
+		set_test_name("Large response bodies with a fixed length are forwarded "
+			"intact with splice()");
+
+		config["turbocaching"] = false;
+		config["response_splice_threshold"] = 1024;
+		init();
+		useTestSessionObject();
+		testSession.setProtocol("http_session");
+
+		connectToServer();
+		sendRequest(
+			"GET /export HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+		readPeerRequestHeader();
+
+		string body;
+		for (unsigned int i = 0; i < 1024 * 1024; i++) {
+			body.append(1, 'a' + i % 26);
+		}
+		string response = "HTTP/1.1 200 OK\r\n"
+			"Content-Length: " + toString(body.size()) + "\r\n\r\n" + body;
+		// The client and app socket buffers can't hold the whole response,
+		// so write it while we read.
+		TempThread writer(boost::bind(&Core_ControllerTest::sendPeerResponse, this,
+			StaticString(response)));
+
+		string header = readResponseHeader();
+		ensure("(1)", containsSubstring(header, "HTTP/1.1 200 OK\r\n"));
+		string receivedBody = readResponseBody();
+		ensure_equals("(2)", receivedBody.size(), body.size());
+		ensure("(3)", receivedBody == body);
+		writer.join();
+
+		Json::Value state = inspectState();
+		ensure_equals("(4)", state["spliced_response_bodies"].asUInt(), 1u);
+		ensure("(5)", state["total_bytes_spliced"].asUInt64() > 0);
+	}
+
+
+	/***** Idle session slots *****/
+
+	TEST_METHOD(48) {
+		set_test_name("A pipelined request reuses the session that the previous "
+			"request left in an idle session slot, without going to the pool");
+
+		config["turbocaching"] = false;
+		config["thread_session_slots"] = 1;
+		init();
+		useTestSessionObject();
+		testSession.setProtocol("http_session");
+
+		connectToServer();
+		sendRequest(
+			"GET /first HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"\r\n"
+			"GET /second HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+		testSession.setGroupName(getLastAppGroupName());
+		ensure("(1)", containsSubstring(readPeerRequestHeader(), "GET /first "));
+		// Don't close the peer socket: the controller may reuse the session
+		// (which replaces it) as soon as it has read the response.
+		writeExact(testSession.peerFd(),
+			"HTTP/1.1 200 OK\r\n"
+			"Content-Length: 3\r\n\r\n"
+			"one");
+
+		EVENTUALLY(5,
+			result = testSession.getInitiateCount() == 2;
+		);
+		ensure("(2)", containsSubstring(readPeerRequestHeader(), "GET /second "));
+		sendPeerResponse(
+			"HTTP/1.1 200 OK\r\n"
+			"Content-Length: 3\r\n\r\n"
+			"two");
+
+		string header = readResponseHeader();
+		ensure("(3)", containsSubstring(header, "HTTP/1.1 200 OK\r\n"));
+		string rest = readResponseBody();
+		ensure("(4)", startsWith(rest, "one"));
+		ensure("(5)", containsSubstring(rest, "two"));
+		waitUntilSessionClosed();
+
+		ensure_equals("(6)", getAsyncGetCalls(), 1u);
+		ensure_equals("(7)", testSession.getRecycleCount(), 2u);
+		Json::Value state = inspectState();
+		ensure_equals("(8)", state["idle_session_slots"]["max"].asUInt(), 1u);
+		ensure_equals("(9)", state["idle_session_slots"]["idle"].asUInt(), 0u);
+		ensure_equals("(10)", state["idle_session_slots"]["hits"].asUInt64(), 1u);
+		ensure_equals("(11)", state["idle_session_slots"]["misses"].asUInt64(), 1u);
+		ensure_equals("(12)", state["idle_session_slots"]["overflows"].asUInt64(), 0u);
+	}
+
+	TEST_METHOD(49) {
+		set_test_name("Sessions that finish while all idle session slots are taken "
+			"are closed, and requests without a matching idle session fall back "
+			"to the pool");
+
+		config["turbocaching"] = false;
+		config["thread_session_slots"] = 1;
+		init();
+
+		TestSession session1, session2;
+		session1.setProtocol("http_session");
+		session2.setProtocol("http_session");
+
+		useTestSessionObject(&session1);
+		FileDescriptor client1(connectToUnixServer("tmp.server", __FILE__, __LINE__), NULL, 0);
+		BufferedIO client1IO(client1);
+		writeExact(client1,
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		EVENTUALLY(5,
+			result = session1.fd() != -1;
+		);
+		readHeader(session1.getPeerBufferedIO());
+
+		useTestSessionObject(&session2);
+		FileDescriptor client2(connectToUnixServer("tmp.server", __FILE__, __LINE__), NULL, 0);
+		BufferedIO client2IO(client2);
+		writeExact(client2,
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		EVENTUALLY(5,
+			result = session2.fd() != -1;
+		);
+		readHeader(session2.getPeerBufferedIO());
+		ensure_equals("(1)", getAsyncGetCalls(), 2u);
+
+		bg.safe->runSync(boost::bind(&Core_ControllerTest::_sendPeerResponses,
+			this, &session1, &session2, StaticString(
+				"HTTP/1.1 200 OK\r\n"
+				"Content-Length: 2\r\n\r\n"
+				"ok")));
+		ensure("(2)", containsSubstring(readHeader(client1IO), "HTTP/1.1 200 OK\r\n"));
+		ensure_equals("(3)", client1IO.readAll(), "ok");
+		ensure("(4)", containsSubstring(readHeader(client2IO), "HTTP/1.1 200 OK\r\n"));
+		ensure_equals("(5)", client2IO.readAll(), "ok");
+		EVENTUALLY(5,
+			result = session1.isClosed() && session2.isClosed();
+		);
+		ensure_equals("(6)", session1.getRecycleCount() + session2.getRecycleCount(), 1u);
+
+		Json::Value state = inspectState();
+		ensure_equals("(7)", state["idle_session_slots"]["idle"].asUInt(), 0u);
+		ensure_equals("(8)", state["idle_session_slots"]["hits"].asUInt64(), 0u);
+		ensure_equals("(9)", state["idle_session_slots"]["misses"].asUInt64(), 2u);
+		ensure_equals("(10)", state["idle_session_slots"]["overflows"].asUInt64(), 1u);
+	}
+
+	TEST_METHOD(50) {
+		set_test_name("An idle session whose process no longer accepts requests "
+			"is closed instead of reused, and the request falls back to the pool");
+
+		config["turbocaching"] = false;
+		config["thread_session_slots"] = 1;
+		config["thread_session_slot_idle_time"] = 60000;
+		init();
+
+		TestSession session1, session2;
+		session1.setProtocol("http_session");
+		session2.setProtocol("http_session");
+		// Don't let session2 outlive this test in a slot.
+		session2.setRecyclable(false);
+
+		useTestSessionObject(&session1);
+		connectToServer();
+		sendRequest(
+			"GET /first HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"\r\n"
+			"GET /second HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		EVENTUALLY(5,
+			result = session1.fd() != -1;
+		);
+		session1.setGroupName(getLastAppGroupName());
+		session2.setGroupName(getLastAppGroupName());
+		ensure("(1)", containsSubstring(readHeader(session1.getPeerBufferedIO()),
+			"GET /first "));
+
+		// As if the process got disabled while the session sat in the slot.
+		session1.setReusable(false);
+		useTestSessionObject(&session2);
+		writeExact(session1.peerFd(),
+			"HTTP/1.1 200 OK\r\n"
+			"Content-Length: 3\r\n\r\n"
+			"one");
+
+		EVENTUALLY(5,
+			result = session2.fd() != -1;
+		);
+		ensure("(2)", session1.isClosed());
+		ensure("(3)", containsSubstring(readHeader(session2.getPeerBufferedIO()),
+			"GET /second "));
+		writeExact(session2.peerFd(),
+			"HTTP/1.1 200 OK\r\n"
+			"Content-Length: 3\r\n\r\n"
+			"two");
+		session2.closePeerFd();
+
+		string header = readResponseHeader();
+		ensure("(4)", containsSubstring(header, "HTTP/1.1 200 OK\r\n"));
+		string rest = readResponseBody();
+		ensure("(5)", startsWith(rest, "one"));
+		ensure("(6)", containsSubstring(rest, "two"));
+
+		ensure_equals("(7)", getAsyncGetCalls(), 2u);
+		Json::Value state = inspectState();
+		ensure_equals("(8)", state["idle_session_slots"]["hits"].asUInt64(), 0u);
+		ensure_equals("(9)", state["idle_session_slots"]["misses"].asUInt64(), 2u);
+	}
+
+	TEST_METHOD(51) {
+		set_test_name("An idle session that no request reuses is closed after "
+			"the idle time");
+
+		config["turbocaching"] = false;
+		config["thread_session_slots"] = 1;
+		config["thread_session_slot_idle_time"] = 1000;
+		init();
+		useTestSessionObject();
+		testSession.setProtocol("http_session");
+
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+		testSession.setGroupName(getLastAppGroupName());
+		readPeerRequestHeader();
+		sendPeerResponse(
+			"HTTP/1.1 200 OK\r\n"
+			"Content-Length: 2\r\n\r\n"
+			"ok");
+		readResponseHeader();
+		ensure_equals("(1)", readResponseBody(), "ok");
+
+		Json::Value state = inspectState();
+		ensure_equals("(2)", state["idle_session_slots"]["idle"].asUInt(), 1u);
+		ensure("(3)", !testSession.isClosed());
+
+		waitUntilSessionClosed();
+		state = inspectState();
+		ensure_equals("(4)", state["idle_session_slots"]["idle"].asUInt(), 0u);
+		ensure_equals("(5)", testSession.getRecycleCount(), 1u);
+	}
+
+	TEST_METHOD(52) {
+		set_test_name("A session is closed instead of kept once it has been "
+			"reused thread_session_slot_max_reuses times");
+
+		config["turbocaching"] = false;
+		config["thread_session_slots"] = 1;
+		config["thread_session_slot_max_reuses"] = 1;
+		config["thread_session_slot_idle_time"] = 60000;
+		init();
+		useTestSessionObject();
+		testSession.setProtocol("http_session");
+
+		connectToServer();
+		sendRequest(
+			"GET /first HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"\r\n"
+			"GET /second HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+		testSession.setGroupName(getLastAppGroupName());
+		readPeerRequestHeader();
+		writeExact(testSession.peerFd(),
+			"HTTP/1.1 200 OK\r\n"
+			"Content-Length: 3\r\n\r\n"
+			"one");
+
+		EVENTUALLY(5,
+			result = testSession.getInitiateCount() == 2;
+		);
+		readPeerRequestHeader();
+		sendPeerResponse(
+			"HTTP/1.1 200 OK\r\n"
+			"Content-Length: 3\r\n\r\n"
+			"two");
+		readResponseHeader();
+		ensure("(1)", containsSubstring(readResponseBody(), "two"));
+
+		// Closed right away, not after the (long) idle time.
+		waitUntilSessionClosed();
+		ensure_equals("(2)", testSession.getRecycleCount(), 1u);
+		ensure_equals("(3)", getAsyncGetCalls(), 1u);
+		Json::Value state = inspectState();
+		ensure_equals("(4)", state["idle_session_slots"]["hits"].asUInt64(), 1u);
+		ensure_equals("(5)", state["idle_session_slots"]["idle"].asUInt(), 0u);
+	}
+
+	TEST_METHOD(53) {
+		set_test_name("When the client is slower than the application, a spliced "
+			"response body is buffered instead, so that the application is not "
+			"held up by the client");
+
+		config["turbocaching"] = false;
+		config["response_splice_threshold"] = 1024;
+		init();
+		useTestSessionObject();
+		testSession.setProtocol("http_session");
+
+		connectToServer();
+		sendRequest(
+			"GET /export HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+		readPeerRequestHeader();
+
+		string body;
+		for (unsigned int i = 0; i < 4 * 1024 * 1024; i++) {
+			body.append(1, 'a' + i % 26);
+		}
+		string response = "HTTP/1.1 200 OK\r\n"
+			"Content-Length: " + toString(body.size()) + "\r\n\r\n" + body;
+		TempThread writer(boost::bind(&Core_ControllerTest::sendPeerResponse, this,
+			StaticString(response)));
+
+		// The client doesn't read anything until the application is done:
+		// the socket buffers and the pipe can't hold the whole response.
+		waitUntilSessionClosed();
+		writer.join();
+
+		string header = readResponseHeader();
+		ensure("(1)", containsSubstring(header, "HTTP/1.1 200 OK\r\n"));
+		string receivedBody = readResponseBody();
+		ensure_equals("(2)", receivedBody.size(), body.size());
+		ensure("(3)", receivedBody == body);
+
+		Json::Value state = inspectState();
+		ensure_equals("(4)", state["spliced_response_bodies"].asUInt(), 1u);
+		ensure_equals("(5)", state["splice_fallbacks"].asUInt(), 1u);
+	}
 }
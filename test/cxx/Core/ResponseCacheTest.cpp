@@ -5,6 +5,11 @@
 #include <Core/Controller/Request.h>
 #include <Core/Controller/AppResponse.h>
 #include <Core/ResponseCache.h>
+#include <MemoryKit/mbuf.h>
+#include <Constants.h>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <zlib.h>
 
 using namespace Passenger;
 using namespace Passenger::Core;
@@ -14,15 +19,44 @@ using namespace std;
 namespace tut {
 	typedef ResponseCache<Request> ResponseCacheType;
 
+	struct CacheRequestOptions {
+		typedef vector< pair<StaticString, StaticString> > HeaderList;
+
+		/** Request headers. */
+		HeaderList requestHeaders;
+		/** App response headers, in addition to Cache-Control. */
+		HeaderList responseHeaders;
+		StaticString cacheControl;
+		/** App response body. Ignored if `bodyBuffers` is set. */
+		string body;
+		/** App response body as parts in mbufs, see appendBodyBuffer(). */
+		const LString *bodyBuffers;
+		/** Time of the store or fetch. 0 means the current time. */
+		ev_tstamp now;
+		/** Cache to use instead of the fixture's `responseCache`. */
+		ResponseCacheType *cache;
+
+		CacheRequestOptions()
+			: cacheControl("public,max-age=99999"),
+			  body(5, 'x'),
+			  bodyBuffers(NULL),
+			  now(0),
+			  cache(NULL)
+			{ }
+	};
+
 	struct Core_ResponseCacheTest {
 		ResponseCacheType responseCache;
 		Request req;
 		Core::ControllerSchema schema;
 		ConfigKit::Store config;
+		struct MemoryKit::mbuf_pool mbufPool;
 
 		Core_ResponseCacheTest()
 			: config(schema)
 		{
+			mbufPool.mbuf_block_chunk_size = DEFAULT_MBUF_CHUNK_SIZE;
+			MemoryKit::mbuf_pool_init(&mbufPool);
 			req.pool = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
 			config["multi_app"] = false;
 			config["default_server_name"] = "localhost";
@@ -31,7 +65,13 @@ namespace tut {
 		}
 
 		~Core_ResponseCacheTest() {
+			// Entries may reference mbufs from mbufPool. Shared storages
+			// never do, and may already have been destroyed.
+			if (!responseCache.usesSharedStorage()) {
+				responseCache.clear();
+			}
 			psg_destroy_pool(req.pool);
+			MemoryKit::mbuf_pool_deinit(&mbufPool);
 		}
 
 		void reset() {
@@ -74,6 +114,7 @@ namespace tut {
 			req.cacheKey = HashedStaticString();
 			req.cacheControl = NULL;
 			req.varyCookie = NULL;
+			req.acceptedEncodings = 0;
 			req.envvars = NULL;
 
 			req.appResponse.headers.clear();
@@ -152,9 +193,178 @@ namespace tut {
 			req.appResponse.bodyType = AppResponse::RBT_CONTENT_LENGTH;
 			req.appResponse.aux.bodyInfo.contentLength = body.size();
 		}
+
+		void setPath(const StaticString &path) {
+			psg_lstr_init(&req.path);
+			psg_lstr_append(&req.path, req.pool, path.data(), path.size());
+		}
+
+		ResponseCacheType *getCache(const CacheRequestOptions &options) {
+			if (options.cache != NULL) {
+				return options.cache;
+			} else {
+				return &responseCache;
+			}
+		}
+
+		ev_tstamp getTime(const CacheRequestOptions &options) {
+			if (options.now != 0) {
+				return options.now;
+			} else {
+				return time(NULL);
+			}
+		}
+
+		void initRequest(const StaticString &path, const CacheRequestOptions &options) {
+			CacheRequestOptions::HeaderList::const_iterator it;
+
+			reset();
+			setPath(path);
+			for (it = options.requestHeaders.begin(); it != options.requestHeaders.end(); it++) {
+				insertReqHeader(createHeader(it->first, it->second), req.pool);
+			}
+		}
+
+		ResponseCacheType::Entry store(const StaticString &path,
+			const CacheRequestOptions &options = CacheRequestOptions())
+		{
+			ResponseCacheType *cache = getCache(options);
+			CacheRequestOptions::HeaderList::const_iterator it;
+			const LString *body = options.bodyBuffers;
+			LString bodyStr;
+
+			initRequest(path, options);
+			insertAppResponseHeader(createHeader("cache-control", options.cacheControl),
+				req.pool);
+			for (it = options.responseHeaders.begin(); it != options.responseHeaders.end(); it++) {
+				insertAppResponseHeader(createHeader(it->first, it->second), req.pool);
+			}
+			if (body == NULL) {
+				psg_lstr_init(&bodyStr);
+				psg_lstr_append(&bodyStr, req.pool, options.body.data(), options.body.size());
+				body = &bodyStr;
+			}
+			initResponseBody(string(body->size, 'x'));
+
+			ensure("Request can be stored", cache->prepareRequest(this, &req)
+				&& cache->requestAllowsStoring(&req)
+				&& cache->prepareRequestForStoring(&req));
+			ResponseCacheType::Entry entry(cache->store(&req, getTime(options), 16, body));
+			if (entry.valid()) {
+				memset(entry.response->getHttpHeaderData(), 'h', 16);
+				cache->commit(entry);
+			}
+			if (body == &bodyStr) {
+				psg_lstr_deinit(&bodyStr);
+			}
+			return entry;
+		}
+
+		ResponseCacheType::Entry fetch(const StaticString &path,
+			const CacheRequestOptions &options = CacheRequestOptions())
+		{
+			ResponseCacheType *cache = getCache(options);
+
+			initRequest(path, options);
+			ensure("Request can be fetched", cache->prepareRequest(this, &req)
+				&& cache->requestAllowsFetching(&req));
+			return cache->fetch(&req, getTime(options));
+		}
+
+		CacheRequestOptions withBodySize(unsigned int size) {
+			CacheRequestOptions options;
+			options.body.assign(size, 'x');
+			return options;
+		}
+
+		// Options for an HTML response to a request with the given
+		// Accept-Encoding header.
+		CacheRequestOptions acceptingEncoding(const StaticString &acceptEncoding) {
+			CacheRequestOptions options;
+			if (!acceptEncoding.empty()) {
+				options.requestHeaders.push_back(make_pair(
+					StaticString("accept-encoding"), acceptEncoding));
+			}
+			options.responseHeaders.push_back(make_pair(
+				StaticString("content-type"), StaticString("text/html; charset=utf-8")));
+			return options;
+		}
+
+		// Appends `size` bytes of `c` to `body`, in mbufs from mbufPool.
+		void appendBodyBuffer(LString *body, char c, unsigned int size) {
+			MemoryKit::mbuf buffer(MemoryKit::mbuf_get(&mbufPool));
+			buffer = MemoryKit::mbuf(buffer, 0, size);
+			memset(buffer.start, c, size);
+			psg_lstr_append(body, req.pool, buffer, buffer.start, size);
+		}
+
+		string gunzip(const char *data, unsigned int size) {
+			z_stream stream;
+			char buf[1024];
+			string result;
+			int ret;
+
+			memset(&stream, 0, sizeof(stream));
+			ensure(inflateInit2(&stream, 15 + 16) == Z_OK);
+			stream.next_in  = (Bytef *) data;
+			stream.avail_in = size;
+			do {
+				stream.next_out  = (Bytef *) buf;
+				stream.avail_out = sizeof(buf);
+				ret = inflate(&stream, Z_NO_FLUSH);
+				result.append(buf, sizeof(buf) - stream.avail_out);
+			} while (ret == Z_OK);
+			inflateEnd(&stream);
+			ensure_equals("Body is valid gzip data", ret, Z_STREAM_END);
+			return result;
+		}
+
+		static void publishEntriesConcurrently(ResponseCacheStorage *storage,
+			unsigned int count)
+		{
+			char key[32];
+
+			for (unsigned int i = 0; i < count; i++) {
+				snprintf(key, sizeof(key), "/%u", i % 64);
+				ResponseCacheStorage::StoredResponse *response =
+					storage->allocate(key, 16, 100 + i % 1000);
+				memset(response->getHttpHeaderData(), 'a' + i % 26,
+					response->httpHeaderSize + response->httpBodySize);
+				storage->publish(response);
+				if (i % 100 == 0) {
+					storage->remove(key);
+				}
+			}
+		}
+
+		static void lookupEntriesConcurrently(ResponseCacheStorage *storage,
+			unsigned int readerIndex, const boost::atomic<bool> *done,
+			boost::atomic<unsigned int> *corruptions)
+		{
+			char key[32];
+			unsigned int i = 0;
+
+			while (!done->load()) {
+				snprintf(key, sizeof(key), "/%u", i++ % 64);
+				storage->beginRead(readerIndex);
+				const ResponseCacheStorage::StoredResponse *response =
+					storage->lookup(key);
+				if (response != NULL) {
+					const char *data = response->getHttpHeaderData();
+					unsigned int size = response->httpHeaderSize + response->httpBodySize;
+					if (response->getKey() != key || data[0] < 'a' || data[0] > 'z'
+					 || memchr(data, data[0] + 1, size) != NULL
+					 || memchr(data, data[0] - 1, size) != NULL)
+					{
+						corruptions->fetch_add(1);
+					}
+				}
+				storage->endRead(readerIndex);
+			}
+		}
 	};
 
-	DEFINE_TEST_GROUP_WITH_LIMIT(Core_ResponseCacheTest, 100);
+	DEFINE_TEST_GROUP_WITH_LIMIT(Core_ResponseCacheTest, 120);
 
 
 	/***** Preparation *****/
@@ -216,7 +426,8 @@ namespace tut {
 		ResponseCacheType::Entry entry(responseCache.store(&req, time(NULL),
 			responseHeadersStr.size(), responseBodyStr.size()));
 		ensure("(5)", entry.valid());
-		ensure_equals("(6)", entry.index, 0u);
+		responseCache.commit(entry);
+		ensure_equals("(6)", responseCache.getEntryCount(), 1u);
 
 
 		reset();
@@ -224,9 +435,9 @@ namespace tut {
 		ensure("(11)", responseCache.requestAllowsFetching(&req));
 		ResponseCacheType::Entry entry2(responseCache.fetch(&req, time(NULL)));
 		ensure("(12)", entry2.valid());
-		ensure_equals("(13)", entry2.index, 0u);
-		ensure_equals<int>("(14)", entry2.body->httpHeaderSize, responseHeadersStr.size());
-		ensure_equals<int>("(15)", entry2.body->httpBodySize, responseBodyStr.size());
+		ensure("(13)", entry2.response == entry.response);
+		ensure_equals<int>("(14)", entry2.response->httpHeaderSize, responseHeadersStr.size());
+		ensure_equals<int>("(15)", entry2.response->httpBodySize, responseBodyStr.size());
 	}
 
 	TEST_METHOD(11) {
@@ -478,7 +689,8 @@ namespace tut {
 		ResponseCacheType::Entry entry(responseCache.store(&req, time(NULL),
 			responseHeadersStr.size(), responseBodyStr.size()));
 		ensure("(5)", entry.valid());
-		ensure_equals("(6)", entry.index, 0u);
+		responseCache.commit(entry);
+		ensure_equals("(6)", responseCache.getEntryCount(), 1u);
 
 
 		reset();
@@ -511,7 +723,8 @@ namespace tut {
 		ResponseCacheType::Entry entry(responseCache.store(&req, time(NULL),
 			responseHeadersStr.size(), responseBodyStr.size()));
 		ensure("(5)", entry.valid());
-		ensure_equals("(6)", entry.index, 0u);
+		responseCache.commit(entry);
+		ensure_equals("(6)", responseCache.getEntryCount(), 1u);
 
 
 		reset();
@@ -549,7 +762,8 @@ namespace tut {
 		ResponseCacheType::Entry entry(responseCache.store(&req, time(NULL),
 			responseHeadersStr.size(), responseBodyStr.size()));
 		ensure("(5)", entry.valid());
-		ensure_equals("(6)", entry.index, 0u);
+		responseCache.commit(entry);
+		ensure_equals("(6)", responseCache.getEntryCount(), 1u);
 
 
 		reset();
@@ -571,4 +785,489 @@ namespace tut {
 		ResponseCacheType::Entry entry2(responseCache.fetch(&req, time(NULL)));
 		ensure("(22)", !entry2.valid());
 	}
+
+
+	/***** Capacity and eviction *****/
+
+	TEST_METHOD(70) {
+		set_test_name("It can hold more than 8 entries");
+		char path[32];
+
+		for (unsigned int i = 0; i < 100; i++) {
+			snprintf(path, sizeof(path), "/%u", i);
+			ensure(store(path).valid());
+		}
+		ensure_equals("(1)", responseCache.getEntryCount(), 100u);
+		for (unsigned int i = 0; i < 100; i++) {
+			snprintf(path, sizeof(path), "/%u", i);
+			ensure(path, fetch(path).valid());
+		}
+		ensure_equals("(2)", responseCache.getEvictions(), 0u);
+	}
+
+	TEST_METHOD(71) {
+		set_test_name("When the entry limit is reached, it evicts an entry that "
+			"hasn't been referenced recently");
+		responseCache.setCapacity(3, ResponseCacheStorage::DEFAULT_MAX_MEMORY);
+		ensure("(1)", store("/a").valid());
+		ensure("(2)", store("/b").valid());
+		ensure("(3)", store("/c").valid());
+		ensure("(4)", fetch("/a").valid());
+		ensure("(5)", fetch("/c").valid());
+
+		ensure("(6)", store("/d").valid());
+		ensure_equals("(7)", responseCache.getEntryCount(), 3u);
+		ensure_equals("(8)", responseCache.getEvictions(), 1u);
+		ensure("(9)", !fetch("/b").valid());
+		ensure("(10)", fetch("/a").valid());
+		ensure("(11)", fetch("/c").valid());
+		ensure("(12)", fetch("/d").valid());
+	}
+
+	TEST_METHOD(72) {
+		set_test_name("When the memory limit is reached, it evicts entries until "
+			"the new entry fits");
+		char path[32];
+		unsigned int i;
+
+		responseCache.setCapacity(100, 64 * 1024);
+		for (i = 0; i < 10; i++) {
+			snprintf(path, sizeof(path), "/%u", i);
+			ensure(store(path, withBodySize(6000)).valid());
+		}
+		ensure_equals("(1)", responseCache.getEntryCount(), 10u);
+		ensure_equals("(2)", responseCache.getEvictions(), 0u);
+
+		ensure("(3)", store("/10", withBodySize(6000)).valid());
+		ensure_equals("(4)", responseCache.getEvictions(), 1u);
+		ensure_equals("(5)", responseCache.getEntryCount(), 10u);
+		ensure("(6)", responseCache.getMemoryUsage() <= responseCache.getMaxMemory());
+		ensure("(7)", !fetch("/0").valid());
+		ensure("(8)", fetch("/1").valid());
+		ensure("(9)", fetch("/10").valid());
+	}
+
+	TEST_METHOD(73) {
+		set_test_name("It stores bodies larger than 32 KB as long as they fit in "
+			"the maximum body size");
+		ResponseCacheType::Entry entry(store("/", withBodySize(100 * 1024)));
+		ensure("(1)", entry.valid());
+
+		entry = fetch("/");
+		ensure("(2)", entry.valid());
+		ensure_equals("(3)", entry.response->httpBodySize, 100u * 1024);
+		ensure_equals("(4)", entry.response->getHttpBodyData()[100 * 1024 - 1], 'x');
+
+		ensure("(5)", !store("/big", withBodySize(responseCache.getMaxBodySize() + 1)).valid());
+	}
+
+	TEST_METHOD(74) {
+		set_test_name("Storing a response under an existing key replaces the old entry");
+		ensure("(1)", store("/").valid());
+		ensure("(2)", store("/", withBodySize(10)).valid());
+		ensure_equals("(3)", responseCache.getEntryCount(), 1u);
+		ensure_equals("(4)", fetch("/").response->httpBodySize, 10u);
+	}
+
+	TEST_METHOD(75) {
+		set_test_name("clear() removes all entries");
+		ensure("(1)", store("/a").valid());
+		ensure("(2)", store("/b").valid());
+		responseCache.clear();
+		ensure_equals("(3)", responseCache.getEntryCount(), 0u);
+		ensure_equals("(4)", responseCache.getMemoryUsage(), 0u);
+		ensure("(5)", !fetch("/a").valid());
+	}
+
+
+	/***** Shared storage *****/
+
+	TEST_METHOD(80) {
+		set_test_name("Caches that share a storage see each other's entries, "
+			"but keep their own statistics");
+		ResponseCacheStorage storage(100, 1024 * 1024, 2);
+		ResponseCacheType otherCache;
+		responseCache.useSharedStorage(&storage, 0);
+		otherCache.useSharedStorage(&storage, 1);
+
+		ensure("(1)", store("/").valid());
+		{
+			ResponseCacheType::ReadGuard guard(otherCache);
+			CacheRequestOptions options;
+			options.cache = &otherCache;
+			ResponseCacheType::Entry entry(fetch("/", options));
+			ensure("(2)", entry.valid());
+			ensure_equals("(3)", entry.response->httpBodySize, 5u);
+		}
+
+		ensure_equals("(4)", responseCache.getStores(), 1u);
+		ensure_equals("(5)", responseCache.getHits(), 0u);
+		ensure_equals("(6)", otherCache.getStores(), 0u);
+		ensure_equals("(7)", otherCache.getHits(), 1u);
+		ensure_equals("(8)", responseCache.getEntryCount(), 1u);
+		ensure_equals("(9)", otherCache.getEntryCount(), 1u);
+	}
+
+	TEST_METHOD(81) {
+		set_test_name("Invalidation through one cache is visible through other "
+			"caches that share the same storage");
+		ResponseCacheStorage storage(100, 1024 * 1024, 2);
+		ResponseCacheType otherCache;
+		responseCache.useSharedStorage(&storage, 0);
+		otherCache.useSharedStorage(&storage, 1);
+
+		ensure("(1)", store("/").valid());
+
+		reset();
+		req.method = HTTP_POST;
+		ensure("(2)", otherCache.prepareRequest(this, &req));
+		ensure("(3)", otherCache.requestAllowsInvalidating(&req));
+		otherCache.invalidate(&req);
+
+		ResponseCacheType::ReadGuard guard(responseCache);
+		ensure("(4)", !fetch("/").valid());
+		ensure_equals("(5)", storage.getEntryCount(), 0u);
+	}
+
+	TEST_METHOD(82) {
+		set_test_name("Readers never see freed or partially written entries "
+			"while a writer modifies a shared storage");
+		const unsigned int READERS = 3;
+		ResponseCacheStorage storage(16, 64 * 1024, READERS);
+		boost::atomic<bool> done(false);
+		boost::atomic<unsigned int> corruptions(0);
+		boost::thread_group readers;
+
+		for (unsigned int i = 0; i < READERS; i++) {
+			readers.create_thread(boost::bind(lookupEntriesConcurrently,
+				&storage, i, &done, &corruptions));
+		}
+		publishEntriesConcurrently(&storage, 20000);
+		done.store(true);
+		readers.join_all();
+
+		ensure_equals("(1)", corruptions.load(), 0u);
+		ensure("(2)", storage.getEntryCount() <= 16u);
+		ensure("(3)", storage.getMemoryUsage() <= 64u * 1024);
+		ensure("(4)", storage.getEvictions() > 0);
+	}
+
+
+	/***** Revalidation and stale responses *****/
+
+	TEST_METHOD(90) {
+		set_test_name("An expired entry is revalidated by a single request "
+			"while the others wait for it");
+		CacheRequestOptions options;
+		vector<Request *> waiters;
+
+		options.cacheControl = "public,max-age=10";
+		ensure("(1)", store("/", options).valid());
+		options.now = time(NULL) + 20;
+		ResponseCacheType::Entry entry(fetch("/", options));
+		ensure("(2)", !entry.valid());
+		ensure_equals("(3)", entry.cacheMissReason, ResponseCacheType::Entry::NOT_FRESH);
+		ensure("(4)", responseCache.isRevalidating(&req));
+		ensure_equals("(5)", responseCache.getEntryCount(), 1u);
+
+		entry = fetch("/", options);
+		ensure("(6)", !entry.valid());
+		ensure_equals("(7)", entry.cacheMissReason, ResponseCacheType::Entry::REVALIDATING);
+		responseCache.waitForRevalidation(&req);
+
+		responseCache.endRevalidation(&req, options.now, waiters);
+		ensure_equals("(8)", waiters.size(), 1u);
+		ensure("(9)", !responseCache.isRevalidating(&req));
+		ensure_equals("(10)", responseCache.getEntryCount(), 0u);
+		ensure_equals("(11)", fetch("/", options).cacheMissReason,
+			ResponseCacheType::Entry::NOT_FOUND);
+	}
+
+	TEST_METHOD(91) {
+		set_test_name("Within the stale-while-revalidate window, requests "
+			"get the stale entry while it is being revalidated");
+		time_t now = time(NULL);
+		CacheRequestOptions options;
+
+		options.cacheControl = "public,max-age=10,stale-while-revalidate=100";
+		ensure("(1)", store("/", options).valid());
+		options.now = now + 20;
+		ensure("(2)", !fetch("/", options).valid());
+
+		ResponseCacheType::Entry entry(fetch("/", options));
+		ensure("(3)", entry.valid());
+		ensure("(4)", entry.stale);
+
+		options.now = now + 200;
+		entry = fetch("/", options);
+		ensure("(5)", !entry.valid());
+		ensure_equals("(6)", entry.cacheMissReason, ResponseCacheType::Entry::REVALIDATING);
+	}
+
+	TEST_METHOD(92) {
+		set_test_name("A fresh response stored by the revalidating request "
+			"replaces the stale entry");
+		CacheRequestOptions options;
+		vector<Request *> waiters;
+
+		options.cacheControl = "public,max-age=10";
+		ensure("(1)", store("/", options).valid());
+		options.now = time(NULL) + 20;
+		ensure("(2)", !fetch("/", options).valid());
+		Request *leader = &req;
+
+		ensure("(3)", store("/").valid());
+		responseCache.endRevalidation(leader, time(NULL), waiters);
+		ensure_equals("(4)", responseCache.getEntryCount(), 1u);
+		ResponseCacheType::Entry entry(fetch("/"));
+		ensure("(5)", entry.valid());
+		ensure("(6)", !entry.stale);
+	}
+
+	TEST_METHOD(93) {
+		set_test_name("Within the stale-if-error window, the revalidating "
+			"request can get the stale entry");
+		time_t now = time(NULL);
+		CacheRequestOptions options;
+		vector<Request *> waiters;
+
+		options.cacheControl = "public,max-age=10,stale-if-error=100";
+		ensure("(1)", store("/", options).valid());
+		ensure("(2)", !responseCache.fetchStaleIfError(&req, now + 20).valid());
+		options.now = now + 20;
+		ensure("(3)", !fetch("/", options).valid());
+
+		ResponseCacheType::Entry entry(responseCache.fetchStaleIfError(&req, now + 20));
+		ensure("(4)", entry.valid());
+		ensure("(5)", entry.stale);
+		ensure("(6)", !responseCache.fetchStaleIfError(&req, now + 200).valid());
+
+		responseCache.endRevalidation(&req, now + 20, waiters, true);
+		ensure_equals("(7)", responseCache.getEntryCount(), 1u);
+	}
+
+	TEST_METHOD(94) {
+		set_test_name("Stale entries are not served if stale serving is disabled");
+		time_t now = time(NULL);
+		CacheRequestOptions options;
+
+		responseCache.setStaleServingEnabled(false);
+		options.cacheControl = "public,max-age=10,stale-while-revalidate=100,stale-if-error=100";
+		ensure("(1)", store("/", options).valid());
+		options.now = now + 20;
+		ensure("(2)", !fetch("/", options).valid());
+		ensure("(3)", !responseCache.fetchStaleIfError(&req, now + 20).valid());
+
+		ResponseCacheType::Entry entry(fetch("/", options));
+		ensure("(4)", !entry.valid());
+		ensure_equals("(5)", entry.cacheMissReason, ResponseCacheType::Entry::REVALIDATING);
+	}
+
+	TEST_METHOD(95) {
+		set_test_name("HEAD requests do not revalidate expired entries");
+		CacheRequestOptions options;
+
+		options.cacheControl = "public,max-age=10";
+		ensure("(1)", store("/", options).valid());
+		reset();
+		req.method = HTTP_HEAD;
+		ensure("(2)", responseCache.prepareRequest(this, &req));
+		ResponseCacheType::Entry entry(responseCache.fetch(&req, time(NULL) + 20));
+		ensure_equals("(3)", entry.cacheMissReason, ResponseCacheType::Entry::NOT_FRESH);
+		ensure("(4)", !responseCache.isRevalidating(&req));
+		ensure_equals("(5)", responseCache.getEntryCount(), 0u);
+	}
+
+
+	/***** Referencing body buffers *****/
+
+	TEST_METHOD(96) {
+		set_test_name("Bodies that fill their mbufs are referenced instead of copied");
+		const unsigned int BLOCK_SIZE = MemoryKit::mbuf_pool_data_size(&mbufPool);
+		CacheRequestOptions options;
+		LString body;
+
+		psg_lstr_init(&body);
+		appendBodyBuffer(&body, 'a', BLOCK_SIZE);
+		appendBodyBuffer(&body, 'b', BLOCK_SIZE);
+		appendBodyBuffer(&body, 'c', BLOCK_SIZE / 2);
+		options.bodyBuffers = &body;
+		ResponseCacheType::Entry entry(store("/", options));
+		psg_lstr_deinit(&body);
+
+		ensure("(1)", entry.valid());
+		ensure("(2)", entry.response->hasHttpBodyBuffers());
+		ensure_equals("(3)", entry.response->nHttpBodyBuffers, 3u);
+		ensure_equals("(4)", entry.response->httpBodySize, BLOCK_SIZE * 5 / 2);
+		ensure("(5)", responseCache.getMemoryUsage() >= BLOCK_SIZE * 3);
+		ensure_equals("(6)", mbufPool.nactive_mbuf_blockq, 3u);
+
+		entry = fetch("/");
+		ensure("(7)", entry.valid());
+		const MemoryKit::mbuf *buffers = entry.response->getHttpBodyBuffers();
+		ensure_equals("(8)", buffers[0].size(), BLOCK_SIZE);
+		ensure_equals("(9)", buffers[1].start[0], 'b');
+		ensure_equals("(10)", buffers[2].size(), BLOCK_SIZE / 2);
+
+		responseCache.clear();
+		ensure_equals("(11)", mbufPool.nactive_mbuf_blockq, 0u);
+	}
+
+	TEST_METHOD(97) {
+		set_test_name("Small bodies in large mbufs are copied");
+		CacheRequestOptions options;
+		LString body;
+
+		psg_lstr_init(&body);
+		appendBodyBuffer(&body, 'a', 100);
+		options.bodyBuffers = &body;
+		ResponseCacheType::Entry entry(store("/", options));
+		psg_lstr_deinit(&body);
+
+		ensure("(1)", entry.valid());
+		ensure("(2)", !entry.response->hasHttpBodyBuffers());
+		ensure_equals("(3)", mbufPool.nactive_mbuf_blockq, 0u);
+		entry = fetch("/");
+		ensure("(4)", entry.valid());
+		ensure_equals("(5)", StaticString(entry.response->getHttpBodyData(), 100),
+			StaticString(string(100, 'a')));
+	}
+
+	TEST_METHOD(98) {
+		set_test_name("Entries in a shared storage never reference body buffers");
+		const unsigned int BLOCK_SIZE = MemoryKit::mbuf_pool_data_size(&mbufPool);
+		ResponseCacheStorage storage(ResponseCacheStorage::DEFAULT_MAX_ENTRIES,
+			ResponseCacheStorage::DEFAULT_MAX_MEMORY, 1);
+		ResponseCacheType cache;
+		CacheRequestOptions options;
+		LString body;
+
+		cache.useSharedStorage(&storage, 0);
+		psg_lstr_init(&body);
+		appendBodyBuffer(&body, 'a', BLOCK_SIZE);
+		appendBodyBuffer(&body, 'b', BLOCK_SIZE);
+		options.bodyBuffers = &body;
+		options.cache = &cache;
+		ResponseCacheType::Entry entry(store("/", options));
+		psg_lstr_deinit(&body);
+
+		ensure("(1)", entry.valid());
+		ensure("(2)", !entry.response->hasHttpBodyBuffers());
+		ensure_equals("(3)", mbufPool.nactive_mbuf_blockq, 0u);
+	}
+
+
+	/***** Content coding variants *****/
+
+	TEST_METHOD(100) {
+		set_test_name("Responses are cached separately for each set of accepted encodings");
+		ensure("(1)", store("/", acceptingEncoding("gzip, deflate")).valid());
+		ensure("(2)", fetch("/", acceptingEncoding("deflate, GZIP")).valid());
+		ensure("(3)", fetch("/", acceptingEncoding("x-gzip")).valid());
+		ensure("(4)", !fetch("/", acceptingEncoding("")).valid());
+		ensure("(5)", !fetch("/", acceptingEncoding("gzip;q=0, deflate")).valid());
+		ensure("(6)", !fetch("/", acceptingEncoding("gzip, br")).valid());
+		ensure("(7)", fetch("/", acceptingEncoding("gzip;q=0.5")).valid());
+	}
+
+	TEST_METHOD(101) {
+		set_test_name("Responses that only vary by Accept-Encoding can be stored");
+		initCacheableResponse();
+		insertAppResponseHeader(createHeader("vary", "Accept-Encoding"), req.pool);
+		ensure("(1)", responseCache.prepareRequest(this, &req));
+		ensure("(2)", responseCache.requestAllowsStoring(&req));
+		ensure("(3)", responseCache.prepareRequestForStoring(&req));
+
+		reset();
+		initCacheableResponse();
+		insertAppResponseHeader(createHeader("vary", "accept-encoding, cookie"), req.pool);
+		ensure("(4)", responseCache.prepareRequest(this, &req));
+		ensure("(5)", responseCache.requestAllowsStoring(&req));
+		ensure("(6)", !responseCache.prepareRequestForStoring(&req));
+	}
+
+	TEST_METHOD(102) {
+		set_test_name("Invalidation removes the entries for all sets of accepted encodings");
+		store("/", acceptingEncoding(""));
+		store("/", acceptingEncoding("gzip"));
+		store("/", acceptingEncoding("br, gzip"));
+		ensure_equals("(1)", responseCache.getEntryCount(), 3u);
+
+		reset();
+		req.method = HTTP_POST;
+		ensure("(2)", responseCache.prepareRequest(this, &req));
+		ensure("(3)", responseCache.requestAllowsInvalidating(&req));
+		responseCache.invalidate(&req);
+		ensure_equals("(4)", responseCache.getEntryCount(), 0u);
+	}
+
+	TEST_METHOD(103) {
+		set_test_name("With compression enabled, compressible responses are stored gzipped");
+		string bodyStr;
+		for (unsigned int i = 0; i < 100; i++) {
+			bodyStr.append("<p>Hello world " + toString(i) + "</p>\n");
+		}
+		responseCache.setCompressionEnabled(true);
+
+		CacheRequestOptions options(acceptingEncoding("gzip"));
+		options.body = bodyStr;
+		ResponseCacheType::Entry entry(store("/", options));
+		ensure("(1)", entry.valid());
+		ensure_equals("(2)", responseCache.getCompressions(), 1u);
+		ensure("(3)", entry.response->httpBodySize < bodyStr.size());
+		ensure_equals("(4)", StaticString(entry.response->getHttpHeaderData(),
+				entry.response->httpHeaderSize),
+			StaticString(string(16, 'h')
+				+ "Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n"));
+		ensure_equals("(5)", gunzip(entry.response->getHttpBodyData(),
+			entry.response->httpBodySize), bodyStr);
+
+		entry = fetch("/", acceptingEncoding("gzip"));
+		ensure("(6)", entry.valid());
+		ensure("(7)", !fetch("/", acceptingEncoding("")).valid());
+	}
+
+	TEST_METHOD(104) {
+		set_test_name("Responses are stored uncompressed if compression doesn't apply to them");
+		string bodyStr(1000, 'x');
+		CacheRequestOptions options;
+		ResponseCacheType::Entry entry;
+
+		options = acceptingEncoding("gzip");
+		options.body = bodyStr;
+		entry = store("/", options);
+		ensure("Compression is disabled", entry.response->httpBodySize == bodyStr.size());
+
+		responseCache.setCompressionEnabled(true);
+		options = acceptingEncoding("br");
+		options.body = bodyStr;
+		entry = store("/", options);
+		ensure("Client doesn't accept gzip", entry.response->httpBodySize == bodyStr.size());
+		options = acceptingEncoding("gzip");
+		options.body = "small";
+		entry = store("/", options);
+		ensure("Body is small", entry.response->httpBodySize == 5);
+		options = acceptingEncoding("gzip");
+		options.body = bodyStr;
+		options.responseHeaders.push_back(make_pair(StaticString("content-encoding"),
+			StaticString("identity")));
+		entry = store("/", options);
+		ensure("Response has a Content-Encoding", entry.response->httpBodySize == bodyStr.size());
+		options = acceptingEncoding("gzip");
+		options.body = bodyStr;
+		options.responseHeaders.push_back(make_pair(StaticString("etag"),
+			StaticString("\"abc\"")));
+		entry = store("/", options);
+		ensure("Response has a strong ETag", entry.response->httpBodySize == bodyStr.size());
+		ensure_equals(responseCache.getCompressions(), 0u);
+
+		options = acceptingEncoding("gzip");
+		options.body = bodyStr;
+		options.responseHeaders.push_back(make_pair(StaticString("etag"),
+			StaticString("W/\"abc\"")));
+		entry = store("/", options);
+		ensure("Response has a weak ETag", entry.response->httpBodySize < bodyStr.size());
+		ensure_equals(gunzip(entry.response->getHttpBodyData(),
+			entry.response->httpBodySize), bodyStr);
+	}
 }
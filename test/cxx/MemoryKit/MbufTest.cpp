@@ -1,5 +1,7 @@
 #include <TestSupport.h>
 #include <boost/move/move.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
 #include <Constants.h>
 #include <MemoryKit/mbuf.h>
 
@@ -10,18 +12,46 @@ using namespace std;
 namespace tut {
 	struct MemoryKit_MbufTest {
 		struct mbuf_pool pool;
+		struct mbuf_pool smallPool, largePool;
 
 		MemoryKit_MbufTest() {
 			pool.mbuf_block_chunk_size = DEFAULT_MBUF_CHUNK_SIZE;
 			mbuf_pool_init(&pool);
+			smallPool.mbuf_block_chunk_size = 512;
+			mbuf_pool_init(&smallPool);
+			largePool.mbuf_block_chunk_size = DEFAULT_MBUF_CHUNK_SIZE * 4;
+			mbuf_pool_init(&largePool);
 		}
 
 		~MemoryKit_MbufTest() {
 			mbuf_pool_deinit(&pool);
+			mbuf_pool_deinit(&smallPool);
+			mbuf_pool_deinit(&largePool);
+		}
+
+		void addSizeClasses() {
+			// Deliberately not in order of size.
+			mbuf_pool_add_size_class(&pool, &largePool);
+			mbuf_pool_add_size_class(&pool, &smallPool);
+		}
+
+		static void releaseInThread(mbuf *buffer) {
+			*buffer = mbuf();
+		}
+
+		static void releaseInOtherThread(mbuf &buffer) {
+			boost::thread thr(releaseInThread, &buffer);
+			thr.join();
+		}
+
+		static void takeAndReleaseSubsets(const mbuf *buffer, unsigned int count) {
+			for (unsigned int i = 0; i < count; i++) {
+				mbuf subset(*buffer, i % 8, 8);
+			}
 		}
 	};
 
-	DEFINE_TEST_GROUP(MemoryKit_MbufTest);
+	DEFINE_TEST_GROUP_WITH_LIMIT(MemoryKit_MbufTest, 100);
 
 	TEST_METHOD(1) {
 		set_test_name("Initial pool state");
@@ -264,4 +294,184 @@ namespace tut {
 		ensure_equals("(5)", pool.nfree_mbuf_blockq, 0u);
 		ensure_equals("(6)", pool.nactive_mbuf_blockq, 0u);
 	}
+
+	TEST_METHOD(30) {
+		set_test_name("It counts freelist hits and misses");
+		mbuf buffer(mbuf_get(&pool));
+		ensure_equals("(1)", pool.nhits, 0u);
+		ensure_equals("(2)", pool.nmisses, 1u);
+
+		buffer = mbuf();
+		buffer = mbuf_get(&pool);
+		ensure_equals("(3)", pool.nhits, 1u);
+		ensure_equals("(4)", pool.nmisses, 1u);
+	}
+
+	TEST_METHOD(31) {
+		set_test_name("mbuf_blocks released by a thread other than the owner are "
+			"returned through the remote free queue");
+		mbuf_pool_bind_to_current_thread(&pool, true);
+
+		mbuf buffer(mbuf_get(&pool));
+		struct mbuf_block *block = buffer.mbuf_block;
+		releaseInOtherThread(buffer);
+		ensure_equals("(1)", pool.nfree_mbuf_blockq, 0u);
+		ensure_equals("(2)", pool.nactive_mbuf_blockq, 1u);
+		ensure_equals("(3)", pool.nremote_frees, 0u);
+
+		buffer = mbuf_get(&pool);
+		ensure("(4)", buffer.mbuf_block == block);
+		ensure_equals("(5)", pool.nfree_mbuf_blockq, 0u);
+		ensure_equals("(6)", pool.nactive_mbuf_blockq, 1u);
+		ensure_equals("(7)", pool.nremote_frees, 1u);
+		ensure_equals("(8)", pool.nhits, 1u);
+	}
+
+	TEST_METHOD(32) {
+		set_test_name("Standalone mbuf_blocks released by a thread other than the owner "
+			"are freed by the owner");
+		mbuf_pool_bind_to_current_thread(&pool, false);
+
+		mbuf buffer(mbuf_get_with_size(&pool, mbuf_pool_data_size(&pool) + 10));
+		releaseInOtherThread(buffer);
+		ensure_equals("(1)", pool.nactive_mbuf_blockq, 1u);
+
+		ensure_equals("(2)", mbuf_pool_compact(&pool), 0u);
+		ensure_equals("(3)", pool.nfree_mbuf_blockq, 0u);
+		ensure_equals("(4)", pool.nactive_mbuf_blockq, 0u);
+		ensure_equals("(5)", pool.nremote_frees, 1u);
+	}
+
+	TEST_METHOD(33) {
+		set_test_name("mbuf_blocks released by the owner thread go straight to the freelist");
+		mbuf_pool_bind_to_current_thread(&pool, false);
+
+		mbuf buffer(mbuf_get(&pool));
+		buffer = mbuf();
+		ensure_equals("(1)", pool.nfree_mbuf_blockq, 1u);
+		ensure_equals("(2)", pool.nactive_mbuf_blockq, 0u);
+		ensure_equals("(3)", pool.nremote_frees, 0u);
+	}
+
+	TEST_METHOD(34) {
+		set_test_name("References to an mbuf_block of a bound pool can be taken and "
+			"released by several threads at the same time");
+		boost::thread_group threads;
+		mbuf_pool_bind_to_current_thread(&pool, false);
+
+		mbuf buffer(mbuf_get(&pool));
+		for (unsigned int i = 0; i < 4; i++) {
+			threads.create_thread(boost::bind(takeAndReleaseSubsets, &buffer, 100000));
+		}
+		threads.join_all();
+		ensure_equals("(1)", buffer.mbuf_block->refcount, 1u);
+
+		buffer = mbuf();
+		ensure_equals("(2)", pool.nfree_mbuf_blockq, 1u);
+		ensure_equals("(3)", pool.nactive_mbuf_blockq, 0u);
+	}
+
+	TEST_METHOD(40) {
+		set_test_name("With slabs enabled, mbuf_blocks are carved out of slabs");
+		mbuf_pool_enable_slabs(&pool, DEFAULT_MBUF_CHUNK_SIZE * 4, false);
+
+		mbuf buffers[5];
+		for (unsigned int i = 0; i < 5; i++) {
+			buffers[i] = mbuf_get(&pool);
+		}
+		ensure_equals("(1)", pool.nslabs, 2u);
+		ensure_equals("(2)", buffers[1].mbuf_block->start - buffers[0].mbuf_block->start,
+			(long) DEFAULT_MBUF_CHUNK_SIZE);
+		ensure("(3)", buffers[0].mbuf_block->slab == buffers[3].mbuf_block->slab);
+		ensure("(4)", buffers[0].mbuf_block->slab != buffers[4].mbuf_block->slab);
+		memset(buffers[3].start, 'x', buffers[3].size());
+
+		buffers[2] = mbuf();
+		buffers[2] = mbuf_get(&pool);
+		ensure_equals("(5)", pool.nslabs, 2u);
+		ensure_equals("(6)", pool.nhits, 1u);
+	}
+
+	TEST_METHOD(41) {
+		set_test_name("With slabs enabled, compaction unmaps slabs of which all "
+			"mbuf_blocks are free");
+		mbuf_pool_enable_slabs(&pool, DEFAULT_MBUF_CHUNK_SIZE * 2, false);
+
+		mbuf buffers[4];
+		for (unsigned int i = 0; i < 4; i++) {
+			buffers[i] = mbuf_get(&pool);
+		}
+		ensure_equals("(1)", pool.nslabs, 2u);
+
+		// Free the first slab entirely, and the second one partially.
+		buffers[0] = mbuf();
+		buffers[1] = mbuf();
+		buffers[2] = mbuf();
+		ensure_equals("(2)", pool.nfree_mbuf_blockq, 3u);
+
+		ensure_equals("(3)", mbuf_pool_compact(&pool), 2u);
+		ensure_equals("(4)", pool.nslabs, 1u);
+		ensure_equals("(5)", pool.nreclaimed_slabs, 1u);
+		ensure_equals("(6)", pool.nfree_mbuf_blockq, 1u);
+		ensure_equals("(7)", pool.nactive_mbuf_blockq, 1u);
+
+		buffers[3] = mbuf();
+		ensure_equals("(8)", mbuf_pool_compact(&pool), 2u);
+		ensure_equals("(9)", pool.nslabs, 0u);
+		ensure_equals("(10)", pool.nfree_mbuf_blockq, 0u);
+
+		buffers[0] = mbuf_get(&pool);
+		ensure_equals("(11)", pool.nslabs, 1u);
+	}
+
+	TEST_METHOD(42) {
+		set_test_name("With huge pages enabled, slabs are aligned to the huge page size");
+		mbuf_pool_enable_slabs(&pool, DEFAULT_MBUF_SLAB_SIZE, true);
+
+		mbuf buffer(mbuf_get(&pool));
+		ensure_equals("(1)", pool.nslabs, 1u);
+		ensure_equals("(2)", (uintptr_t) buffer.mbuf_block->start % DEFAULT_MBUF_SLAB_SIZE, 0u);
+		memset(buffer.start, 'x', buffer.size());
+	}
+
+	TEST_METHOD(50) {
+		set_test_name("mbuf_pool_for_size() picks the smallest size class that fits");
+
+		ensure("(1)", mbuf_pool_for_size(&pool, 1) == &pool);
+		ensure("(2)", mbuf_pool_for_size(&pool, 1024 * 1024) == &pool);
+
+		addSizeClasses();
+		ensure("(3)", mbuf_pool_for_size(&pool, 0) == &smallPool);
+		ensure("(4)", mbuf_pool_for_size(&pool, mbuf_pool_data_size(&smallPool)) == &smallPool);
+		ensure("(5)", mbuf_pool_for_size(&pool, mbuf_pool_data_size(&smallPool) + 1) == &pool);
+		ensure("(6)", mbuf_pool_for_size(&pool, mbuf_pool_data_size(&pool)) == &pool);
+		ensure("(7)", mbuf_pool_for_size(&pool, mbuf_pool_data_size(&pool) + 1) == &largePool);
+		ensure("(8)", mbuf_pool_for_size(&pool, 1024 * 1024) == &largePool);
+	}
+
+	TEST_METHOD(51) {
+		set_test_name("mbuf_get_with_size() takes mbuf_blocks from the best fitting "
+			"size class and returns them there");
+		addSizeClasses();
+
+		mbuf small(mbuf_get_with_size(&pool, 100));
+		mbuf large(mbuf_get_with_size(&pool, DEFAULT_MBUF_CHUNK_SIZE * 2));
+		ensure("(1)", small.mbuf_block->pool == &smallPool);
+		ensure_equals("(2)", small.size(), 100u);
+		ensure("(3)", large.mbuf_block->pool == &largePool);
+		ensure_equals("(4)", large.size(), DEFAULT_MBUF_CHUNK_SIZE * 2u);
+		ensure_equals("(5)", pool.nactive_mbuf_blockq, 0u);
+		ensure_equals("(6)", smallPool.nactive_mbuf_blockq, 1u);
+		ensure_equals("(7)", largePool.nactive_mbuf_blockq, 1u);
+
+		small = mbuf();
+		large = mbuf();
+		ensure_equals("(8)", smallPool.nfree_mbuf_blockq, 1u);
+		ensure_equals("(9)", largePool.nfree_mbuf_blockq, 1u);
+		ensure_equals("(10)", pool.nfree_mbuf_blockq, 0u);
+
+		mbuf huge(mbuf_get_with_size(&pool, 1024 * 1024));
+		ensure_equals("(11)", huge.size(), 1024u * 1024u);
+		memset(huge.start, 'x', huge.size());
+	}
 }
@@ -439,4 +439,65 @@ namespace tut {
 		ensure("psg_reset_pool fails",
 			!psg_reset_pool(pool, PSG_DEFAULT_POOL_SIZE));
 	}
+
+	TEST_METHOD(30) {
+		set_test_name("psg_recycle_pool() frees all but the first data struct"
+			" and resets it for reuse");
+		pool = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
+
+		void *origLast1 = pool->data.last;
+		while (pool->current == pool) {
+			psg_palloc(pool, sizeof(double));
+		}
+		volatile char *largebuf;
+		TEST_LARGE_ALLOCATION();
+		psg_recycle_pool(pool, PSG_DEFAULT_POOL_SIZE);
+
+		ensure_equals<void *>("pool->data.last is correctly reset",
+			pool->data.last, origLast1);
+		ensure_equals("pool->data.failed is 0",
+			pool->data.failed, 0u);
+		ensure_equals<void *>("Only one pool data struct is allocated",
+			pool->data.next, NULL);
+		ensure_equals<void *>("pool->current points to the first pool data struct",
+			pool->current, pool);
+		ensure_equals<void *>("Nothing is allocated through the large list",
+			pool->large, NULL);
+
+		TEST_BASIC_ALLOCATIONS();
+		TEST_LARGE_ALLOCATION();
+	}
+
+	TEST_METHOD(31) {
+		set_test_name("psg_pool_get_usage() reports current usage, and"
+			" psg_recycle_pool() keeps high-water marks");
+		pool = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
+		psg_pool_usage_t usage;
+
+		psg_pool_get_usage(pool, &usage);
+		ensure_equals("(1)", usage.used, 0u);
+		ensure_equals("(2)", usage.nblocks, 1u);
+		ensure_equals("(3)", usage.nlarge, 0u);
+
+		psg_pnalloc(pool, 100);
+		psg_pnalloc(pool, PSG_MAX_ALLOC_FROM_POOL + 1);
+		psg_pool_get_usage(pool, &usage);
+		ensure("(4)", usage.used >= 100u);
+		ensure_equals("(5)", usage.nblocks, 1u);
+		ensure_equals("(6)", usage.nlarge, 1u);
+
+		while (pool->data.next == NULL) {
+			psg_pnalloc(pool, 32);
+		}
+		psg_pool_get_usage(pool, &usage);
+		ensure_equals("(7)", usage.nblocks, 2u);
+
+		psg_recycle_pool(pool, PSG_DEFAULT_POOL_SIZE);
+		psg_pnalloc(pool, 10);
+		psg_recycle_pool(pool, PSG_DEFAULT_POOL_SIZE);
+		ensure_equals("(8)", pool->nrecycles, 2u);
+		ensure("(9)", pool->peak_used > PSG_DEFAULT_POOL_SIZE - sizeof(psg_pool_t) - 32);
+		ensure_equals("(10)", pool->peak_blocks, 2u);
+		ensure_equals("(11)", pool->peak_large, 1u);
+	}
 }
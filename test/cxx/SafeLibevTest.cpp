@@ -0,0 +1,233 @@
+#include <TestSupport.h>
+#include <BackgroundEventLoop.h>
+#include <SafeLibev.h>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace Passenger;
+using namespace std;
+
+namespace tut {
+	/**
+	 * The mutex-and-vector command queue that SafeLibev used before it
+	 * switched to a lock-free queue. Only used for benchmarking.
+	 */
+	struct LockedCommandQueue {
+		typedef boost::function<void ()> Callback;
+
+		struct ev_loop *loop;
+		ev_async async;
+		boost::mutex syncher;
+		vector<Callback> commands;
+
+		static void asyncHandler(EV_P_ ev_async *w, int revents) {
+			LockedCommandQueue *self = (LockedCommandQueue *) w->data;
+			boost::unique_lock<boost::mutex> l(self->syncher);
+			vector<Callback> commands = self->commands;
+			self->commands.clear();
+			l.unlock();
+
+			vector<Callback>::const_iterator it, end = commands.end();
+			for (it = commands.begin(); it != end; it++) {
+				(*it)();
+			}
+		}
+
+		void start(struct ev_loop *_loop) {
+			loop = _loop;
+			ev_async_init(&async, asyncHandler);
+			async.data = this;
+			ev_async_start(loop, &async);
+		}
+
+		void stop() {
+			ev_async_stop(loop, &async);
+		}
+
+		void runLater(const Callback &callback) {
+			{
+				boost::unique_lock<boost::mutex> l(syncher);
+				commands.push_back(callback);
+			}
+			ev_async_send(loop, &async);
+		}
+	};
+
+	struct SafeLibevTest {
+		static const unsigned int PRODUCERS = 4;
+		static const unsigned int COMMANDS_PER_PRODUCER = 50000;
+
+		BackgroundEventLoop bg;
+		boost::mutex syncher;
+		vector<int> log;
+		boost::atomic<unsigned int> counter;
+
+		SafeLibevTest()
+			: bg(false, false)
+		{
+			counter.store(0);
+			bg.start();
+		}
+
+		~SafeLibevTest() {
+			bg.stop();
+		}
+
+		void append(int value) {
+			boost::lock_guard<boost::mutex> l(syncher);
+			log.push_back(value);
+		}
+
+		void increment() {
+			counter.fetch_add(1, boost::memory_order_relaxed);
+		}
+
+		vector<int> getLog() {
+			boost::lock_guard<boost::mutex> l(syncher);
+			return log;
+		}
+
+		void appendInOrder(unsigned int n) {
+			for (unsigned int i = 0; i < n; i++) {
+				bg.safe->runLater(boost::bind(&SafeLibevTest::append, this, (int) i));
+			}
+		}
+
+		void produceWithSafeLibev() {
+			for (unsigned int i = 0; i < COMMANDS_PER_PRODUCER; i++) {
+				bg.safe->runLater(boost::bind(&SafeLibevTest::increment, this));
+			}
+		}
+
+		void produceWithLockedQueue(LockedCommandQueue *queue) {
+			for (unsigned int i = 0; i < COMMANDS_PER_PRODUCER; i++) {
+				queue->runLater(boost::bind(&SafeLibevTest::increment, this));
+			}
+		}
+
+		unsigned long long runProducers(const boost::function<void ()> &producer) {
+			boost::thread_group threads;
+			unsigned long long startTime = uv_hrtime();
+
+			counter.store(0);
+			for (unsigned int i = 0; i < PRODUCERS; i++) {
+				threads.create_thread(producer);
+			}
+			threads.join_all();
+			EVENTUALLY2(5000, 1,
+				result = counter.load() == PRODUCERS * COMMANDS_PER_PRODUCER;
+			);
+			return (uv_hrtime() - startTime) / 1000;
+		}
+	};
+
+	DEFINE_TEST_GROUP(SafeLibevTest);
+
+	TEST_METHOD(1) {
+		set_test_name("runLater() runs commands in the order in which they were scheduled");
+		appendInOrder(100);
+		EVENTUALLY(5,
+			result = getLog().size() == 100;
+		);
+		vector<int> log = getLog();
+		for (int i = 0; i < 100; i++) {
+			ensure_equals(log[i], i);
+		}
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("runLater() from multiple threads runs every command");
+		runProducers(boost::bind(&SafeLibevTest::produceWithSafeLibev, this));
+		ensure_equals(counter.load(), PRODUCERS * COMMANDS_PER_PRODUCER);
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("cancelCommand() prevents a scheduled command from running");
+		unsigned int id;
+
+		{
+			// Schedule and cancel on the event loop thread so that
+			// the command cannot have run yet.
+			struct Scheduler {
+				static void run(SafeLibevTest *self, unsigned int *id, bool *canceled,
+					bool *canceledTwice)
+				{
+					*id = self->bg.safe->runLater(boost::bind(&SafeLibevTest::append, self, 1));
+					self->bg.safe->runLater(boost::bind(&SafeLibevTest::append, self, 2));
+					*canceled = self->bg.safe->cancelCommand(*id);
+					*canceledTwice = self->bg.safe->cancelCommand(*id);
+				}
+			};
+			bool canceled = false, canceledTwice = true;
+			bg.safe->runSync(boost::bind(Scheduler::run, this, &id, &canceled, &canceledTwice));
+			ensure("(1)", canceled);
+			ensure("(2)", !canceledTwice);
+		}
+		EVENTUALLY(5,
+			result = getLog().size() == 1;
+		);
+		ensure_equals(getLog()[0], 2);
+		ensure("(3)", !bg.safe->cancelCommand(id));
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("Benchmark: lock-free runLater() versus a mutex-protected command vector");
+		LockedCommandQueue queue;
+		bg.safe->runSync(boost::bind(&LockedCommandQueue::start, &queue, bg.libev_loop));
+
+		unsigned long long lockedDuration = runProducers(
+			boost::bind(&SafeLibevTest::produceWithLockedQueue, this, &queue));
+		unsigned long long lockFreeDuration = runProducers(
+			boost::bind(&SafeLibevTest::produceWithSafeLibev, this));
+		bg.safe->runSync(boost::bind(&LockedCommandQueue::stop, &queue));
+
+		if (getenv("PRINT_BENCHMARK_RESULTS") != NULL) {
+			printf("SafeLibev runLater(), %u producers x %u commands: "
+				"mutex+vector %llu usec, lock-free %llu usec\n",
+				PRODUCERS, COMMANDS_PER_PRODUCER,
+				lockedDuration, lockFreeDuration);
+		}
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("Commands are taken from the command pool and returned to it "
+			"after they have run");
+		unsigned int n = SafeLibev::getCommandPoolSize();
+
+		for (unsigned int round = 1; round <= 4; round++) {
+			appendInOrder(n);
+			EVENTUALLY(5,
+				result = getLog().size() == round * n;
+			);
+		}
+		ensure_equals(bg.safe->getCommandPoolMisses(), 0u);
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("Commands are allocated on the heap when the command pool "
+			"is exhausted");
+		unsigned int n = SafeLibev::getCommandPoolSize();
+
+		// Nothing can run while we're on the event loop thread. The command
+		// that runSync() itself uses also takes a slot in the pool, so
+		// the last 11 commands don't fit.
+		bg.safe->runSync(boost::bind(&SafeLibevTest::appendInOrder, this, n + 10));
+		EVENTUALLY(5,
+			result = getLog().size() == n + 10;
+		);
+		vector<int> log = getLog();
+		for (unsigned int i = 0; i < n + 10; i++) {
+			ensure_equals(log[i], (int) i);
+		}
+		ensure_equals("(1)", bg.safe->getCommandPoolMisses(), 11u);
+
+		appendInOrder(n);
+		EVENTUALLY(5,
+			result = getLog().size() == 2 * n + 10;
+		);
+		ensure_equals("(2)", bg.safe->getCommandPoolMisses(), 11u);
+	}
+}
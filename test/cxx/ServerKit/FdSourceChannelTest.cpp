@@ -0,0 +1,306 @@
+#include <TestSupport.h>
+#include <boost/thread.hpp>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <uv.h>
+#include <BackgroundEventLoop.h>
+#include <Constants.h>
+#include <LoggingKit/LoggingKit.h>
+#include <ServerKit/FdSourceChannel.h>
+#include <Utils/IOUtils.h>
+
+using namespace Passenger;
+using namespace Passenger::ServerKit;
+using namespace Passenger::MemoryKit;
+using namespace std;
+
+namespace tut {
+	struct ServerKit_FdSourceChannelTest: public ServerKit::Hooks {
+		BackgroundEventLoop bg;
+		ServerKit::Schema skSchema;
+		ServerKit::Context context;
+		FdSourceChannel channel;
+		SocketPair sockets;
+		boost::mutex syncher;
+		string received;
+		unsigned int callbacks;
+		unsigned int lastBufferSize;
+		struct mbuf_pool *lastBufferPool;
+		boost::uint64_t sizeHint;
+		bool consumeLater;
+		bool eof;
+
+		ServerKit_FdSourceChannelTest()
+			: bg(false, true),
+			  context(skSchema, createContextConfig()),
+			  callbacks(0),
+			  lastBufferSize(0),
+			  lastBufferPool(NULL),
+			  sizeHint(0),
+			  consumeLater(false),
+			  eof(false)
+		{
+			context.libev = bg.safe;
+			context.libuv = bg.libuv_loop;
+			context.initialize();
+			channel.setContext(&context);
+			channel.setDataCallback(dataCallback);
+			channel.setHooks(this);
+			Hooks::impl = NULL;
+			Hooks::userData = NULL;
+			bg.start();
+		}
+
+		~ServerKit_FdSourceChannelTest() {
+			bg.safe->runSync(boost::bind(&ServerKit_FdSourceChannelTest::deinitializeChannel,
+				this));
+			bg.stop();
+			LoggingKit::setLevel(LoggingKit::Level(DEFAULT_LOG_LEVEL));
+		}
+
+		static Json::Value createContextConfig() {
+			Json::Value config;
+			config["mbuf_block_size_classes"] = true;
+			return config;
+		}
+
+		void setReadvBuffers(unsigned int count) {
+			Json::Value config;
+			vector<ConfigKit::Error> errors;
+			config["fd_source_channel_readv_buffers"] = count;
+			ensure(context.configure(config, errors));
+		}
+
+		void startReading() {
+			sockets = createUnixSocketPair(__FILE__, __LINE__);
+			setNonBlocking(sockets.second);
+			bg.safe->runSync(boost::bind(&ServerKit_FdSourceChannelTest::_startReading,
+				this));
+		}
+
+		void _startReading() {
+			channel.reinitialize(sockets.second);
+			channel.setSizeHint(sizeHint);
+			channel.startReadingInNextTick();
+		}
+
+		void deinitializeChannel() {
+			channel.deinitialize();
+		}
+
+		void restart() {
+			bg.safe->runSync(boost::bind(&ServerKit_FdSourceChannelTest::deinitializeChannel,
+				this));
+			boost::lock_guard<boost::mutex> l(syncher);
+			received.clear();
+			callbacks = 0;
+			lastBufferSize = 0;
+			eof = false;
+		}
+
+		static Channel::Result dataCallback(Channel *_channel, const mbuf &buffer, int errcode) {
+			FdSourceChannel *channel = reinterpret_cast<FdSourceChannel *>(_channel);
+			ServerKit_FdSourceChannelTest *self = (ServerKit_FdSourceChannelTest *)
+				channel->getHooks();
+			boost::lock_guard<boost::mutex> l(self->syncher);
+			self->callbacks++;
+			if (errcode != 0 || buffer.empty()) {
+				self->eof = true;
+				return Channel::Result(0, true);
+			} else {
+				self->received.append(buffer.start, buffer.size());
+				self->lastBufferSize = buffer.size();
+				self->lastBufferPool = buffer.mbuf_block->pool;
+				if (self->consumeLater) {
+					return Channel::Result(-1, false);
+				} else {
+					return Channel::Result(buffer.size(), false);
+				}
+			}
+		}
+
+		void channelConsumed(unsigned int size) {
+			bg.safe->runSync(boost::bind(&ServerKit_FdSourceChannelTest::_channelConsumed,
+				this, size));
+		}
+
+		void _channelConsumed(unsigned int size) {
+			channel.consumed(size, false);
+		}
+
+		Channel::State getChannelState() {
+			Channel::State result;
+			bg.safe->runSync(boost::bind(&ServerKit_FdSourceChannelTest::_getChannelState,
+				this, &result));
+			return result;
+		}
+
+		void _getChannelState(Channel::State *result) {
+			*result = channel.getState();
+		}
+
+		string makeData(size_t size) {
+			string data;
+			data.reserve(size);
+			for (size_t i = 0; i < size; i++) {
+				data.append(1, (char) ('a' + i % 26));
+			}
+			return data;
+		}
+
+		static void writeAndClose(int fd, size_t total) {
+			char buf[1024 * 64];
+			size_t written = 0;
+
+			memset(buf, 'x', sizeof(buf));
+			while (written < total) {
+				ssize_t ret = write(fd, buf, std::min(sizeof(buf), total - written));
+				if (ret == -1) {
+					int e = errno;
+					throw SystemException("write() failed", e);
+				}
+				written += ret;
+			}
+			close(fd);
+		}
+
+		/**
+		 * Streams `total` bytes through the channel and returns how long
+		 * that took, in microseconds.
+		 */
+		unsigned long long measureThroughput(size_t total) {
+			restart();
+			startReading();
+
+			unsigned long long startTime = uv_hrtime();
+			boost::thread writer(writeAndClose, sockets.first.detach(), total);
+			EVENTUALLY(30,
+				boost::lock_guard<boost::mutex> l(syncher);
+				result = eof;
+			);
+			unsigned long long duration = (uv_hrtime() - startTime) / 1000;
+			writer.join();
+
+			boost::lock_guard<boost::mutex> l(syncher);
+			ensure_equals(received.size(), total);
+			return duration;
+		}
+	};
+
+	DEFINE_TEST_GROUP(ServerKit_FdSourceChannelTest);
+
+
+	/***** Reading *****/
+
+	TEST_METHOD(1) {
+		set_test_name("It feeds the data that it reads, followed by EOF");
+
+		startReading();
+		writeExact(sockets.first, "hello");
+		sockets.first.close();
+		EVENTUALLY(5,
+			boost::lock_guard<boost::mutex> l(syncher);
+			result = eof;
+		);
+		ensure_equals(received, "hello");
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("With readv buffers, data larger than a single buffer is fed "
+			"in order as multiple buffers");
+
+		string data = makeData(context.mbuf_pool.mbuf_block_chunk_size * 3 + 10);
+		setReadvBuffers(4);
+		startReading();
+		writeExact(sockets.first, data);
+		sockets.first.close();
+		EVENTUALLY(5,
+			boost::lock_guard<boost::mutex> l(syncher);
+			result = eof;
+		);
+		ensure(received == data);
+		ensure("(1)", callbacks >= 5);
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("With readv buffers, buffers that the data callback cannot accept "
+			"yet are fed after it is done consuming");
+
+		string data = makeData(context.mbuf_pool.mbuf_block_chunk_size * 3 + 10);
+		setReadvBuffers(4);
+		consumeLater = true;
+		startReading();
+		writeExact(sockets.first, data);
+		sockets.first.close();
+
+		while (true) {
+			EVENTUALLY(5,
+				Channel::State state = getChannelState();
+				boost::lock_guard<boost::mutex> l(syncher);
+				result = eof || state == Channel::WAITING_FOR_CALLBACK;
+			);
+			unsigned int size;
+			{
+				boost::lock_guard<boost::mutex> l(syncher);
+				if (eof) {
+					break;
+				}
+				size = lastBufferSize;
+			}
+			channelConsumed(size);
+		}
+		ensure(received == data);
+	}
+
+
+	TEST_METHOD(4) {
+		set_test_name("With a size hint, it reads into buffers from the best fitting "
+			"mbuf size class");
+
+		startReading();
+		writeExact(sockets.first, "hello");
+		EVENTUALLY(5,
+			boost::lock_guard<boost::mutex> l(syncher);
+			result = callbacks == 1;
+		);
+		ensure("(1)", lastBufferPool == &context.mbuf_pool);
+
+		restart();
+		sizeHint = 5;
+		startReading();
+		writeExact(sockets.first, "hello");
+		EVENTUALLY(5,
+			boost::lock_guard<boost::mutex> l(syncher);
+			result = callbacks == 1;
+		);
+		ensure("(2)", lastBufferPool == mbuf_pool_for_size(&context.mbuf_pool, 5));
+		ensure("(3)", lastBufferPool != &context.mbuf_pool);
+		ensure_equals("(4)", lastBufferPool->mbuf_block_chunk_size, 512u);
+	}
+
+
+	/***** Benchmark *****/
+
+	TEST_METHOD(10) {
+		set_test_name("Benchmark: throughput with a single read() per event "
+			"versus readv() into multiple buffers");
+
+		const size_t TOTAL = 1024 * 1024 * 32;
+		unsigned long long readDuration, readvDuration;
+
+		readDuration = measureThroughput(TOTAL);
+		setReadvBuffers(FdSourceChannel::MAX_READV_BUFFERS);
+		readvDuration = measureThroughput(TOTAL);
+
+		if (getenv("PRINT_BENCHMARK_RESULTS") != NULL) {
+			printf("Reading %u MB: read() %llu usec (%.1f MB/s), "
+				"readv() with %u buffers %llu usec (%.1f MB/s)\n",
+				(unsigned int) (TOTAL / 1024 / 1024),
+				readDuration, TOTAL / (double) readDuration,
+				FdSourceChannel::MAX_READV_BUFFERS,
+				readvDuration, TOTAL / (double) readvDuration);
+		}
+	}
+}
@@ -213,6 +213,57 @@ namespace tut {
 			channel.start();
 		}
 
+		void initializeBufferFilePool(unsigned int size) {
+			string error;
+			if (!context.bufferFilePool.initialize(bg.libuv_loop, getSystemTempDir(),
+				size, error))
+			{
+				P_BUG("Unable to initialize buffer file pool: " << error);
+			}
+		}
+
+		Json::Value inspectBufferFilePool() {
+			Json::Value result;
+			bg.safe->runSync(boost::bind(&ServerKit_FileBufferedChannelTest::_inspectBufferFilePool,
+				this, &result));
+			return result;
+		}
+
+		void _inspectBufferFilePool(Json::Value *result) {
+			*result = context.bufferFilePool.inspectStateAsJson();
+		}
+
+		/**
+		 * Destroys a buffer file pool while one of its files is still being
+		 * recycled, and fills the pool's memory with garbage so that any later
+		 * access to it is noticed. The caller must free `*storage`.
+		 */
+		void _destroyBufferFilePoolWhileRecycling(void **storage, int *fd) {
+			BufferFilePool *pool;
+			string error;
+
+			*storage = malloc(sizeof(BufferFilePool));
+			pool = new (*storage) BufferFilePool();
+			if (!pool->initialize(bg.libuv_loop, getSystemTempDir(), 1, error)) {
+				P_BUG("Unable to initialize buffer file pool: " << error);
+			}
+			*fd = pool->checkout();
+			pool->checkin(*fd);
+			pool->~BufferFilePool();
+			memset(*storage, 0xff, sizeof(BufferFilePool));
+		}
+
+		boost::uint64_t getContextMemoryUsage() {
+			boost::uint64_t result;
+			bg.safe->runSync(boost::bind(&ServerKit_FileBufferedChannelTest::_getContextMemoryUsage,
+				this, &result));
+			return result;
+		}
+
+		void _getContextMemoryUsage(boost::uint64_t *result) {
+			*result = context.fileBufferedChannelMemoryUsage;
+		}
+
 		void setChannelDataCallback(FileBufferedChannel::DataCallback callback) {
 			bg.safe->runLater(boost::bind(&ServerKit_FileBufferedChannelTest::_setChannelDataCallback,
 				this, callback));
@@ -1004,6 +1055,114 @@ namespace tut {
 	}
 
 
+	/***** Buffer file pool *****/
+
+	TEST_METHOD(42) {
+		set_test_name("When switching to in-file mode, it uses a file from the buffer "
+			"file pool if available, and returns it to the pool afterwards");
+
+		#if defined(__linux__) && defined(O_TMPFILE)
+			Json::Value config;
+			vector<ConfigKit::Error> errors;
+			config["file_buffered_channel_threshold"] = 1;
+			ensure(context.configure(config, errors));
+			initializeBufferFilePool(1);
+
+			toConsume = -1;
+			startLoop();
+
+			feedChannel("hello");
+			feedChannel("world!");
+			EVENTUALLY(5,
+				result = getChannelMode() == FileBufferedChannel::IN_FILE_MODE;
+			);
+			EVENTUALLY(5,
+				result = getChannelWriterState() == FileBufferedChannel::WS_INACTIVE;
+			);
+			Json::Value doc = inspectBufferFilePool();
+			ensure_equals("(1)", doc["hits"].asUInt(), 1u);
+			ensure_equals("(2)", doc["available"].asUInt(), 0u);
+
+			channelConsumed(sizeof("hello") - 1, false);
+			EVENTUALLY(5,
+				LOCK();
+				result = counter == 2
+					&& getChannelState() == Channel::WAITING_FOR_CALLBACK;
+			);
+			channelConsumed(sizeof("world!") - 1, false);
+			EVENTUALLY(5,
+				result = getChannelMode() == FileBufferedChannel::IN_MEMORY_MODE;
+			);
+			EVENTUALLY(5,
+				result = inspectBufferFilePool()["available"].asUInt() == 1;
+			);
+			{
+				LOCK();
+				ensure_equals("(3)", log,
+					"Data: hello\n"
+					"Data: world!\n");
+			}
+			doc = inspectBufferFilePool();
+			ensure_equals("(4)", doc["size"].asUInt(), 1u);
+			ensure_equals("(5)", doc["recycled"].asUInt(), 1u);
+		#endif
+	}
+
+	TEST_METHOD(43) {
+		set_test_name("If the buffer file pool is empty, it creates a file");
+
+		#if defined(__linux__) && defined(O_TMPFILE)
+			Json::Value config;
+			vector<ConfigKit::Error> errors;
+			config["file_buffered_channel_threshold"] = 1;
+			ensure(context.configure(config, errors));
+			initializeBufferFilePool(1);
+			int fd = context.bufferFilePool.checkout();
+
+			toConsume = -1;
+			startLoop();
+
+			feedChannel("hello");
+			feedChannel("world!");
+			EVENTUALLY(5,
+				result = getChannelMode() == FileBufferedChannel::IN_FILE_MODE;
+			);
+			EVENTUALLY(5,
+				result = getChannelWriterState() == FileBufferedChannel::WS_INACTIVE;
+			);
+			ensure_equals(inspectBufferFilePool()["misses"].asUInt(), 1u);
+
+			channelConsumed(sizeof("hello") - 1, false);
+			EVENTUALLY(5,
+				LOCK();
+				result = log ==
+					"Data: hello\n"
+					"Data: world!\n";
+			);
+			close(fd);
+		#endif
+	}
+
+	TEST_METHOD(44) {
+		set_test_name("Destroying the buffer file pool while a file is being recycled "
+			"closes that file once recycling is done, without touching the pool");
+
+		#if defined(__linux__) && defined(O_TMPFILE)
+			void *storage;
+			int fd;
+
+			startLoop();
+			bg.safe->runSync(boost::bind(
+				&ServerKit_FileBufferedChannelTest::_destroyBufferFilePoolWhileRecycling,
+				this, &storage, &fd));
+			EVENTUALLY(5,
+				result = fcntl(fd, F_GETFD) == -1 && errno == EBADF;
+			);
+			free(storage);
+		#endif
+	}
+
+
 	/***** When stopped *****/
 
 	TEST_METHOD(45) {
@@ -1080,4 +1239,112 @@ namespace tut {
 			ensure_equals(counter, 2u);
 		}
 	}
+
+
+	/***** Memory budget *****/
+
+	TEST_METHOD(50) {
+		set_test_name("With a memory budget, it keeps buffering in memory past the threshold "
+			"for as long as the context's total stays within the budget");
+
+		Json::Value config;
+		vector<ConfigKit::Error> errors;
+		config["file_buffered_channel_threshold"] = 1;
+		config["file_buffered_channel_memory_budget"] = 1024;
+		ensure(context.configure(config, errors));
+
+		toConsume = -1;
+		startLoop();
+
+		feedChannel("hello");
+		feedChannel("world!");
+		feedChannel("again");
+		SHOULD_NEVER_HAPPEN(100,
+			result = getChannelMode() != FileBufferedChannel::IN_MEMORY_MODE;
+		);
+		ensure_equals("(1)", getChannelBytesBuffered(), 11u);
+		ensure_equals("(2)", getContextMemoryUsage(), 11u);
+
+		channelConsumed(sizeof("hello") - 1, false);
+		EVENTUALLY(5,
+			LOCK();
+			result = counter == 2;
+		);
+		channelConsumed(sizeof("world!") - 1, false);
+		EVENTUALLY(5,
+			LOCK();
+			result = counter == 3;
+		);
+		channelConsumed(sizeof("again") - 1, false);
+		EVENTUALLY(5,
+			result = getContextMemoryUsage() == 0;
+		);
+	}
+
+	TEST_METHOD(51) {
+		set_test_name("With a memory budget, it switches to in-file mode once the "
+			"context's total exceeds the budget");
+
+		Json::Value config;
+		vector<ConfigKit::Error> errors;
+		config["file_buffered_channel_threshold"] = 1;
+		config["file_buffered_channel_memory_budget"] = 8;
+		ensure(context.configure(config, errors));
+
+		toConsume = -1;
+		startLoop();
+
+		feedChannel("hello");
+		feedChannel("world!");
+		SHOULD_NEVER_HAPPEN(100,
+			result = getChannelMode() != FileBufferedChannel::IN_MEMORY_MODE;
+		);
+		feedChannel("again");
+		EVENTUALLY(5,
+			result = getChannelMode() == FileBufferedChannel::IN_FILE_MODE;
+		);
+		EVENTUALLY(5,
+			result = getChannelWriterState() == FileBufferedChannel::WS_INACTIVE;
+		);
+		ensure_equals(getContextMemoryUsage(), 0u);
+
+		channelConsumed(sizeof("hello") - 1, false);
+		EVENTUALLY(5,
+			LOCK();
+			result = log ==
+				"Data: hello\n"
+				"Data: world!again\n";
+		);
+	}
+
+	TEST_METHOD(52) {
+		set_test_name("With a memory budget, it switches to in-file mode before reaching "
+			"the threshold once the context's total exceeds the budget far enough");
+
+		Json::Value config;
+		vector<ConfigKit::Error> errors;
+		config["file_buffered_channel_threshold"] = 64;
+		config["file_buffered_channel_memory_budget"] = 16;
+		ensure(context.configure(config, errors));
+
+		toConsume = -1;
+		startLoop();
+
+		// The reader picks this one up immediately.
+		feedChannel("hello");
+		// 20 bytes buffered: over the budget, but under 64 * 16 / 20 = 51.
+		feedChannel("aaaaaaaaaaaaaaaaaaaa");
+		SHOULD_NEVER_HAPPEN(100,
+			result = getChannelMode() != FileBufferedChannel::IN_MEMORY_MODE;
+		);
+		// 40 bytes buffered: over 64 * 16 / 40 = 25.
+		feedChannel("bbbbbbbbbbbbbbbbbbbb");
+		EVENTUALLY(5,
+			result = getChannelMode() == FileBufferedChannel::IN_FILE_MODE;
+		);
+		EVENTUALLY(5,
+			result = getChannelWriterState() == FileBufferedChannel::WS_INACTIVE;
+		);
+		ensure_equals(getContextMemoryUsage(), 0u);
+	}
 }
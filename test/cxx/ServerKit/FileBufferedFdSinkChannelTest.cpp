@@ -0,0 +1,153 @@
+#include <TestSupport.h>
+#include <boost/thread.hpp>
+#include <string>
+#include <cerrno>
+#include <unistd.h>
+#include <BackgroundEventLoop.h>
+#include <Constants.h>
+#include <LoggingKit/LoggingKit.h>
+#include <ServerKit/FileBufferedFdSinkChannel.h>
+#include <Utils/IOUtils.h>
+
+using namespace Passenger;
+using namespace Passenger::ServerKit;
+using namespace Passenger::MemoryKit;
+using namespace std;
+
+namespace tut {
+	struct ServerKit_FileBufferedFdSinkChannelTest: public ServerKit::Hooks {
+		BackgroundEventLoop bg;
+		ServerKit::Schema skSchema;
+		ServerKit::Context context;
+		FileBufferedFdSinkChannel channel;
+		SocketPair sockets;
+		string received;
+
+		ServerKit_FileBufferedFdSinkChannelTest()
+			: bg(false, true),
+			  context(skSchema)
+		{
+			context.libev = bg.safe;
+			context.libuv = bg.libuv_loop;
+			context.initialize();
+			channel.setContext(&context);
+			channel.setHooks(this);
+			Hooks::impl = NULL;
+			Hooks::userData = NULL;
+			sockets = createUnixSocketPair(__FILE__, __LINE__);
+			setNonBlocking(sockets.first);
+			setNonBlocking(sockets.second);
+			bg.start();
+			bg.safe->runSync(boost::bind(&ServerKit_FileBufferedFdSinkChannelTest::initializeChannel,
+				this));
+		}
+
+		~ServerKit_FileBufferedFdSinkChannelTest() {
+			bg.safe->runSync(boost::bind(&ServerKit_FileBufferedFdSinkChannelTest::deinitializeChannel,
+				this));
+			bg.stop();
+			LoggingKit::setLevel(LoggingKit::Level(DEFAULT_LOG_LEVEL));
+		}
+
+		void initializeChannel() {
+			channel.reinitialize(sockets.first);
+		}
+
+		void deinitializeChannel() {
+			channel.deinitialize(); // Stop the watcher and cancel next tick callbacks.
+		}
+
+		void feedChannel(const string &data) {
+			bg.safe->runSync(boost::bind(&ServerKit_FileBufferedFdSinkChannelTest::_feedChannel,
+				this, data));
+		}
+
+		void _feedChannel(string data) {
+			assert(data.size() < context.mbuf_pool.mbuf_block_chunk_size);
+			mbuf buf = mbuf_get(&context.mbuf_pool);
+			memcpy(buf.start, data.data(), data.size());
+			buf = mbuf(buf, 0, (unsigned int) data.size());
+			channel.feed(buf);
+		}
+
+		FileBufferedFdSinkChannel::WriteStats getWriteStats() {
+			FileBufferedFdSinkChannel::WriteStats result;
+			bg.safe->runSync(boost::bind(&ServerKit_FileBufferedFdSinkChannelTest::_getWriteStats,
+				this, &result));
+			return result;
+		}
+
+		void _getWriteStats(FileBufferedFdSinkChannel::WriteStats *result) {
+			*result = channel.getWriteStats();
+		}
+
+		unsigned int fillSocketBuffer() {
+			char buf[1024 * 8];
+			unsigned int total = 0;
+			ssize_t ret;
+
+			memset(buf, 'x', sizeof(buf));
+			while (true) {
+				ret = write(sockets.first, buf, sizeof(buf));
+				if (ret == -1) {
+					ensure_equals(errno, EAGAIN);
+					return total;
+				}
+				total += ret;
+			}
+		}
+
+		void readAvailable() {
+			char buf[1024 * 8];
+			ssize_t ret;
+
+			while ((ret = read(sockets.second, buf, sizeof(buf))) > 0) {
+				received.append(buf, ret);
+			}
+		}
+	};
+
+	DEFINE_TEST_GROUP(ServerKit_FileBufferedFdSinkChannelTest);
+
+
+	/***** Writing *****/
+
+	TEST_METHOD(1) {
+		set_test_name("If the file descriptor is writable, a fed buffer is written with a single write()");
+
+		feedChannel("hello");
+		EVENTUALLY(5,
+			readAvailable();
+			result = received == "hello";
+		);
+
+		FileBufferedFdSinkChannel::WriteStats stats = getWriteStats();
+		ensure_equals(stats.syscalls, 1u);
+		ensure_equals(stats.buffers, 1u);
+		ensure_equals(stats.partialWrites, 0u);
+		ensure_equals(stats.bytesWritten, 5u);
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Buffers queued while the file descriptor is not writable are "
+			"written together with a single writev()");
+
+		unsigned int filled = fillSocketBuffer();
+		feedChannel("hello");
+		feedChannel("world");
+		feedChannel("!");
+
+		EVENTUALLY(5,
+			readAvailable();
+			result = received.size() == filled + sizeof("helloworld!") - 1;
+		);
+		ensure_equals(received.substr(filled), "helloworld!");
+
+		FileBufferedFdSinkChannel::WriteStats stats = getWriteStats();
+		// One write() that failed with EAGAIN, then one writev() with all buffers.
+		ensure_equals(stats.syscalls, 2u);
+		ensure_equals(stats.buffers, 4u);
+		ensure_equals(stats.partialWrites, 1u);
+		ensure_equals(stats.bytesWritten, 11u);
+	}
+}
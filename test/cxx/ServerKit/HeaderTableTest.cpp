@@ -1,5 +1,11 @@
 #include <TestSupport.h>
 #include <ServerKit/HeaderTable.h>
+#include <ServerKit/HttpHeaderParser.h>
+#include <Utils/Hasher.h>
+#include <Utils/StrIntUtils.h>
+#include <Utils/SystemTime.h>
+#include <cstdio>
+#include <cstdlib>
 
 using namespace Passenger;
 using namespace Passenger::ServerKit;
@@ -191,4 +197,89 @@ namespace tut {
 
 		ensure_equals<void *>("(3)", table.lookup("Content-Length"), NULL);
 	}
+
+	TEST_METHOD(11) {
+		set_test_name("insert() computes the same hash as HashedStaticString does for the downcased name");
+		table.insert(pool, "X-Forwarded-Proto-With-A-Long-Name", "https");
+		table.insert(pool, "Content-Length", "5");
+		table.insert(pool, "Transfer-Encoding", "chunked");
+
+		ensure_equals("(1)", table.lookupHeader("x-forwarded-proto-with-a-long-name")->hash,
+			HashedStaticString("x-forwarded-proto-with-a-long-name").hash());
+		ensure_equals("(2)", table.lookupHeader(HTTP_CONTENT_LENGTH)->hash,
+			HTTP_CONTENT_LENGTH.hash());
+		ensure_equals("(3)", table.lookupHeader(HTTP_TRANSFER_ENCODING)->hash,
+			HTTP_TRANSFER_ENCODING.hash());
+	}
+
+	TEST_METHOD(12) {
+		set_test_name("Hasher::updateLowerCase() is equivalent to convertLowerCase() followed by update()");
+		string data;
+		for (unsigned int i = 0; i < 256; i++) {
+			data.append(1, (char) i);
+			data.append(1, (char) ('A' + i % 26));
+		}
+
+		for (unsigned int size = 0; size <= data.size(); size += 7) {
+			for (unsigned int offset = 0; offset < 3 && offset <= size; offset++) {
+				StaticString input(data.data() + offset, size - offset);
+				string expected(input.size(), '\0');
+				string actual(input.size(), '\0');
+				Hasher expectedHasher, actualHasher;
+
+				convertLowerCase((const unsigned char *) input.data(),
+					(unsigned char *) &expected[0], input.size());
+				expectedHasher.update(expected.data(), expected.size());
+				actualHasher.updateLowerCase(input.data(), &actual[0], input.size());
+
+				ensure(("(1) size " + toString(size)).c_str(), expected == actual);
+				ensure_equals(("(2) size " + toString(size)).c_str(),
+					actualHasher.finalize(), expectedHasher.finalize());
+			}
+		}
+	}
+
+
+	/***** Benchmark *****/
+
+	TEST_METHOD(20) {
+		set_test_name("Benchmark: downcasing and hashing header names in one pass "
+			"versus two");
+
+		const unsigned int ITERATIONS = 1000000;
+		const StaticString names[] = {
+			"Host", "User-Agent", "Accept-Encoding", "X-Forwarded-For",
+			"Access-Control-Request-Headers"
+		};
+		const unsigned int nnames = sizeof(names) / sizeof(names[0]);
+		char output[64];
+		boost::uint32_t checksum = 0;
+		unsigned long long startTime, twoPassDuration, onePassDuration;
+
+		startTime = SystemTime::getUsec();
+		for (unsigned int i = 0; i < ITERATIONS; i++) {
+			const StaticString &name = names[i % nnames];
+			Hasher hasher;
+			convertLowerCase((const unsigned char *) name.data(),
+				(unsigned char *) output, name.size());
+			hasher.update(output, name.size());
+			checksum += hasher.finalize();
+		}
+		twoPassDuration = SystemTime::getUsec() - startTime;
+
+		startTime = SystemTime::getUsec();
+		for (unsigned int i = 0; i < ITERATIONS; i++) {
+			const StaticString &name = names[i % nnames];
+			Hasher hasher;
+			hasher.updateLowerCase(name.data(), output, name.size());
+			checksum -= hasher.finalize();
+		}
+		onePassDuration = SystemTime::getUsec() - startTime;
+
+		ensure_equals(checksum, 0u);
+		if (getenv("PRINT_BENCHMARK_RESULTS") != NULL) {
+			printf("Downcasing and hashing %u header names: two passes %llu usec, "
+				"one pass %llu usec\n", ITERATIONS, twoPassDuration, onePassDuration);
+		}
+	}
 }
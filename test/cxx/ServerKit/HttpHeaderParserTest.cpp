@@ -0,0 +1,401 @@
+#include <TestSupport.h>
+#include <boost/random.hpp>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <BackgroundEventLoop.h>
+#include <ServerKit/Context.h>
+#include <ServerKit/HttpRequest.h>
+#include <ServerKit/HttpHeaderParser.h>
+#include <Utils/StrIntUtils.h>
+#include <Utils/SystemTime.h>
+
+using namespace Passenger;
+using namespace Passenger::ServerKit;
+using namespace Passenger::MemoryKit;
+using namespace std;
+
+namespace tut {
+	struct ServerKit_HttpHeaderParserTest {
+		BackgroundEventLoop bg;
+		ServerKit::Schema skSchema;
+		ServerKit::Context context;
+		http_parser_scan_level defaultScanLevel;
+		boost::mt19937 random;
+
+		ServerKit_HttpHeaderParserTest()
+			: bg(false, true),
+			  context(skSchema),
+			  defaultScanLevel(http_parser_get_scan_level()),
+			  random(1234)
+		{
+			context.libev = bg.safe;
+			context.libuv = bg.libuv_loop;
+			context.initialize();
+		}
+
+		~ServerKit_HttpHeaderParserTest() {
+			http_parser_set_scan_level(defaultScanLevel);
+		}
+
+		static string lstrToString(const LString *str) {
+			string result;
+			const LString::Part *part = str->start;
+			while (part != NULL) {
+				result.append(part->data, part->size);
+				part = part->next;
+			}
+			return result;
+		}
+
+		static string describeHeaders(const HeaderTable &table) {
+			string result;
+			HeaderTable::ConstIterator it(table);
+			while (*it != NULL) {
+				result.append(cEscapeString(lstrToString(&it->header->origKey)));
+				result.append(" -> ");
+				result.append(cEscapeString(lstrToString(&it->header->key)));
+				result.append(" = ");
+				result.append(cEscapeString(lstrToString(&it->header->val)));
+				result.append(" #" + toString(it->header->hash));
+				if (it->header->key.start != it->header->key.end) {
+					result.append(" (non-contiguous key)");
+				}
+				if (it->header->hash != HashedStaticString(
+					lstrToString(&it->header->key)).hash())
+				{
+					result.append(" (wrong hash)");
+				}
+				result.append("\n");
+				it.next();
+			}
+			return result;
+		}
+
+		static void deinitializeHeaders(HeaderTable &table) {
+			HeaderTable::Iterator it(table);
+			while (*it != NULL) {
+				psg_lstr_deinit(&it->header->key);
+				psg_lstr_deinit(&it->header->origKey);
+				psg_lstr_deinit(&it->header->val);
+				it.next();
+			}
+		}
+
+		/**
+		 * Feeds `data` to a request header parser in chunks of the given sizes
+		 * (the last chunk size is repeated as necessary) and returns a description
+		 * of everything that the parser produced, unless `describe` is false.
+		 */
+		string parse(const string &data, const vector<size_t> &chunkSizes,
+			bool describe = true)
+		{
+			psg_pool_t *pool = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
+			HttpHeaderParserState state;
+			BaseHttpRequest req;
+			size_t pos = 0, consumed = 0;
+			unsigned int i = 0;
+
+			req.httpState = BaseHttpRequest::PARSING_HEADERS;
+			req.bodyType = BaseHttpRequest::RBT_NO_BODY;
+			req.method = HTTP_GET;
+			req.wantKeepAlive = false;
+			req.pool = pool;
+			req.queryStringIndex = -1;
+
+			HttpHeaderParser<BaseHttpRequest> parser(&context, &state, &req, pool);
+			parser.initialize();
+			while (pos < data.size() && req.httpState == BaseHttpRequest::PARSING_HEADERS) {
+				size_t size = std::min(chunkSizes[std::min<size_t>(i, chunkSizes.size() - 1)],
+					data.size() - pos);
+				mbuf buffer(mbuf_get_with_size(&context.mbuf_pool, size));
+				memcpy(buffer.start, data.data() + pos, size);
+				consumed += parser.feed(buffer);
+				pos += size;
+				i++;
+			}
+
+			string result;
+			if (describe) {
+				result = describeResult(req, state, consumed);
+			}
+
+			psg_lstr_deinit(&req.path);
+			deinitializeHeaders(req.headers);
+			deinitializeHeaders(req.secureHeaders);
+			psg_destroy_pool(pool);
+			return result;
+		}
+
+		static string describeResult(const BaseHttpRequest &req,
+			const HttpHeaderParserState &state, size_t consumed)
+		{
+			string result = "state=" + string(req.getHttpStateString())
+				+ " consumed=" + toString(consumed)
+				+ " http_errno=" + toString((int) HTTP_PARSER_ERRNO(&state.parser))
+				+ " nread=" + toString(state.parser.nread) + "\n";
+			if (req.httpState == BaseHttpRequest::ERROR) {
+				result.append("error=" + toString(req.aux.parseError) + "\n");
+			} else if (req.httpState != BaseHttpRequest::PARSING_HEADERS) {
+				result.append("method=" + toString((int) req.method)
+					+ " version=" + toString((int) req.httpMajor)
+					+ "." + toString((int) req.httpMinor)
+					+ " keepalive=" + toString((int) req.wantKeepAlive)
+					+ " body=" + req.getBodyTypeString()
+					+ " content_length=" + toString(req.aux.bodyInfo.contentLength)
+					+ " query_string_index=" + toString(req.queryStringIndex) + "\n");
+			}
+			result.append("path=" + cEscapeString(lstrToString(&req.path)) + "\n");
+			result.append(describeHeaders(req.headers));
+			result.append("secure:\n");
+			result.append(describeHeaders(req.secureHeaders));
+			return result;
+		}
+
+		/**
+		 * Parses `data` at every available scan level and checks that all
+		 * of them produce the same result as byte-at-a-time parsing.
+		 */
+		void checkAllScanLevels(const string &data, const vector<size_t> &chunkSizes) {
+			http_parser_set_scan_level(HTTP_PARSER_SCAN_BYTEWISE);
+			string expected = parse(data, chunkSizes);
+
+			for (int level = HTTP_PARSER_SCAN_SCALAR; level <= HTTP_PARSER_SCAN_AVX2; level++) {
+				if (http_parser_set_scan_level((http_parser_scan_level) level) != level) {
+					break;
+				}
+				string actual = parse(data, chunkSizes);
+				if (actual != expected) {
+					fail(("Scan level " + toString(level) + " differs from bytewise parsing.\n"
+						"Input: " + cEscapeString(data) + "\n"
+						"Expected:\n" + expected + "Actual:\n" + actual).c_str());
+				}
+			}
+		}
+
+		unsigned int randomNumber(unsigned int max) {
+			return boost::uniform_int<unsigned int>(0, max)(random);
+		}
+
+		string randomString(const char *alphabet, unsigned int maxSize) {
+			unsigned int size = randomNumber(maxSize);
+			unsigned int alphabetSize = strlen(alphabet);
+			string result;
+			for (unsigned int i = 0; i < size; i++) {
+				result.append(1, alphabet[randomNumber(alphabetSize - 1)]);
+			}
+			return result;
+		}
+
+		string randomRequest() {
+			static const char *pathChars = "abcdefghijklmnopqrstuvwxyz0123456789/-_.~%+=&";
+			static const char *fieldChars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+			static const char *valueChars = "abcdefghijklmnopqrstuvwxyz ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+				"0123456789;,=/\"()<>@:?{}[]\t";
+			static const char *methods[] = { "GET", "POST", "HEAD", "PUT", "DELETE" };
+			static const char *knownHeaders[] = {
+				"Connection: keep-alive", "Connection: close", "Connection: upgrade",
+				"Content-Length: 0", "Content-Length: 12", "Transfer-Encoding: chunked",
+				"Upgrade: websocket", "Host: foo.com", "!~: ", "!~Foo: bar"
+			};
+			string result = methods[randomNumber(4)];
+
+			result.append(" /" + randomString(pathChars, 80));
+			if (randomNumber(1) == 0) {
+				result.append("?" + randomString(pathChars, 120));
+				if (randomNumber(3) == 0) {
+					result.append("?" + randomString(pathChars, 20));
+				}
+			}
+			if (randomNumber(7) == 0) {
+				result.append("#" + randomString(pathChars, 10));
+			}
+			result.append(randomNumber(7) == 0 ? " HTTP/1.0\r\n" : " HTTP/1.1\r\n");
+
+			unsigned int nheaders = randomNumber(12);
+			for (unsigned int i = 0; i < nheaders; i++) {
+				if (randomNumber(3) == 0) {
+					result.append(knownHeaders[randomNumber(
+						sizeof(knownHeaders) / sizeof(knownHeaders[0]) - 1)]);
+				} else {
+					result.append("X-" + randomString(fieldChars, 40) + ": "
+						+ randomString(valueChars, 200));
+				}
+				result.append(randomNumber(15) == 0 ? "\n" : "\r\n");
+			}
+			result.append("\r\n");
+			if (randomNumber(3) == 0) {
+				result.append("body data");
+			}
+			return result;
+		}
+
+		string mutate(string data) {
+			unsigned int nmutations = randomNumber(3) + 1;
+			for (unsigned int i = 0; i < nmutations && !data.empty(); i++) {
+				unsigned int pos = randomNumber(data.size() - 1);
+				char ch = (char) randomNumber(255);
+				switch (randomNumber(2)) {
+				case 0:
+					data[pos] = ch;
+					break;
+				case 1:
+					data.insert(pos, 1, ch);
+					break;
+				default:
+					data.erase(pos, 1);
+					break;
+				}
+			}
+			return data;
+		}
+
+		vector<size_t> randomChunkSizes() {
+			vector<size_t> result;
+			unsigned int nchunks = randomNumber(4) + 1;
+			for (unsigned int i = 0; i < nchunks; i++) {
+				result.push_back(randomNumber(randomNumber(1) == 0 ? 16 : 1024) + 1);
+			}
+			return result;
+		}
+
+		vector<size_t> wholeBuffer() {
+			return vector<size_t>(1, 1024 * 1024);
+		}
+	};
+
+	DEFINE_TEST_GROUP(ServerKit_HttpHeaderParserTest);
+
+	TEST_METHOD(1) {
+		set_test_name("A request parses the same at every scan level");
+
+		string data = "GET /foo/bar.html?hello=world&x=y HTTP/1.1\r\n"
+			"Host: www.example.com\r\n"
+			"User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 "
+				"(KHTML, like Gecko) Chrome/90.0.4430.93 Safari/537.36\r\n"
+			"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+			"Connection: keep-alive\r\n"
+			"Content-Length: 5\r\n"
+			"\r\n"
+			"hello";
+		checkAllScanLevels(data, wholeBuffer());
+		checkAllScanLevels(data, vector<size_t>(1, 1));
+		checkAllScanLevels(data, vector<size_t>(1, 7));
+
+		http_parser_set_scan_level(defaultScanLevel);
+		string result = parse(data, wholeBuffer());
+		ensure(result, containsSubstring(result, "state=PARSING_BODY"));
+		ensure(result, containsSubstring(result, "path=/foo/bar.html?hello=world&x=y\n"));
+		ensure(result, containsSubstring(result, "Host -> host = www.example.com"));
+		ensure(result, containsSubstring(result, "content_length=5"));
+		ensure(result, containsSubstring(result, "query_string_index=13"));
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Random requests, split at random places, parse the same "
+			"at every scan level");
+
+		for (unsigned int i = 0; i < 2000; i++) {
+			string data = randomRequest();
+			checkAllScanLevels(data, wholeBuffer());
+			checkAllScanLevels(data, randomChunkSizes());
+		}
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Randomly corrupted requests, split at random places, parse "
+			"the same at every scan level");
+
+		for (unsigned int i = 0; i < 5000; i++) {
+			string data = mutate(randomRequest());
+			checkAllScanLevels(data, wholeBuffer());
+			checkAllScanLevels(data, randomChunkSizes());
+		}
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("Headers that exceed the maximum header size are rejected "
+			"at the same position at every scan level");
+
+		string longPath = "GET /" + string(HTTP_MAX_HEADER_SIZE, 'a') + " HTTP/1.1\r\n\r\n";
+		string longField = "GET / HTTP/1.1\r\nX-"
+			+ string(HTTP_MAX_HEADER_SIZE, 'a') + ": b\r\n\r\n";
+		string longValue = "GET / HTTP/1.1\r\nX-Foo: "
+			+ string(HTTP_MAX_HEADER_SIZE, 'a') + "\r\n\r\n";
+		checkAllScanLevels(longPath, wholeBuffer());
+		checkAllScanLevels(longPath, vector<size_t>(1, 4000));
+		checkAllScanLevels(longField, wholeBuffer());
+		checkAllScanLevels(longValue, wholeBuffer());
+		checkAllScanLevels(longValue, vector<size_t>(1, 4093));
+
+		http_parser_set_scan_level(defaultScanLevel);
+		string result = parse(longValue, wholeBuffer());
+		ensure(result, containsSubstring(result,
+			"http_errno=" + toString((int) HPE_HEADER_OVERFLOW)));
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("Header keys are downcased and stored contiguously, with the same "
+			"hash as HashedStaticString, even if they span multiple buffers");
+
+		string data = "GET / HTTP/1.1\r\n"
+			"Content-Length: 5\r\n"
+			"X-Some-Rather-Long-Header-Name-That-Spans-Buffers: foo\r\n"
+			"\r\n";
+		for (size_t chunkSize = 1; chunkSize <= 5; chunkSize++) {
+			string result = parse(data, vector<size_t>(1, chunkSize));
+			ensure(result, containsSubstring(result, "Content-Length -> content-length = 5 #"
+				+ toString(HTTP_CONTENT_LENGTH.hash()) + "\n"));
+			ensure(result, containsSubstring(result,
+				" -> x-some-rather-long-header-name-that-spans-buffers = foo #"));
+			ensure(result, !containsSubstring(result, "(non-contiguous key)"));
+			ensure(result, !containsSubstring(result, "(wrong hash)"));
+		}
+	}
+
+
+	/***** Benchmark *****/
+
+	TEST_METHOD(10) {
+		set_test_name("Benchmark: parsing typical request headers at every scan level");
+
+		const unsigned int ITERATIONS = 20000;
+		string data = "GET /assets/application-4f1f2c3d5e6f7a8b9c0d.js?body=1&v=2 HTTP/1.1\r\n"
+			"Host: www.example.com\r\n"
+			"User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/537.36 "
+				"(KHTML, like Gecko) Chrome/90.0.4430.93 Safari/537.36\r\n"
+			"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,"
+				"image/webp,image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.9\r\n"
+			"Accept-Encoding: gzip, deflate, br\r\n"
+			"Accept-Language: en-US,en;q=0.9,nl;q=0.8\r\n"
+			"Cache-Control: max-age=0\r\n"
+			"Cookie: _session_id=4f1f2c3d5e6f7a8b9c0d1e2f3a4b5c6d; _ga=GA1.2.123456789.1234567890; "
+				"_gid=GA1.2.987654321.0987654321; remember_user_token=abcdefghijklmnopqrstuvwxyz\r\n"
+			"Referer: https://www.example.com/some/page/that/links/here?with=a&query=string\r\n"
+			"Connection: keep-alive\r\n"
+			"\r\n";
+		vector<size_t> chunkSizes = wholeBuffer();
+		string report;
+
+		for (int level = HTTP_PARSER_SCAN_BYTEWISE; level <= HTTP_PARSER_SCAN_AVX2; level++) {
+			if (http_parser_set_scan_level((http_parser_scan_level) level) != level) {
+				break;
+			}
+			unsigned long long startTime = SystemTime::getUsec();
+			for (unsigned int i = 0; i < ITERATIONS; i++) {
+				parse(data, chunkSizes, false);
+			}
+			unsigned long long duration = SystemTime::getUsec() - startTime;
+			report.append("  scan level " + toString(level) + ": "
+				+ toString(duration) + " usec ("
+				+ toString(duration * 1000 / ITERATIONS) + " nsec per request)\n");
+		}
+
+		if (getenv("PRINT_BENCHMARK_RESULTS") != NULL) {
+			printf("Parsing a %u byte request header %u times:\n%s",
+				(unsigned int) data.size(), ITERATIONS, report.c_str());
+		}
+	}
+}
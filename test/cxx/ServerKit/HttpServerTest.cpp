@@ -143,6 +143,12 @@ namespace tut {
 			// Continues in onRequestEarlyHalfClose()
 		}
 
+		void testDelayedResponse(MyClient *client, MyRequest *req) {
+			refRequest(req, __FILE__, __LINE__);
+			delayedRequests.push_back(req);
+			// Continues in endDelayedRequests()
+		}
+
 		void testEarlyReadErrorDetection(MyClient *client, MyRequest *req) {
 			req->nextRequestEarlyReadError = ENOSPC;
 			writeSimpleResponse(client, 200, NULL, "OK");
@@ -172,6 +178,8 @@ namespace tut {
 				testPath(client, req);
 			} else if (psg_lstr_cmp(&req->path, "/half_close_test")) {
 				testHalfClose(client, req);
+			} else if (psg_lstr_cmp(&req->path, "/delayed_response_test")) {
+				testDelayedResponse(client, req);
 			} else if (psg_lstr_cmp(&req->path, "/early_read_error_detection_test")) {
 				testEarlyReadErrorDetection(client, req);
 			} else {
@@ -233,6 +241,13 @@ namespace tut {
 					break;
 				}
 			}
+			for (i = 0; i < delayedRequests.size(); i++) {
+				if (delayedRequests[i] == req) {
+					delayedRequests.erase(delayedRequests.begin() + i);
+					unrefRequest(req, __FILE__, __LINE__);
+					break;
+				}
+			}
 			ParentClass::deinitializeRequest(client, req);
 		}
 
@@ -244,6 +259,7 @@ namespace tut {
 		bool allowUpgrades;
 
 		vector<MyRequest *> requestsWaitingToStartAcceptingBody;
+		vector<MyRequest *> delayedRequests;
 		unsigned int bodyBytesRead;
 		unsigned int halfCloseDetected;
 		unsigned int clientDataErrors;
@@ -269,6 +285,20 @@ namespace tut {
 				unrefRequest(req, __FILE__, __LINE__);
 			}
 		}
+
+		void endDelayedRequests() {
+			MyRequest *req;
+			vector<MyRequest *> delayedRequests;
+
+			delayedRequests.swap(this->delayedRequests);
+
+			foreach (req, delayedRequests) {
+				if (!req->ended()) {
+					testRequest(static_cast<MyClient *>(req->client), req);
+				}
+				unrefRequest(req, __FILE__, __LINE__);
+			}
+		}
 	};
 
 	struct ServerKit_HttpServerTest {
@@ -451,6 +481,26 @@ namespace tut {
 			server->startAcceptingBody();
 		}
 
+		void endDelayedRequests() {
+			bg.safe->runLater(boost::bind(&ServerKit_HttpServerTest::_endDelayedRequests,
+				this));
+		}
+
+		void _endDelayedRequests() {
+			server->endDelayedRequests();
+		}
+
+		// Must be called before the event loop is started.
+		void setPipelinedRequestsLimit(unsigned int limit) {
+			Json::Value updates;
+			vector<ConfigKit::Error> errors;
+			MyServer::ConfigChangeRequest req;
+
+			updates["pipelined_requests_limit"] = limit;
+			ensure(server->prepareConfigChange(updates, errors, req));
+			server->commitConfigChange(req);
+		}
+
 		void shutdownServer() {
 			bg.safe->runLater(boost::bind(&ServerKit_HttpServerTest::_shutdownServer,
 				this));
@@ -489,7 +539,7 @@ namespace tut {
 		}
 	};
 
-	DEFINE_TEST_GROUP_WITH_LIMIT(ServerKit_HttpServerTest, 100);
+	DEFINE_TEST_GROUP_WITH_LIMIT(ServerKit_HttpServerTest, 110);
 
 
 	/***** Valid HTTP header parsing *****/
@@ -1744,4 +1794,179 @@ namespace tut {
 			result = getActiveClientCount() == 0;
 		);
 	}
+
+
+	/***** Request pipelining *****/
+
+	TEST_METHOD(100) {
+		set_test_name("Without pipelining, requests that follow the current one are "
+			"not read until the current one is done");
+
+		connectToServer();
+		sendRequest(
+			"GET /delayed_response_test HTTP/1.1\r\n\r\n"
+			"GET /foo HTTP/1.1\r\n"
+			"Connection: close\r\n\r\n");
+		SHOULD_NEVER_HAPPEN(100,
+			result = getTotalBytesConsumed() > strlen(
+				"GET /delayed_response_test HTTP/1.1\r\n\r\n");
+		);
+
+		endDelayedRequests();
+		string response = readAll(fd);
+		ensure("(1)", containsSubstring(response, "hello /delayed_response_test"));
+		ensure("(2)", containsSubstring(response, "hello /foo"));
+	}
+
+	TEST_METHOD(101) {
+		set_test_name("With pipelining, requests that follow the current one are "
+			"parsed while it is in progress, and are handled in order after it");
+
+		const char data[] =
+			"GET /delayed_response_test HTTP/1.1\r\n\r\n"
+			"GET /foo HTTP/1.1\r\n\r\n"
+			"GET /bar HTTP/1.1\r\n"
+			"Connection: close\r\n\r\n";
+
+		setPipelinedRequestsLimit(4);
+		connectToServer();
+		sendRequestAndWait(data);
+		ensure_equals("(1)", getTotalRequestsBegun(), 1u);
+
+		endDelayedRequests();
+		string response = readAll(fd);
+		string::size_type pos1 = response.find("hello /delayed_response_test");
+		string::size_type pos2 = response.find("hello /foo");
+		string::size_type pos3 = response.find("hello /bar");
+		ensure("(2)", pos1 != string::npos);
+		ensure("(3)", pos2 != string::npos);
+		ensure("(4)", pos3 != string::npos);
+		ensure("(5)", pos1 < pos2);
+		ensure("(6)", pos2 < pos3);
+		ensure_equals("(7)", getTotalRequestsBegun(), 3u);
+	}
+
+	TEST_METHOD(102) {
+		set_test_name("It parses no more than pipelined_requests_limit requests ahead");
+
+		const char first[] =
+			"GET /delayed_response_test HTTP/1.1\r\n\r\n"
+			"GET /foo HTTP/1.1\r\n\r\n";
+
+		setPipelinedRequestsLimit(1);
+		connectToServer();
+		sendRequest(string(first) +
+			"GET /bar HTTP/1.1\r\n"
+			"Connection: close\r\n\r\n");
+		EVENTUALLY(5,
+			result = getTotalBytesConsumed() == strlen(first);
+		);
+		SHOULD_NEVER_HAPPEN(100,
+			result = getTotalBytesConsumed() > strlen(first);
+		);
+
+		endDelayedRequests();
+		string response = readAll(fd);
+		ensure("(1)", containsSubstring(response, "hello /foo"));
+		ensure("(2)", containsSubstring(response, "hello /bar"));
+	}
+
+	TEST_METHOD(103) {
+		set_test_name("It does not read ahead into the body of a pipelined request");
+
+		const char first[] =
+			"GET /delayed_response_test HTTP/1.1\r\n\r\n"
+			"POST /body_test HTTP/1.1\r\n"
+			"Content-Length: 2\r\n\r\n";
+
+		setPipelinedRequestsLimit(4);
+		connectToServer();
+		sendRequest(string(first) +
+			"ok"
+			"GET /bar HTTP/1.1\r\n"
+			"Connection: close\r\n\r\n");
+		EVENTUALLY(5,
+			result = getTotalBytesConsumed() == strlen(first);
+		);
+		SHOULD_NEVER_HAPPEN(100,
+			result = getTotalBytesConsumed() > strlen(first);
+		);
+
+		endDelayedRequests();
+		string response = readAll(fd);
+		string::size_type pos1 = response.find("2 bytes: ok");
+		string::size_type pos2 = response.find("hello /bar");
+		ensure("(1)", pos1 != string::npos);
+		ensure("(2)", pos2 != string::npos);
+		ensure("(3)", pos1 < pos2);
+	}
+
+	TEST_METHOD(104) {
+		set_test_name("An invalid pipelined request is responded to after the "
+			"requests before it");
+
+		setPipelinedRequestsLimit(4);
+		connectToServer();
+		sendRequest(
+			"GET /delayed_response_test HTTP/1.1\r\n\r\n"
+			"GET /foo HTTP/1.1\r\n\r\n"
+			"!bad request\r\n\r\n");
+		EVENTUALLY(5,
+			result = getTotalBytesConsumed() == strlen(
+				"GET /delayed_response_test HTTP/1.1\r\n\r\n"
+				"GET /foo HTTP/1.1\r\n\r\n");
+		);
+
+		endDelayedRequests();
+		string response = readAll(fd);
+		string::size_type pos1 = response.find("hello /foo");
+		string::size_type pos2 = response.find("400 Bad Request");
+		ensure("(1)", pos1 != string::npos);
+		ensure("(2)", pos2 != string::npos);
+		ensure("(3)", pos1 < pos2);
+	}
+
+	TEST_METHOD(105) {
+		set_test_name("An early half-close after pipelined requests is detected "
+			"once the last one begins");
+
+		setPipelinedRequestsLimit(4);
+		connectToServer();
+		sendRequestAndWait(
+			"GET /delayed_response_test HTTP/1.1\r\n\r\n"
+			"GET /foo HTTP/1.1\r\n\r\n"
+			"GET /half_close_test HTTP/1.1\r\n\r\n");
+		shutdown(fd, SHUT_WR);
+		SHOULD_NEVER_HAPPEN(100,
+			result = getHalfCloseDetected() > 0;
+		);
+
+		endDelayedRequests();
+		EVENTUALLY(5,
+			result = getHalfCloseDetected() == 1;
+		);
+		string response = readAll(fd);
+		ensure("(1)", containsSubstring(response, "hello /foo"));
+		EVENTUALLY(5,
+			result = getActiveClientCount() == 0;
+		);
+	}
+
+	TEST_METHOD(106) {
+		set_test_name("Pipelined requests are discarded when the client disconnects");
+
+		setPipelinedRequestsLimit(4);
+		connectToServer();
+		sendRequestAndWait(
+			"GET /delayed_response_test HTTP/1.1\r\n\r\n"
+			"GET /foo HTTP/1.1\r\n\r\n"
+			"GET /bar HTTP/1.1\r\n"
+			"Fo");
+		fd.close();
+		// The disconnection is noticed upon writing the response.
+		endDelayedRequests();
+		EVENTUALLY(5,
+			result = getActiveClientCount() == 0;
+		);
+	}
 }
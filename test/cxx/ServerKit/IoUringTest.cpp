@@ -0,0 +1,250 @@
+#include <TestSupport.h>
+#include <boost/thread.hpp>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <BackgroundEventLoop.h>
+#include <Constants.h>
+#include <LoggingKit/LoggingKit.h>
+#include <StaticString.h>
+#include <ServerKit/IoUring.h>
+#include <ServerKit/FileBufferedChannel.h>
+#include <FileTools/FileManip.h>
+#include <Utils/IOUtils.h>
+#include <Utils/StrIntUtils.h>
+
+using namespace Passenger;
+using namespace Passenger::ServerKit;
+using namespace Passenger::MemoryKit;
+using namespace std;
+
+namespace tut {
+	struct ServerKit_IoUringTest: public ServerKit::Hooks {
+		BackgroundEventLoop bg;
+		ServerKit::Schema skSchema;
+		ServerKit::Context context;
+		FileBufferedChannel channel;
+		IoUring::Request request;
+		boost::mutex syncher;
+		int lastResult;
+		unsigned int completed;
+		string log;
+
+		ServerKit_IoUringTest()
+			: bg(false, true),
+			  context(skSchema, createContextConfig()),
+			  channel(&context),
+			  lastResult(0),
+			  completed(0)
+		{
+			context.libev = bg.safe;
+			context.libuv = bg.libuv_loop;
+			context.initialize();
+			channel.setDataCallback(dataCallback);
+			channel.setHooks(this);
+			Hooks::impl = NULL;
+			Hooks::userData = NULL;
+			request.callback = operationCompleted;
+			request.userData = this;
+			bg.start();
+		}
+
+		~ServerKit_IoUringTest() {
+			bg.safe->runSync(boost::bind(&ServerKit_IoUringTest::deinitializeChannel,
+				this));
+			bg.stop();
+			unlink("tmp.iouring");
+			LoggingKit::setLevel(LoggingKit::Level(DEFAULT_LOG_LEVEL));
+		}
+
+		static Json::Value createContextConfig() {
+			Json::Value config;
+			config["file_buffered_channel_io_uring"] = true;
+			config["file_buffered_channel_threshold"] = 1;
+			return config;
+		}
+
+		void deinitializeChannel() {
+			channel.deinitialize();
+		}
+
+		static void operationCompleted(void *userData, int result) {
+			ServerKit_IoUringTest *self = static_cast<ServerKit_IoUringTest *>(userData);
+			boost::lock_guard<boost::mutex> l(self->syncher);
+			self->lastResult = result;
+			self->completed++;
+		}
+
+		static Channel::Result dataCallback(Channel *_channel, const mbuf &buffer, int errcode) {
+			FileBufferedChannel *channel = reinterpret_cast<FileBufferedChannel *>(_channel);
+			ServerKit_IoUringTest *self = (ServerKit_IoUringTest *) channel->getHooks();
+			boost::lock_guard<boost::mutex> l(self->syncher);
+			if (errcode == 0) {
+				if (buffer.empty()) {
+					self->log.append("EOF\n");
+				} else {
+					StaticString str(buffer.start, buffer.size());
+					self->log.append("Data: " + cEscapeString(str) + "\n");
+				}
+			} else {
+				self->log.append("Error: " + toString(errcode) + "\n");
+			}
+			// Keep the channel busy so that subsequent data goes through the file.
+			return Channel::Result(-1, false);
+		}
+
+		/**
+		 * Starts an operation on the event loop and waits for its result.
+		 */
+		int perform(const boost::function<bool ()> &operation) {
+			unsigned int expected;
+			bool submitted;
+			{
+				boost::lock_guard<boost::mutex> l(syncher);
+				expected = completed + 1;
+			}
+			bg.safe->runSync(boost::bind(&ServerKit_IoUringTest::_perform, this,
+				operation, &submitted));
+			ensure("(1)", submitted);
+			EVENTUALLY(5,
+				boost::lock_guard<boost::mutex> l(syncher);
+				result = completed == expected;
+			);
+			boost::lock_guard<boost::mutex> l(syncher);
+			return lastResult;
+		}
+
+		void _perform(const boost::function<bool ()> &operation, bool *submitted) {
+			*submitted = operation();
+		}
+
+		void feedChannel(const string &data) {
+			bg.safe->runSync(boost::bind(&ServerKit_IoUringTest::_feedChannel,
+				this, data));
+		}
+
+		void _feedChannel(string data) {
+			mbuf buf = mbuf_get(&context.mbuf_pool);
+			memcpy(buf.start, data.data(), data.size());
+			buf = mbuf(buf, 0, (unsigned int) data.size());
+			channel.feed(buf);
+		}
+
+		void channelConsumed(int size) {
+			bg.safe->runSync(boost::bind(&ServerKit_IoUringTest::_channelConsumed,
+				this, size));
+		}
+
+		void _channelConsumed(int size) {
+			channel.consumed(size, false);
+		}
+
+		FileBufferedChannel::WriterState getChannelWriterState() {
+			FileBufferedChannel::WriterState result;
+			bg.safe->runSync(boost::bind(&ServerKit_IoUringTest::_getChannelWriterState,
+				this, &result));
+			return result;
+		}
+
+		void _getChannelWriterState(FileBufferedChannel::WriterState *result) {
+			*result = channel.getWriterState();
+		}
+
+		FileBufferedChannel::Mode getChannelMode() {
+			FileBufferedChannel::Mode result;
+			bg.safe->runSync(boost::bind(&ServerKit_IoUringTest::_getChannelMode,
+				this, &result));
+			return result;
+		}
+
+		void _getChannelMode(FileBufferedChannel::Mode *result) {
+			*result = channel.getMode();
+		}
+
+		Json::Value inspectContext() {
+			Json::Value result;
+			bg.safe->runSync(boost::bind(&ServerKit_IoUringTest::_inspectContext,
+				this, &result));
+			return result;
+		}
+
+		void _inspectContext(Json::Value *result) {
+			*result = context.inspectStateAsJson();
+		}
+	};
+
+	DEFINE_TEST_GROUP(ServerKit_IoUringTest);
+
+	#define SKIP_IF_UNSUPPORTED() \
+		do { \
+			if (!context.ioUring.isInitialized()) { \
+				return; \
+			} \
+		} while (false)
+
+
+	/***** Basic operations *****/
+
+	TEST_METHOD(1) {
+		set_test_name("It performs file operations and reports their results on the event loop");
+		SKIP_IF_UNSUPPORTED();
+
+		IoUring *ring = &context.ioUring;
+		char buf[16];
+		int fd = perform(boost::bind(&IoUring::openat, ring, "tmp.iouring",
+			O_RDWR | O_CREAT | O_TRUNC, 0600, &request));
+		ensure("(2)", fd >= 0);
+
+		ensure_equals("(3)", perform(boost::bind(&IoUring::write, ring, fd,
+			"hello world", 11, 0, &request)), 11);
+		ensure_equals("(4)", readAll("tmp.iouring"), "hello world");
+
+		memset(buf, 0, sizeof(buf));
+		ensure_equals("(5)", perform(boost::bind(&IoUring::read, ring, fd,
+			buf, sizeof(buf), 6, &request)), 5);
+		ensure_equals("(6)", string(buf), "world");
+
+		ensure_equals("(7)", perform(boost::bind(&IoUring::close, ring, fd, &request)), 0);
+		ensure_equals("(8)", perform(boost::bind(&IoUring::unlink, ring, "tmp.iouring",
+			&request)), 0);
+		ensure("(9)", !fileExists("tmp.iouring"));
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("It reports errors as negative errno values");
+		SKIP_IF_UNSUPPORTED();
+
+		ensure_equals(perform(boost::bind(&IoUring::unlink, &context.ioUring,
+			"tmp.iouring.nonexistant", &request)), -ENOENT);
+	}
+
+
+	/***** FileBufferedChannel integration *****/
+
+	TEST_METHOD(10) {
+		set_test_name("FileBufferedChannel buffers data to disk through io_uring and "
+			"reads it back into fixed buffers");
+		SKIP_IF_UNSUPPORTED();
+
+		feedChannel("hello");
+		feedChannel("world");
+		EVENTUALLY(5,
+			result = getChannelMode() == FileBufferedChannel::IN_FILE_MODE
+				&& getChannelWriterState() == FileBufferedChannel::WS_INACTIVE;
+		);
+
+		channelConsumed(sizeof("hello") - 1);
+		EVENTUALLY(5,
+			boost::lock_guard<boost::mutex> l(syncher);
+			result = log ==
+				"Data: hello\n"
+				"Data: world\n";
+		);
+
+		Json::Value doc = inspectContext()["io_uring"];
+		ensure("(1)", doc["completions"].asUInt() > 0);
+		if (context.ioUring.getFixedBufferCount() > 0) {
+			ensure_equals("(2)", doc["fixed_buffer_reads"].asUInt(), 1u);
+		}
+	}
+}
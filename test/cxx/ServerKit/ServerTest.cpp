@@ -4,9 +4,12 @@
 #include <boost/thread.hpp>
 #include <oxt/system_calls.hpp>
 #include <vector>
+#include <cstdio>
+#include <cstdlib>
 #include <BackgroundEventLoop.h>
 #include <ServerKit/Server.h>
 #include <ServerKit/ClientRef.h>
+#include <ServerKit/AcceptLoadBalancer.h>
 #include <LoggingKit/LoggingKit.h>
 #include <FileDescriptor.h>
 #include <Utils/IOUtils.h>
@@ -157,6 +160,113 @@ namespace tut {
 		}
 	};
 
+	/**
+	 * A Server running on its own event loop thread, used for testing
+	 * the different ways in which multiple threads can accept clients.
+	 */
+	struct AcceptingThread {
+		BackgroundEventLoop bg;
+		ServerKit::Context context;
+		boost::shared_ptr< Server<Client> > server;
+
+		AcceptingThread(const ServerKit::Schema &skSchema,
+			const ServerKit::BaseServerSchema &schema)
+			: bg(false, true),
+			  context(skSchema)
+		{
+			context.libev = bg.safe;
+			context.libuv = bg.libuv_loop;
+			context.initialize();
+			server = boost::make_shared< Server<Client> >(&context, schema);
+			server->initialize();
+		}
+
+		~AcceptingThread() {
+			if (!bg.isStarted()) {
+				bg.start();
+			}
+			bg.safe->runSync(boost::bind(&Server<Client>::shutdown, server.get(), true));
+			while (getServerState() != Server<Client>::FINISHED_SHUTDOWN) {
+				syscalls::usleep(10000);
+			}
+			bg.safe->runSync(boost::bind(&AcceptingThread::destroyServer, this));
+			bg.stop();
+		}
+
+		void destroyServer() {
+			server.reset();
+		}
+
+		Server<Client>::State getServerState() {
+			Server<Client>::State result;
+			bg.safe->runSync(boost::bind(&AcceptingThread::_getServerState,
+				this, &result));
+			return result;
+		}
+
+		void _getServerState(Server<Client>::State *state) {
+			*state = server->serverState;
+		}
+
+		unsigned long getTotalClientsAccepted() {
+			unsigned long result;
+			bg.safe->runSync(boost::bind(&AcceptingThread::_getTotalClientsAccepted,
+				this, &result));
+			return result;
+		}
+
+		void _getTotalClientsAccepted(unsigned long *result) {
+			*result = server->totalClientsAccepted;
+		}
+	};
+
+	typedef boost::shared_ptr<AcceptingThread> AcceptingThreadPtr;
+
+	static unsigned short
+	getTcpServerPort(int fd) {
+		union {
+			struct sockaddr_in v4;
+			struct sockaddr_in6 v6;
+		} addr;
+		socklen_t len = sizeof(addr);
+
+		if (getsockname(fd, (struct sockaddr *) &addr, &len) == -1) {
+			int e = errno;
+			throw SystemException("getsockname() failed", e);
+		}
+		return ntohs(addr.v4.sin_port);
+	}
+
+	static unsigned long
+	getTotalClientsAccepted(const vector<AcceptingThreadPtr> &threads) {
+		unsigned long result = 0;
+		for (unsigned int i = 0; i < threads.size(); i++) {
+			result += threads[i]->getTotalClientsAccepted();
+		}
+		return result;
+	}
+
+	/**
+	 * Connects and disconnects `count` times, then waits until all those
+	 * clients have been accepted. Returns the elapsed time in microseconds.
+	 */
+	static unsigned long long
+	measureConnectionRate(unsigned short port, unsigned int count,
+		const vector<AcceptingThreadPtr> &threads)
+	{
+		unsigned long initialAccepted = getTotalClientsAccepted(threads);
+		unsigned long long startTime = uv_hrtime();
+
+		for (unsigned int i = 0; i < count; i++) {
+			FileDescriptor fd(connectToTcpServer("127.0.0.1", port, __FILE__, __LINE__),
+				NULL, 0);
+		}
+		EVENTUALLY(10,
+			result = getTotalClientsAccepted(threads) - initialAccepted == count;
+		);
+		return (uv_hrtime() - startTime) / 1000;
+	}
+
 	DEFINE_TEST_GROUP(ServerKit_ServerTest);
 
 
@@ -450,4 +560,161 @@ namespace tut {
 			result = !clientIsConnected(client.get());
 		);
 	}
+
+
+	/****** Accepting clients on multiple threads *****/
+
+	TEST_METHOD(35) {
+		set_test_name("Multiple threads can each accept clients on their own "
+			"SO_REUSEPORT listener bound to the same port");
+
+		vector<AcceptingThreadPtr> threads;
+		int fd1 = createReusePortTcpServer("127.0.0.1", 0, 0, __FILE__, __LINE__);
+		FdGuard guard1(fd1, NULL, 0);
+		unsigned short port = getTcpServerPort(fd1);
+		int fd2 = createReusePortTcpServer("127.0.0.1", port, 0, __FILE__, __LINE__);
+		FdGuard guard2(fd2, NULL, 0);
+
+		threads.push_back(boost::make_shared<AcceptingThread>(skSchema, schema));
+		threads.push_back(boost::make_shared<AcceptingThread>(skSchema, schema));
+		threads[0]->server->listen(fd1);
+		threads[1]->server->listen(fd2);
+		threads[0]->bg.start();
+		threads[1]->bg.start();
+
+		measureConnectionRate(port, 50, threads);
+	}
+
+	TEST_METHOD(36) {
+		set_test_name("Benchmark: connection rate with an AcceptLoadBalancer "
+			"versus per-thread SO_REUSEPORT listeners");
+
+		const unsigned int THREADS = 2;
+		const unsigned int CONNECTIONS = 2000;
+		unsigned long long loadBalancerDuration, reusePortDuration;
+
+		{
+			vector<AcceptingThreadPtr> threads;
+			AcceptLoadBalancer< Server<Client> > loadBalancer;
+			int fd = createTcpServer("127.0.0.1", 0, 0, __FILE__, __LINE__);
+			FdGuard guard(fd, NULL, 0);
+
+			loadBalancer.listen(fd);
+			for (unsigned int i = 0; i < THREADS; i++) {
+				threads.push_back(boost::make_shared<AcceptingThread>(skSchema, schema));
+				loadBalancer.servers.push_back(threads[i]->server.get());
+				threads[i]->bg.start();
+			}
+			loadBalancer.start();
+
+			loadBalancerDuration = measureConnectionRate(getTcpServerPort(fd),
+				CONNECTIONS, threads);
+			loadBalancer.shutdown();
+		}
+
+		{
+			vector<AcceptingThreadPtr> threads;
+			vector<int> fds;
+			unsigned short port = 0;
+
+			for (unsigned int i = 0; i < THREADS; i++) {
+				fds.push_back(createReusePortTcpServer("127.0.0.1", port, 0,
+					__FILE__, __LINE__));
+				port = getTcpServerPort(fds.back());
+				threads.push_back(boost::make_shared<AcceptingThread>(skSchema, schema));
+				threads[i]->server->listen(fds.back());
+				threads[i]->bg.start();
+			}
+
+			reusePortDuration = measureConnectionRate(port, CONNECTIONS, threads);
+			threads.clear();
+			for (unsigned int i = 0; i < fds.size(); i++) {
+				safelyClose(fds[i]);
+			}
+		}
+
+		if (getenv("PRINT_BENCHMARK_RESULTS") != NULL) {
+			printf("Accepting %u connections on %u threads: "
+				"AcceptLoadBalancer %llu usec, SO_REUSEPORT %llu usec\n",
+				CONNECTIONS, THREADS, loadBalancerDuration, reusePortDuration);
+		}
+	}
+
+	static void
+	testAcceptLoadBalancingPolicy(const ServerKit::Schema &skSchema,
+		const ServerKit::BaseServerSchema &schema, AcceptLoadBalancingPolicy policy)
+	{
+		vector<AcceptingThreadPtr> threads;
+		vector<FileDescriptor> clients;
+		int unixFd = createUnixServer("tmp.server3");
+		FdGuard unixGuard(unixFd, NULL, 0);
+		int tcpFd = createTcpServer("127.0.0.1", 0, 0, __FILE__, __LINE__);
+		FdGuard tcpGuard(tcpFd, NULL, 0);
+
+		threads.push_back(boost::make_shared<AcceptingThread>(skSchema, schema));
+		threads.push_back(boost::make_shared<AcceptingThread>(skSchema, schema));
+		threads[0]->server->listen(unixFd);
+		threads[0]->bg.start();
+		threads[1]->bg.start();
+
+		// Make the first thread busy by connecting to it directly.
+		for (unsigned int i = 0; i < 3; i++) {
+			clients.push_back(FileDescriptor(connectToUnixServer("tmp.server3",
+				__FILE__, __LINE__), NULL, 0));
+		}
+		EVENTUALLY(5,
+			result = threads[0]->getTotalClientsAccepted() == 3;
+		);
+
+		{
+			AcceptLoadBalancer< Server<Client> > loadBalancer;
+			loadBalancer.policy = policy;
+			loadBalancer.listen(tcpFd);
+			loadBalancer.servers.push_back(threads[0]->server.get());
+			loadBalancer.servers.push_back(threads[1]->server.get());
+			loadBalancer.start();
+
+			for (unsigned int i = 0; i < 2; i++) {
+				clients.push_back(FileDescriptor(connectToTcpServer("127.0.0.1",
+					getTcpServerPort(tcpFd), __FILE__, __LINE__), NULL, 0));
+			}
+			EVENTUALLY(5,
+				result = getTotalClientsAccepted(threads) == 5;
+			);
+			ensure_equals(threads[0]->getTotalClientsAccepted(), 3u);
+			ensure_equals(threads[1]->getTotalClientsAccepted(), 2u);
+		}
+
+		threads.clear();
+		unlink("tmp.server3");
+	}
+
+	TEST_METHOD(37) {
+		set_test_name("AcceptLoadBalancer with the least_active_clients policy hands "
+			"clients to the server with the fewest active clients");
+		testAcceptLoadBalancingPolicy(skSchema, schema, ALB_LEAST_ACTIVE_CLIENTS);
+	}
+
+	TEST_METHOD(38) {
+		set_test_name("AcceptLoadBalancer with the power_of_two_choices policy hands "
+			"clients to the less loaded of two servers");
+		// With two servers, both are always the candidates.
+		testAcceptLoadBalancingPolicy(skSchema, schema, ALB_POWER_OF_TWO_CHOICES);
+	}
+
+	TEST_METHOD(39) {
+		set_test_name("Accept load balancing policies can be parsed from and "
+			"converted to strings");
+		AcceptLoadBalancingPolicy policy = ALB_ROUND_ROBIN;
+
+		ensure(parseAcceptLoadBalancingPolicy("least_active_clients", policy));
+		ensure_equals(policy, ALB_LEAST_ACTIVE_CLIENTS);
+		ensure(parseAcceptLoadBalancingPolicy("power_of_two_choices", policy));
+		ensure_equals(policy, ALB_POWER_OF_TWO_CHOICES);
+		ensure(parseAcceptLoadBalancingPolicy("round_robin", policy));
+		ensure_equals(policy, ALB_ROUND_ROBIN);
+		ensure(!parseAcceptLoadBalancingPolicy("random", policy));
+		ensure_equals(StaticString(acceptLoadBalancingPolicyToString(
+			ALB_POWER_OF_TWO_CHOICES)), StaticString("power_of_two_choices"));
+	}
 }
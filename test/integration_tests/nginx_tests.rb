@@ -418,6 +418,95 @@ def log(message)
     end
   end
 
+  describe "keep-alive connections to the core" do
+    before :all do
+      create_nginx_controller
+      @server = "http://passenger.test:#{@nginx.port}"
+      @stub = RackStub.new('rack')
+      @nginx.add_server do |server|
+        server[:server_name] = "passenger.test"
+        server[:root]        = "#{@stub.full_app_root}/public"
+      end
+    end
+
+    after :all do
+      @stub.destroy
+      @nginx.stop if @nginx
+    end
+
+    before :each do
+      @stub.reset
+
+      File.write("#{@stub.app_root}/config.ru", <<-RUBY)
+        app = lambda do |env|
+          case env['PATH_INFO']
+          when '/no_content'
+            [204, {}, []]
+          when '/not_modified'
+            [304, {}, []]
+          when '/reject_body'
+            # Respond without reading the request body.
+            [413, { "Content-Type" => "text/plain" }, ["rejected"]]
+          else
+            [200, { "Content-Type" => "text/plain" }, [env['PATH_INFO']]]
+          end
+        end
+        run app
+      RUBY
+
+      @nginx.start
+    end
+
+    def perform_requests(*requests)
+      start_web_server_if_necessary
+      uri = URI.parse(@server)
+      Net::HTTP.start(uri.host, uri.port) do |http|
+        requests.map { |request| http.request(request) }
+      end
+    end
+
+    it "serves consecutive requests over reused connections" do
+      20.times do |i|
+        get("/request#{i}").should == "/request#{i}"
+      end
+      responses = perform_requests(*(0...20).map { |i| Net::HTTP::Get.new("/request#{i}") })
+      responses.map { |r| r.body }.should == (0...20).map { |i| "/request#{i}" }
+    end
+
+    it "serves the next request on a reused connection after a HEAD request" do
+      responses = perform_requests(
+        Net::HTTP::Head.new("/head"),
+        Net::HTTP::Get.new("/after_head"))
+      responses[0].code.should == "200"
+      responses[0].body.should be_nil
+      responses[1].code.should == "200"
+      responses[1].body.should == "/after_head"
+    end
+
+    it "serves the next request on a reused connection after a response without a body" do
+      responses = perform_requests(
+        Net::HTTP::Get.new("/no_content"),
+        Net::HTTP::Get.new("/after_no_content"),
+        Net::HTTP::Get.new("/not_modified"),
+        Net::HTTP::Get.new("/after_not_modified"))
+      responses.map { |r| r.code }.should == ["204", "200", "304", "200"]
+      responses[1].body.should == "/after_no_content"
+      responses[3].body.should == "/after_not_modified"
+    end
+
+    it "does not reuse a connection whose request body was not fully sent" do
+      request = Net::HTTP::Post.new("/reject_body")
+      request["Content-Type"] = "application/octet-stream"
+      request.body = "x" * (512 * 1024)
+      responses = perform_requests(request, Net::HTTP::Get.new("/after_reject_body"))
+      responses[0].code.should == "413"
+      responses[0].body.should == "rejected"
+      responses[1].code.should == "200"
+      responses[1].body.should == "/after_reject_body"
+      get("/after_reject_body_2").should == "/after_reject_body_2"
+    end
+  end
+
   ##### Helper methods #####
 
   def start_web_server_if_necessary